@@ -260,6 +260,7 @@ void App::initialize(const AppOptions& options)
     std::string importLayer;
     std::string importLayerSaveAs;
     std::string filenameFormat;
+    std::string dithering;
 
     for (const auto& value : options.values()) {
       const AppOptions::Option* opt = value.option();
@@ -304,6 +305,42 @@ void App::initialize(const AppOptions& options)
           if (m_exporter)
             m_exporter->setTexturePack(true);
         }
+        // --sheet-rotate
+        else if (opt == &options.sheetRotate()) {
+          if (m_exporter)
+            m_exporter->setTextureRotation(true);
+        }
+        // --sheet-heuristic <name>
+        else if (opt == &options.sheetHeuristic()) {
+          const std::string& name = value.value();
+          gfx::PackingRects::Heuristic heuristic = gfx::PackingRects::BottomLeft;
+          bool valid = true;
+          if (name == "bottom-left")
+            heuristic = gfx::PackingRects::BottomLeft;
+          else if (name == "short-side")
+            heuristic = gfx::PackingRects::BestShortSideFit;
+          else if (name == "long-side")
+            heuristic = gfx::PackingRects::BestLongSideFit;
+          else if (name == "area")
+            heuristic = gfx::PackingRects::BestAreaFit;
+          else
+            valid = false;
+
+          if (!valid)
+            console.printf("Invalid packing heuristic \"%s\"\n", name.c_str());
+          else if (m_exporter)
+            m_exporter->setTextureHeuristic(heuristic);
+        }
+        // --sheet-tight
+        else if (opt == &options.sheetTight()) {
+          if (m_exporter)
+            m_exporter->setTexturePowerOfTwo(false);
+        }
+        // --sheet-cache
+        else if (opt == &options.sheetCache()) {
+          if (m_exporter)
+            m_exporter->setUseCache(true);
+        }
         // --split-layers
         else if (opt == &options.splitLayers()) {
           splitLayers = true;
@@ -464,6 +501,39 @@ void App::initialize(const AppOptions& options)
             ctx->executeCommand(command);
           }
         }
+        // --dithering <method>
+        else if (opt == &options.dithering()) {
+          const std::string& method = value.value();
+          if (method != "none" &&
+              method != "ordered" &&
+              method != "floyd-steinberg" &&
+              method != "atkinson" &&
+              method != "sierra") {
+            console.printf("Invalid dithering method \"%s\"\n", method.c_str());
+          }
+          else
+            dithering = method;
+        }
+        // --color-mode <mode>
+        else if (opt == &options.colorMode()) {
+          const std::string& mode = value.value();
+          if (mode != "rgb" && mode != "grayscale" && mode != "indexed") {
+            console.printf("Invalid color mode \"%s\"\n", mode.c_str());
+          }
+          else {
+            Command* command = CommandsModule::instance()->getCommandByName(CommandId::ChangePixelFormat);
+            Params params;
+            params.set("format", mode.c_str());
+            if (mode == "indexed" && !dithering.empty())
+              params.set("dithering", dithering.c_str());
+
+            // Convert all sprites
+            for (auto doc : ctx->documents()) {
+              ctx->setActiveDocument(static_cast<app::Document*>(doc));
+              ctx->executeCommand(command, params);
+            }
+          }
+        }
       }
       // File names aren't associated to any option
       else {
@@ -30,12 +30,18 @@ AppOptions::AppOptions(int argc, const char* argv[])
   , m_batch(m_po.add("batch").description("Do not start the UI"))
   , m_saveAs(m_po.add("save-as").requiresValue("<filename>").description("Save the last given document with other format"))
   , m_scale(m_po.add("scale").requiresValue("<factor>").description("Resize all previous opened documents"))
+  , m_colorMode(m_po.add("color-mode").requiresValue("<mode>").description("Convert all previous opened documents to the\ngiven color mode (rgb, grayscale, indexed)"))
+  , m_dithering(m_po.add("dithering").requiresValue("<method>").description("Dithering method used by the next --color-mode\nindexed (none, ordered, floyd-steinberg,\natkinson, sierra)"))
   , m_data(m_po.add("data").requiresValue("<filename.json>").description("File to store the sprite sheet metadata"))
   , m_format(m_po.add("format").requiresValue("<format>").description("Format to export the data file (json-hash, json-array)"))
   , m_sheet(m_po.add("sheet").requiresValue("<filename.png>").description("Image file to save the texture"))
   , m_sheetWidth(m_po.add("sheet-width").requiresValue("<pixels>").description("Sprite sheet width"))
   , m_sheetHeight(m_po.add("sheet-height").requiresValue("<pixels>").description("Sprite sheet height"))
   , m_sheetPack(m_po.add("sheet-pack").description("Use a packing algorithm to avoid waste of space\nin the texture"))
+  , m_sheetRotate(m_po.add("sheet-rotate").description("Allow rotating frames 90 degrees to pack them\nwith --sheet-pack"))
+  , m_sheetHeuristic(m_po.add("sheet-heuristic").requiresValue("<name>").description("Where --sheet-pack places each frame (bottom-left,\nshort-side, long-side, area)"))
+  , m_sheetTight(m_po.add("sheet-tight").description("Do not round the size of the --sheet-pack\ntexture to a power of two"))
+  , m_sheetCache(m_po.add("sheet-cache").description("Keep a cache next to the texture to render only\nthe changed frames in the next export"))
   , m_splitLayers(m_po.add("split-layers").description("Import each layer of the next given sprite as\na separated image in the sheet"))
   , m_importLayer(m_po.add("import-layer").requiresValue("<name>").description("Import just one layer of the next given sprite"))
   , m_ignoreEmpty(m_po.add("ignore-empty").description("Do not export empty frames/cels"))
@@ -38,12 +38,18 @@ public:
   // Export options
   const Option& saveAs() const { return m_saveAs; }
   const Option& scale() const { return m_scale; }
+  const Option& colorMode() const { return m_colorMode; }
+  const Option& dithering() const { return m_dithering; }
   const Option& data() const { return m_data; }
   const Option& format() const { return m_format; }
   const Option& sheet() const { return m_sheet; }
   const Option& sheetWidth() const { return m_sheetWidth; }
   const Option& sheetHeight() const { return m_sheetHeight; }
   const Option& sheetPack() const { return m_sheetPack; }
+  const Option& sheetRotate() const { return m_sheetRotate; }
+  const Option& sheetHeuristic() const { return m_sheetHeuristic; }
+  const Option& sheetTight() const { return m_sheetTight; }
+  const Option& sheetCache() const { return m_sheetCache; }
   const Option& splitLayers() const { return m_splitLayers; }
   const Option& importLayer() const { return m_importLayer; }
   const Option& ignoreEmpty() const { return m_ignoreEmpty; }
@@ -72,12 +78,18 @@ private:
   Option& m_batch;
   Option& m_saveAs;
   Option& m_scale;
+  Option& m_colorMode;
+  Option& m_dithering;
   Option& m_data;
   Option& m_format;
   Option& m_sheet;
   Option& m_sheetWidth;
   Option& m_sheetHeight;
   Option& m_sheetPack;
+  Option& m_sheetRotate;
+  Option& m_sheetHeuristic;
+  Option& m_sheetTight;
+  Option& m_sheetCache;
   Option& m_splitLayers;
   Option& m_importLayer;
   Option& m_ignoreEmpty;
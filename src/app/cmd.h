@@ -29,9 +29,9 @@ namespace app {
     void undo() override;
     void redo() override;
     void dispose() override;
+    size_t memSize() const override;
 
     std::string label() const;
-    size_t memSize() const;
 
     Context* context() const { return m_ctx; }
 
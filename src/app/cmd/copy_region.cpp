@@ -11,7 +11,9 @@
 
 #include "app/cmd/copy_region.h"
 
+#include "base/exception.h"
 #include "doc/image.h"
+#include "zlib.h"
 
 #include <algorithm>
 
@@ -21,8 +23,11 @@ namespace cmd {
 CopyRegion::CopyRegion(Image* dst, Image* src,
   const gfx::Region& region, int dst_dx, int dst_dy)
   : WithImage(dst)
+  , m_size(0)
+  , m_compressed(false)
 {
   // Save region pixels
+  std::vector<uint8_t> pixels;
   for (const auto& rc : region) {
     gfx::Clip clip(
       rc.x+dst_dx, rc.y+dst_dy,
@@ -35,11 +40,13 @@ CopyRegion::CopyRegion(Image* dst, Image* src,
     m_region.createUnion(m_region, gfx::Region(clip.dstBounds()));
 
     for (int y=0; y<clip.size.h; ++y)  {
-      m_stream.write(
-        (const char*)src->getPixelAddress(clip.src.x, clip.src.y+y),
-        src->getRowStrideSize(clip.size.w));
+      const uint8_t* address = src->getPixelAddress(clip.src.x, clip.src.y+y);
+      pixels.insert(pixels.end(), address,
+                    address + src->getRowStrideSize(clip.size.w));
     }
   }
+
+  storePixels(pixels);
 }
 
 void CopyRegion::onExecute()
@@ -61,29 +68,68 @@ void CopyRegion::swap()
 {
   Image* image = this->image();
 
-  // Save current image region in "tmp" stream
-  std::stringstream tmp;
+  // Save current image region in "tmp"
+  std::vector<uint8_t> tmp;
+  tmp.reserve(m_size);
   for (const auto& rc : m_region)
-    for (int y=0; y<rc.h; ++y)
-      tmp.write(
-        (const char*)image->getPixelAddress(rc.x, rc.y+y),
-        image->getRowStrideSize(rc.w));
-
-  // Restore m_stream into the image
-  for (const auto& rc : m_region) {
     for (int y=0; y<rc.h; ++y) {
-      m_stream.read(
-        (char*)image->getPixelAddress(rc.x, rc.y+y),
-        image->getRowStrideSize(rc.w));
+      const uint8_t* address = image->getPixelAddress(rc.x, rc.y+y);
+      tmp.insert(tmp.end(), address,
+                 address + image->getRowStrideSize(rc.w));
     }
+
+  // Restore saved pixels into the image
+  std::vector<uint8_t> pixels;
+  loadPixels(pixels);
+
+  const uint8_t* src = (pixels.empty() ? nullptr: &pixels[0]);
+  for (const auto& rc : m_region) {
+    int rowBytes = image->getRowStrideSize(rc.w);
+    for (int y=0; y<rc.h; ++y, src+=rowBytes)
+      std::copy(src, src+rowBytes, image->getPixelAddress(rc.x, rc.y+y));
   }
 
-  // TODO use m_stream.swap(tmp) when clang and gcc support it
-  m_stream.str(tmp.str());
-  m_stream.clear();
+  storePixels(tmp);
 
   image->incrementVersion();
 }
 
+void CopyRegion::storePixels(const std::vector<uint8_t>& pixels)
+{
+  m_size = pixels.size();
+  m_compressed = false;
+
+  // Small regions (e.g. one brush stamp) are not worth compressing
+  if (m_size >= 256) {
+    uLongf len = compressBound(uLong(m_size));
+    std::vector<uint8_t> buf(len);
+    int err = compress2(&buf[0], &len, &pixels[0], uLong(m_size), Z_BEST_SPEED);
+    if (err != Z_OK)
+      throw base::Exception("ZLib error %d in compress2().", err);
+
+    if (len < m_size) {
+      m_data.assign(buf.begin(), buf.begin()+len);
+      m_compressed = true;
+      return;
+    }
+  }
+
+  m_data = pixels;
+}
+
+void CopyRegion::loadPixels(std::vector<uint8_t>& pixels) const
+{
+  if (!m_compressed) {
+    pixels = m_data;
+    return;
+  }
+
+  pixels.resize(m_size);
+  uLongf len = uLongf(m_size);
+  int err = uncompress(&pixels[0], &len, &m_data[0], uLong(m_data.size()));
+  if (err != Z_OK || len != m_size)
+    throw base::Exception("ZLib error %d in uncompress().", err);
+}
+
 } // namespace cmd
 } // namespace app
@@ -13,7 +13,7 @@
 #include "app/cmd/with_image.h"
 #include "gfx/region.h"
 
-#include <sstream>
+#include <vector>
 
 namespace app {
 namespace cmd {
@@ -30,15 +30,21 @@ namespace cmd {
     void onUndo() override;
     void onRedo() override;
     size_t onMemSize() const override {
-      return sizeof(*this) +
-        (size_t)const_cast<std::stringstream*>(&m_stream)->tellp();
+      return sizeof(*this) + m_data.size();
     }
 
   private:
     void swap();
+    void storePixels(const std::vector<uint8_t>& pixels);
+    void loadPixels(std::vector<uint8_t>& pixels) const;
 
     gfx::Region m_region;
-    std::stringstream m_stream;
+
+    // Pixels of the region to be copied in the image in the next
+    // swap(), compressed with zlib (if it makes them smaller).
+    std::vector<uint8_t> m_data;
+    size_t m_size;              // Size of the uncompressed pixels
+    bool m_compressed;
   };
 
 } // namespace cmd
@@ -34,12 +34,13 @@ ReplaceImage::ReplaceImage(Sprite* sprite, const ImageRef& oldImage, const Image
 
 void ReplaceImage::onExecute()
 {
-  // Save old image in m_copy. We cannot keep an ImageRef to this
+  // Save old image in m_tiles. We cannot keep an ImageRef to this
   // image, because there are other undo branches that could try to
-  // modify/re-add this same image ID
+  // modify/re-add this same image ID. Only the tiles that are
+  // different from the new image are saved.
   ImageRef oldImage = sprite()->getImageRef(m_oldImageId);
   ASSERT(oldImage);
-  m_copy.reset(Image::createCopy(oldImage.get()));
+  m_tiles.reset(new ImageTiles(oldImage.get(), m_newImage.get()));
 
   replaceImage(m_oldImageId, m_newImage);
   m_newImage.reset();
@@ -47,24 +48,26 @@ void ReplaceImage::onExecute()
 
 void ReplaceImage::onUndo()
 {
-  ImageRef newImage = sprite()->getImageRef(m_newImageId);
-  ASSERT(newImage);
-  ASSERT(!sprite()->getImageRef(m_oldImageId));
-  m_copy->setId(m_oldImageId);
-
-  replaceImage(m_newImageId, m_copy);
-  m_copy.reset(Image::createCopy(newImage.get()));
+  swapImage(m_newImageId, m_oldImageId);
 }
 
 void ReplaceImage::onRedo()
 {
-  ImageRef oldImage = sprite()->getImageRef(m_oldImageId);
-  ASSERT(oldImage);
-  ASSERT(!sprite()->getImageRef(m_newImageId));
-  m_copy->setId(m_newImageId);
+  swapImage(m_oldImageId, m_newImageId);
+}
+
+void ReplaceImage::swapImage(ObjectId currentId, ObjectId savedId)
+{
+  ImageRef currentImage = sprite()->getImageRef(currentId);
+  ASSERT(currentImage);
+  ASSERT(!sprite()->getImageRef(savedId));
+
+  // Tiles are the difference with the current image
+  ImageRef savedImage(m_tiles->createImage(currentImage.get()));
+  savedImage->setId(savedId);
 
-  replaceImage(m_oldImageId, m_copy);
-  m_copy.reset(Image::createCopy(oldImage.get()));
+  m_tiles.reset(new ImageTiles(currentImage.get(), savedImage.get()));
+  replaceImage(currentId, savedImage);
 }
 
 void ReplaceImage::replaceImage(ObjectId oldId, const ImageRef& newImage)
@@ -11,7 +11,9 @@
 
 #include "app/cmd.h"
 #include "app/cmd/with_sprite.h"
+#include "base/unique_ptr.h"
 #include "doc/image_ref.h"
+#include "doc/image_tiles.h"
 
 #include <sstream>
 
@@ -30,10 +32,11 @@ namespace cmd {
     void onRedo() override;
     size_t onMemSize() const override {
       return sizeof(*this) +
-        (m_copy ? m_copy->getMemSize(): 0);
+        (m_tiles ? m_tiles->getMemSize(): 0);
     }
 
   private:
+    void swapImage(ObjectId currentId, ObjectId savedId);
     void replaceImage(ObjectId oldId, const ImageRef& newImage);
 
     ObjectId m_oldImageId;
@@ -43,7 +46,10 @@ namespace cmd {
     // ReplaceImage() ctor until the ReplaceImage::onExecute() call.
     // Then the reference is not used anymore.
     ImageRef m_newImage;
-    ImageRef m_copy;
+
+    // Tiles of the replaced image (old image on undo, new image on
+    // redo) which are different from the image in the sprite.
+    base::UniquePtr<ImageTiles> m_tiles;
   };
 
 } // namespace cmd
@@ -546,6 +546,7 @@ void ExportSpriteSheetCommand::onExecute(Context* context)
   if (sheet_h == 0) sheet_h = fit.height;
 
   DocumentExporter exporter;
+  exporter.setContext(context);
   exporter.setTextureFilename(filename);
   if (!dataFilename.empty())
     exporter.setDataFilename(dataFilename);
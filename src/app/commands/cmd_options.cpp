@@ -145,6 +145,7 @@ public:
 
     // Undo preferences
     undoSizeLimit()->setTextf("%d", m_preferences.undo.sizeLimit());
+    undoTotalSizeLimit()->setTextf("%d", m_preferences.undo.totalSizeLimit());
     undoGotoModified()->setSelected(m_preferences.undo.gotoModified());
     undoAllowNonlinearHistory()->setSelected(m_preferences.undo.allowNonlinearHistory());
 
@@ -195,9 +196,15 @@ public:
 
     int undo_size_limit_value;
     undo_size_limit_value = undoSizeLimit()->getTextInt();
-    undo_size_limit_value = MID(1, undo_size_limit_value, 9999);
+    undo_size_limit_value = MID(0, undo_size_limit_value, 9999);
 
     m_preferences.undo.sizeLimit(undo_size_limit_value);
+
+    int undo_total_size_limit_value;
+    undo_total_size_limit_value = undoTotalSizeLimit()->getTextInt();
+    undo_total_size_limit_value = MID(0, undo_total_size_limit_value, 99999);
+
+    m_preferences.undo.totalSizeLimit(undo_total_size_limit_value);
     m_preferences.undo.gotoModified(undoGotoModified()->isSelected());
     m_preferences.undo.allowNonlinearHistory(undoAllowNonlinearHistory()->isSelected());
 
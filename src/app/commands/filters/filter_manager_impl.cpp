@@ -19,6 +19,9 @@
 #include "app/modules/editors.h"
 #include "app/transaction.h"
 #include "app/ui/editor/editor.h"
+#include "base/scoped_lock.h"
+#include "base/thread.h"
+#include "base/thread_pool.h"
 #include "doc/cel.h"
 #include "doc/image.h"
 #include "doc/images_collector.h"
@@ -33,13 +36,65 @@
 
 #include <cstdlib>
 #include <cstring>
+#include <exception>
 #include <set>
+#include <vector>
 
 namespace app {
 
 using namespace std;
 using namespace ui;
 
+// Minimum number of pixels of an image to apply a filter using
+// several threads.
+static const int kMinPixelsForThreads = 64*1024;
+
+// Number of rows that a thread takes each time to apply the filter.
+static const int kRowsPerBand = 8;
+
+// FilterManager used to apply the filter to bands of rows of the
+// image from one thread. Each thread has its own RowsBand (with its
+// own current row and iterator in the mask).
+class FilterManagerImpl::RowsBand : public FilterManager {
+public:
+  RowsBand(FilterManagerImpl* mgr) : m_mgr(mgr), m_row(0) { }
+
+  // Applies the filter to rows [row, end) of the image
+  void applyToRows(int row, int end) {
+    for (m_row=row; m_row<end; ++m_row)
+      m_mgr->applyToRow(this, m_row, m_maskBits, m_maskIterator);
+  }
+
+  // FilterManager implementation
+  const void* getSourceAddress() override {
+    return m_mgr->m_src->getPixelAddress(m_mgr->m_x, m_mgr->m_y+m_row);
+  }
+  void* getDestinationAddress() override {
+    return m_mgr->m_dst->getPixelAddress(m_mgr->m_x, m_mgr->m_y+m_row);
+  }
+  int getWidth() override { return m_mgr->m_w; }
+  Target getTarget() override { return m_mgr->m_target; }
+  FilterIndexedData* getIndexedData() override { return m_mgr; }
+  bool skipPixel() override {
+    bool skip = false;
+    if (m_mgr->m_mask && m_mgr->m_mask->bitmap()) {
+      if (!*m_maskIterator)
+        skip = true;
+      ++m_maskIterator;
+    }
+    return skip;
+  }
+  const doc::Image* getSourceImage() override { return m_mgr->m_src; }
+  int x() override { return m_mgr->m_x; }
+  int y() override { return m_mgr->m_y+m_row; }
+
+private:
+  FilterManagerImpl* m_mgr;
+  int m_row;
+  MaskBits m_maskBits;
+  MaskBits::iterator m_maskIterator;
+};
+
 FilterManagerImpl::FilterManagerImpl(Context* context, Filter* filter)
   : m_context(context)
   , m_site(context->activeSite())
@@ -47,6 +102,9 @@ FilterManagerImpl::FilterManagerImpl(Context* context, Filter* filter)
   , m_dst(NULL)
   , m_preview_mask(NULL)
   , m_progressDelegate(NULL)
+  , m_nextRow(0)
+  , m_rowsDone(0)
+  , m_stopRows(false)
 {
   int offset_x, offset_y;
 
@@ -155,44 +213,18 @@ bool FilterManagerImpl::applyStep()
   if (m_row < 0 || m_row >= m_h)
     return false;
 
-  if ((m_mask) && (m_mask->bitmap())) {
-    int x = m_x - m_mask->bounds().x + m_offset_x;
-    int y = m_y - m_mask->bounds().y + m_offset_y + m_row;
-
-    if ((m_w - x < 1) || (m_h - y < 1))
-      return false;
-
-    m_maskBits = m_mask->bitmap()
-      ->lockBits<BitmapTraits>(Image::ReadLock,
-        gfx::Rect(x, y, m_w - x, m_h - y));
-
-    m_maskIterator = m_maskBits.begin();
-  }
+  if (!applyToRow(this, m_row, m_maskBits, m_maskIterator))
+    return false;
 
-  switch (m_site.sprite()->pixelFormat()) {
-    case IMAGE_RGB:       m_filter->applyToRgba(this); break;
-    case IMAGE_GRAYSCALE: m_filter->applyToGrayscale(this); break;
-    case IMAGE_INDEXED:   m_filter->applyToIndexed(this); break;
-  }
   ++m_row;
-
   return true;
 }
 
 void FilterManagerImpl::apply(Transaction& transaction)
 {
-  bool cancelled = false;
-
   begin();
-  while (!cancelled && applyStep()) {
-    if (m_progressDelegate) {
-      // Report progress.
-      m_progressDelegate->reportProgress(m_progressBase + m_progressWidth * (m_row+1) / m_h);
 
-      // Does the user cancelled the whole process?
-      cancelled = m_progressDelegate->isCancelled();
-    }
-  }
+  bool cancelled = !applyToRows();
 
   if (!cancelled) {
     // Copy "dst" to "src"
@@ -201,6 +233,158 @@ void FilterManagerImpl::apply(Transaction& transaction)
   }
 }
 
+// Applies the filter to all rows of the current image. Big images
+// are filtered from several threads, each one takes bands of
+// kRowsPerBand rows until all rows are filtered. As each row is
+// filtered from "src" to "dst", the result is the same as applying
+// the filter row by row. This thread reports the progress and checks
+// if the user cancelled the process.
+//
+// Returns false if the process was cancelled.
+bool FilterManagerImpl::applyToRows()
+{
+  // The sprite creates the RgbMap when it's needed, so we get it from
+  // this thread before using it from several threads.
+  if (pixelFormat() == IMAGE_INDEXED) {
+    getPalette();
+    getRgbMap();
+  }
+
+  m_nextRow = 0;
+  m_rowsDone = 0;
+  m_stopRows = false;
+
+  int nthreads = 0;
+  if (m_w*m_h >= kMinPixelsForThreads)
+    nthreads = MID(0, int(base::thread::hardware_concurrency())-1, m_h/kRowsPerBand-1);
+
+  // The workers are created with the first big image
+  std::vector<base::ThreadPool::TaskRef> tasks;
+  if (nthreads > 0) {
+    if (!m_pool)
+      m_pool.reset(new base::ThreadPool(int(base::thread::hardware_concurrency())-1));
+    for (int i=0; i<nthreads; ++i)
+      tasks.push_back(m_pool->execute([this]{ applyToRowsInThread(); }));
+  }
+
+  bool cancelled = false;
+  std::exception_ptr error;
+  try {
+    RowsBand band(this);
+    while (true) {
+      int row, rowsDone;
+      {
+        base::scoped_lock lock(m_rowsMutex);
+        if (m_stopRows || m_nextRow >= m_h)
+          break;
+        row = m_nextRow;
+        m_nextRow = MIN(m_h, m_nextRow+kRowsPerBand);
+      }
+
+      band.applyToRows(row, MIN(m_h, row+kRowsPerBand));
+
+      {
+        base::scoped_lock lock(m_rowsMutex);
+        m_rowsDone += MIN(m_h, row+kRowsPerBand) - row;
+        rowsDone = m_rowsDone;
+      }
+
+      if (m_progressDelegate) {
+        // Report progress.
+        m_progressDelegate->reportProgress(m_progressBase + m_progressWidth * rowsDone / m_h);
+
+        // Does the user cancelled the whole process?
+        if (m_progressDelegate->isCancelled()) {
+          base::scoped_lock lock(m_rowsMutex);
+          m_stopRows = true;
+          cancelled = true;
+        }
+      }
+    }
+  }
+  catch (...) {
+    base::scoped_lock lock(m_rowsMutex);
+    m_stopRows = true;
+    error = std::current_exception();
+  }
+
+  // Wait all threads (they use this FilterManagerImpl), an exception
+  // thrown in any of them is rethrown in this thread
+  for (const base::ThreadPool::TaskRef& task : tasks) {
+    try {
+      m_pool->wait(task);
+    }
+    catch (...) {
+      if (!error)
+        error = std::current_exception();
+    }
+  }
+
+  if (error)
+    std::rethrow_exception(error);
+
+  return !cancelled;
+}
+
+void FilterManagerImpl::applyToRowsInThread()
+{
+  try {
+    RowsBand band(this);
+    while (true) {
+      int row;
+      {
+        base::scoped_lock lock(m_rowsMutex);
+        if (m_stopRows || m_nextRow >= m_h)
+          break;
+        row = m_nextRow;
+        m_nextRow = MIN(m_h, m_nextRow+kRowsPerBand);
+      }
+
+      band.applyToRows(row, MIN(m_h, row+kRowsPerBand));
+
+      base::scoped_lock lock(m_rowsMutex);
+      m_rowsDone += MIN(m_h, row+kRowsPerBand) - row;
+    }
+  }
+  catch (...) {
+    // Stop the other threads, the exception is rethrown from
+    // applyToRows()
+    {
+      base::scoped_lock lock(m_rowsMutex);
+      m_stopRows = true;
+    }
+    throw;
+  }
+}
+
+// Applies the filter to the given row of the current image using the
+// given FilterManager (which must return addresses of the same row).
+// Returns false if the row is outside the mask.
+bool FilterManagerImpl::applyToRow(FilterManager* filterMgr, int row,
+                                   MaskBits& maskBits, MaskBits::iterator& maskIterator)
+{
+  if ((m_mask) && (m_mask->bitmap())) {
+    int x = m_x - m_mask->bounds().x + m_offset_x;
+    int y = m_y - m_mask->bounds().y + m_offset_y + row;
+
+    if ((m_w - x < 1) || (m_h - y < 1))
+      return false;
+
+    maskBits = m_mask->bitmap()
+      ->lockBits<BitmapTraits>(Image::ReadLock,
+        gfx::Rect(x, y, m_w - x, m_h - y));
+
+    maskIterator = maskBits.begin();
+  }
+
+  switch (m_site.sprite()->pixelFormat()) {
+    case IMAGE_RGB:       m_filter->applyToRgba(filterMgr); break;
+    case IMAGE_GRAYSCALE: m_filter->applyToGrayscale(filterMgr); break;
+    case IMAGE_INDEXED:   m_filter->applyToIndexed(filterMgr); break;
+  }
+  return true;
+}
+
 void FilterManagerImpl::applyToTarget()
 {
   bool cancelled = false;
@@ -10,6 +10,7 @@
 #pragma once
 
 #include "base/exception.h"
+#include "base/mutex.h"
 #include "base/unique_ptr.h"
 #include "doc/image_impl.h"
 #include "doc/pixel_format.h"
@@ -18,6 +19,7 @@
 #include "filters/filter_manager.h"
 
 #include <cstring>
+#include <string>
 
 namespace doc {
   class Image;
@@ -26,6 +28,10 @@ namespace doc {
   class Sprite;
 }
 
+namespace base {
+  class ThreadPool;
+}
+
 namespace filters {
   class Filter;
 }
@@ -106,9 +112,15 @@ namespace app {
     doc::RgbMap* getRgbMap();
 
   private:
+    class RowsBand;
+    typedef doc::ImageBits<doc::BitmapTraits> MaskBits;
+
     void init(const doc::Layer* layer, doc::Image* image, int offset_x, int offset_y);
     void apply(Transaction& transaction);
     void applyToImage(Transaction& transaction, doc::Layer* layer, doc::Image* image, int x, int y);
+    bool applyToRows();
+    void applyToRowsInThread();
+    bool applyToRow(FilterManager* filterMgr, int row, MaskBits& maskBits, MaskBits::iterator& maskIterator);
     bool updateMask(doc::Mask* mask, const doc::Image* image);
 
     Context* m_context;
@@ -121,8 +133,8 @@ namespace app {
     int m_offset_x, m_offset_y;
     doc::Mask* m_mask;
     base::UniquePtr<doc::Mask> m_preview_mask;
-    doc::ImageBits<doc::BitmapTraits> m_maskBits;
-    doc::ImageBits<doc::BitmapTraits>::iterator m_maskIterator;
+    MaskBits m_maskBits;
+    MaskBits::iterator m_maskIterator;
     Target m_targetOrig;          // Original targets
     Target m_target;              // Filtered targets
 
@@ -130,6 +142,17 @@ namespace app {
     float m_progressBase;
     float m_progressWidth;
     IProgressDelegate* m_progressDelegate;
+
+    // Rows of the current image are filtered from several threads in
+    // bands of rows (see applyToRows()). These fields are accessed
+    // with m_rowsMutex locked.
+    base::mutex m_rowsMutex;
+    int m_nextRow;                // Next row to be filtered
+    int m_rowsDone;               // Number of filtered rows
+    bool m_stopRows;              // Cancelled by the user or an error
+
+    // Worker threads used for all images of the target
+    base::UniquePtr<base::ThreadPool> m_pool;
   };
 
 } // namespace app
@@ -0,0 +1,217 @@
+// Aseprite
+// Copyright (C) 2001-2015  David Capello
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#include "tests/test.h"
+
+#include "app/commands/filters/filter_manager_impl.h"
+#include "app/context.h"
+#include "app/document.h"
+#include "base/thread.h"
+#include "base/unique_ptr.h"
+#include "doc/doc.h"
+#include "doc/test_context.h"
+#include "filters/median_filter.h"
+#include "filters/target.h"
+
+#include <atomic>
+#include <stdexcept>
+
+using namespace app;
+using namespace doc;
+using namespace filters;
+
+// Big enough to be filtered from several threads (in several bands
+// of rows).
+static const int kWidth = 160;
+static const int kHeight = 512;
+
+class FilterManagerImplTest : public ::testing::Test {
+protected:
+  app::Document* createDocument(PixelFormat pixelFormat) {
+    ColorMode colorMode = (pixelFormat == IMAGE_RGB ? ColorMode::RGB:
+                           pixelFormat == IMAGE_GRAYSCALE ? ColorMode::GRAYSCALE:
+                                                            ColorMode::INDEXED);
+    app::Document* doc = static_cast<app::Document*>(
+      m_ctx.documents().add(kWidth, kHeight, colorMode, 256));
+
+    Image* image = celImage(doc);
+    unsigned int seed = 1;
+    for (int y=0; y<kHeight; ++y) {
+      for (int x=0; x<kWidth; ++x) {
+        seed = seed*1103515245 + 12345;
+        int v = (seed >> 16) & 0xff;
+        switch (pixelFormat) {
+          case IMAGE_RGB:
+            put_pixel(image, x, y, rgba(v, (v*7) & 0xff, (x+y) & 0xff, 255-(v & 0x3f)));
+            break;
+          case IMAGE_GRAYSCALE:
+            put_pixel(image, x, y, graya(v, 255-(v & 0x3f)));
+            break;
+          case IMAGE_INDEXED:
+            put_pixel(image, x, y, v);
+            break;
+        }
+      }
+    }
+    return doc;
+  }
+
+  static Image* celImage(app::Document* doc) {
+    return doc->sprite()->folder()->getFirstLayer()->cel(frame_t(0))->image();
+  }
+
+  // Applies the filter row by row from this thread (like the preview
+  // does) and returns the result.
+  Image* applyRowByRow(Filter* filter) {
+    FilterManagerImpl filterMgr(&m_ctx, filter);
+    filterMgr.setTarget(TARGET_ALL_CHANNELS);
+    filterMgr.begin();
+    while (filterMgr.applyStep())
+      ;
+    filterMgr.end();
+    return Image::createCopy(filterMgr.destinationImage());
+  }
+
+  doc::TestContextT<app::Context> m_ctx;
+};
+
+class CancelAfterFirstBand : public FilterManagerImpl::IProgressDelegate {
+public:
+  CancelAfterFirstBand() : m_reports(0) { }
+  void reportProgress(float progress) override { ++m_reports; }
+  bool isCancelled() override { return m_reports > 0; }
+  int reports() const { return m_reports; }
+private:
+  int m_reports;
+};
+
+// Inverts each row slowly and counts the filtered rows.
+class SlowInvertFilter : public Filter {
+public:
+  SlowInvertFilter() : m_rows(0) { }
+  int rows() const { return m_rows; }
+
+  const char* getName() override { return "Slow Invert"; }
+  void applyToRgba(FilterManager* filterMgr) override {
+    const uint32_t* src = (const uint32_t*)filterMgr->getSourceAddress();
+    uint32_t* dst = (uint32_t*)filterMgr->getDestinationAddress();
+    for (int x=0; x<filterMgr->getWidth(); ++x, ++src, ++dst)
+      if (!filterMgr->skipPixel())
+        *dst = *src ^ 0x00ffffff;
+    ++m_rows;
+    base::this_thread::sleep_for(0.001);
+  }
+  void applyToGrayscale(FilterManager* filterMgr) override { }
+  void applyToIndexed(FilterManager* filterMgr) override { }
+
+private:
+  std::atomic<int> m_rows;
+};
+
+// Throws an exception in some rows (filtered from any thread).
+class FailingFilter : public Filter {
+public:
+  const char* getName() override { return "Failing"; }
+  void applyToRgba(FilterManager* filterMgr) override {
+    if ((filterMgr->y() % 64) == 40)
+      throw std::runtime_error("Failing filter");
+  }
+  void applyToGrayscale(FilterManager* filterMgr) override { }
+  void applyToIndexed(FilterManager* filterMgr) override { }
+};
+
+TEST_F(FilterManagerImplTest, MedianInBandsIsEqualToRowByRow)
+{
+  for (PixelFormat pixelFormat : { IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED }) {
+    app::Document* doc = createDocument(pixelFormat);
+
+    MedianFilter filter;
+    filter.setTiledMode(TiledMode::BOTH);
+    filter.setSize(5, 5);
+
+    base::UniquePtr<Image> expected(applyRowByRow(&filter));
+
+    FilterManagerImpl filterMgr(&m_ctx, &filter);
+    filterMgr.setTarget(TARGET_ALL_CHANNELS);
+    filterMgr.applyToTarget();
+
+    EXPECT_EQ(0, count_diff_between_images(expected.get(), celImage(doc)))
+      << "pixel format " << pixelFormat;
+
+    doc->close();
+    delete doc;
+  }
+}
+
+TEST_F(FilterManagerImplTest, MedianInBandsWithSelection)
+{
+  app::Document* doc = createDocument(IMAGE_RGB);
+
+  // The selection starts in the middle of a band of rows
+  Mask mask;
+  mask.replace(gfx::Rect(13, 21, 97, 401));
+  mask.subtract(gfx::Rect(40, 100, 20, 150));
+  doc->setMask(&mask);
+
+  MedianFilter filter;
+  filter.setTiledMode(TiledMode::NONE);
+  filter.setSize(3, 3);
+
+  base::UniquePtr<Image> expected(applyRowByRow(&filter));
+
+  FilterManagerImpl filterMgr(&m_ctx, &filter);
+  filterMgr.setTarget(TARGET_ALL_CHANNELS);
+  filterMgr.applyToTarget();
+
+  EXPECT_EQ(0, count_diff_between_images(expected.get(), celImage(doc)));
+
+  doc->close();
+  delete doc;
+}
+
+TEST_F(FilterManagerImplTest, CancelStopsAllBands)
+{
+  app::Document* doc = createDocument(IMAGE_RGB);
+  base::UniquePtr<Image> original(Image::createCopy(celImage(doc)));
+
+  SlowInvertFilter filter;
+  CancelAfterFirstBand delegate;
+
+  FilterManagerImpl filterMgr(&m_ctx, &filter);
+  filterMgr.setTarget(TARGET_ALL_CHANNELS);
+  filterMgr.setProgressDelegate(&delegate);
+  filterMgr.applyToTarget();
+
+  // The first band is reported and then all threads stop (each one
+  // can finish the band that it was filtering).
+  EXPECT_EQ(1, delegate.reports());
+  EXPECT_LT(filter.rows(), kHeight);
+
+  // The cancelled filter doesn't modify the image
+  EXPECT_EQ(0, count_diff_between_images(original.get(), celImage(doc)));
+
+  doc->close();
+  delete doc;
+}
+
+TEST_F(FilterManagerImplTest, ExceptionInBand)
+{
+  app::Document* doc = createDocument(IMAGE_RGB);
+  base::UniquePtr<Image> original(Image::createCopy(celImage(doc)));
+
+  // The same exception is rethrown in this thread when all bands
+  // are stopped
+  FailingFilter filter;
+  FilterManagerImpl filterMgr(&m_ctx, &filter);
+  filterMgr.setTarget(TARGET_ALL_CHANNELS);
+  EXPECT_THROW(filterMgr.applyToTarget(), std::runtime_error);
+
+  EXPECT_EQ(0, count_diff_between_images(original.get(), celImage(doc)));
+
+  doc->close();
+  delete doc;
+}
@@ -20,6 +20,20 @@ namespace crash {
 
   const uint32_t MAGIC_NUMBER = 0x454E4946; // 'FINE' in ASCII
 
+  // Objects of a document backup are saved in "pack" files
+  // (e.g. "objects.1"), logs where each new version of an object is
+  // appended as a new record:
+  //
+  //   string  Object type prefix (e.g. "img", "cel", "lay", etc.)
+  //   DWORD   Object ID
+  //   DWORD   Object version
+  //   DWORD   Size of the data
+  //   BYTE[]  Object data
+  //   DWORD   Adler-32 checksum of the data
+  //   DWORD   MAGIC_NUMBER (the record is complete)
+  const uint32_t PACK_MAGIC_NUMBER = 0x4B434150; // 'PACK' in ASCII
+  const char* const PACK_FILENAME_PREFIX = "objects.";
+
   class ObjVersions {
   public:
     ObjVersions() {
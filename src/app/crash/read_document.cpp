@@ -36,9 +36,13 @@
 #include "doc/sprite.h"
 #include "doc/string_io.h"
 #include "doc/subobjects_io.h"
+#include "zlib.h"
 
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <map>
+#include <sstream>
 
 namespace app {
 namespace crash {
@@ -57,7 +61,18 @@ public:
     , m_docId(0)
     , m_docVersions(nullptr)
     , m_loadInfo(nullptr) {
+    std::vector<int> packs;
+
     for (const auto& fn : base::list_files(dir)) {
+      // Pack files
+      if (fn.compare(0, std::strlen(PACK_FILENAME_PREFIX), PACK_FILENAME_PREFIX) == 0) {
+        int pack = base::convert_to<int>(fn.substr(std::strlen(PACK_FILENAME_PREFIX)));
+        if (pack > 0)
+          packs.push_back(pack);
+        continue;
+      }
+
+      // Files with one object (backups of old versions)
       auto i = fn.find('-');
       if (i == std::string::npos)
         continue;               // Has no ID
@@ -84,6 +99,10 @@ public:
         m_docVersions = &versions;
       }
     }
+
+    std::sort(packs.begin(), packs.end());
+    for (int pack : packs)
+      readPackIndex(pack);
   }
 
   app::Document* loadDocument() {
@@ -132,8 +151,104 @@ private:
     return m_celdatas[celdataId] = celData;
   }
 
+  // Location of an object version inside a pack file
+  struct PackRecord {
+    int pack;
+    std::streampos pos;         // Position of the object data
+    size_t size;                // Size of the object data
+  };
+
+  std::string packFilename(int pack) const {
+    return base::join_path(m_dir,
+      PACK_FILENAME_PREFIX + base::convert_to<std::string>(pack));
+  }
+
+  // Reads the list of objects saved in the given pack file. Only
+  // complete records are used (the last one could be incomplete if
+  // the program crashed while it was being written).
+  void readPackIndex(int pack) {
+    std::ifstream s(FSTREAM_PATH(packFilename(pack)), std::ifstream::binary);
+    s.seekg(0, std::ios::end);
+    std::streampos end = s.tellg();
+    s.seekg(0);
+    if (read32(s) != PACK_MAGIC_NUMBER)
+      return;
+
+    std::vector<char> data;
+    while (s) {
+      std::string prefix = read_string(s);
+      ObjectId id = read32(s);
+      ObjectVersion ver = read32(s);
+      uint32_t size = read32(s);
+      if (!s || prefix.empty() || !id || !ver ||
+          size > size_t(end - s.tellg()))
+        break;
+
+      PackRecord rec;
+      rec.pack = pack;
+      rec.pos = s.tellg();
+      rec.size = size;
+
+      data.resize(size);
+      if (size > 0)
+        s.read(&data[0], size);
+      uint32_t checksum = read32(s);
+      uint32_t magic = read32(s);
+      if (!s || magic != MAGIC_NUMBER ||
+          checksum != adler32(adler32(0, nullptr, 0),
+                              (const Bytef*)(size > 0 ? &data[0]: nullptr), size)) {
+        TRACE(" - Invalid record %s #%d v%d in pack %d\n", prefix.c_str(), id, ver, pack);
+        break;
+      }
+
+      ObjVersions& versions = m_objVersions[id];
+      versions.add(ver);
+      m_packRecords[std::make_pair(id, ver)] = rec;
+
+      if (prefix == "doc") {
+        if (!m_docId)
+          m_docId = id;
+        else {
+          ASSERT(m_docId == id);
+        }
+
+        m_docVersions = &versions;
+      }
+    }
+  }
+
+  // Reads the data of the given object version (from a pack file or
+  // from a file with just one object).
+  bool loadObjectData(const char* prefix, ObjectId id, ObjectVersion ver, std::string& data) {
+    auto it = m_packRecords.find(std::make_pair(id, ver));
+    if (it != m_packRecords.end()) {
+      const PackRecord& rec = it->second;
+      std::ifstream s(FSTREAM_PATH(packFilename(rec.pack)), std::ifstream::binary);
+      s.seekg(rec.pos);
+      data.resize(rec.size);
+      if (rec.size > 0)
+        s.read(&data[0], rec.size);
+      return !!s;
+    }
+
+    std::string fn = prefix;
+    fn.push_back('-');
+    fn += base::convert_to<std::string>(id);
+    fn.push_back('.');
+    fn += base::convert_to<std::string>(ver);
+
+    std::ifstream s(FSTREAM_PATH(base::join_path(m_dir, fn)), std::ifstream::binary);
+    if (read32(s) != MAGIC_NUMBER)
+      return false;
+
+    std::ostringstream buf(std::ios::binary);
+    buf << s.rdbuf();
+    data = buf.str();
+    return true;
+  }
+
   template<typename T>
-  T loadObject(const char* prefix, ObjectId id, T (Reader::*readMember)(std::ifstream&)) {
+  T loadObject(const char* prefix, ObjectId id, T (Reader::*readMember)(std::istream&)) {
     const ObjVersions& versions = m_objVersions[id];
 
     for (size_t i=0; i<versions.size(); ++i) {
@@ -143,16 +258,12 @@ private:
 
       TRACE(" - Restoring %s #%d v%d\n", prefix, id, ver);
 
-      std::string fn = prefix;
-      fn.push_back('-');
-      fn += base::convert_to<std::string>(id);
-      fn.push_back('.');
-      fn += base::convert_to<std::string>(ver);
-
-      std::ifstream s(FSTREAM_PATH(base::join_path(m_dir, fn)), std::ifstream::binary);
+      std::string data;
       T obj = nullptr;
-      if (read32(s) == MAGIC_NUMBER)
+      if (loadObjectData(prefix, id, ver, data)) {
+        std::istringstream s(data, std::ios::binary);
         obj = (this->*readMember)(s);
+      }
 
       if (obj) {
         TRACE(" - %s #%d v%d restored successfully\n", prefix, id, ver);
@@ -170,7 +281,7 @@ private:
     return nullptr;
   }
 
-  app::Document* readDocument(std::ifstream& s) {
+  app::Document* readDocument(std::istream& s) {
     ObjectId sprId = read32(s);
     std::string filename = read_string(s);
 
@@ -193,7 +304,7 @@ private:
     }
   }
 
-  Sprite* readSprite(std::ifstream& s) {
+  Sprite* readSprite(std::istream& s) {
     PixelFormat format = (PixelFormat)read8(s);
     int w = read16(s);
     int h = read16(s);
@@ -276,7 +387,7 @@ private:
     return spr.release();
   }
 
-  Layer* readLayer(std::ifstream& s) {
+  Layer* readLayer(std::istream& s) {
     LayerFlags flags = (LayerFlags)read32(s);
     ObjectType type = (ObjectType)read16(s);
     ASSERT(type == ObjectType::LayerImage);
@@ -310,23 +421,23 @@ private:
     }
   }
 
-  Cel* readCel(std::ifstream& s) {
+  Cel* readCel(std::istream& s) {
     return read_cel(s, this, false);
   }
 
-  CelData* readCelData(std::ifstream& s) {
+  CelData* readCelData(std::istream& s) {
     return read_celdata(s, this, false);
   }
 
-  Image* readImage(std::ifstream& s) {
+  Image* readImage(std::istream& s) {
     return read_image(s, false);
   }
 
-  Palette* readPalette(std::ifstream& s) {
+  Palette* readPalette(std::istream& s) {
     return read_palette(s);
   }
 
-  FrameTag* readFrameTag(std::ifstream& s) {
+  FrameTag* readFrameTag(std::istream& s) {
     return read_frame_tag(s, false);
   }
 
@@ -361,6 +472,7 @@ private:
   DocumentInfo* m_loadInfo;
   std::map<ObjectId, ImageRef> m_images;
   std::map<ObjectId, CelDataRef> m_celdatas;
+  std::map<std::pair<ObjectId, ObjectVersion>, PackRecord> m_packRecords;
 };
 
 } // anonymous namespace
@@ -16,7 +16,6 @@
 #include "app/crash/read_document.h"
 #include "app/crash/write_document.h"
 #include "app/document.h"
-#include "app/document_access.h"
 #include "app/file/file.h"
 #include "app/ui_context.h"
 #include "base/bind.h"
@@ -131,7 +130,6 @@ void Session::removeFromDisk()
 
 void Session::saveDocumentChanges(app::Document* doc)
 {
-  DocumentReader reader(doc, 250);
   app::Context ctx;
   std::string dir = base::join_path(m_path,
     base::convert_to<std::string>(doc->id()));
@@ -140,7 +138,8 @@ void Session::saveDocumentChanges(app::Document* doc)
   if (!base::is_directory(dir))
     base::make_directory(dir);
 
-  // Save document information
+  // Save document information (the document is locked only to copy
+  // the modified objects)
   write_document(dir, doc);
 }
 
@@ -13,6 +13,7 @@
 
 #include "app/crash/internals.h"
 #include "app/document.h"
+#include "app/document_access.h"
 #include "base/convert_to.h"
 #include "base/fs.h"
 #include "base/fstream_path.h"
@@ -33,9 +34,12 @@
 #include "doc/palette_io.h"
 #include "doc/sprite.h"
 #include "doc/string_io.h"
+#include "zlib.h"
 
 #include <fstream>
 #include <map>
+#include <set>
+#include <sstream>
 
 namespace app {
 namespace crash {
@@ -46,17 +50,42 @@ using namespace doc;
 
 namespace {
 
-static std::map<ObjectId, ObjVersionsMap> g_docVersions;
+// Packs are compacted when they have more than this number of bytes
+// of old versions/deleted objects (and more unused than used bytes)
+const size_t kMinWastedPackSize = 4*1024*1024;
+
+// Record of the last version of an object saved in the pack file
+struct PackRecord {
+  size_t pos;                   // Position in the pack file
+  size_t size;                  // Size of the whole record
+};
+
+typedef std::map<ObjectId, PackRecord> PackRecords;
+
+// Information about the backup of each document
+struct DocBackup {
+  ObjVersionsMap objVersions;
+  PackRecords records;
+  int pack;                     // Index of the current pack file
+  size_t packSize;              // Size of the current pack file
+
+  DocBackup() : pack(0), packSize(0) { }
+};
+
+static std::map<ObjectId, DocBackup> g_docBackups;
 
 class Writer {
 public:
   Writer(const std::string& dir, app::Document* doc)
     : m_dir(dir)
     , m_doc(doc)
-    , m_objVersions(g_docVersions[doc->id()]) {
+    , m_backup(g_docBackups[doc->id()]) {
   }
 
-  void saveDocument() {
+  // Copies the modified objects in memory, so they can be written
+  // when the document is unlocked. It's the only function that needs
+  // the document locked (for reading).
+  void collectChanges() {
     Sprite* spr = m_doc->sprite();
 
     // Save from objects without children (e.g. images), to aggregated
@@ -69,7 +98,7 @@ public:
       saveObject("frtag", frtag, &Writer::writeFrameTag);
 
     for (Cel* cel : spr->uniqueCels()) {
-      saveObject("img", cel->image(), &Writer::writeImage);
+      saveImage(cel->image());
       saveObject("celdata", cel->data(), &Writer::writeCelData);
     }
 
@@ -85,14 +114,98 @@ public:
     saveObject("doc", m_doc, &Writer::writeDocumentFile);
   }
 
+  // Appends all modified objects at the end of the pack file (in
+  // just one write operation), and compacts the pack if needed.
+  void writeChanges() {
+    if (!m_objects.empty()) {
+      std::ostringstream s(std::ios::binary);
+      std::vector<size_t> sizes;
+
+      if (m_backup.packSize == 0) {
+        ++m_backup.pack;
+        write32(s, PACK_MAGIC_NUMBER);
+      }
+      size_t pos = m_backup.packSize + size_t(s.tellp());
+
+      for (ModifiedObject& obj : m_objects) {
+        // Images are serialized (and compressed) here, without the
+        // document lock
+        if (obj.image) {
+          std::ostringstream data(std::ios::binary);
+          write_image(data, obj.image.get());
+          obj.data = data.str();
+          obj.image.reset();
+        }
+
+        std::ostream::pos_type start = s.tellp();
+        writeRecord(s, obj);
+        sizes.push_back(size_t(s.tellp() - start));
+      }
+
+      std::string buf = s.str();
+      {
+        std::ofstream f(FSTREAM_PATH(packFilename(m_backup.pack)),
+                        std::ofstream::binary |
+                        (m_backup.packSize == 0 ? std::ofstream::trunc:
+                                                  std::ofstream::app));
+        f.write(buf.c_str(), buf.size());
+        f.flush();
+        if (!f) {
+          // The pack could contain an incomplete record at the end,
+          // so we cannot append more records. All saved objects
+          // will be copied to a new pack file.
+          TRACE(" - Error writing pack file %d\n", m_backup.pack);
+          compact();
+          return;
+        }
+      }
+      m_backup.packSize += buf.size();
+
+      for (size_t i=0; i<m_objects.size(); ++i) {
+        const ModifiedObject& obj = m_objects[i];
+
+        PackRecord& rec = m_backup.records[obj.id];
+        rec.pos = pos;
+        rec.size = sizes[i];
+        pos += sizes[i];
+
+        // Rotate versions and add the latest one
+        m_backup.objVersions[obj.id].rotateRevisions(obj.version);
+
+        TRACE(" - Saved %s #%d v%d\n", obj.prefix, obj.id, obj.version);
+      }
+    }
+
+    // Bytes used by the last version of existent objects (the rest
+    // are old versions or deleted objects)
+    size_t usedSize = 0;
+    for (const auto& item : m_backup.records) {
+      if (m_usedObjects.find(item.first) != m_usedObjects.end())
+        usedSize += item.second.size;
+    }
+
+    size_t wastedSize = m_backup.packSize - MIN(usedSize, m_backup.packSize);
+    if (wastedSize > kMinWastedPackSize && wastedSize > usedSize)
+      compact();
+  }
+
 private:
 
-  void writeDocumentFile(std::ofstream& s, app::Document* doc) {
+  // Modified object to be written in the pack file
+  struct ModifiedObject {
+    const char* prefix;
+    ObjectId id;
+    ObjectVersion version;
+    std::string data;
+    ImageRef image;             // Copy of the image to serialize
+  };
+
+  void writeDocumentFile(std::ostream& s, app::Document* doc) {
     write32(s, doc->sprite()->id());
     write_string(s, doc->filename());
   }
 
-  void writeSprite(std::ofstream& s, Sprite* spr) {
+  void writeSprite(std::ostream& s, Sprite* spr) {
     write8(s, spr->pixelFormat());
     write16(s, spr->width());
     write16(s, spr->height());
@@ -121,7 +234,7 @@ private:
       write32(s, frtag->id());
   }
 
-  void writeLayerStructure(std::ofstream& s, Layer* lay) {
+  void writeLayerStructure(std::ostream& s, Layer* lay) {
     write32(s, static_cast<int>(lay->flags())); // Flags
     write16(s, static_cast<int>(lay->type()));  // Type
     write_string(s, lay->name());
@@ -139,73 +252,146 @@ private:
     }
   }
 
-  void writeCel(std::ofstream& s, Cel* cel) {
+  void writeCel(std::ostream& s, Cel* cel) {
     write_cel(s, cel);
   }
 
-  void writeCelData(std::ofstream& s, CelData* celdata) {
+  void writeCelData(std::ostream& s, CelData* celdata) {
     write_celdata(s, celdata);
   }
 
-  void writeImage(std::ofstream& s, Image* img) {
-    write_image(s, img);
-  }
-
-  void writePalette(std::ofstream& s, Palette* pal) {
+  void writePalette(std::ostream& s, Palette* pal) {
     write_palette(s, pal);
   }
 
-  void writeFrameTag(std::ofstream& s, FrameTag* frameTag) {
+  void writeFrameTag(std::ostream& s, FrameTag* frameTag) {
     write_frame_tag(s, frameTag);
   }
 
   template<typename T>
-  void saveObject(const char* prefix, T* obj, void (Writer::*writeMember)(std::ofstream&, T*)) {
+  ModifiedObject* addObject(const char* prefix, T* obj) {
     if (!obj->version())
       obj->incrementVersion();
 
-    ObjVersions& versions = m_objVersions[obj->id()];
-    if (versions.newer() == obj->version())
-      return;
+    m_usedObjects.insert(obj->id());
 
-    std::string fn = prefix;
-    fn.push_back('-');
-    fn += base::convert_to<std::string>(obj->id());
+    if (m_backup.objVersions[obj->id()].newer() == obj->version())
+      return nullptr;
 
-    std::string fullfn = base::join_path(m_dir, fn);
-    std::string oldfn = fullfn + "." + base::convert_to<std::string>(versions.older());
-    fullfn += "." + base::convert_to<std::string>(obj->version());
+    m_objects.push_back(ModifiedObject());
+    ModifiedObject* o = &m_objects.back();
+    o->prefix = prefix;
+    o->id = obj->id();
+    o->version = obj->version();
+    return o;
+  }
 
-    std::ofstream s(FSTREAM_PATH(fullfn), std::ofstream::binary);
-    write32(s, 0);                // Leave a room for the magic number
-    (this->*writeMember)(s, obj); // Write the object
+  template<typename T>
+  void saveObject(const char* prefix, T* obj, void (Writer::*writeMember)(std::ostream&, T*)) {
+    if (ModifiedObject* o = addObject(prefix, obj)) {
+      std::ostringstream s(std::ios::binary);
+      (this->*writeMember)(s, obj); // Write the object
+      o->data = s.str();
+    }
+  }
 
-    // Flush all data. In this way we ensure that the magic number is
-    // the last thing being written in the file.
-    s.flush();
+  void saveImage(Image* img) {
+    // Just a copy of the pixels (the compression is done in
+    // writeChanges() when the document is unlocked)
+    if (ModifiedObject* o = addObject("img", img))
+      o->image.reset(Image::createCopy(img));
+  }
 
-    // Write the magic number
-    s.seekp(0);
+  void writeRecord(std::ostream& s, const ModifiedObject& obj) {
+    write_string(s, obj.prefix);
+    write32(s, obj.id);
+    write32(s, obj.version);
+    write32(s, obj.data.size());
+    s.write(obj.data.c_str(), obj.data.size());
+    write32(s, adler32(adler32(0, nullptr, 0),
+                       (const Bytef*)obj.data.c_str(), obj.data.size()));
     write32(s, MAGIC_NUMBER);
+  }
+
+  // Copies the last version of all used objects to a new pack file,
+  // and deletes the old one.
+  void compact() {
+    std::string oldfn = packFilename(m_backup.pack);
+    std::string newfn = packFilename(m_backup.pack+1);
+    TRACE(" - Compacting pack %d (%d bytes)\n",
+          m_backup.pack, m_backup.packSize);
+
+    PackRecords records;
+    size_t pos = 0;
+    {
+      std::ifstream in(FSTREAM_PATH(oldfn), std::ifstream::binary);
+      std::ofstream out(FSTREAM_PATH(newfn), std::ofstream::binary);
+      write32(out, PACK_MAGIC_NUMBER);
+      pos += 4;
+
+      std::vector<char> buf;
+      for (const auto& item : m_backup.records) {
+        if (m_usedObjects.find(item.first) == m_usedObjects.end())
+          continue;
+
+        const PackRecord& rec = item.second;
+        buf.resize(rec.size);
+        in.seekg(rec.pos);
+        in.read(&buf[0], rec.size);
+        if (!in)
+          break;
+
+        out.write(&buf[0], rec.size);
+
+        PackRecord& newRec = records[item.first];
+        newRec = rec;
+        newRec.pos = pos;
+        pos += rec.size;
+      }
+
+      out.flush();
+      if (!in || !out) {
+        // Objects are saved again in a new pack in the next backup
+        TRACE(" - Error compacting pack %d\n", m_backup.pack);
+        m_backup.objVersions.clear();
+        m_backup.records.clear();
+        m_backup.packSize = 0;
+        return;
+      }
+    }
+
+    // Forget deleted objects (if they are restored with undo, they
+    // will be saved again)
+    for (auto it=m_backup.objVersions.begin(); it!=m_backup.objVersions.end(); ) {
+      if (records.find(it->first) == records.end())
+        it = m_backup.objVersions.erase(it);
+      else
+        ++it;
+    }
 
-    // Remove the older version
     try {
-      if (versions.older() && base::is_file(oldfn))
+      if (base::is_file(oldfn))
         base::delete_file(oldfn);
     }
     catch (const std::exception&) {
-      TRACE(" - Cannot delete %s #%d v%d\n", prefix, obj->id(), versions.older());
+      TRACE(" - Cannot delete pack %d\n", m_backup.pack);
     }
 
-    // Rotate versions and add the latest one
-    versions.rotateRevisions(obj->version());
+    ++m_backup.pack;
+    m_backup.records.swap(records);
+    m_backup.packSize = pos;
+  }
 
-    TRACE(" - Saved %s #%d v%d\n", prefix, obj->id(), obj->version());
+  std::string packFilename(int pack) const {
+    return base::join_path(m_dir,
+      PACK_FILENAME_PREFIX + base::convert_to<std::string>(pack));
   }
 
   std::string m_dir;
   app::Document* m_doc;
-  ObjVersionsMap& m_objVersions;
+  DocBackup& m_backup;
+  std::vector<ModifiedObject> m_objects;
+  std::set<ObjectId> m_usedObjects;
 };
 
 } // anonymous namespace
@@ -216,18 +402,23 @@ private:
 void write_document(const std::string& dir, app::Document* doc)
 {
   Writer writer(dir, doc);
-  writer.saveDocument();
+  {
+    // Throws a LockedDocumentException if the document is locked
+    DocumentReader reader(doc, 250);
+    writer.collectChanges();
+  }
+  writer.writeChanges();
 }
 
 void delete_document_internals(app::Document* doc)
 {
   ASSERT(doc);
-  auto it = g_docVersions.find(doc->id());
+  auto it = g_docBackups.find(doc->id());
 
-  // The document could not be inside g_documentObjects in case it was
+  // The document could not be inside g_docBackups in case it was
   // never saved by the backup process.
-  if (it != g_docVersions.end())
-    g_docVersions.erase(it);
+  if (it != g_docBackups.end())
+    g_docBackups.erase(it);
 }
 
 } // namespace crash
@@ -0,0 +1,204 @@
+// Aseprite
+// Copyright (C) 2001-2015  David Capello
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#include "tests/test.h"
+
+#include "app/context.h"
+#include "app/crash/internals.h"
+#include "app/crash/read_document.h"
+#include "app/crash/write_document.h"
+#include "app/document.h"
+#include "base/convert_to.h"
+#include "base/fs.h"
+#include "base/fstream_path.h"
+#include "base/path.h"
+#include "base/unique_ptr.h"
+#include "doc/doc.h"
+#include "doc/test_context.h"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+using namespace app;
+using namespace doc;
+
+class CrashPack : public ::testing::Test {
+public:
+  CrashPack() : m_doc(nullptr) {
+    m_dir = base::join_path(base::get_temp_path(), "aseprite_crash_tests");
+    removeDir();
+    base::make_all_directories(m_dir);
+  }
+
+  ~CrashPack() {
+    if (m_doc) {
+      crash::delete_document_internals(m_doc);
+      m_doc->close();
+      delete m_doc;
+    }
+    removeDir();
+  }
+
+protected:
+  void createDocument(int w, int h) {
+    m_doc = static_cast<app::Document*>(
+      m_ctx.documents().add(w, h, doc::ColorMode::RGB, 256));
+    m_doc->setFilename("crash_test.ase");
+  }
+
+  // Fills the cel image with random pixels (so it cannot be
+  // compressed) and increments its version like a command does.
+  void fillImage(unsigned int seed) {
+    Image* image = celImage(m_doc);
+    for (int y=0; y<image->height(); ++y) {
+      for (int x=0; x<image->width(); ++x) {
+        seed = seed*1103515245 + 12345;
+        put_pixel(image, x, y, rgba((seed >> 8) & 0xff,
+                                    (seed >> 16) & 0xff,
+                                    (seed >> 24) & 0xff, 255));
+      }
+    }
+    image->incrementVersion();
+  }
+
+  static Image* celImage(app::Document* doc) {
+    return doc->sprite()->folder()->getFirstLayer()->cel(frame_t(0))->image();
+  }
+
+  std::string packFilename(int pack) const {
+    return base::join_path(m_dir,
+      crash::PACK_FILENAME_PREFIX + base::convert_to<std::string>(pack));
+  }
+
+  std::string readFile(const std::string& fn) const {
+    std::ifstream f(FSTREAM_PATH(fn), std::ifstream::binary);
+    std::ostringstream buf(std::ios::binary);
+    buf << f.rdbuf();
+    return buf.str();
+  }
+
+  void writeFile(const std::string& fn, const std::string& data) const {
+    std::ofstream f(FSTREAM_PATH(fn), std::ofstream::binary | std::ofstream::trunc);
+    f.write(data.c_str(), data.size());
+  }
+
+  // Restores the backup and compares its cel image with the given one
+  void expectRestoredImage(const Image* expected) {
+    base::UniquePtr<app::Document> restored(crash::read_document(m_dir));
+    ASSERT_TRUE(restored != nullptr);
+    EXPECT_EQ("crash_test.ase", restored->filename());
+    EXPECT_EQ(m_doc->sprite()->bounds(), restored->sprite()->bounds());
+    EXPECT_EQ(0, count_diff_between_images(expected, celImage(restored.get())));
+  }
+
+  void removeDir() {
+    if (!base::is_directory(m_dir))
+      return;
+    for (const auto& fn : base::list_files(m_dir))
+      base::delete_file(base::join_path(m_dir, fn));
+    base::remove_directory(m_dir);
+  }
+
+  doc::TestContextT<app::Context> m_ctx;
+  app::Document* m_doc;
+  std::string m_dir;
+};
+
+TEST_F(CrashPack, WriteAndRead)
+{
+  createDocument(32, 16);
+  fillImage(1);
+  crash::write_document(m_dir, m_doc);
+
+  ASSERT_TRUE(base::is_file(packFilename(1)));
+  size_t size = base::file_size(packFilename(1));
+
+  crash::DocumentInfo info;
+  EXPECT_TRUE(crash::read_document_info(m_dir, info));
+  EXPECT_EQ(IMAGE_RGB, info.format);
+  EXPECT_EQ(32, info.width);
+  EXPECT_EQ(1, info.frames);
+  EXPECT_EQ("crash_test.ase", info.filename);
+
+  expectRestoredImage(celImage(m_doc));
+
+  // Without changes nothing is appended
+  crash::write_document(m_dir, m_doc);
+  EXPECT_EQ(size, base::file_size(packFilename(1)));
+
+  // New versions are appended to the same pack
+  fillImage(2);
+  crash::write_document(m_dir, m_doc);
+  EXPECT_LT(size, base::file_size(packFilename(1)));
+  EXPECT_FALSE(base::is_file(packFilename(2)));
+
+  expectRestoredImage(celImage(m_doc));
+}
+
+TEST_F(CrashPack, CompactWastedPack)
+{
+  // Each version of the image uses 4MB (random pixels are not
+  // compressed), so the third backup has more wasted than used bytes.
+  createDocument(1024, 1024);
+  for (unsigned int seed=1; seed<=3; ++seed) {
+    fillImage(seed);
+    crash::write_document(m_dir, m_doc);
+  }
+
+  EXPECT_FALSE(base::is_file(packFilename(1)));
+  ASSERT_TRUE(base::is_file(packFilename(2)));
+  EXPECT_GT(size_t(8*1024*1024), base::file_size(packFilename(2)));
+
+  expectRestoredImage(celImage(m_doc));
+
+  // New versions are appended to the compacted pack
+  fillImage(4);
+  crash::write_document(m_dir, m_doc);
+  EXPECT_FALSE(base::is_file(packFilename(3)));
+
+  expectRestoredImage(celImage(m_doc));
+}
+
+TEST_F(CrashPack, TruncatedLastRecord)
+{
+  createDocument(32, 16);
+  fillImage(1);
+  base::UniquePtr<Image> first(Image::createCopy(celImage(m_doc)));
+  crash::write_document(m_dir, m_doc);
+  size_t size = base::file_size(packFilename(1));
+
+  fillImage(2);
+  crash::write_document(m_dir, m_doc);
+
+  // Crash in the middle of the new image record
+  std::string data = readFile(packFilename(1));
+  ASSERT_LT(size+64, data.size());
+  writeFile(packFilename(1), data.substr(0, size+64));
+
+  expectRestoredImage(first.get());
+}
+
+TEST_F(CrashPack, CorruptLastRecord)
+{
+  createDocument(32, 16);
+  fillImage(1);
+  base::UniquePtr<Image> first(Image::createCopy(celImage(m_doc)));
+  crash::write_document(m_dir, m_doc);
+  size_t size = base::file_size(packFilename(1));
+
+  fillImage(2);
+  crash::write_document(m_dir, m_doc);
+
+  // A complete record with wrong data (the checksum doesn't match)
+  std::string data = readFile(packFilename(1));
+  ASSERT_LT(size+64, data.size());
+  data[size+64] ^= 0xff;
+  writeFile(packFilename(1), data);
+
+  expectRestoredImage(first.get());
+}
@@ -113,10 +113,12 @@ void Document::notifyGeneralUpdate()
   notifyObservers<doc::DocumentEvent&>(&doc::DocumentObserver::onGeneralUpdate, ev);
 }
 
-void Document::notifySpritePixelsModified(Sprite* sprite, const gfx::Region& region)
+void Document::notifySpritePixelsModified(Sprite* sprite, const gfx::Region& region,
+                                          Layer* layer)
 {
   doc::DocumentEvent ev(this);
   ev.sprite(sprite);
+  ev.layer(layer);
   ev.region(region);
   notifyObservers<doc::DocumentEvent&>(&doc::DocumentObserver::onSpritePixelsModified, ev);
 }
@@ -19,8 +19,10 @@
 #include "app/ui_context.h"
 #include "base/convert_to.h"
 #include "base/fstream_path.h"
+#include "base/fs.h"
 #include "base/path.h"
 #include "base/replace_string.h"
+#include "base/sha1.h"
 #include "base/shared_ptr.h"
 #include "base/string.h"
 #include "base/unique_ptr.h"
@@ -37,9 +39,12 @@
 #include "gfx/size.h"
 #include "render/render.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <sstream>
 
 using namespace doc;
 
@@ -52,16 +57,138 @@ std::string escape_path_for_json(const std::string& path)
   return res;
 }
 
+template<typename T>
+void add_to_hash(base::Sha1::Calculator& calc, const T& value)
+{
+  calc.add(&value, sizeof(value));
+}
+
+void add_image_to_hash(base::Sha1::Calculator& calc, const Image* image)
+{
+  add_to_hash(calc, image->pixelFormat());
+  add_to_hash(calc, image->width());
+  add_to_hash(calc, image->height());
+  add_to_hash(calc, image->maskColor());
+
+  int rowBytes = image->getRowStrideSize();
+  for (int y=0; y<image->height(); ++y)
+    calc.add(image->getPixelAddress(0, y), rowBytes);
+}
+
+// Adds to the hash everything from the layer that is used to render
+// it in the given frame.
+void add_layer_to_hash(base::Sha1::Calculator& calc, Layer* layer, frame_t frame)
+{
+  add_to_hash(calc, layer->type());
+  add_to_hash(calc, layer->flags());
+
+  if (layer->isImage()) {
+    LayerImage* layerImage = static_cast<LayerImage*>(layer);
+    add_to_hash(calc, layerImage->blendMode());
+    add_to_hash(calc, layerImage->opacity());
+
+    Cel* cel = layer->cel(frame);
+    if (cel) {
+      add_to_hash(calc, cel->position());
+      add_to_hash(calc, cel->opacity());
+      add_image_to_hash(calc, cel->image());
+    }
+  }
+  else if (layer->isFolder()) {
+    for (Layer* child : static_cast<LayerFolder*>(layer)->getLayersList())
+      add_layer_to_hash(calc, child, frame);
+  }
+}
+
+// Returns a key to identify the sample of the given file, layer and
+// frame in the SamplesCache.
+std::string sample_cache_key(const std::string& filename, Layer* layer, frame_t frame)
+{
+  base::Sha1::Calculator calc;
+  calc.add(filename.c_str(), filename.size()+1);
+  if (layer) {
+    LayerIndex index = layer->sprite()->layerToIndex(layer);
+    add_to_hash(calc, (int)index);
+    calc.add(layer->name().c_str(), layer->name().size()+1);
+  }
+  add_to_hash(calc, frame);
+  return base::convert_to<std::string>(calc.result());
+}
+
+// Returns the hash of all the information needed to render the given
+// sprite/layer in the given frame.
+std::string sample_content_hash(Sprite* sprite, Layer* layer, frame_t frame)
+{
+  base::Sha1::Calculator calc;
+  add_to_hash(calc, sprite->pixelFormat());
+  add_to_hash(calc, sprite->width());
+  add_to_hash(calc, sprite->height());
+  add_to_hash(calc, sprite->transparentColor());
+
+  const Palette* palette = sprite->palette(frame);
+  for (int i=0; i<palette->size(); ++i)
+    add_to_hash(calc, palette->getEntry(i));
+
+  add_layer_to_hash(calc, (layer ? layer: sprite->folder()), frame);
+  return base::convert_to<std::string>(calc.result());
+}
+
 } // anonymous namespace
 
 namespace app {
 
+// Information about the samples of the last exported texture. It's
+// saved in a text file next to the texture, so the next export can
+// reuse the trimmed bounds and the position in the texture of the
+// samples that didn't change (and their pixels from the texture
+// itself).
+class DocumentExporter::SamplesCache {
+public:
+  struct Entry {
+    std::string hash;
+    bool empty;
+    bool rotated;
+    gfx::Rect trimmedBounds;
+    gfx::Rect inTextureBounds;
+    Entry() : empty(false), rotated(false) { }
+  };
+
+  SamplesCache() : m_textureWidth(0), m_textureHeight(0) { }
+
+  bool load(const std::string& filename, const std::string& options);
+  void save(const std::string& filename, const std::string& options,
+            const Samples& samples, int textureWidth, int textureHeight,
+            const std::string& textureFilename);
+
+  const Entry* find(const std::string& key) const {
+    auto it = m_entries.find(key);
+    return (it != m_entries.end() ? &it->second: nullptr);
+  }
+
+  // Number of non-empty samples in the last texture
+  int layoutSize() const { return int(m_layout.size()); }
+
+  int textureWidth() const { return m_textureWidth; }
+  int textureHeight() const { return m_textureHeight; }
+  const std::string& textureHash() const { return m_textureHash; }
+
+private:
+  static const char* kVersion;
+
+  std::map<std::string, Entry> m_entries;
+  std::vector<std::string> m_layout;      // Keys of non-empty samples
+  int m_textureWidth;
+  int m_textureHeight;
+  std::string m_textureHash;
+};
+
 class SampleBounds {
 public:
   SampleBounds(Sprite* sprite) :
     m_originalSize(sprite->width(), sprite->height()),
     m_trimmedBounds(0, 0, sprite->width(), sprite->height()),
-    m_inTextureBounds(0, 0, sprite->width(), sprite->height()) {
+    m_inTextureBounds(0, 0, sprite->width(), sprite->height()),
+    m_rotated(false) {
   }
 
   bool trimmed() const {
@@ -74,14 +201,17 @@ public:
   const gfx::Size& originalSize() const { return m_originalSize; }
   const gfx::Rect& trimmedBounds() const { return m_trimmedBounds; }
   const gfx::Rect& inTextureBounds() const { return m_inTextureBounds; }
+  bool rotated() const { return m_rotated; }
 
   void setTrimmedBounds(const gfx::Rect& bounds) { m_trimmedBounds = bounds; }
   void setInTextureBounds(const gfx::Rect& bounds) { m_inTextureBounds = bounds; }
+  void setRotated(bool state) { m_rotated = state; }
 
 private:
   gfx::Size m_originalSize;
   gfx::Rect m_trimmedBounds;
   gfx::Rect m_inTextureBounds;
+  bool m_rotated;               // Rotated 90 degrees clockwise in the texture
 };
 
 typedef base::SharedPtr<SampleBounds> SampleBoundsPtr;
@@ -97,7 +227,8 @@ public:
     m_filename(filename),
     m_innerPadding(innerPadding),
     m_bounds(new SampleBounds(sprite)),
-    m_isDuplicated(false) {
+    m_isDuplicated(false),
+    m_isCached(false) {
   }
 
   Document* document() const { return m_document; }
@@ -108,6 +239,7 @@ public:
   const gfx::Size& originalSize() const { return m_bounds->originalSize(); }
   const gfx::Rect& trimmedBounds() const { return m_bounds->trimmedBounds(); }
   const gfx::Rect& inTextureBounds() const { return m_bounds->inTextureBounds(); }
+  bool rotated() const { return m_bounds->rotated(); }
 
   gfx::Size requiredSize() const {
     gfx::Size size = m_bounds->trimmedBounds().getSize();
@@ -122,10 +254,23 @@ public:
 
   void setTrimmedBounds(const gfx::Rect& bounds) { m_bounds->setTrimmedBounds(bounds); }
   void setInTextureBounds(const gfx::Rect& bounds) { m_bounds->setInTextureBounds(bounds); }
+  void setRotated(bool state) { m_bounds->setRotated(state); }
 
   bool isDuplicated() const { return m_isDuplicated; }
   SampleBoundsPtr sharedBounds() const { return m_bounds; }
 
+  // Key and hash of the sample content in the SamplesCache
+  const std::string& cacheKey() const { return m_cacheKey; }
+  const std::string& contentHash() const { return m_contentHash; }
+  void setCacheKey(const std::string& key, const std::string& hash) {
+    m_cacheKey = key;
+    m_contentHash = hash;
+  }
+
+  // True if the sample is the same as in the last exported texture
+  bool isCached() const { return m_isCached; }
+  void setCached(bool state) { m_isCached = state; }
+
   void setSharedBounds(const SampleBoundsPtr& bounds) {
     m_isDuplicated = true;
     m_bounds = bounds;
@@ -142,6 +287,9 @@ private:
   int m_innerPadding;
   SampleBoundsPtr m_bounds;
   bool m_isDuplicated;
+  bool m_isCached;
+  std::string m_cacheKey;
+  std::string m_contentHash;
 };
 
 class DocumentExporter::Samples {
@@ -156,6 +304,13 @@ public:
     m_samples.push_back(sample);
   }
 
+  // Samples ignored because they are empty, they are kept in the
+  // SamplesCache to avoid rendering them again.
+  void addEmptySample(const Sample& sample) {
+    m_emptySamples.push_back(sample);
+  }
+  const List& emptySamples() const { return m_emptySamples; }
+
   iterator begin() { return m_samples.begin(); }
   iterator end() { return m_samples.end(); }
   const_iterator begin() const { return m_samples.begin(); }
@@ -163,6 +318,7 @@ public:
 
 private:
   List m_samples;
+  List m_emptySamples;
 };
 
 class DocumentExporter::LayoutSamples {
@@ -225,8 +381,19 @@ public:
 class DocumentExporter::BestFitLayoutSamples :
     public DocumentExporter::LayoutSamples {
 public:
+  BestFitLayoutSamples(gfx::PackingRects::Heuristic heuristic,
+                       bool allowRotation,
+                       bool powerOfTwo)
+    : m_heuristic(heuristic)
+    , m_allowRotation(allowRotation)
+    , m_powerOfTwo(powerOfTwo) {
+  }
+
   void layoutSamples(Samples& samples, int borderPadding, int shapePadding, int& width, int& height) override {
     gfx::PackingRects pr;
+    pr.setHeuristic(m_heuristic);
+    pr.setAllowRotation(m_allowRotation);
+    pr.setPowerOfTwo(m_powerOfTwo);
 
     for (auto& sample : samples) {
       if (sample.isDuplicated())
@@ -243,24 +410,236 @@ public:
     else
       pr.pack(gfx::Size(width, height));
 
-    auto it = samples.begin();
-    for (auto& rc : pr) {
-      if (it->isDuplicated())
+    int i = 0;
+    for (auto& sample : samples) {
+      if (sample.isDuplicated())
         continue;
 
-      ASSERT(it != samples.end());
-      it->setInTextureBounds(rc);
-      ++it;
+      ASSERT(i < int(pr.size()));
+      sample.setInTextureBounds(pr[i]);
+      sample.setRotated(pr.isRotated(i));
+      ++i;
     }
   }
+
+private:
+  gfx::PackingRects::Heuristic m_heuristic;
+  bool m_allowRotation;
+  bool m_powerOfTwo;
 };
 
+// Keeps the position of the samples that have the same size as in
+// the last exported texture (so unchanged frames keep their texture
+// coordinates), and packs the new samples (or samples with a
+// different size) in the free space. The texture grows (doubling its
+// width or height) if they don't fit and its size isn't fixed.
+class DocumentExporter::CachedLayoutSamples {
+public:
+  CachedLayoutSamples(const SamplesCache& cache,
+                      gfx::PackingRects::Heuristic heuristic,
+                      bool allowRotation,
+                      bool powerOfTwo)
+    : m_cache(cache)
+    , m_heuristic(heuristic)
+    , m_allowRotation(allowRotation)
+    , m_powerOfTwo(powerOfTwo) {
+  }
+
+  // Returns false if no position can be kept or if the changed
+  // samples don't fit in a texture of a fixed size (in that case all
+  // samples must be laid out again).
+  bool layoutSamples(Samples& samples, int borderPadding, int shapePadding, int& width, int& height) {
+    gfx::PackingRects pr;
+    pr.setHeuristic(m_heuristic);
+    pr.setAllowRotation(m_allowRotation);
+
+    std::vector<gfx::Rect> kept;
+    std::vector<Sample*> packed;
+    gfx::Rect used;
+
+    for (auto& sample : samples) {
+      if (sample.isDuplicated())
+        continue;
+
+      const SamplesCache::Entry* entry = m_cache.find(sample.cacheKey());
+      if (entry && !entry->empty) {
+        const gfx::Rect& rc = entry->inTextureBounds;
+        gfx::Size size = sample.requiredSize();
+        if (entry->rotated)
+          std::swap(size.w, size.h);
+
+        bool keep = (rc.getSize() == size);
+        for (const auto& other : kept)
+          if (keep && other.intersects(rc))
+            keep = false;
+
+        if (keep) {
+          sample.setInTextureBounds(rc);
+          sample.setRotated(entry->rotated);
+          kept.push_back(rc);
+          used |= rc;
+          continue;
+        }
+      }
+
+      // The sample must be rendered in its new position
+      sample.setCached(false);
+      packed.push_back(&sample);
+
+      gfx::Size size = sample.requiredSize();
+      pr.add(gfx::Size(size.w+shapePadding, size.h+shapePadding));
+    }
+
+    if (kept.empty())
+      return false;
+
+    // The packing area is inside the border, and the shape padding
+    // is added at the right/bottom side of each rectangle.
+    const bool fixedSize = (width > 0 && height > 0);
+    int w = (width > 0 ? width: m_cache.textureWidth());
+    int h = (height > 0 ? height: m_cache.textureHeight());
+    w = MAX(w, used.x2()+borderPadding);
+    h = MAX(h, used.y2()+borderPadding);
+
+    gfx::PackingRects::Rects occupied;
+    for (const auto& rc : kept)
+      occupied.push_back(gfx::Rect(rc.x-borderPadding, rc.y-borderPadding,
+                                   rc.w+shapePadding, rc.h+shapePadding));
+
+    while (!pr.packAround(gfx::Size(w-2*borderPadding+shapePadding,
+                                     h-2*borderPadding+shapePadding), occupied)) {
+      if (fixedSize || w > kMaxTextureSize || h > kMaxTextureSize)
+        return false;
+
+      if (width > 0)
+        h *= 2;
+      else if (height > 0)
+        w *= 2;
+      else if (w <= h)
+        w *= 2;
+      else
+        h *= 2;
+    }
+
+    for (int i=0; i<int(packed.size()); ++i) {
+      gfx::Rect rc = pr[i];
+      rc.x += borderPadding;
+      rc.y += borderPadding;
+      rc.w -= shapePadding;
+      rc.h -= shapePadding;
+      packed[i]->setInTextureBounds(rc);
+      packed[i]->setRotated(pr.isRotated(i));
+      used |= rc;
+    }
+
+    // Crop the grown sides to the used area
+    if (!fixedSize && !m_powerOfTwo) {
+      if (width == 0) w = MIN(w, MAX(m_cache.textureWidth(), used.x2()+borderPadding));
+      if (height == 0) h = MIN(h, MAX(m_cache.textureHeight(), used.y2()+borderPadding));
+    }
+
+    width = w;
+    height = h;
+    return true;
+  }
+
+private:
+  static const int kMaxTextureSize = 65536;
+
+  const SamplesCache& m_cache;
+  gfx::PackingRects::Heuristic m_heuristic;
+  bool m_allowRotation;
+  bool m_powerOfTwo;
+};
+
+const char* DocumentExporter::SamplesCache::kVersion = "aseprite-sheet-cache 2";
+
+bool DocumentExporter::SamplesCache::load(const std::string& filename, const std::string& options)
+{
+  std::ifstream f(FSTREAM_PATH(filename));
+  std::string line;
+
+  if (!std::getline(f, line) || line != kVersion ||
+      !std::getline(f, line) || line != "options " + options)
+    return false;
+
+  while (std::getline(f, line)) {
+    std::istringstream is(line);
+    std::string type, key;
+    Entry entry;
+
+    is >> type;
+    if (type == "texture") {
+      is >> m_textureWidth >> m_textureHeight >> m_textureHash;
+    }
+    else if (type == "sample") {
+      is >> key >> entry.hash
+         >> entry.trimmedBounds.x >> entry.trimmedBounds.y
+         >> entry.trimmedBounds.w >> entry.trimmedBounds.h
+         >> entry.inTextureBounds.x >> entry.inTextureBounds.y
+         >> entry.inTextureBounds.w >> entry.inTextureBounds.h
+         >> entry.rotated;
+      m_layout.push_back(key);
+    }
+    else if (type == "empty") {
+      is >> key >> entry.hash;
+      entry.empty = true;
+    }
+    else
+      continue;
+
+    if (is.fail()) {
+      m_entries.clear();
+      m_layout.clear();
+      m_textureHash.clear();
+      return false;
+    }
+
+    if (!key.empty())
+      m_entries[key] = entry;
+  }
+  return true;
+}
+
+void DocumentExporter::SamplesCache::save(const std::string& filename, const std::string& options,
+                                          const Samples& samples, int textureWidth, int textureHeight,
+                                          const std::string& textureFilename)
+{
+  std::ofstream f(FSTREAM_PATH(filename), std::ios::out);
+
+  f << kVersion << "\n"
+    << "options " << options << "\n"
+    << "texture " << textureWidth << " " << textureHeight << " "
+    << base::convert_to<std::string>(base::Sha1::calculateFromFile(textureFilename)) << "\n";
+
+  for (const auto& sample : samples) {
+    if (sample.isDuplicated() || sample.cacheKey().empty())
+      continue;
+
+    const gfx::Rect& trimmed = sample.trimmedBounds();
+    const gfx::Rect& inTexture = sample.inTextureBounds();
+    f << "sample " << sample.cacheKey() << " " << sample.contentHash() << " "
+      << trimmed.x << " " << trimmed.y << " " << trimmed.w << " " << trimmed.h << " "
+      << inTexture.x << " " << inTexture.y << " " << inTexture.w << " " << inTexture.h << " "
+      << sample.rotated() << "\n";
+  }
+
+  for (const auto& sample : samples.emptySamples()) {
+    if (!sample.cacheKey().empty())
+      f << "empty " << sample.cacheKey() << " " << sample.contentHash() << "\n";
+  }
+}
+
 DocumentExporter::DocumentExporter()
- : m_dataFormat(DefaultDataFormat)
+ : m_context(nullptr)
+ , m_dataFormat(DefaultDataFormat)
  , m_textureFormat(DefaultTextureFormat)
  , m_textureWidth(0)
  , m_textureHeight(0)
  , m_texturePack(false)
+ , m_textureRotation(false)
+ , m_textureHeuristic(gfx::PackingRects::BottomLeft)
+ , m_texturePowerOfTwo(true)
  , m_scale(1.0)
  , m_scaleMode(DefaultScaleMode)
  , m_ignoreEmptyCels(false)
@@ -268,6 +647,7 @@ DocumentExporter::DocumentExporter()
  , m_shapePadding(0)
  , m_innerPadding(0)
  , m_trimCels(false)
+ , m_useCache(false)
 {
 }
 
@@ -284,19 +664,56 @@ Document* DocumentExporter::exportSheet()
   }
   std::ostream os(osbuf);
 
+  // Load the information of the last exported texture (the cache is
+  // discarded if the options are different).
+  SamplesCache cache;
+  std::string options = optionsKey();
+  bool useCache = (m_useCache && !m_textureFilename.empty());
+  if (useCache)
+    cache.load(cacheFilename(), options);
+
   // Steps for sheet construction:
   // 1) Capture the samples (each sprite+frame pair)
   Samples samples;
-  captureSamples(samples);
+  captureSamples(samples, useCache ? &cache: nullptr);
   if (samples.empty()) {
     Console console;
     console.printf("No documents to export");
     return nullptr;
   }
 
-  // 2) Layout those samples in a texture field.
-  if (m_texturePack) {
-    BestFitLayoutSamples layout;
+  // 2) Layout those samples in a texture field. In packed textures,
+  // samples with the same size as in the cached texture keep their
+  // positions, and the other ones are placed in the free space. If
+  // they don't fit (the texture size is fixed), all samples are
+  // packed again.
+  bool cachedLayout = false;
+  if (useCache && m_texturePack && cache.layoutSize() > 0) {
+    CachedLayoutSamples layout(cache,
+                               m_textureHeuristic,
+                               m_textureRotation,
+                               m_texturePack && m_texturePowerOfTwo);
+    int width = m_textureWidth;
+    int height = m_textureHeight;
+    cachedLayout = layout.layoutSamples(samples,
+      m_borderPadding, m_shapePadding, width, height);
+    if (cachedLayout) {
+      m_textureWidth = width;
+      m_textureHeight = height;
+    }
+    else {
+      PRINTF("Sprite sheet cache: changed samples don't fit in the free space of \"%s\", packing all samples again\n",
+             m_textureFilename.c_str());
+    }
+  }
+
+  if (cachedLayout) {
+    // Done
+  }
+  else if (m_texturePack) {
+    BestFitLayoutSamples layout(m_textureHeuristic,
+                                m_textureRotation,
+                                m_texturePowerOfTwo);
     layout.layoutSamples(samples,
       m_borderPadding, m_shapePadding, m_textureWidth, m_textureHeight);
   }
@@ -304,6 +721,11 @@ Document* DocumentExporter::exportSheet()
     SimpleLayoutSamples layout;
     layout.layoutSamples(samples,
       m_borderPadding, m_shapePadding, m_textureWidth, m_textureHeight);
+
+    // The strip/grid layout is always the same as without cache, we
+    // can only reuse the pixels of samples that keep their slot.
+    if (useCache && cache.layoutSize() > 0)
+      cachedLayout = keepCachedSlots(cache, samples);
   }
 
   // 3) Create and render the texture.
@@ -314,7 +736,10 @@ Document* DocumentExporter::exportSheet()
   Image* textureImage = texture->folder()->getFirstLayer()
     ->cel(frame_t(0))->image();
 
-  renderTexture(samples, textureImage);
+  // If samples kept their positions, we can copy them from the last
+  // texture and render only the samples that have changed.
+  bool restored = (cachedLayout && restoreTexture(cache, samples, textureImage));
+  renderTexture(samples, textureImage, restored);
 
   // Save the metadata.
   createDataFile(samples, os, textureImage);
@@ -322,15 +747,41 @@ Document* DocumentExporter::exportSheet()
   // Save the image files.
   if (!m_textureFilename.empty()) {
     textureDocument->setFilename(m_textureFilename.c_str());
-    int ret = save_document(UIContext::instance(), textureDocument.get());
-    if (ret == 0)
+
+    // The texture is the same if all samples of the last texture
+    // are in the same position (and nothing else was added).
+    int cachedSamples = 0;
+    bool modified = (!restored ||
+                     textureImage->width() != cache.textureWidth() ||
+                     textureImage->height() != cache.textureHeight());
+    for (const auto& sample : samples) {
+      if (sample.isDuplicated())
+        continue;
+      if (sample.isCached())
+        ++cachedSamples;
+      else
+        modified = true;
+    }
+    if (cachedSamples != cache.layoutSize())
+      modified = true;
+
+    if (modified) {
+      int ret = save_document(context(), textureDocument.get());
+      if (ret == 0)
+        textureDocument->markAsSaved();
+    }
+    else
       textureDocument->markAsSaved();
+
+    if (useCache)
+      cache.save(cacheFilename(), options, samples,
+                 m_textureWidth, m_textureHeight, m_textureFilename);
   }
 
   return textureDocument.release();
 }
 
-void DocumentExporter::captureSamples(Samples& samples)
+void DocumentExporter::captureSamples(Samples& samples, const SamplesCache* cache)
 {
   for (auto& item : m_documents) {
     Document* doc = item.doc;
@@ -392,6 +843,27 @@ void DocumentExporter::captureSamples(Samples& samples)
         ASSERT(done);
       }
 
+      // Re-use samples from the cache that have the same content
+      if (!done && cache) {
+        sample.setCacheKey(
+          sample_cache_key(doc->filename(), layer, frame),
+          sample_content_hash(sprite, layer, frame));
+
+        const SamplesCache::Entry* entry = cache->find(sample.cacheKey());
+        if (entry && entry->hash == sample.contentHash()) {
+          if (entry->empty) {
+            samples.addEmptySample(sample);
+            continue;
+          }
+
+          if (m_trimCels)
+            sample.setTrimmedBounds(entry->trimmedBounds);
+
+          sample.setCached(true);
+          done = true;
+        }
+      }
+
       if (!done && (m_ignoreEmptyCels || m_trimCels)) {
         // Ignore empty cels
         if (layer && layer->isImage() && !cel)
@@ -428,6 +900,7 @@ void DocumentExporter::captureSamples(Samples& samples)
         if (!algorithm::shrink_bounds(sampleRender, frameBounds, refColor)) {
           // If shrink_bounds() returns false, it's because the whole
           // image is transparent (equal to the mask color).
+          samples.addEmptySample(sample);
           continue;
         }
 
@@ -484,26 +957,111 @@ Document* DocumentExporter::createEmptyTexture(const Samples& samples)
   return document.release();
 }
 
-void DocumentExporter::renderTexture(const Samples& samples, Image* textureImage)
+// Marks as changed the cached samples that aren't in the same position
+// as in the cached texture. Returns true if some sample can be copied
+// from the cached texture.
+bool DocumentExporter::keepCachedSlots(const SamplesCache& cache, Samples& samples)
 {
+  bool kept = false;
+  for (auto& sample : samples) {
+    if (sample.isDuplicated() || !sample.isCached())
+      continue;
+
+    const SamplesCache::Entry* entry = cache.find(sample.cacheKey());
+    if (entry && !entry->empty && !entry->rotated &&
+        entry->inTextureBounds == sample.inTextureBounds())
+      kept = true;
+    else
+      sample.setCached(false);
+  }
+  return kept;
+}
+
+bool DocumentExporter::restoreTexture(const SamplesCache& cache, const Samples& samples, Image* textureImage)
+{
+  // The texture file must be the same that was saved with the cache
+  if (cache.textureHash().empty() ||
+      !base::is_file(m_textureFilename) ||
+      base::convert_to<std::string>(base::Sha1::calculateFromFile(m_textureFilename))
+        != cache.textureHash())
+    return false;
+
+  base::UniquePtr<Document> oldTexture(load_document(nullptr, m_textureFilename.c_str()));
+  if (!oldTexture)
+    return false;
+
+  Sprite* oldSprite = oldTexture->sprite();
+  Layer* oldLayer = oldSprite->folder()->getFirstLayer();
+  Cel* oldCel = (oldLayer ? oldLayer->cel(frame_t(0)): nullptr);
+  if (!oldCel ||
+      oldCel->position() != gfx::Point(0, 0) ||
+      oldCel->image()->pixelFormat() != textureImage->pixelFormat())
+    return false;
+
+  // Copy only the samples that didn't change (the texture could have
+  // a different size, and the space of removed samples must be
+  // empty).
+  const Image* oldImage = oldCel->image();
   textureImage->clear(0);
+  for (const auto& sample : samples) {
+    if (sample.isDuplicated() || !sample.isCached())
+      continue;
+
+    const gfx::Rect& rc = sample.inTextureBounds();
+    if (!oldImage->bounds().contains(rc))
+      return false;
+
+    textureImage->copy(oldImage, gfx::Clip(rc.x, rc.y, rc));
+  }
+  return true;
+}
+
+void DocumentExporter::renderTexture(const Samples& samples, Image* textureImage, bool onlyChangedSamples)
+{
+  if (!onlyChangedSamples)
+    textureImage->clear(0);
 
   for (const auto& sample : samples) {
     if (sample.isDuplicated())
       continue;
 
+    if (onlyChangedSamples) {
+      if (sample.isCached())
+        continue;
+
+      fill_rect(textureImage, sample.inTextureBounds(), 0);
+    }
+
     // Make the sprite compatible with the texture so the render()
     // works correctly.
     if (sample.sprite()->pixelFormat() != textureImage->pixelFormat()) {
       cmd::SetPixelFormat(
         sample.sprite(),
         textureImage->pixelFormat(),
-        DitheringMethod::NONE).execute(UIContext::instance());
+        DitheringMethod::NONE).execute(context());
     }
 
-    renderSample(sample, textureImage,
-      sample.inTextureBounds().x+m_innerPadding,
-      sample.inTextureBounds().y+m_innerPadding);
+    if (sample.rotated()) {
+      // Render the sample in a temporary image to copy it rotated 90
+      // degrees clockwise in the texture.
+      const gfx::Rect& trimmed = sample.trimmedBounds();
+      base::UniquePtr<Image> sampleRender(
+        Image::create(textureImage->pixelFormat(), trimmed.w, trimmed.h));
+      base::UniquePtr<Image> rotatedRender(
+        Image::create(textureImage->pixelFormat(), trimmed.h, trimmed.w));
+
+      sampleRender->clear(0);
+      renderSample(sample, sampleRender, 0, 0);
+      rotate_image(sampleRender, rotatedRender, 90);
+      copy_image(textureImage, rotatedRender,
+        sample.inTextureBounds().x+m_innerPadding,
+        sample.inTextureBounds().y+m_innerPadding);
+    }
+    else {
+      renderSample(sample, textureImage,
+        sample.inTextureBounds().x+m_innerPadding,
+        sample.inTextureBounds().y+m_innerPadding);
+    }
   }
 }
 
@@ -539,6 +1097,10 @@ void DocumentExporter::createDataFile(const Samples& samples, std::ostream& os,
     gfx::Rect spriteSourceBounds = sample.trimmedBounds();
     gfx::Rect frameBounds = sample.inTextureBounds();
 
+    // The size of a rotated frame is the size before rotating it.
+    if (sample.rotated())
+      std::swap(frameBounds.w, frameBounds.h);
+
     if (filename_as_key)
       os << "   \"" << escape_path_for_json(sample.filename()) << "\": {\n";
     else if (filename_as_attr)
@@ -550,7 +1112,7 @@ void DocumentExporter::createDataFile(const Samples& samples, std::ostream& os,
        << "\"y\": " << frameBounds.y << ", "
        << "\"w\": " << frameBounds.w << ", "
        << "\"h\": " << frameBounds.h << " },\n"
-       << "    \"rotated\": false,\n"
+       << "    \"rotated\": " << (sample.rotated() ? "true": "false") << ",\n"
        << "    \"trimmed\": " << (sample.trimmed() ? "true": "false") << ",\n"
        << "    \"spriteSourceSize\": { "
        << "\"x\": " << spriteSourceBounds.x << ", "
@@ -584,6 +1146,35 @@ void DocumentExporter::createDataFile(const Samples& samples, std::ostream& os,
      << "}\n";
 }
 
+std::string DocumentExporter::optionsKey() const
+{
+  // Options that modify the layout of the texture
+  std::ostringstream os;
+  os << m_textureWidth << ","
+     << m_textureHeight << ","
+     << m_texturePack << ","
+     << m_textureRotation << ","
+     << m_textureHeuristic << ","
+     << m_texturePowerOfTwo << ","
+     << m_scale << ","
+     << m_ignoreEmptyCels << ","
+     << m_borderPadding << ","
+     << m_shapePadding << ","
+     << m_innerPadding << ","
+     << m_trimCels;
+  return os.str();
+}
+
+std::string DocumentExporter::cacheFilename() const
+{
+  return m_textureFilename + ".cache";
+}
+
+Context* DocumentExporter::context() const
+{
+  return (m_context ? m_context: UIContext::instance());
+}
+
 void DocumentExporter::renderSample(const Sample& sample, doc::Image* dst, int x, int y)
 {
   render::Render render;
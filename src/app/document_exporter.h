@@ -12,6 +12,7 @@
 #include "base/disable_copying.h"
 #include "doc/image_buffer.h"
 #include "gfx/fwd.h"
+#include "gfx/packing_rects.h"
 
 #include <iosfwd>
 #include <string>
@@ -23,6 +24,7 @@ namespace doc {
 }
 
 namespace app {
+  class Context;
   class Document;
 
   class DocumentExporter {
@@ -44,6 +46,8 @@ namespace app {
 
     DocumentExporter();
 
+    // Context used to save the texture (by default the UIContext)
+    void setContext(Context* context) { m_context = context; }
     void setDataFormat(DataFormat format) { m_dataFormat = format; }
     void setDataFilename(const std::string& filename) { m_dataFilename = filename; }
     void setTextureFormat(TextureFormat format) { m_textureFormat = format; }
@@ -51,6 +55,9 @@ namespace app {
     void setTextureWidth(int width) { m_textureWidth = width; }
     void setTextureHeight(int height) { m_textureHeight = height; }
     void setTexturePack(bool state) { m_texturePack = state; }
+    void setTextureRotation(bool state) { m_textureRotation = state; }
+    void setTextureHeuristic(gfx::PackingRects::Heuristic heuristic) { m_textureHeuristic = heuristic; }
+    void setTexturePowerOfTwo(bool state) { m_texturePowerOfTwo = state; }
     void setScale(double scale) { m_scale = scale; }
     void setScaleMode(ScaleMode mode) { m_scaleMode = mode; }
     void setIgnoreEmptyCels(bool ignore) { m_ignoreEmptyCels = ignore; }
@@ -60,6 +67,13 @@ namespace app {
     void setTrimCels(bool trim) { m_trimCels = trim; }
     void setFilenameFormat(const std::string& format) { m_filenameFormat = format; }
 
+    // Keeps information about the exported samples in a file next to
+    // the texture (textureFilename + ".cache"), so the next export
+    // only renders the frames that have changed. Unchanged frames
+    // keep their position in the texture (unless the changed ones
+    // don't fit in a texture of a fixed size).
+    void setUseCache(bool state) { m_useCache = state; }
+
     void addDocument(Document* document, doc::Layer* layer = NULL) {
       m_documents.push_back(Item(document, layer));
     }
@@ -72,12 +86,19 @@ namespace app {
     class LayoutSamples;
     class SimpleLayoutSamples;
     class BestFitLayoutSamples;
+    class CachedLayoutSamples;
+    class SamplesCache;
 
-    void captureSamples(Samples& samples);
+    void captureSamples(Samples& samples, const SamplesCache* cache);
     Document* createEmptyTexture(const Samples& samples);
-    void renderTexture(const Samples& samples, doc::Image* textureImage);
+    bool keepCachedSlots(const SamplesCache& cache, Samples& samples);
+    bool restoreTexture(const SamplesCache& cache, const Samples& samples, doc::Image* textureImage);
+    void renderTexture(const Samples& samples, doc::Image* textureImage, bool onlyChangedSamples);
     void createDataFile(const Samples& samples, std::ostream& os, doc::Image* textureImage);
     void renderSample(const Sample& sample, doc::Image* dst, int x, int y);
+    std::string optionsKey() const;
+    std::string cacheFilename() const;
+    Context* context() const;
 
     class Item {
     public:
@@ -89,6 +110,7 @@ namespace app {
     };
     typedef std::vector<Item> Items;
 
+    Context* m_context;
     DataFormat m_dataFormat;
     std::string m_dataFilename;
     TextureFormat m_textureFormat;
@@ -96,6 +118,9 @@ namespace app {
     int m_textureWidth;
     int m_textureHeight;
     bool m_texturePack;
+    bool m_textureRotation;
+    gfx::PackingRects::Heuristic m_textureHeuristic;
+    bool m_texturePowerOfTwo;
     double m_scale;
     ScaleMode m_scaleMode;
     bool m_ignoreEmptyCels;
@@ -103,6 +128,7 @@ namespace app {
     int m_shapePadding;
     int m_innerPadding;
     bool m_trimCels;
+    bool m_useCache;
     Items m_documents;
     std::string m_filenameFormat;
     doc::ImageBufferPtr m_sampleRenderBuf;
@@ -0,0 +1,206 @@
+// Aseprite
+// Copyright (C) 2001-2015  David Capello
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#include "tests/test.h"
+
+#include "app/context.h"
+#include "app/document.h"
+#include "app/document_exporter.h"
+#include "app/file/file_formats_manager.h"
+#include "base/fs.h"
+#include "base/unique_ptr.h"
+#include "doc/doc.h"
+#include "doc/test_context.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace app;
+using namespace doc;
+
+class DocumentExporterCache : public ::testing::Test {
+public:
+  DocumentExporterCache() : m_doc(nullptr) {
+    FileFormatsManager::instance()->registerAllFormats();
+  }
+
+  ~DocumentExporterCache() {
+    if (m_doc) {
+      m_doc->close();
+      delete m_doc;
+    }
+    for (const char* fn : { kTexture, kData, kCache })
+      if (base::is_file(fn))
+        base::delete_file(fn);
+  }
+
+protected:
+  static const char* kTexture;
+  static const char* kData;
+  static const char* kCache;
+
+  // Creates a sprite with a square of the given size in each frame
+  void createSprite(const std::vector<int>& sizes) {
+    m_doc = static_cast<app::Document*>(
+      m_ctx.documents().add(64, 64, doc::ColorMode::RGB, 256));
+    Sprite* sprite = m_doc->sprite();
+    sprite->setTotalFrames(frame_t(sizes.size()));
+
+    LayerImage* layer = static_cast<LayerImage*>(sprite->folder()->getFirstLayer());
+    for (frame_t f(1); f<frame_t(sizes.size()); ++f)
+      layer->addCel(new Cel(f, ImageRef(Image::create(IMAGE_RGB, 64, 64))));
+
+    // Each frame has a different color, so there are no duplicates
+    for (frame_t f(0); f<frame_t(sizes.size()); ++f)
+      drawSquare(f, sizes[f], rgba(255, 16*f, 0, 255));
+  }
+
+  void drawSquare(frame_t frame, int size, color_t color) {
+    Image* image = m_doc->sprite()->folder()->getFirstLayer()->cel(frame)->image();
+    clear_image(image, 0);
+    fill_rect(image, 2, 2, 2+size-1, 2+size-1, color);
+  }
+
+  // Exports the sprite and returns the texture bounds of each frame
+  // (read from the data file).
+  std::vector<gfx::Rect> exportSheet(bool pack = true) {
+    DocumentExporter exporter;
+    exporter.setContext(&m_ctx);
+    exporter.setTextureFilename(kTexture);
+    exporter.setDataFilename(kData);
+    exporter.setDataFormat(DocumentExporter::JsonArrayDataFormat);
+    exporter.setTexturePack(pack);
+    exporter.setTrimCels(true);
+    exporter.setUseCache(true);
+    exporter.addDocument(m_doc);
+
+    base::UniquePtr<app::Document> texture(exporter.exportSheet());
+    EXPECT_TRUE(texture != nullptr);
+    if (texture)
+      m_textureSize = texture->sprite()->bounds().getSize();
+
+    std::ifstream f(kData);
+    std::stringstream data;
+    data << f.rdbuf();
+
+    std::vector<gfx::Rect> frames;
+    std::string str = data.str();
+    std::size_t pos = 0;
+    while ((pos = str.find("\"frame\": {", pos)) != std::string::npos) {
+      gfx::Rect rc;
+      EXPECT_EQ(4, std::sscanf(str.c_str()+pos,
+                               "\"frame\": { \"x\": %d, \"y\": %d, \"w\": %d, \"h\": %d",
+                               &rc.x, &rc.y, &rc.w, &rc.h));
+      frames.push_back(rc);
+      ++pos;
+    }
+    return frames;
+  }
+
+  static void expectNoOverlap(const std::vector<gfx::Rect>& frames) {
+    for (std::size_t i=0; i<frames.size(); ++i)
+      for (std::size_t j=i+1; j<frames.size(); ++j)
+        EXPECT_FALSE(frames[i].intersects(frames[j])) << i << " and " << j;
+  }
+
+  doc::TestContextT<app::Context> m_ctx;
+  app::Document* m_doc;
+  gfx::Size m_textureSize;
+};
+
+const char* DocumentExporterCache::kTexture = "test_sheet.png";
+const char* DocumentExporterCache::kData = "test_sheet.json";
+const char* DocumentExporterCache::kCache = "test_sheet.png.cache";
+
+TEST_F(DocumentExporterCache, SameFrames)
+{
+  createSprite({ 8, 12, 6, 10, 9 });
+
+  std::vector<gfx::Rect> before = exportSheet();
+  ASSERT_EQ(5, int(before.size()));
+  EXPECT_TRUE(base::is_file(kCache));
+
+  std::vector<gfx::Rect> after = exportSheet();
+  ASSERT_EQ(before.size(), after.size());
+  for (std::size_t i=0; i<before.size(); ++i)
+    EXPECT_EQ(before[i], after[i]) << "frame " << i;
+}
+
+TEST_F(DocumentExporterCache, ChangedFrameKeepsOtherFrames)
+{
+  createSprite({ 8, 12, 6, 10, 9 });
+
+  std::vector<gfx::Rect> before = exportSheet();
+  ASSERT_EQ(5, int(before.size()));
+
+  // Same size and different color, it keeps its position too
+  drawSquare(frame_t(0), 8, rgba(0, 0, 255, 255));
+  // Different size
+  drawSquare(frame_t(2), 7, rgba(0, 255, 0, 255));
+
+  std::vector<gfx::Rect> after = exportSheet();
+  ASSERT_EQ(5, int(after.size()));
+  for (int i : { 0, 1, 3, 4 })
+    EXPECT_EQ(before[i], after[i]) << "frame " << i;
+
+  EXPECT_EQ(gfx::Size(7, 7), after[2].getSize());
+  expectNoOverlap(after);
+}
+
+TEST_F(DocumentExporterCache, ChangedFrameGrowsTexture)
+{
+  createSprite({ 8, 8, 8, 8 });
+
+  std::vector<gfx::Rect> before = exportSheet();
+  ASSERT_EQ(4, int(before.size()));
+  gfx::Size oldSize = m_textureSize;
+
+  drawSquare(frame_t(1), 40, rgba(0, 255, 0, 255));
+
+  std::vector<gfx::Rect> after = exportSheet();
+  ASSERT_EQ(4, int(after.size()));
+  for (int i : { 0, 2, 3 })
+    EXPECT_EQ(before[i], after[i]) << "frame " << i;
+
+  EXPECT_EQ(gfx::Size(40, 40), after[1].getSize());
+  EXPECT_TRUE(m_textureSize.w > oldSize.w ||
+              m_textureSize.h > oldSize.h);
+  expectNoOverlap(after);
+  for (const auto& rc : after)
+    EXPECT_TRUE(gfx::Rect(m_textureSize).contains(rc));
+}
+
+TEST_F(DocumentExporterCache, ChangedFrameInStrip)
+{
+  createSprite({ 8, 12, 6, 10, 9 });
+
+  std::vector<gfx::Rect> before = exportSheet(false);
+  ASSERT_EQ(5, int(before.size()));
+
+  drawSquare(frame_t(2), 7, rgba(0, 255, 0, 255));
+
+  // Frames keep the strip order (the next frames are moved), so the
+  // result is the same as exporting without cache.
+  std::vector<gfx::Rect> after = exportSheet(false);
+  ASSERT_EQ(5, int(after.size()));
+  EXPECT_EQ(before[0], after[0]);
+  EXPECT_EQ(before[1], after[1]);
+  EXPECT_EQ(gfx::Size(7, 7), after[2].getSize());
+  for (int i=1; i<5; ++i) {
+    EXPECT_EQ(after[i-1].y, after[i].y);
+    EXPECT_EQ(after[i-1].x2(), after[i].x);
+  }
+
+  base::delete_file(kCache);
+  std::vector<gfx::Rect> uncached = exportSheet(false);
+  ASSERT_EQ(5, int(uncached.size()));
+  for (int i=0; i<5; ++i)
+    EXPECT_EQ(uncached[i], after[i]) << "frame " << i;
+}
@@ -14,13 +14,16 @@
 #include "app/app.h"
 #include "app/cmd.h"
 #include "app/cmd_transaction.h"
+#include "app/document.h"
 #include "app/pref/preferences.h"
 #include "doc/context.h"
 #include "undo/undo_history.h"
 #include "undo/undo_state.h"
 
+#include <algorithm>
 #include <cassert>
 #include <stdexcept>
+#include <vector>
 
 namespace app {
 
@@ -47,6 +50,12 @@ void DocumentUndo::add(CmdTransaction* cmd)
   }
 
   m_undoHistory.add(cmd);
+
+  if (App::instance()) {
+    Preferences& pref = App::instance()->preferences();
+    limitMemSize(size_t(pref.undo.sizeLimit()) * 1024 * 1024,
+                 size_t(pref.undo.totalSizeLimit()) * 1024 * 1024);
+  }
 }
 
 bool DocumentUndo::canUndo() const
@@ -74,6 +83,11 @@ void DocumentUndo::clearRedo()
   return m_undoHistory.clearRedo();
 }
 
+size_t DocumentUndo::memSize() const
+{
+  return m_undoHistory.memSize();
+}
+
 bool DocumentUndo::isSavedState() const
 {
   return (!m_savedStateIsLost && m_savedCounter == 0);
@@ -151,4 +165,43 @@ const undo::UndoState* DocumentUndo::nextRedo() const
     return m_undoHistory.firstState();
 }
 
+// Deletes the oldest undo states until this history uses less than
+// "limit" bytes, and the histories of all documents in the context
+// use less than "totalLimit" bytes (in this case the states are
+// deleted from the biggest history first). A limit of 0 means that
+// there is no limit.
+void DocumentUndo::limitMemSize(size_t limit, size_t totalLimit)
+{
+  while (limit > 0 && m_undoHistory.memSize() > limit) {
+    if (!m_undoHistory.deleteFirstState())
+      break;
+  }
+
+  if (!m_ctx || totalLimit == 0)
+    return;
+
+  std::vector<DocumentUndo*> histories;
+  size_t total = 0;
+  for (doc::Document* doc : m_ctx->documents()) {
+    DocumentUndo* undo = static_cast<app::Document*>(doc)->undoHistory();
+    histories.push_back(undo);
+    total += undo->memSize();
+  }
+
+  while (total > totalLimit && !histories.empty()) {
+    auto it = std::max_element(
+      histories.begin(), histories.end(),
+      [](const DocumentUndo* a, const DocumentUndo* b) {
+        return a->memSize() < b->memSize();
+      });
+
+    DocumentUndo* undo = *it;
+    size_t oldSize = undo->memSize();
+    if (undo->m_undoHistory.deleteFirstState())
+      total -= oldSize - undo->memSize();
+    else
+      histories.erase(it);
+  }
+}
+
 } // namespace app
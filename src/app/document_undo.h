@@ -41,6 +41,9 @@ namespace app {
 
     void clearRedo();
 
+    // Memory used by the undo information (in bytes).
+    size_t memSize() const;
+
     bool isSavedState() const;
     void markSavedState();
     void impossibleToBackToSavedState();
@@ -58,6 +61,7 @@ namespace app {
   private:
     const undo::UndoState* nextUndo() const;
     const undo::UndoState* nextRedo() const;
+    void limitMemSize(size_t limit, size_t totalLimit);
 
     undo::UndoHistory m_undoHistory;
     doc::Context* m_ctx;
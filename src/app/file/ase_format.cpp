@@ -9,17 +9,26 @@
 #include "config.h"
 #endif
 
+#include "app/app.h"
 #include "app/document.h"
+#include "app/file/ase_options.h"
 #include "app/file/file.h"
 #include "app/file/file_format.h"
 #include "app/file/format_options.h"
+#include "app/ini_file.h"
 #include "base/cfile.h"
 #include "base/exception.h"
 #include "base/file_handle.h"
+#include "base/mutex.h"
+#include "base/scoped_lock.h"
+#include "base/thread.h"
+#include "base/thread_pool.h"
+#include "base/unique_ptr.h"
 #include "doc/doc.h"
 #include "zlib.h"
 
 #include <stdio.h>
+#include <vector>
 
 #define ASE_FILE_MAGIC                  0xA5E0
 #define ASE_FILE_FRAME_MAGIC            0xF1FA
@@ -77,6 +86,9 @@ struct ASE_Chunk {
   int start;
 };
 
+class CompressedCelsDecoder;
+class CompressedCelsEncoder;
+
 static bool ase_file_read_header(FILE* f, ASE_Header* header);
 static void ase_file_prepare_header(FILE* f, ASE_Header* header, const Sprite* sprite);
 static void ase_file_write_header(FILE* f, ASE_Header* header);
@@ -87,7 +99,7 @@ static void ase_file_prepare_frame_header(FILE* f, ASE_FrameHeader* frame_header
 static void ase_file_write_frame_header(FILE* f, ASE_FrameHeader* frame_header);
 
 static void ase_file_write_layers(FILE* f, ASE_FrameHeader* frame_header, Layer* layer);
-static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, Sprite* sprite, Layer* layer, frame_t frame);
+static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, Sprite* sprite, Layer* layer, frame_t frame, CompressedCelsEncoder* encoder);
 
 static void ase_file_read_padding(FILE* f, int bytes);
 static void ase_file_write_padding(FILE* f, int bytes);
@@ -102,8 +114,8 @@ static Palette* ase_file_read_color2_chunk(FILE* f, Sprite* sprite, frame_t fram
 static void ase_file_write_color2_chunk(FILE* f, ASE_FrameHeader* frame_header, Palette* pal);
 static Layer* ase_file_read_layer_chunk(FILE* f, Sprite* sprite, Layer** previous_layer, int* current_level);
 static void ase_file_write_layer_chunk(FILE* f, ASE_FrameHeader* frame_header, Layer* layer);
-static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, frame_t frame, PixelFormat pixelFormat, FileOp* fop, ASE_Header* header, size_t chunk_end);
-static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header, Cel* cel, LayerImage* layer, Sprite* sprite);
+static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, frame_t frame, PixelFormat pixelFormat, FileOp* fop, ASE_Header* header, size_t chunk_end, CompressedCelsDecoder* decoder);
+static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header, Cel* cel, LayerImage* layer, Sprite* sprite, CompressedCelsEncoder* encoder);
 static Mask* ase_file_read_mask_chunk(FILE* f);
 #if 0
 static void ase_file_write_mask_chunk(FILE* f, ASE_FrameHeader* frame_header, Mask* mask);
@@ -126,6 +138,78 @@ private:
   ASE_Chunk m_chunk;
 };
 
+// Inflates the pixels of compressed cels in worker threads, so the
+// main thread can continue reading the file (layers, cels, palettes,
+// etc.) meanwhile.
+class CompressedCelsDecoder {
+public:
+  CompressedCelsDecoder(FileOp* fop, int maxThreads);
+  ~CompressedCelsDecoder();
+
+  // Adds the compressed pixels of "image" to be decoded. The image
+  // must be alive until the job is finished (e.g. it's in the
+  // sprite). "data" is swapped with an empty vector.
+  void add(Image* image, std::vector<uint8_t>& data);
+
+  // Decodes all pending images (the caller thread helps the
+  // workers), reporting the progress of the whole file operation.
+  void waitPendingJobs(size_t fileSize, size_t readBytes);
+
+  // Progress of the whole load process: half for reading the file,
+  // and half for decoding images.
+  double progress(size_t fileSize, size_t readBytes) const;
+
+private:
+  struct Job {
+    Image* image;
+    std::vector<uint8_t> data;
+    base::ThreadPool::TaskRef task;
+  };
+
+  void decodeJob(Job* job);
+
+  FileOp* m_fop;
+  int m_maxThreads;
+  std::vector<Job*> m_jobs;
+  size_t m_nextWait;            // Next job to be waited
+  mutable base::mutex m_mutex;
+  size_t m_decodedBytes;
+  base::UniquePtr<base::ThreadPool> m_pool;
+};
+
+// Compresses the images of all cels in worker threads. The main
+// thread writes the compressed data in the same order as the cel
+// chunks are saved in the file, so the output is exactly the same
+// as compressing each image when its chunk is written.
+class CompressedCelsEncoder {
+public:
+  CompressedCelsEncoder(Sprite* sprite, int level, int maxThreads);
+  ~CompressedCelsEncoder();
+
+  // Writes the compressed pixels of the given cel (it must be the
+  // next compressed cel in the file order).
+  void writeCompressedImage(FILE* f, Cel* cel);
+
+private:
+  struct Job {
+    Cel* cel;
+    Image* image;
+    std::vector<uint8_t> data;
+    base::ThreadPool::TaskRef task;
+  };
+
+  void addCels(Layer* layer, frame_t frame);
+  void addPendingJobs();
+  void compressJob(Job* job);
+  static void writeData(FILE* f, const std::vector<uint8_t>& data);
+
+  int m_level;
+  std::vector<Job> m_jobs;
+  size_t m_nextJob;             // Next job to be added to the pool
+  size_t m_nextWrite;           // Next job to be written in the file
+  base::UniquePtr<base::ThreadPool> m_pool;
+};
+
 class AseFormat : public FileFormat {
   const char* onGetName() const { return "ase"; }
   const char* onGetExtensions() const { return "ase,aseprite"; }
@@ -141,13 +225,16 @@ class AseFormat : public FileFormat {
       FILE_SUPPORT_LAYERS |
       FILE_SUPPORT_FRAMES |
       FILE_SUPPORT_PALETTES |
-      FILE_SUPPORT_FRAME_TAGS;
+      FILE_SUPPORT_FRAME_TAGS |
+      FILE_SUPPORT_GET_FORMAT_OPTIONS;
   }
 
   bool onLoad(FileOp* fop) override;
 #ifdef ENABLE_SAVE
   bool onSave(FileOp* fop) override;
 #endif
+
+  base::SharedPtr<FormatOptions> onGetFormatOptions(FileOp* fop) override;
 };
 
 FileFormat* CreateAseFormat()
@@ -182,11 +269,19 @@ bool AseFormat::onLoad(FileOp* fop)
   Layer* last_layer = sprite->folder();
   int current_level = -1;
 
+  // Number of threads to decode images (the main thread included)
+  int maxThreads = int(base::thread::hardware_concurrency());
+  if (AseOptions* ase_options = dynamic_cast<AseOptions*>(fop->seq.format_options.get()))
+    maxThreads = ase_options->maxThreads();
+
+  // It's destroyed (and its threads are joined) before the sprite
+  CompressedCelsDecoder decoder(fop, maxThreads);
+
   /* read frame by frame to end-of-file */
   for (frame_t frame(0); frame<sprite->totalFrames(); ++frame) {
     /* start frame position */
     int frame_pos = ftell(f);
-    fop_progress(fop, (float)frame_pos / (float)header.size);
+    fop_progress(fop, decoder.progress(header.size, frame_pos));
 
     /* read frame header */
     ASE_FrameHeader frame_header;
@@ -202,7 +297,7 @@ bool AseFormat::onLoad(FileOp* fop)
       for (int c=0; c<frame_header.chunks; c++) {
         /* start chunk position */
         int chunk_pos = ftell(f);
-        fop_progress(fop, (float)chunk_pos / (float)header.size);
+        fop_progress(fop, decoder.progress(header.size, chunk_pos));
 
         // Read chunk information
         int chunk_size = fgetl(f);
@@ -240,7 +335,7 @@ bool AseFormat::onLoad(FileOp* fop)
 
             ase_file_read_cel_chunk(f, sprite, frame,
                                     sprite->pixelFormat(), fop, &header,
-                                    chunk_pos+chunk_size);
+                                    chunk_pos+chunk_size, &decoder);
             break;
           }
 
@@ -287,6 +382,8 @@ bool AseFormat::onLoad(FileOp* fop)
       break;
   }
 
+  decoder.waitPendingJobs(header.size, ftell(f));
+
   fop->createDocument(sprite);
   sprite.release();
 
@@ -306,6 +403,19 @@ bool AseFormat::onSave(FileOp* fop)
   FileHandle handle(open_file_with_exception(fop->filename, "wb"));
   FILE* f = handle.get();
 
+  // Compression level of cel images and threads to compress them
+  int level = Z_DEFAULT_COMPRESSION;
+  int maxThreads = int(base::thread::hardware_concurrency());
+  if (AseOptions* ase_options = dynamic_cast<AseOptions*>(fop->seq.format_options.get())) {
+    maxThreads = ase_options->maxThreads();
+    switch (ase_options->compression()) {
+      case AseOptions::FastCompression: level = Z_BEST_SPEED; break;
+      case AseOptions::SmallCompression: level = Z_BEST_COMPRESSION; break;
+      default: break;
+    }
+  }
+  CompressedCelsEncoder encoder(sprite, level, maxThreads);
+
   // Write the header
   ASE_Header header;
   ase_file_prepare_header(f, &header, sprite);
@@ -342,7 +452,7 @@ bool AseFormat::onSave(FileOp* fop)
     }
 
     // Write cel chunks
-    ase_file_write_cels(f, &frame_header, sprite, sprite->folder(), frame);
+    ase_file_write_cels(f, &frame_header, sprite, sprite->folder(), frame, &encoder);
 
     // Write the frame header
     ase_file_write_frame_header(f, &frame_header);
@@ -368,6 +478,19 @@ bool AseFormat::onSave(FileOp* fop)
 }
 #endif
 
+base::SharedPtr<FormatOptions> AseFormat::onGetFormatOptions(FileOp* fop)
+{
+  base::SharedPtr<AseOptions> ase_options(new AseOptions);
+
+  // Configuration parameters
+  if (App::instance())
+    ase_options->setCompression(
+      (AseOptions::Compression)get_config_int("ASE", "Compression",
+                                              (int)ase_options->compression()));
+
+  return ase_options;
+}
+
 static bool ase_file_read_header(FILE* f, ASE_Header* header)
 {
   header->pos = ftell(f);
@@ -505,7 +628,7 @@ static void ase_file_write_layers(FILE* f, ASE_FrameHeader* frame_header, Layer*
   }
 }
 
-static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, Sprite* sprite, Layer* layer, frame_t frame)
+static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, Sprite* sprite, Layer* layer, frame_t frame, CompressedCelsEncoder* encoder)
 {
   if (layer->isImage()) {
     Cel* cel = layer->cel(frame);
@@ -513,7 +636,7 @@ static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, Sprite*
 /*       fop_error(fop, "New cel in frame %d, in layer %d\n", */
 /*                   frame, sprite_layer2index(sprite, layer)); */
 
-      ase_file_write_cel_chunk(f, frame_header, cel, static_cast<LayerImage*>(layer), sprite);
+      ase_file_write_cel_chunk(f, frame_header, cel, static_cast<LayerImage*>(layer), sprite, encoder);
     }
   }
 
@@ -522,7 +645,7 @@ static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, Sprite*
     LayerIterator end = static_cast<LayerFolder*>(layer)->getLayerEnd();
 
     for (; it != end; ++it)
-      ase_file_write_cels(f, frame_header, sprite, *it, frame);
+      ase_file_write_cels(f, frame_header, sprite, *it, frame, encoder);
   }
 }
 
@@ -883,7 +1006,7 @@ static void write_raw_image(FILE* f, Image* image)
 //////////////////////////////////////////////////////////////////////
 
 template<typename ImageTraits>
-static void read_compressed_image(FILE* f, Image* image, size_t chunk_end, FileOp* fop, ASE_Header* header)
+static void decode_compressed_image(const std::vector<uint8_t>& data, Image* image)
 {
   PixelIO<ImageTraits> pixel_io;
   z_stream zstream;
@@ -897,52 +1020,38 @@ static void read_compressed_image(FILE* f, Image* image, size_t chunk_end, FileO
   if (err != Z_OK)
     throw base::Exception("ZLib error %d in inflateInit().", err);
 
-  std::vector<uint8_t> scanline(ImageTraits::getRowStrideBytes(image->width()));
   std::vector<uint8_t> uncompressed(image->height() * ImageTraits::getRowStrideBytes(image->width()));
-  std::vector<uint8_t> compressed(4096);
-  int uncompressed_offset = 0;
-
-  while (true) {
-    size_t input_bytes;
-
-    if (ftell(f)+compressed.size() > chunk_end) {
-      input_bytes = chunk_end - ftell(f); // Remaining bytes
-      ASSERT(input_bytes < compressed.size());
-
-      if (input_bytes == 0)
-        break;                  // Done, we consumed all chunk
+  bool complete = true;
+
+  if (!data.empty() && !uncompressed.empty()) {
+    zstream.next_in = (Bytef*)&data[0];
+    zstream.avail_in = data.size();
+    zstream.next_out = (Bytef*)&uncompressed[0];
+    zstream.avail_out = uncompressed.size();
+
+    err = inflate(&zstream, Z_NO_FLUSH);
+    if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR) {
+      inflateEnd(&zstream);
+      throw base::Exception("ZLib error %d in inflate().", err);
     }
-    else
-      input_bytes = compressed.size();
-
-    size_t bytes_read = fread(&compressed[0], 1, input_bytes, f);
-    zstream.next_in = (Bytef*)&compressed[0];
-    zstream.avail_in = bytes_read;
-
-    do {
-      zstream.next_out = (Bytef*)&scanline[0];
-      zstream.avail_out = scanline.size();
 
+    // More data than the expected image size
+    if (zstream.avail_out == 0 && err == Z_OK) {
+      uint8_t extra;
+      zstream.next_out = (Bytef*)&extra;
+      zstream.avail_out = 1;
       err = inflate(&zstream, Z_NO_FLUSH);
-      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
-        throw base::Exception("ZLib error %d in inflate().", err);
-
-      size_t uncompressed_bytes = scanline.size() - zstream.avail_out;
-      if (uncompressed_bytes > 0) {
-        if (uncompressed_offset+uncompressed_bytes > uncompressed.size())
-          throw base::Exception("Bad compressed image.");
-
-        std::copy(scanline.begin(), scanline.begin()+uncompressed_bytes,
-                  uncompressed.begin()+uncompressed_offset);
-
-        uncompressed_offset += uncompressed_bytes;
+      if (zstream.avail_out == 0) {
+        inflateEnd(&zstream);
+        throw base::Exception("Bad compressed image.");
       }
-    } while (zstream.avail_out == 0);
+    }
 
-    fop_progress(fop, (float)ftell(f) / (float)header->size);
+    // The stream was truncated (the decoded pixels are kept anyway)
+    complete = (err == Z_STREAM_END);
   }
 
-  uncompressed_offset = 0;
+  int uncompressed_offset = 0;
   for (y=0; y<image->height(); y++) {
     typename ImageTraits::address_t address =
       (typename ImageTraits::address_t)image->getPixelAddress(0, y);
@@ -955,10 +1064,101 @@ static void read_compressed_image(FILE* f, Image* image, size_t chunk_end, FileO
   err = inflateEnd(&zstream);
   if (err != Z_OK)
     throw base::Exception("ZLib error %d in inflateEnd().", err);
+
+  if (!complete)
+    throw base::Exception("Incomplete compressed image.");
+}
+
+//////////////////////////////////////////////////////////////////////
+// Compressed Cels Decoder
+//////////////////////////////////////////////////////////////////////
+
+CompressedCelsDecoder::CompressedCelsDecoder(FileOp* fop, int maxThreads)
+  : m_fop(fop)
+  , m_maxThreads(maxThreads)
+  , m_nextWait(0)
+  , m_decodedBytes(0)
+{
+}
+
+CompressedCelsDecoder::~CompressedCelsDecoder()
+{
+  // Jobs that weren't decoded are discarded (e.g. there was an
+  // exception in the main thread)
+  m_pool.reset();
+
+  for (Job* job : m_jobs)
+    delete job;
+}
+
+void CompressedCelsDecoder::add(Image* image, std::vector<uint8_t>& data)
+{
+  // Workers are created with the first compressed cel. Without
+  // workers, all images are decoded in waitPendingJobs().
+  if (!m_pool)
+    m_pool.reset(new base::ThreadPool(MAX(0, m_maxThreads-1)));
+
+  Job* job = new Job;
+  job->image = image;
+  job->data.swap(data);
+  m_jobs.push_back(job);
+  job->task = m_pool->execute([this, job]{ decodeJob(job); });
+}
+
+void CompressedCelsDecoder::waitPendingJobs(size_t fileSize, size_t readBytes)
+{
+  for (; m_nextWait<m_jobs.size(); ++m_nextWait) {
+    m_pool->wait(m_jobs[m_nextWait]->task);
+    fop_progress(m_fop, progress(fileSize, readBytes));
+  }
+}
+
+double CompressedCelsDecoder::progress(size_t fileSize, size_t readBytes) const
+{
+  if (fileSize == 0)
+    return 0.0;
+
+  size_t decodedBytes;
+  {
+    scoped_lock lock(m_mutex);
+    decodedBytes = m_decodedBytes;
+  }
+  return 0.5 * double(readBytes + decodedBytes) / double(fileSize);
+}
+
+void CompressedCelsDecoder::decodeJob(Job* job)
+{
+  // In case of error we can show the problem, but continue loading
+  // more cels (like when the images are decoded in the main thread).
+  try {
+    switch (job->image->pixelFormat()) {
+
+      case IMAGE_RGB:
+        decode_compressed_image<RgbTraits>(job->data, job->image);
+        break;
+
+      case IMAGE_GRAYSCALE:
+        decode_compressed_image<GrayscaleTraits>(job->data, job->image);
+        break;
+
+      case IMAGE_INDEXED:
+        decode_compressed_image<IndexedTraits>(job->data, job->image);
+        break;
+    }
+  }
+  catch (const std::exception& e) {
+    fop_error(m_fop, "%s\n", e.what());
+  }
+
+  {
+    scoped_lock lock(m_mutex);
+    m_decodedBytes += job->data.size();
+  }
+  std::vector<uint8_t>().swap(job->data);
 }
 
 template<typename ImageTraits>
-static void write_compressed_image(FILE* f, Image* image)
+static void compress_image(Image* image, int level, std::vector<uint8_t>& output)
 {
   PixelIO<ImageTraits> pixel_io;
   z_stream zstream;
@@ -967,7 +1167,7 @@ static void write_compressed_image(FILE* f, Image* image)
   zstream.zalloc = (alloc_func)0;
   zstream.zfree  = (free_func)0;
   zstream.opaque = (voidpf)0;
-  err = deflateInit(&zstream, Z_DEFAULT_COMPRESSION);
+  err = deflateInit(&zstream, level);
   if (err != Z_OK)
     throw base::Exception("ZLib error %d in deflateInit().", err);
 
@@ -990,15 +1190,14 @@ static void write_compressed_image(FILE* f, Image* image)
 
       // Compress
       err = deflate(&zstream, flush);
-      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
+      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR) {
+        deflateEnd(&zstream);
         throw base::Exception("ZLib error %d in deflate().", err);
+      }
 
       int output_bytes = compressed.size() - zstream.avail_out;
-      if (output_bytes > 0) {
-        if ((fwrite(&compressed[0], 1, output_bytes, f) != (size_t)output_bytes)
-            || ferror(f))
-          throw base::Exception("Error writing compressed image pixels.\n");
-      }
+      if (output_bytes > 0)
+        output.insert(output.end(), compressed.begin(), compressed.begin()+output_bytes);
     } while (zstream.avail_out == 0);
   }
 
@@ -1007,13 +1206,131 @@ static void write_compressed_image(FILE* f, Image* image)
     throw base::Exception("ZLib error %d in deflateEnd().", err);
 }
 
+//////////////////////////////////////////////////////////////////////
+// Compressed Cels Encoder
+//////////////////////////////////////////////////////////////////////
+
+// Maximum number of compressed images waiting to be written in the
+// file (to limit the memory used by big sprites)
+static const size_t kMaxCompressedJobsAhead = 256;
+
+CompressedCelsEncoder::CompressedCelsEncoder(Sprite* sprite, int level, int maxThreads)
+  : m_level(level)
+  , m_nextJob(0)
+  , m_nextWrite(0)
+{
+  // Jobs are created in the same order that cel chunks are written
+  for (frame_t frame(0); frame<sprite->totalFrames(); ++frame)
+    addCels(sprite->folder(), frame);
+
+  // Without workers, each image is compressed when it's written
+  int n = MIN(maxThreads-1, int(m_jobs.size())-1);
+  m_pool.reset(new base::ThreadPool(MAX(0, n)));
+  addPendingJobs();
+}
+
+CompressedCelsEncoder::~CompressedCelsEncoder()
+{
+  // Pending jobs are discarded (e.g. if the operation was cancelled
+  // or there was an error writing the file)
+  m_pool.reset();
+}
+
+void CompressedCelsEncoder::writeCompressedImage(FILE* f, Cel* cel)
+{
+  if (m_nextWrite >= m_jobs.size() ||
+      m_jobs[m_nextWrite].cel != cel) {
+    // Unexpected cel (it's not in the same order as the file)
+    ASSERT(false);
+    Job tmp;
+    tmp.cel = cel;
+    tmp.image = cel->image();
+    compressJob(&tmp);
+    writeData(f, tmp.data);
+    return;
+  }
+
+  Job& job = m_jobs[m_nextWrite++];
+  addPendingJobs();
+
+  // Wait the worker that is compressing this image (or compress it
+  // in this thread), the exception of the job is rethrown here
+  m_pool->wait(job.task);
+  writeData(f, job.data);
+
+  // Free the memory of this job
+  std::vector<uint8_t>().swap(job.data);
+}
+
+void CompressedCelsEncoder::addCels(Layer* layer, frame_t frame)
+{
+  if (layer->isImage()) {
+    Cel* cel = layer->cel(frame);
+    if (cel && !cel->link() && cel->image()) {
+      Job job;
+      job.cel = cel;
+      job.image = cel->image();
+      m_jobs.push_back(job);
+    }
+  }
+
+  if (layer->isFolder()) {
+    LayerIterator it = static_cast<LayerFolder*>(layer)->getLayerBegin();
+    LayerIterator end = static_cast<LayerFolder*>(layer)->getLayerEnd();
+
+    for (; it != end; ++it)
+      addCels(*it, frame);
+  }
+}
+
+// Adds the next images to the pool, only some images ahead of the
+// next one to be written (so the compressed data of a few images is
+// in memory).
+void CompressedCelsEncoder::addPendingJobs()
+{
+  for (; m_nextJob < m_jobs.size() &&
+         m_nextJob < m_nextWrite + kMaxCompressedJobsAhead; ++m_nextJob) {
+    Job* job = &m_jobs[m_nextJob];
+    job->task = m_pool->execute([this, job]{ compressJob(job); });
+  }
+}
+
+void CompressedCelsEncoder::compressJob(Job* job)
+{
+  switch (job->image->pixelFormat()) {
+
+    case IMAGE_RGB:
+      compress_image<RgbTraits>(job->image, m_level, job->data);
+      break;
+
+    case IMAGE_GRAYSCALE:
+      compress_image<GrayscaleTraits>(job->image, m_level, job->data);
+      break;
+
+    case IMAGE_INDEXED:
+      compress_image<IndexedTraits>(job->image, m_level, job->data);
+      break;
+  }
+}
+
+// static
+void CompressedCelsEncoder::writeData(FILE* f, const std::vector<uint8_t>& data)
+{
+  if (!data.empty()) {
+    if ((fwrite(&data[0], 1, data.size(), f) != data.size())
+        || ferror(f))
+      throw base::Exception("Error writing compressed image pixels.\n");
+  }
+}
+
 //////////////////////////////////////////////////////////////////////
 // Cel Chunk
 //////////////////////////////////////////////////////////////////////
 
 static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, frame_t frame,
                                     PixelFormat pixelFormat,
-                                    FileOp* fop, ASE_Header* header, size_t chunk_end)
+                                    FileOp* fop, ASE_Header* header, size_t chunk_end,
+                                    CompressedCelsDecoder* decoder)
 {
   /* read chunk data */
   LayerIndex layer_index = LayerIndex(fgetw(f));
@@ -1087,6 +1404,9 @@ static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, frame_t frame,
           cel->setFrame(frame);
         }
         else {
+          // The pixels of the linked cel must be decoded to copy them
+          decoder->waitPendingJobs(header->size, ftell(f));
+
           cel.reset(Cel::createCopy(link));
           cel->setFrame(frame);
           cel->setPosition(x, y);
@@ -1108,32 +1428,20 @@ static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, frame_t frame,
       if (w > 0 && h > 0) {
         ImageRef image(Image::create(pixelFormat, w, h));
 
-        // Try to read pixel data
-        try {
-          switch (image->pixelFormat()) {
-
-            case IMAGE_RGB:
-              read_compressed_image<RgbTraits>(f, image.get(), chunk_end, fop, header);
-              break;
-
-            case IMAGE_GRAYSCALE:
-              read_compressed_image<GrayscaleTraits>(f, image.get(), chunk_end, fop, header);
-              break;
-
-            case IMAGE_INDEXED:
-              read_compressed_image<IndexedTraits>(f, image.get(), chunk_end, fop, header);
-              break;
-          }
-        }
-        // OK, in case of error we can show the problem, but continue
-        // loading more cels.
-        catch (const std::exception& e) {
-          fop_error(fop, e.what());
-        }
+        // Read the compressed pixels, they are decoded in other
+        // thread when the cel is already in the layer
+        size_t pos = ftell(f);
+        std::vector<uint8_t> data(pos < chunk_end ? chunk_end - pos: 0);
+        if (!data.empty())
+          data.resize(fread(&data[0], 1, data.size(), f));
 
         cel.reset(new Cel(frame, image));
         cel->setPosition(x, y);
         cel->setOpacity(opacity);
+
+        static_cast<LayerImage*>(layer)->addCel(cel);
+        decoder->add(image.get(), data);
+        return cel.release();
       }
       break;
     }
@@ -1147,7 +1455,7 @@ static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, frame_t frame,
   return cel.release();
 }
 
-static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header, Cel* cel, LayerImage* layer, Sprite* sprite)
+static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header, Cel* cel, LayerImage* layer, Sprite* sprite, CompressedCelsEncoder* encoder)
 {
   ChunkWriter chunk(f, frame_header, ASE_FILE_CHUNK_CEL);
 
@@ -1209,21 +1517,8 @@ static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header, Cel
         fputw(image->width(), f);
         fputw(image->height(), f);
 
-        // Pixel data
-        switch (image->pixelFormat()) {
-
-          case IMAGE_RGB:
-            write_compressed_image<RgbTraits>(f, image);
-            break;
-
-          case IMAGE_GRAYSCALE:
-            write_compressed_image<GrayscaleTraits>(f, image);
-            break;
-
-          case IMAGE_INDEXED:
-            write_compressed_image<IndexedTraits>(f, image);
-            break;
-        }
+        // Pixel data (compressed in other thread)
+        encoder->writeCompressedImage(f, cel);
       }
       else {
         // Width and height
@@ -0,0 +1,45 @@
+// Aseprite
+// Copyright (C) 2001-2015  David Capello
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#ifndef APP_FILE_ASE_OPTIONS_H_INCLUDED
+#define APP_FILE_ASE_OPTIONS_H_INCLUDED
+#pragma once
+
+#include "app/file/format_options.h"
+#include "base/base.h"
+#include "base/thread.h"
+
+namespace app {
+
+  // Data for .ase files
+  class AseOptions : public FormatOptions {
+  public:
+    // How cel images are compressed (the file format is the same,
+    // only the time to save the file and its size change).
+    enum Compression { DefaultCompression, FastCompression, SmallCompression };
+
+    AseOptions(Compression compression = DefaultCompression)
+      : m_compression(compression)
+      , m_maxThreads(int(base::thread::hardware_concurrency())) {
+    }
+
+    Compression compression() const { return m_compression; }
+    void setCompression(Compression compression) { m_compression = compression; }
+
+    // Maximum number of threads (the caller one included) used to
+    // compress/decode cel images.
+    int maxThreads() const { return m_maxThreads; }
+    void setMaxThreads(int threads) { m_maxThreads = MAX(1, threads); }
+
+  private:
+    Compression m_compression;
+    int m_maxThreads;
+  };
+
+} // namespace app
+
+#endif
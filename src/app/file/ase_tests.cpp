@@ -0,0 +1,304 @@
+// Aseprite
+// Copyright (C) 2001-2015  David Capello
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#include "tests/test.h"
+
+#include "app/context.h"
+#include "app/document.h"
+#include "app/file/ase_options.h"
+#include "app/file/file.h"
+#include "app/file/file_formats_manager.h"
+#include "base/fs.h"
+#include "base/fstream_path.h"
+#include "base/unique_ptr.h"
+#include "doc/doc.h"
+#include "doc/test_context.h"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace app;
+using namespace doc;
+
+class AseFormat : public ::testing::Test {
+public:
+  AseFormat() {
+    FileFormatsManager::instance()->registerAllFormats();
+  }
+
+  ~AseFormat() {
+    if (base::is_file(kFilename))
+      base::delete_file(kFilename);
+  }
+
+protected:
+  static const char* kFilename;
+  static const int kLayers = 3;
+  static const int kFrames = 24;
+
+  // Creates a sprite with several layers and frames. All cels are
+  // compressed, except the odd frames of the second layer, which are
+  // linked to the previous frame.
+  app::Document* createDocument() {
+    const int w = 96, h = 64;
+    app::Document* doc = static_cast<app::Document*>(
+      m_ctx.documents().add(w, h, doc::ColorMode::RGB, 256));
+    doc->setFilename(kFilename);
+
+    Sprite* sprite = doc->sprite();
+    sprite->setTotalFrames(frame_t(kFrames));
+    for (int i=1; i<kLayers; ++i)
+      sprite->folder()->addLayer(new LayerImage(sprite));
+
+    unsigned int seed = 1;
+    for (int i=0; i<kLayers; ++i) {
+      LayerImage* layer = static_cast<LayerImage*>(sprite->indexToLayer(LayerIndex(i)));
+
+      for (frame_t f(0); f<kFrames; ++f) {
+        if (i == 1 && (f & 1)) {
+          Cel* link = Cel::createLink(layer->cel(f-1));
+          link->setFrame(f);
+          layer->addCel(link);
+          continue;
+        }
+
+        Image* image;
+        if (layer->cel(f))
+          image = layer->cel(f)->image();
+        else {
+          image = Image::create(IMAGE_RGB, w, h);
+          layer->addCel(new Cel(f, ImageRef(image)));
+        }
+
+        // Runs of random colors (so images are compressed with
+        // different ratios)
+        color_t c = 0;
+        for (int y=0; y<h; ++y) {
+          for (int x=0; x<w; ++x) {
+            seed = seed*1103515245 + 12345;
+            if (((seed >> 16) & 7) == 0)
+              c = rgba((seed >> 8) & 0xff, (seed >> 16) & 0xff, (seed >> 24) & 0xff, 255);
+            put_pixel(image, x, y, c);
+          }
+        }
+      }
+    }
+    return doc;
+  }
+
+  // Saves the file compressing images with the given options.
+  void saveDocument(app::Document* doc,
+                    AseOptions::Compression compression = AseOptions::DefaultCompression,
+                    int maxThreads = 4) {
+    FileOp* fop = fop_to_save_document(&m_ctx, doc, kFilename, "");
+    ASSERT_TRUE(fop != nullptr);
+
+    AseOptions* options = new AseOptions(compression);
+    options->setMaxThreads(maxThreads);
+    fop->seq.format_options.reset(options);
+
+    fop_operate(fop, nullptr);
+    fop_done(fop);
+    EXPECT_EQ("", fop->error);
+    fop_free(fop);
+  }
+
+  // Loads the file decoding images with the given number of threads.
+  // Returns the error reported by the load operation in "error".
+  app::Document* loadDocument(int maxThreads, std::string& error) {
+    FileOp* fop = fop_to_load_document(&m_ctx, kFilename, FILE_LOAD_SEQUENCE_NONE);
+    EXPECT_TRUE(fop != nullptr);
+    if (!fop)
+      return nullptr;
+
+    AseOptions* options = new AseOptions;
+    options->setMaxThreads(maxThreads);
+    fop->seq.format_options.reset(options);
+
+    fop_operate(fop, nullptr);
+    fop_done(fop);
+    fop_post_load(fop);
+
+    error = fop->error;
+    app::Document* doc = fop->document;
+    fop_free(fop);
+
+    if (doc)
+      doc->setContext(&m_ctx);
+    return doc;
+  }
+
+  static void expectSameCels(Sprite* expected, Sprite* result) {
+    ASSERT_EQ(expected->totalFrames(), result->totalFrames());
+    ASSERT_EQ(expected->countLayers(), result->countLayers());
+
+    for (LayerIndex i(0); i<expected->countLayers(); ++i) {
+      Layer* a = expected->indexToLayer(i);
+      Layer* b = result->indexToLayer(i);
+      for (frame_t f(0); f<expected->totalFrames(); ++f) {
+        Cel* celA = a->cel(f);
+        Cel* celB = b->cel(f);
+        ASSERT_TRUE(celA && celB) << "layer " << i << " frame " << f;
+        EXPECT_EQ(celA->link() != nullptr, celB->link() != nullptr)
+          << "layer " << i << " frame " << f;
+        EXPECT_EQ(0, count_diff_between_images(celA->image(), celB->image()))
+          << "layer " << i << " frame " << f;
+      }
+    }
+  }
+
+  static std::string readFile() {
+    std::ifstream f(FSTREAM_PATH(kFilename), std::ifstream::binary);
+    std::ostringstream buf(std::ios::binary);
+    buf << f.rdbuf();
+    return buf.str();
+  }
+
+  // Removes the last bytes of the zlib stream of the given compressed
+  // cel (fixing the chunk, frame, and file sizes, so the rest of the
+  // file can be read).
+  static bool truncateCompressedCel(int cel, int bytes) {
+    std::string data = readFile();
+    int frames = getWord(data, 6);
+    size_t pos = 128;           // Header size
+    for (int frame=0; frame<frames; ++frame) {
+      uint32_t frameSize = getLong(data, pos);
+      int chunks = getWord(data, pos+6);
+
+      size_t chunkPos = pos+16; // Frame header size
+      for (int c=0; c<chunks; ++c) {
+        uint32_t chunkSize = getLong(data, chunkPos);
+        int chunkType = getWord(data, chunkPos+4);
+
+        // Cel chunk of a compressed cel
+        if (chunkType == 0x2005 && getWord(data, chunkPos+13) == 2 && cel-- == 0) {
+          data.erase(chunkPos+chunkSize-bytes, bytes);
+          putLong(data, chunkPos, chunkSize-bytes);
+          putLong(data, pos, frameSize-bytes);
+          putLong(data, 0, getLong(data, 0)-bytes);
+
+          std::ofstream f(FSTREAM_PATH(kFilename), std::ofstream::binary | std::ofstream::trunc);
+          f.write(data.c_str(), data.size());
+          return true;
+        }
+        chunkPos += chunkSize;
+      }
+      pos += frameSize;
+    }
+    return false;
+  }
+
+  static int getWord(const std::string& data, size_t pos) {
+    return (uint8_t(data[pos]) | (uint8_t(data[pos+1]) << 8));
+  }
+
+  static uint32_t getLong(const std::string& data, size_t pos) {
+    return (getWord(data, pos) | (getWord(data, pos+2) << 16));
+  }
+
+  static void putLong(std::string& data, size_t pos, uint32_t value) {
+    for (int i=0; i<4; ++i)
+      data[pos+i] = char((value >> (8*i)) & 0xff);
+  }
+
+  doc::TestContextT<app::Context> m_ctx;
+};
+
+const char* AseFormat::kFilename = "test.ase";
+
+TEST_F(AseFormat, CompressedAndLinkedCels)
+{
+  base::UniquePtr<app::Document> doc(createDocument());
+  saveDocument(doc.get());
+
+  for (int threads : { 1, 2, 4, 8 }) {
+    std::string error;
+    base::UniquePtr<app::Document> loaded(loadDocument(threads, error));
+    ASSERT_TRUE(loaded != nullptr) << "threads " << threads;
+    EXPECT_EQ("", error) << "threads " << threads;
+
+    expectSameCels(doc->sprite(), loaded->sprite());
+    loaded->close();
+  }
+
+  doc->close();
+}
+
+// An invalid cel is reported as an error of the whole load operation,
+// and the other cels are loaded (like when images are decoded in the
+// main thread).
+TEST_F(AseFormat, TruncatedCompressedCel)
+{
+  base::UniquePtr<app::Document> doc(createDocument());
+  saveDocument(doc.get());
+  doc->close();
+
+  ASSERT_TRUE(truncateCompressedCel(kFrames, 100));
+
+  std::string expectedError;
+  base::UniquePtr<app::Document> expected(loadDocument(1, expectedError));
+  ASSERT_TRUE(expected != nullptr);
+  EXPECT_NE("", expectedError);
+
+  for (int threads : { 2, 4, 8 }) {
+    std::string error;
+    base::UniquePtr<app::Document> loaded(loadDocument(threads, error));
+    ASSERT_TRUE(loaded != nullptr) << "threads " << threads;
+    EXPECT_EQ(expectedError, error) << "threads " << threads;
+
+    expectSameCels(expected->sprite(), loaded->sprite());
+    loaded->close();
+  }
+
+  expected->close();
+}
+
+TEST_F(AseFormat, CompressionLevels)
+{
+  base::UniquePtr<app::Document> doc(createDocument());
+
+  std::vector<size_t> sizes;
+  for (AseOptions::Compression compression : { AseOptions::DefaultCompression,
+                                               AseOptions::FastCompression,
+                                               AseOptions::SmallCompression }) {
+    saveDocument(doc.get(), compression);
+    sizes.push_back(base::file_size(kFilename));
+
+    std::string error;
+    base::UniquePtr<app::Document> loaded(loadDocument(4, error));
+    ASSERT_TRUE(loaded != nullptr) << "compression " << compression;
+    EXPECT_EQ("", error) << "compression " << compression;
+
+    expectSameCels(doc->sprite(), loaded->sprite());
+    loaded->close();
+  }
+
+  EXPECT_LE(sizes[2], sizes[0]);
+  EXPECT_LE(sizes[0], sizes[1]);
+
+  doc->close();
+}
+
+// Images are compressed in the same order as they are written, so the
+// file is the same with any number of threads.
+TEST_F(AseFormat, SameFileWithThreads)
+{
+  base::UniquePtr<app::Document> doc(createDocument());
+
+  saveDocument(doc.get(), AseOptions::DefaultCompression, 1);
+  std::string expected = readFile();
+  ASSERT_FALSE(expected.empty());
+
+  for (int threads : { 2, 4, 8 }) {
+    saveDocument(doc.get(), AseOptions::DefaultCompression, threads);
+    EXPECT_TRUE(expected == readFile()) << "threads " << threads;
+  }
+
+  doc->close();
+}
@@ -20,6 +20,8 @@
 #include "app/modules/gui.h"
 #include "app/util/autocrop.h"
 #include "base/file_handle.h"
+#include "base/thread.h"
+#include "base/thread_pool.h"
 #include "base/unique_ptr.h"
 #include "doc/doc.h"
 #include "render/quantization.h"
@@ -30,9 +32,14 @@
 #include "generated_gif_options.h"
 
 #include <gif_lib.h>
+#include "zlib.h"
+
+#include <algorithm>
+#include <vector>
 
 #if GIFLIB_MAJOR < 5
 #define GifMakeMapObject MakeMapObject
+#define GifFreeMapObject FreeMapObject
 #endif
 
 namespace app {
@@ -331,6 +338,39 @@ bool GifFormat::onLoad(FileOp* fop)
   return true;
 }
 
+// Returns true if the composed frames can't contain transparent
+// pixels: the first frame covers the whole canvas without transparent
+// pixels and no frame is cleared. In this case the transparent index
+// of the next frames is only used to keep pixels of the previous
+// frame (e.g. opaque files saved with "Optimize Frames").
+static bool has_opaque_canvas(const GifData* data)
+{
+  if (data->frames.empty())
+    return false;
+
+  const GifFrame& first = data->frames.front();
+  if (first.x != 0 || first.y != 0 ||
+      first.image->width() != data->sprite_w ||
+      first.image->height() != data->sprite_h)
+    return false;
+
+  if (first.mask_index >= 0) {
+    const LockImageBits<IndexedTraits> bits(first.image);
+    for (auto it=bits.begin(), end=bits.end(); it != end; ++it)
+      if (*it == first.mask_index)
+        return false;
+  }
+
+  // The disposal method of the last frame doesn't matter
+  for (size_t i=0; i+1<data->frames.size(); ++i) {
+    DisposalMethod disposal = data->frames[i].disposal_method;
+    if (disposal != DISPOSAL_METHOD_NONE &&
+        disposal != DISPOSAL_METHOD_DO_NOT_DISPOSE)
+      return false;
+  }
+  return true;
+}
+
 bool GifFormat::onPostLoad(FileOp* fop)
 {
   GifData* data = reinterpret_cast<GifData*>(fop->format_data);
@@ -340,7 +380,11 @@ bool GifFormat::onPostLoad(FileOp* fop)
   PixelFormat pixelFormat = IMAGE_INDEXED;
   bool askForConversion = false;
 
-  if (!fop->oneframe) {
+  // Opaque animation, it's loaded in a background layer.
+  if (!fop->oneframe && has_opaque_canvas(data)) {
+    data->bgcolor_index = -1;
+  }
+  else if (!fop->oneframe) {
     int global_mask_index = -1;
 
     for (GifFrames::iterator
@@ -544,6 +588,491 @@ void GifFormat::onDestroyData(FileOp* fop)
 }
 
 #ifdef ENABLE_SAVE
+
+// Maximum number of bytes of rendered frames that are kept
+// uncompressed in memory between the palette pass and the encoding
+// pass (QuantizeAll). Bigger animations are kept compressed (or are
+// rendered again if there are no worker threads).
+static const size_t kMaxUncompressedFramesBytes = 128*1024*1024;
+
+static void deflate_image(const Image* image, std::vector<uint8_t>& output)
+{
+  z_stream zstream;
+  int err;
+
+  zstream.zalloc = (alloc_func)0;
+  zstream.zfree  = (free_func)0;
+  zstream.opaque = (voidpf)0;
+  err = deflateInit(&zstream, Z_BEST_SPEED);
+  if (err != Z_OK)
+    throw Exception("ZLib error %d in deflateInit().", err);
+
+  int rowBytes = image->getRowStrideSize();
+  std::vector<uint8_t> compressed(4096);
+
+  for (int y=0; y<image->height(); ++y) {
+    zstream.next_in = (Bytef*)image->getPixelAddress(0, y);
+    zstream.avail_in = rowBytes;
+    int flush = (y == image->height()-1 ? Z_FINISH: Z_NO_FLUSH);
+
+    do {
+      zstream.next_out = (Bytef*)&compressed[0];
+      zstream.avail_out = compressed.size();
+
+      err = deflate(&zstream, flush);
+      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR) {
+        deflateEnd(&zstream);
+        throw Exception("ZLib error %d in deflate().", err);
+      }
+
+      int output_bytes = compressed.size() - zstream.avail_out;
+      if (output_bytes > 0)
+        output.insert(output.end(), compressed.begin(), compressed.begin()+output_bytes);
+    } while (zstream.avail_out == 0);
+  }
+
+  err = deflateEnd(&zstream);
+  if (err != Z_OK)
+    throw Exception("ZLib error %d in deflateEnd().", err);
+}
+
+static void inflate_image(const std::vector<uint8_t>& input, Image* image)
+{
+  z_stream zstream;
+  int err;
+
+  zstream.zalloc = (alloc_func)0;
+  zstream.zfree  = (free_func)0;
+  zstream.opaque = (voidpf)0;
+  zstream.next_in = (Bytef*)&input[0];
+  zstream.avail_in = input.size();
+  err = inflateInit(&zstream);
+  if (err != Z_OK)
+    throw Exception("ZLib error %d in inflateInit().", err);
+
+  int rowBytes = image->getRowStrideSize();
+  for (int y=0; y<image->height(); ++y) {
+    zstream.next_out = (Bytef*)image->getPixelAddress(0, y);
+    zstream.avail_out = rowBytes;
+
+    err = inflate(&zstream, Z_NO_FLUSH);
+    if ((err != Z_OK && err != Z_STREAM_END) || zstream.avail_out != 0) {
+      inflateEnd(&zstream);
+      throw Exception("ZLib error %d in inflate().", err);
+    }
+  }
+
+  inflateEnd(&zstream);
+}
+
+// Renders the frames of the sprite and converts them to indexed
+// images in worker threads, so GifFormat::onSave() only has to write
+// them with giflib (in order, from one thread). Images are rendered
+// in a ring of buffers, so worker threads can be only some frames
+// ahead of the frame that is being written.
+class GifFramesRenderer {
+public:
+  struct Frame {
+    Image* image;               // Frame converted to indexed
+    Palette palette;            // Palette used to convert the frame
+
+    // Result of get_shrink_rect2() with the previous frame, and
+    // get_shrink_rect() with the background color.
+    bool changed;
+    int u1, v1, u2, v2;
+    bool hasContent;
+    int i1, j1, i2, j2;
+
+    // Only when frames are optimized (unchangedIndex() >= 0)
+    bool samePalette;           // Same palette as the previous frame
+    bool incremental;           // Can be drawn over the previous frame
+    Image* optimized;           // Image with unchanged pixels replaced with unchangedIndex()
+
+    Frame() : image(nullptr), palette(frame_t(0), 0), changed(false), hasContent(false),
+              samePalette(false), incremental(false), optimized(nullptr) { }
+  };
+
+  GifFramesRenderer(Sprite* sprite, const GifOptions* options,
+                    int background_color, int transparent_index, bool has_background);
+  ~GifFramesRenderer();
+
+  // Renders all frames to calculate one palette for the whole
+  // animation. The rendered frames are kept (compressed if they are
+  // too big) to convert them to indexed without rendering them again.
+  void calculatePalette(FileOp* fop, Palette* palette);
+
+  // Returns the given frame converted to indexed (waiting or
+  // converting it from this thread if it's not ready yet). Frames
+  // must be requested in order, and a frame is valid until the
+  // frame after the next one is requested (so the next frame can
+  // be checked before writing the current one).
+  const Frame& frame(frame_t frame);
+
+  // Index used for pixels that didn't change from the previous
+  // frame (i.e. the transparent index), or -1 if frames are not
+  // optimized.
+  int unchangedIndex() const { return m_unchangedIndex; }
+
+private:
+  struct Job {
+    Image* rendered;              // Rendered frame kept to convert it
+    std::vector<uint8_t> data;    // Compressed rendered frame
+    Frame frame;
+    base::ThreadPool::TaskRef task;     // Render or convert task
+    base::ThreadPool::TaskRef diffTask; // Comparison with the previous frame
+
+    Job() : rendered(nullptr) { }
+  };
+
+  struct Slot {
+    base::UniquePtr<Image> rgb;
+    base::UniquePtr<Image> indexed;
+    base::UniquePtr<Image> optimized;
+    base::UniquePtr<RgbMap> rgbmap;
+  };
+
+  void addConvertJob(int i);
+  void renderJob(int i);
+  void convertJob(int i);
+  void diffJob(int i);
+  bool optimizeFrame(int i);
+  void renderFrame(int i, Image* dst);
+
+  Sprite* m_sprite;
+  GifOptions::Quantize m_quantize;
+  DitheringMethod m_dithering;
+  int m_background_color;
+  int m_transparent_index;
+  bool m_has_background;
+  int m_unchangedIndex;
+  Palette m_palette;            // Palette for all frames
+  RgbMap m_rgbmap;
+  bool m_keepRendered;
+  bool m_compressRendered;
+  int m_threadsCount;
+  std::vector<Job> m_jobs;
+  std::vector<Slot*> m_slots;
+  base::UniquePtr<base::ThreadPool> m_pool;
+  int m_nextJob;                // Next frame to be converted
+};
+
+GifFramesRenderer::GifFramesRenderer(Sprite* sprite, const GifOptions* options,
+                                     int background_color, int transparent_index, bool has_background)
+  : m_sprite(sprite)
+  , m_quantize(options->quantize())
+  , m_dithering(options->dithering())
+  , m_background_color(background_color)
+  , m_transparent_index(transparent_index)
+  , m_has_background(has_background)
+  , m_unchangedIndex(-1)
+  , m_palette(*sprite->palette(frame_t(0)))
+  , m_keepRendered(false)
+  , m_compressRendered(false)
+  , m_threadsCount(MAX(0, int(base::thread::hardware_concurrency())-1))
+  , m_jobs(sprite->totalFrames())
+  , m_pool(new base::ThreadPool(m_jobs.size() > 1 ? m_threadsCount: 0))
+  , m_nextJob(0)
+{
+  // Each thread needs at least two slots (the frame that it's
+  // converting and the previous one to compare them).
+  int slots = MIN(2*(m_threadsCount+1), int(m_jobs.size())+1);
+  for (int i=0; i<slots; ++i)
+    m_slots.push_back(new Slot);
+
+  if (m_sprite->pixelFormat() != IMAGE_INDEXED && m_quantize == GifOptions::QuantizeAll) {
+    size_t bytes =
+      size_t(m_sprite->width()) * m_sprite->height() *
+      (m_sprite->pixelFormat() == IMAGE_RGB ? 4: 2) * m_jobs.size();
+    m_keepRendered = (bytes <= kMaxUncompressedFramesBytes);
+
+    // Without worker threads it's faster to render the frames again
+    // than to compress/uncompress them.
+    m_compressRendered = (!m_keepRendered && m_threadsCount > 0);
+  }
+
+  if (options->optimizeFrames() && m_jobs.size() > 1) {
+    // Transparent GIF files use the transparent index. Opaque ones
+    // need an index that is not used by any frame (the first one
+    // after the biggest palette).
+    if (!has_background)
+      m_unchangedIndex = transparent_index;
+    else {
+      int size = 0;
+      for (const Palette* palette : sprite->getPalettes())
+        size = MAX(size, palette->size());
+      if (size < 256)
+        m_unchangedIndex = size;
+    }
+  }
+}
+
+GifFramesRenderer::~GifFramesRenderer()
+{
+  // Pending jobs are discarded and the running ones finished before
+  // deleting the images (e.g. if there was an error writing the file)
+  m_pool.reset();
+
+  for (Job& job : m_jobs)
+    delete job.rendered;
+
+  for (Slot* slot : m_slots)
+    delete slot;
+}
+
+void GifFramesRenderer::calculatePalette(FileOp* fop, Palette* palette)
+{
+  render::PaletteOptimizer optimizer;
+  const int njobs = int(m_jobs.size());
+  const int nslots = int(m_slots.size());
+  int next = 0;
+
+  // The optimizer is fed in frame order (the result depends on the
+  // order of the colors). Next frames are rendered in the meantime
+  // if their slots are free.
+  for (int i=0; i<njobs; ++i) {
+    for (; next<njobs && next<i+nslots; ++next)
+      m_jobs[next].task = m_pool->execute([this, next]{ renderJob(next); });
+
+    Job& job = m_jobs[i];
+    m_pool->wait(job.task);
+
+    optimizer.feedWithImage(m_keepRendered ? job.rendered:
+                                             m_slots[i % nslots]->rgb.get());
+
+    fop_progress(fop, 0.5 * (i+1) / njobs);
+  }
+
+  palette->makeBlack();
+  optimizer.calculate(palette, m_has_background);
+
+  palette->copyColorsTo(&m_palette);
+  m_rgbmap.regenerate(&m_palette, m_transparent_index);
+}
+
+const GifFramesRenderer::Frame& GifFramesRenderer::frame(frame_t frame)
+{
+  // Frames before the previous one are not used anymore, so their
+  // slots can be used to convert the next frames.
+  const int njobs = int(m_jobs.size());
+  const int nslots = int(m_slots.size());
+  for (; m_nextJob<njobs && m_nextJob<=frame+nslots-2; ++m_nextJob)
+    addConvertJob(m_nextJob);
+
+  // The first frame is not compared with anything
+  Job& job = m_jobs[frame];
+  m_pool->wait(frame == 0 ? job.task: job.diffTask);
+
+  return job.frame;
+}
+
+void GifFramesRenderer::addConvertJob(int i)
+{
+  Job& job = m_jobs[i];
+  job.task = m_pool->execute([this, i]{ convertJob(i); });
+
+  // Frames are compared with the previous one when both are
+  // converted (the previous frame was added to the pool before, so
+  // it doesn't block the pool).
+  if (i > 0) {
+    job.diffTask = m_pool->execute([this, i]{
+        m_pool->wait(m_jobs[i-1].task);
+        m_pool->wait(m_jobs[i].task);
+        diffJob(i);
+      });
+  }
+}
+
+void GifFramesRenderer::renderJob(int i)
+{
+  Job& job = m_jobs[i];
+  Image* image;
+
+  if (m_keepRendered) {
+    job.rendered = Image::create(m_sprite->pixelFormat(), m_sprite->width(), m_sprite->height());
+    image = job.rendered;
+  }
+  else {
+    Slot* slot = m_slots[i % m_slots.size()];
+    if (!slot->rgb)
+      slot->rgb.reset(Image::create(m_sprite->pixelFormat(), m_sprite->width(), m_sprite->height()));
+    image = slot->rgb.get();
+  }
+
+  renderFrame(i, image);
+
+  if (m_compressRendered) {
+    job.data.clear();
+    deflate_image(image, job.data);
+  }
+}
+
+void GifFramesRenderer::convertJob(int i)
+{
+  Job& job = m_jobs[i];
+  Frame& frame = job.frame;
+  Slot* slot = m_slots[i % m_slots.size()];
+
+  if (!slot->indexed)
+    slot->indexed.reset(Image::create(IMAGE_INDEXED, m_sprite->width(), m_sprite->height()));
+  frame.image = slot->indexed.get();
+
+  // If the sprite is Indexed, we can render directly into the indexed image.
+  if (m_sprite->pixelFormat() == IMAGE_INDEXED) {
+    m_palette.copyColorsTo(&frame.palette);
+    renderFrame(i, frame.image);
+    return;
+  }
+
+  // The sprite is RGB or Grayscale, we must to convert it to Indexed.
+  Image* image = job.rendered;
+  if (!image) {
+    if (!slot->rgb)
+      slot->rgb.reset(Image::create(m_sprite->pixelFormat(), m_sprite->width(), m_sprite->height()));
+    image = slot->rgb.get();
+
+    if (!job.data.empty())
+      inflate_image(job.data, image);
+    else
+      renderFrame(i, image);
+  }
+
+  const RgbMap* rgbmap = &m_rgbmap;
+  switch (m_quantize) {
+    case GifOptions::NoQuantize:
+      m_sprite->palette(frame_t(i))->copyColorsTo(&frame.palette);
+      break;
+    case GifOptions::QuantizeEach:
+      {
+        // Each frame can use all entries of the sprite palette (the
+        // size of the previous frame palette is not a limit, so the
+        // frames can be converted in any order).
+        m_palette.copyColorsTo(&frame.palette);
+        frame.palette.makeBlack();
+
+        std::vector<Image*> imgarray(1);
+        imgarray[0] = image;
+        render::create_palette_from_images(imgarray, &frame.palette, m_has_background);
+      }
+      break;
+    case GifOptions::QuantizeAll:
+      // The palette for all frames was calculated in calculatePalette().
+      m_palette.copyColorsTo(&frame.palette);
+      break;
+  }
+
+  if (m_quantize != GifOptions::QuantizeAll) {
+    if (!slot->rgbmap)
+      slot->rgbmap.reset(new RgbMap);
+    slot->rgbmap->regenerate(&frame.palette, m_transparent_index);
+    rgbmap = slot->rgbmap.get();
+  }
+
+  render::convert_pixel_format(
+    image,
+    frame.image,
+    IMAGE_INDEXED,
+    m_dithering,
+    rgbmap,
+    &frame.palette,
+    m_has_background);
+
+  // Free the rendered frame, it's not needed anymore
+  delete job.rendered;
+  job.rendered = nullptr;
+  std::vector<uint8_t>().swap(job.data);
+}
+
+void GifFramesRenderer::diffJob(int i)
+{
+  ASSERT(i > 0);
+  Frame& frame = m_jobs[i].frame;
+
+  // Get the rectangle where start differences with the previous frame.
+  frame.changed = get_shrink_rect2(&frame.u1, &frame.v1, &frame.u2, &frame.v2,
+                                   frame.image, m_jobs[i-1].frame.image);
+
+  // Check the minimal area with the background color.
+  if (frame.changed || m_unchangedIndex >= 0)
+    frame.hasContent = get_shrink_rect(&frame.i1, &frame.j1, &frame.i2, &frame.j2,
+                                       frame.image, m_background_color);
+
+  if (m_unchangedIndex >= 0) {
+    frame.samePalette = (frame.palette.countDiff(&m_jobs[i-1].frame.palette, NULL, NULL) == 0);
+    frame.incremental = (frame.samePalette && optimizeFrame(i));
+  }
+}
+
+// Replaces the pixels that are equal in the previous frame with the
+// unchanged index. Returns false if the frame cannot be drawn over
+// the previous one, i.e. some pixel must be changed to the
+// transparent index (or the unchanged index is used in the frame).
+bool GifFramesRenderer::optimizeFrame(int i)
+{
+  Frame& frame = m_jobs[i].frame;
+  const Image* prevImage = m_jobs[i-1].frame.image;
+  Slot* slot = m_slots[i % m_slots.size()];
+
+  if (!slot->optimized)
+    slot->optimized.reset(Image::create(IMAGE_INDEXED, m_sprite->width(), m_sprite->height()));
+  frame.optimized = slot->optimized.get();
+
+  const IndexedTraits::pixel_t unchanged = m_unchangedIndex;
+  const int w = frame.image->width();
+  for (int y=0; y<frame.image->height(); ++y) {
+    const IndexedTraits::pixel_t* cur = (const IndexedTraits::pixel_t*)frame.image->getPixelAddress(0, y);
+    const IndexedTraits::pixel_t* prev = (const IndexedTraits::pixel_t*)prevImage->getPixelAddress(0, y);
+    IndexedTraits::pixel_t* dst = (IndexedTraits::pixel_t*)frame.optimized->getPixelAddress(0, y);
+
+    for (int x=0; x<w; ++x) {
+      if (cur[x] == prev[x])
+        dst[x] = unchanged;
+      else if (cur[x] == unchanged)
+        return false;
+      else
+        dst[x] = cur[x];
+    }
+  }
+  return true;
+}
+
+void GifFramesRenderer::renderFrame(int i, Image* dst)
+{
+  render::Render render;
+  render.setBgType(render::BgType::NONE);
+
+  clear_image(dst, m_background_color);
+  render.renderSprite(dst, m_sprite, frame_t(i));
+}
+
+// Returns the bounds of a frame from the given rectangle (x1, y1,
+// x2, y2 inclusive). If there is no rectangle (nothing to draw),
+// the frame is just the first pixel (GIF images cannot be empty).
+static void get_frame_bounds(bool hasRect, int x1, int y1, int x2, int y2,
+                             int& x, int& y, int& w, int& h)
+{
+  if (hasRect) {
+    x = x1;
+    y = y1;
+    w = x2 - x1 + 1;
+    h = y2 - y1 + 1;
+  }
+  else {
+    x = y = 0;
+    w = h = 1;
+  }
+}
+
+// Returns the number of entries of a GIF color map to store the
+// given number of colors (it must be a power of two).
+static int get_color_map_size(int colors)
+{
+  int size = 2;
+  while (size < colors)
+    size <<= 1;
+  ASSERT(size <= 256);
+  return size;
+}
+
 bool GifFormat::onSave(FileOp* fop)
 {
 #if GIFLIB_MAJOR >= 5
@@ -571,17 +1100,8 @@ bool GifFormat::onSave(FileOp* fop)
 
   Palette current_palette = *sprite->palette(frame_t(0));
   Palette previous_palette(current_palette);
-  RgbMap rgbmap;
 
-  // The color map must be a power of two.
-  int color_map_size = current_palette.size();
-  for (int i = 30; i >= 0; --i) {
-    if (color_map_size & (1 << i)) {
-      color_map_size = (1 << (i + (color_map_size & (1 << (i - 1)) ? 1: 0)));
-      break;
-    }
-  }
-  ASSERT(color_map_size > 0 && color_map_size <= 256);
+  int color_map_size = get_color_map_size(current_palette.size());
 
   ColorMapObject* color_map = NULL;
   int bpp;
@@ -613,83 +1133,39 @@ bool GifFormat::onSave(FileOp* fop)
                         background_color, color_map) == GIF_ERROR)
     throw Exception("Error writing GIF header.\n");
 
-  UniquePtr<Image> buffer_image;
-  UniquePtr<Image> current_image(Image::create(IMAGE_INDEXED, sprite_w, sprite_h));
-  UniquePtr<Image> previous_image(Image::create(IMAGE_INDEXED, sprite_w, sprite_h));
   int frame_x, frame_y, frame_w, frame_h;
-  int u1, v1, u2, v2;
-  int i1, j1, i2, j2;
-
-  // If the sprite is not Indexed type, we will need a temporary
-  // buffer to render the full RGB or Grayscale sprite.
-  if (sprite_format != IMAGE_INDEXED)
-    buffer_image.reset(Image::create(sprite_format, sprite_w, sprite_h));
-
-  clear_image(current_image, background_color);
-  clear_image(previous_image, background_color);
-
   ColorMapObject* image_color_map = NULL;
 
-  render::Render render;
-  render.setBgType(render::BgType::NONE);
+  // EGifPutLine() masks the given pixels in-place, so each scanline
+  // is copied here (the frame is still used by other threads to
+  // compare it with the next one).
+  std::vector<GifPixelType> scanline(sprite_w);
 
-  // Check if the user wants one optimized palette for all frames.
-  if (sprite_format != IMAGE_INDEXED &&
-      gif_options->quantize() == GifOptions::QuantizeAll) {
-    // Feed the optimizer with all rendered frames.
-    render::PaletteOptimizer optimizer;
-    for (frame_t frame_num(0); frame_num<sprite->totalFrames(); ++frame_num) {
-      clear_image(buffer_image, background_color);
-      render.renderSprite(buffer_image, sprite, frame_num);
-      optimizer.feedWithImage(buffer_image);
-    }
+  // Frames are rendered and converted to indexed in other threads.
+  GifFramesRenderer renderer(sprite, gif_options.get(),
+                             background_color, transparent_index, has_background);
 
-    current_palette.makeBlack();
-    optimizer.calculate(&current_palette, has_background);
+  // Check if the user wants one optimized palette for all frames.
+  bool quantize_all = (sprite_format != IMAGE_INDEXED &&
+                       gif_options->quantize() == GifOptions::QuantizeAll);
+  if (quantize_all)
+    renderer.calculatePalette(fop, &current_palette);
 
-    rgbmap.regenerate(&current_palette, transparent_index);
-  }
+  // Index used for pixels that didn't change from the previous frame
+  int unchanged_index = renderer.unchangedIndex();
 
+  const GifFramesRenderer::Frame* next_frame = &renderer.frame(frame_t(0));
   for (frame_t frame_num(0); frame_num<sprite->totalFrames(); ++frame_num) {
-    // If the sprite is RGB or Grayscale, we must to convert it to Indexed on the fly.
-    if (sprite_format != IMAGE_INDEXED) {
-      clear_image(buffer_image, background_color);
-      render.renderSprite(buffer_image, sprite, frame_num);
-
-      switch (gif_options->quantize()) {
-        case GifOptions::NoQuantize:
-          sprite->palette(frame_num)->copyColorsTo(&current_palette);
-          rgbmap.regenerate(&current_palette, transparent_index);
-          break;
-        case GifOptions::QuantizeEach:
-          {
-            current_palette.makeBlack();
-
-            std::vector<Image*> imgarray(1);
-            imgarray[0] = buffer_image;
-            render::create_palette_from_images(imgarray, &current_palette, has_background);
-            rgbmap.regenerate(&current_palette, transparent_index);
-          }
-          break;
-        case GifOptions::QuantizeAll:
-          // Do nothing, we've already calculate the palette for all frames.
-          break;
-      }
+    const GifFramesRenderer::Frame& frame = *next_frame;
+    Image* current_image = frame.image;
+    frame.palette.copyColorsTo(&current_palette);
 
-      render::convert_pixel_format(
-        buffer_image,
-        current_image,
-        IMAGE_INDEXED,
-        gif_options->dithering(),
-        &rgbmap,
-        &current_palette,
-        has_background);
-    }
-    // If the sprite is Indexed, we can render directly into "current_image".
-    else {
-      clear_image(current_image, background_color);
-      render.renderSprite(current_image, sprite, frame_num);
-    }
+    // The next frame is needed to know the disposal method of this one.
+    next_frame = (frame_num+1 < sprite->totalFrames() ? &renderer.frame(frame_num+1): nullptr);
+
+    int disposal_method = (sprite->backgroundLayer() ? DISPOSAL_METHOD_DO_NOT_DISPOSE:
+                                                       DISPOSAL_METHOD_RESTORE_BGCOLOR);
+    int frame_transparent_index = transparent_index;
 
     if (frame_num == 0) {
       frame_x = 0;
@@ -697,15 +1173,64 @@ bool GifFormat::onSave(FileOp* fop)
       frame_w = sprite->width();
       frame_h = sprite->height();
     }
-    else {
+    else if (unchanged_index < 0) {
       // Get the rectangle where start differences with the previous frame.
-      if (get_shrink_rect2(&u1, &v1, &u2, &v2, current_image, previous_image)) {
+      if (frame.changed) {
         // Check the minimal area with the background color.
-        if (get_shrink_rect(&i1, &j1, &i2, &j2, current_image, background_color)) {
-          frame_x = MIN(u1, i1);
-          frame_y = MIN(v1, j1);
-          frame_w = MAX(u2, i2) - MIN(u1, i1) + 1;
-          frame_h = MAX(v2, j2) - MIN(v1, j1) + 1;
+        if (frame.hasContent) {
+          frame_x = MIN(frame.u1, frame.i1);
+          frame_y = MIN(frame.v1, frame.j1);
+          frame_w = MAX(frame.u2, frame.i2) - MIN(frame.u1, frame.i1) + 1;
+          frame_h = MAX(frame.v2, frame.j2) - MIN(frame.v1, frame.j1) + 1;
+        }
+      }
+    }
+    // Optimized frame: only the changed pixels are drawn over the
+    // previous frame, the other ones use the unchanged index.
+    else if (frame.incremental) {
+      current_image = frame.optimized;
+      frame_transparent_index = unchanged_index;
+      get_frame_bounds(frame.changed, frame.u1, frame.v1, frame.u2, frame.v2,
+                       frame_x, frame_y, frame_w, frame_h);
+    }
+    // The previous frame was cleared (transparent GIF) so we have to
+    // draw all the content of the frame.
+    else if (!has_background) {
+      get_frame_bounds(frame.hasContent, frame.i1, frame.j1, frame.i2, frame.j2,
+                       frame_x, frame_y, frame_w, frame_h);
+    }
+    // The previous frame is still there, but if the palette is
+    // different we have to draw all pixels again.
+    else if (frame.samePalette) {
+      get_frame_bounds(frame.changed, frame.u1, frame.v1, frame.u2, frame.v2,
+                       frame_x, frame_y, frame_w, frame_h);
+    }
+    else {
+      frame_x = 0;
+      frame_y = 0;
+      frame_w = sprite->width();
+      frame_h = sprite->height();
+    }
+
+    if (unchanged_index >= 0) {
+      if (has_background)
+        disposal_method = DISPOSAL_METHOD_DO_NOT_DISPOSE;
+      // In transparent GIF files, pixels can be cleared only
+      // restoring the background, so this frame is kept only if the
+      // next one can be drawn over it.
+      else if (next_frame && next_frame->incremental)
+        disposal_method = DISPOSAL_METHOD_DO_NOT_DISPOSE;
+      else {
+        disposal_method = DISPOSAL_METHOD_RESTORE_BGCOLOR;
+
+        // The whole content of this frame must be cleared.
+        if (frame_num > 0 && frame.hasContent) {
+          int x2 = MAX(frame_x+frame_w-1, frame.i2);
+          int y2 = MAX(frame_y+frame_h-1, frame.j2);
+          frame_x = MIN(frame_x, frame.i1);
+          frame_y = MIN(frame_y, frame.j1);
+          frame_w = x2 - frame_x + 1;
+          frame_h = y2 - frame_y + 1;
         }
       }
     }
@@ -752,15 +1277,13 @@ bool GifFormat::onSave(FileOp* fop)
     // frame and maybe the transparency index).
     {
       unsigned char extension_bytes[5];
-      int disposal_method = (sprite->backgroundLayer() ? DISPOSAL_METHOD_DO_NOT_DISPOSE:
-                                                         DISPOSAL_METHOD_RESTORE_BGCOLOR);
       int frame_delay = sprite->frameDuration(frame_num) / 10;
 
       extension_bytes[0] = (((disposal_method & 7) << 2) |
-                            (transparent_index >= 0 ? 1: 0));
+                            (frame_transparent_index >= 0 ? 1: 0));
       extension_bytes[1] = (frame_delay & 0xff);
       extension_bytes[2] = (frame_delay >> 8) & 0xff;
-      extension_bytes[3] = (transparent_index >= 0 ? transparent_index: 0);
+      extension_bytes[3] = (frame_transparent_index >= 0 ? frame_transparent_index: 0);
 
       if (EGifPutExtension(gif_file, GRAPHICS_EXT_FUNC_CODE, 4, extension_bytes) == GIF_ERROR)
         throw Exception("Error writing GIF graphics extension record for frame %d.\n", (int)frame_num);
@@ -769,17 +1292,32 @@ bool GifFormat::onSave(FileOp* fop)
     // Image color map
     if ((!color_map && frame_num == 0) ||
         (current_palette.countDiff(&previous_palette, NULL, NULL) > 0)) {
+      // Palettes of different frames can have different sizes.
+      int image_color_map_size =
+        get_color_map_size(MAX(current_palette.size(), unchanged_index+1));
+
+      if (image_color_map && image_color_map->ColorCount != image_color_map_size) {
+        GifFreeMapObject(image_color_map);
+        image_color_map = NULL;
+      }
+
       if (!image_color_map) {
-        image_color_map = GifMakeMapObject(current_palette.size(), NULL);
+        image_color_map = GifMakeMapObject(image_color_map_size, NULL);
         if (image_color_map == NULL)
           throw std::bad_alloc();
       }
 
-      for (int i = 0; i < current_palette.size(); ++i) {
+      int i;
+      for (i = 0; i < current_palette.size(); ++i) {
         image_color_map->Colors[i].Red   = rgba_getr(current_palette.getEntry(i));
         image_color_map->Colors[i].Green = rgba_getg(current_palette.getEntry(i));
         image_color_map->Colors[i].Blue  = rgba_getb(current_palette.getEntry(i));
       }
+      for (; i < image_color_map_size; ++i) {
+        image_color_map->Colors[i].Red   = 0;
+        image_color_map->Colors[i].Green = 0;
+        image_color_map->Colors[i].Blue  = 0;
+      }
 
       current_palette.copyColorsTo(&previous_palette);
     }
@@ -798,8 +1336,9 @@ bool GifFormat::onSave(FileOp* fop)
         for (int y = interlaced_offset[i]; y < frame_h; y += interlaced_jumps[i]) {
           IndexedTraits::address_t addr =
             (IndexedTraits::address_t)current_image->getPixelAddress(frame_x, frame_y + y);
+          std::copy(addr, addr+frame_w, scanline.begin());
 
-          if (EGifPutLine(gif_file, addr, frame_w) == GIF_ERROR)
+          if (EGifPutLine(gif_file, &scanline[0], frame_w) == GIF_ERROR)
             throw Exception("Error writing GIF image scanlines for frame %d.\n", (int)frame_num);
         }
     }
@@ -808,15 +1347,22 @@ bool GifFormat::onSave(FileOp* fop)
       for (int y=0; y<frame_h; ++y) {
         IndexedTraits::address_t addr =
           (IndexedTraits::address_t)current_image->getPixelAddress(frame_x, frame_y + y);
+        std::copy(addr, addr+frame_w, scanline.begin());
 
-        if (EGifPutLine(gif_file, addr, frame_w) == GIF_ERROR)
+        if (EGifPutLine(gif_file, &scanline[0], frame_w) == GIF_ERROR)
           throw Exception("Error writing GIF image scanlines for frame %d.\n", (int)frame_num);
       }
     }
 
-    copy_image(previous_image, current_image);
+    if (quantize_all)
+      fop_progress(fop, 0.5 + 0.5 * (frame_num+1) / sprite->totalFrames());
+    else
+      fop_progress(fop, double(frame_num+1) / sprite->totalFrames());
   }
 
+  if (image_color_map)
+    GifFreeMapObject(image_color_map);
+
   return true;
 #endif
 }
@@ -824,7 +1370,9 @@ bool GifFormat::onSave(FileOp* fop)
 base::SharedPtr<FormatOptions> GifFormat::onGetFormatOptions(FileOp* fop)
 {
   base::SharedPtr<GifOptions> gif_options;
-  if (fop->document->getFormatOptions())
+  // The document can contain options of other format (e.g. it was
+  // loaded/saved as .ase file)
+  if (dynamic_cast<GifOptions*>(fop->document->getFormatOptions().get()))
     gif_options = base::SharedPtr<GifOptions>(fop->document->getFormatOptions());
 
   if (!gif_options)
@@ -839,7 +1387,15 @@ base::SharedPtr<FormatOptions> GifFormat::onGetFormatOptions(FileOp* fop)
     gif_options->setQuantize((GifOptions::Quantize)get_config_int("GIF", "Quantize", (int)gif_options->quantize()));
     gif_options->setInterlaced(get_config_bool("GIF", "Interlaced", gif_options->interlaced()));
     gif_options->setLoop(get_config_bool("GIF", "Loop", gif_options->loop()));
-    gif_options->setDithering((doc::DitheringMethod)get_config_int("GIF", "Dither", (int)gif_options->dithering()));
+    gif_options->setOptimizeFrames(get_config_bool("GIF", "OptimizeFrames", gif_options->optimizeFrames()));
+
+    // Unknown dithering methods (e.g. an invalid value in the
+    // configuration file) are not used
+    int dither = get_config_int("GIF", "Dither", (int)gif_options->dithering());
+    if (dither < int(doc::DitheringMethod::NONE) ||
+        dither > int(doc::DitheringMethod::SIERRA))
+      dither = int(doc::DitheringMethod::NONE);
+    gif_options->setDithering((doc::DitheringMethod)dither);
 
     // Load the window to ask to the user the GIF options he wants.
 
@@ -853,9 +1409,15 @@ base::SharedPtr<FormatOptions> GifFormat::onGetFormatOptions(FileOp* fop)
     }
     win.interlaced()->setSelected(gif_options->interlaced());
     win.loop()->setSelected(gif_options->loop());
+    win.optimizeFrames()->setSelected(gif_options->optimizeFrames());
 
-    win.dither()->setEnabled(true);
-    win.dither()->setSelected(gif_options->dithering() == doc::DitheringMethod::ORDERED);
+    // Items in the same order as doc::DitheringMethod values
+    win.dither()->addItem("None");
+    win.dither()->addItem("Ordered");
+    win.dither()->addItem("Floyd-Steinberg");
+    win.dither()->addItem("Atkinson");
+    win.dither()->addItem("Sierra");
+    win.dither()->setSelectedItemIndex(int(gif_options->dithering()));
 
     win.openWindowInForeground();
 
@@ -869,13 +1431,13 @@ base::SharedPtr<FormatOptions> GifFormat::onGetFormatOptions(FileOp* fop)
 
       gif_options->setInterlaced(win.interlaced()->isSelected());
       gif_options->setLoop(win.loop()->isSelected());
-      gif_options->setDithering(win.dither()->isSelected() ?
-        doc::DitheringMethod::ORDERED:
-        doc::DitheringMethod::NONE);
+      gif_options->setOptimizeFrames(win.optimizeFrames()->isSelected());
+      gif_options->setDithering((doc::DitheringMethod)win.dither()->getSelectedItemIndex());
 
       set_config_int("GIF", "Quantize", gif_options->quantize());
       set_config_bool("GIF", "Interlaced", gif_options->interlaced());
       set_config_bool("GIF", "Loop", gif_options->loop());
+      set_config_bool("GIF", "OptimizeFrames", gif_options->optimizeFrames());
       set_config_int("GIF", "Dither", int(gif_options->dithering()));
     }
     else {
@@ -23,11 +23,13 @@ namespace app {
       Quantize quantize = QuantizeEach,
       bool interlaced = false,
       bool loop = true,
-      DitheringMethod dithering = doc::DitheringMethod::NONE)
+      DitheringMethod dithering = doc::DitheringMethod::NONE,
+      bool optimizeFrames = true)
       : m_quantize(quantize)
       , m_interlaced(interlaced)
       , m_loop(loop)
-      , m_dithering(dithering) {
+      , m_dithering(dithering)
+      , m_optimizeFrames(optimizeFrames) {
     }
 
     Quantize quantize() const { return m_quantize; }
@@ -35,16 +37,23 @@ namespace app {
     bool loop() const { return m_loop; }
     doc::DitheringMethod dithering() const { return m_dithering; }
 
+    // True if pixels that didn't change from the previous frame are
+    // saved with the transparent index (so they are compressed in
+    // long runs of the same index).
+    bool optimizeFrames() const { return m_optimizeFrames; }
+
     void setQuantize(const Quantize quantize) { m_quantize = quantize; }
     void setInterlaced(bool interlaced) { m_interlaced = interlaced; }
     void setLoop(bool loop) { m_loop = loop; }
     void setDithering(const doc::DitheringMethod dithering) { m_dithering = dithering; }
+    void setOptimizeFrames(bool state) { m_optimizeFrames = state; }
 
   private:
     Quantize m_quantize;
     bool m_interlaced;
     bool m_loop;
     doc::DitheringMethod m_dithering;
+    bool m_optimizeFrames;
   };
 
 } // namespace app
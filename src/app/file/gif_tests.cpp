@@ -12,9 +12,15 @@
 #include "app/file/file.h"
 #include "app/file/file_formats_manager.h"
 #include "app/file/gif_options.h"
+#include "base/fs.h"
 #include "doc/doc.h"
 #include "doc/test_context.h"
 
+#include <chrono>
+#include <cstdio>
+#include <set>
+#include <vector>
+
 using namespace app;
 
 class GifFormat : public ::testing::Test {
@@ -178,6 +184,60 @@ TEST_F(GifFormat, TransparentIndexed)
   }
 }
 
+// The color map of these palettes must be rounded up to the next
+// power of two (8 and 16 entries).
+TEST_F(GifFormat, IndexedColorMapSizes)
+{
+  const char* fn = "test.gif";
+
+  for (int ncolors : { 5, 9 }) {
+    for (bool background : { false, true }) {
+      {
+        doc::Document* doc = m_ctx.documents().add(ncolors, 1, doc::ColorMode::INDEXED, ncolors);
+        Sprite* sprite = doc->sprite();
+        doc->setFilename(fn);
+
+        Palette* pal = sprite->palette(frame_t(0));
+        for (int i=0; i<ncolors; ++i)
+          pal->setEntry(i, rgba(25*i, 255-20*i, 7*i, 255));
+
+        LayerImage* layer = dynamic_cast<LayerImage*>(sprite->folder()->getFirstLayer());
+        ASSERT_NE((LayerImage*)NULL, layer);
+        layer->setBackground(background);
+
+        Image* image = layer->cel(frame_t(0))->image();
+        for (int i=0; i<ncolors; ++i)
+          image->putPixel(i, 0, i);
+
+        save_document(&m_ctx, doc);
+
+        doc->close();
+        delete doc;
+      }
+
+      {
+        app::Document* doc = load_document(&m_ctx, fn);
+        Sprite* sprite = doc->sprite();
+
+        LayerImage* layer = dynamic_cast<LayerImage*>(sprite->folder()->getFirstLayer());
+        ASSERT_NE((LayerImage*)NULL, layer);
+        EXPECT_EQ(background, layer->isBackground());
+
+        Palette* pal = sprite->palette(frame_t(0));
+        Image* image = layer->cel(frame_t(0))->image();
+        if (!background)
+          EXPECT_EQ(0, image->getPixel(0, 0));
+        for (int i=(background ? 0: 1); i<ncolors; ++i)
+          EXPECT_EQ(rgba(25*i, 255-20*i, 7*i, 255), pal->getEntry(image->getPixel(i, 0)))
+            << "colors " << ncolors << " background " << background << " entry " << i;
+
+        doc->close();
+        delete doc;
+      }
+    }
+  }
+}
+
 TEST_F(GifFormat, TransparentRgbQuantization)
 {
   const char* fn = "test.gif";
@@ -330,3 +390,251 @@ TEST_F(GifFormat, OpaqueRgbQuantizationTwoLayers)
     delete doc;
   }
 }
+
+// Saves an RGB animation with one palette for all frames, loads it
+// and checks some frames. The frames contain a square moving over a
+// background with less than 256 colors, so the quantization must
+// keep the exact colors. Returns the seconds to save it.
+static double save_and_check_rgb_animation_quantize_all(app::Context* ctx, const int frames)
+{
+  const char* fn = "test.gif";
+  const int w = 320, h = 240;
+  const int size = 32;
+  double seconds = 0.0;
+
+  {
+    app::Document* doc(static_cast<app::Document*>(ctx->documents().add(w, h, doc::ColorMode::RGB, 256)));
+    Sprite* sprite = doc->sprite();
+    doc->setFilename(fn);
+    sprite->setTotalFrames(frame_t(frames));
+
+    LayerImage* layer = dynamic_cast<LayerImage*>(sprite->folder()->getFirstLayer());
+    EXPECT_NE((LayerImage*)NULL, layer);
+    layer->setBackground(true);
+
+    for (frame_t f(0); f<frames; ++f) {
+      ImageRef image;
+      if (f == 0)
+        image = layer->cel(f)->imageRef();
+      else {
+        image.reset(Image::create(IMAGE_RGB, w, h));
+        layer->addCel(new Cel(f, image));
+      }
+
+      for (int y=0; y<h; ++y)
+        for (int x=0; x<w; ++x)
+          image->putPixel(x, y, rgba(24*(x/32), 32*(y/32), 128, 255));
+
+      int x = f % (w-size);
+      fill_rect(image.get(), x, 100, x+size-1, 100+size-1, rgba(255, 255, 0, 255));
+    }
+
+    doc->setFormatOptions(base::SharedPtr<FormatOptions>(new GifOptions(GifOptions::QuantizeAll)));
+
+    auto t0 = std::chrono::steady_clock::now();
+    save_document(ctx, doc);
+    auto t1 = std::chrono::steady_clock::now();
+    seconds = std::chrono::duration<double>(t1-t0).count();
+
+    doc->close();
+    delete doc;
+  }
+
+  {
+    app::Document* doc = load_document(ctx, fn);
+    Sprite* sprite = doc->sprite();
+    EXPECT_EQ(frames, sprite->totalFrames());
+
+    LayerImage* layer = dynamic_cast<LayerImage*>(sprite->folder()->getFirstLayer());
+    EXPECT_NE((LayerImage*)NULL, layer);
+
+    const frame_t checkFrames[] = { 0, 1, frames/2, frames-1 };
+    for (frame_t f : checkFrames) {
+      Palette* pal = sprite->palette(f);
+      Image* image = layer->cel(f)->image();
+      int x = f % (w-size);
+      EXPECT_EQ(rgba(255, 255, 0, 255), pal->getEntry(image->getPixel(x, 100)));
+      EXPECT_EQ(rgba(255, 255, 0, 255), pal->getEntry(image->getPixel(x+size-1, 100+size-1)));
+      EXPECT_EQ(rgba(24*((x+size)/32), 32*(100/32), 128, 255),
+                pal->getEntry(image->getPixel(x+size, 100)));
+      EXPECT_EQ(rgba(24*((w-1)/32), 32*((h-1)/32), 128, 255),
+                pal->getEntry(image->getPixel(w-1, h-1)));
+    }
+
+    doc->close();
+    delete doc;
+  }
+
+  return seconds;
+}
+
+TEST_F(GifFormat, RgbAnimationQuantizeAll)
+{
+  save_and_check_rgb_animation_quantize_all(&m_ctx, 12);
+}
+
+// Prints the time to save a long RGB animation with one palette for
+// all frames. Run it with --gtest_also_run_disabled_tests.
+TEST_F(GifFormat, DISABLED_LongRgbAnimationQuantizeAllBenchmark)
+{
+  const int frames = 500;
+  double seconds = save_and_check_rgb_animation_quantize_all(&m_ctx, frames);
+  std::printf("Saved %d frames of 320x240 in %.2f s\n", frames, seconds);
+}
+
+// Draws the frame "f" of an indexed animation where most pixels
+// don't change (the bottom half), others move, appear and disappear.
+TEST_F(GifFormat, RgbAnimationQuantizeEach)
+{
+  const char* fn = "test.gif";
+  const int w = 8, h = 8;
+  const int ncolors = 40;
+
+  {
+    app::Document* doc(static_cast<app::Document*>(m_ctx.documents().add(w, h, doc::ColorMode::RGB, 256)));
+    Sprite* sprite = doc->sprite();
+    doc->setFilename(fn);
+    sprite->setTotalFrames(frame_t(2));
+
+    LayerImage* layer = dynamic_cast<LayerImage*>(sprite->folder()->getFirstLayer());
+    ASSERT_NE((LayerImage*)NULL, layer);
+    layer->setBackground(true);
+
+    // The first frame has just one color and the second one has
+    // several colors (each one in a different histogram entry).
+    Image* image = layer->cel(frame_t(0))->image();
+    clear_image(image, rgba(0, 0, 0, 255));
+
+    ImageRef image2(Image::create(IMAGE_RGB, w, h));
+    clear_image(image2.get(), rgba(0, 0, 0, 255));
+    for (int i=0; i<ncolors; ++i)
+      image2->putPixel(i % w, i / w, rgba(32*(i%8), 50*(i/8), 128, 255));
+    layer->addCel(new Cel(frame_t(1), image2));
+
+    doc->setFormatOptions(base::SharedPtr<FormatOptions>(new GifOptions(GifOptions::QuantizeEach)));
+    save_document(&m_ctx, doc);
+
+    doc->close();
+    delete doc;
+  }
+
+  {
+    app::Document* doc = load_document(&m_ctx, fn);
+    Sprite* sprite = doc->sprite();
+    ASSERT_EQ(2, sprite->totalFrames());
+
+    LayerImage* layer = dynamic_cast<LayerImage*>(sprite->folder()->getFirstLayer());
+    ASSERT_NE((LayerImage*)NULL, layer);
+
+    // The palette of the second frame is not limited by the number
+    // of colors of the first frame.
+    Palette* pal = sprite->palette(frame_t(1));
+    Image* image = layer->cel(frame_t(1))->image();
+    std::set<color_t> colors;
+    for (int i=0; i<ncolors; ++i)
+      colors.insert(pal->getEntry(image->getPixel(i % w, i / w)));
+    EXPECT_EQ(ncolors, int(colors.size()));
+
+    doc->close();
+    delete doc;
+  }
+}
+
+static void draw_optimized_frame(Image* image, int f, color_t bg)
+{
+  clear_image(image, bg);
+
+  for (int y=image->height()/2; y<image->height(); ++y)
+    for (int x=0; x<image->width(); ++x)
+      image->putPixel(x, y, 1 + ((x ^ y) % 4));
+
+  fill_rect(image, 4*f, 28, 4*f+7, 35, 5);
+
+  if ((f % 4) == 0)
+    image->putPixel(image->width()-4, 2, 6);
+
+  if (f >= 3)
+    draw_hline(image, 10, 30, 10+4*f, 7);
+}
+
+// Saves the same animation with and without optimized frames, and
+// checks that both files are loaded with the original frames (the
+// optimized one must be smaller).
+TEST_F(GifFormat, OptimizedFrames)
+{
+  const char* fn = "test.gif";
+  const int w = 64, h = 48;
+  const int frames = 8;
+
+  for (int background=0; background<2; ++background) {
+    const color_t bg = (background ? 1: 0);
+    std::vector<size_t> sizes;
+
+    for (int optimize=0; optimize<2; ++optimize) {
+      {
+        app::Document* doc(static_cast<app::Document*>(m_ctx.documents().add(w, h, doc::ColorMode::INDEXED, 8)));
+        Sprite* sprite = doc->sprite();
+        doc->setFilename(fn);
+        sprite->setTotalFrames(frame_t(frames));
+
+        Palette* pal = sprite->palette(frame_t(0));
+        for (int i=0; i<8; ++i)
+          pal->setEntry(i, rgba(32*i, 255-32*i, 128, 255));
+
+        LayerImage* layer = dynamic_cast<LayerImage*>(sprite->folder()->getFirstLayer());
+        ASSERT_NE((LayerImage*)NULL, layer);
+        if (background)
+          layer->setBackground(true);
+
+        for (frame_t f(0); f<frames; ++f) {
+          ImageRef image;
+          if (f == 0)
+            image = layer->cel(f)->imageRef();
+          else {
+            image.reset(Image::create(IMAGE_INDEXED, w, h));
+            layer->addCel(new Cel(f, image));
+          }
+          draw_optimized_frame(image.get(), f, bg);
+        }
+
+        doc->setFormatOptions(
+          base::SharedPtr<FormatOptions>(
+            new GifOptions(GifOptions::NoQuantize, true, true,
+                           DitheringMethod::NONE, optimize == 1)));
+        save_document(&m_ctx, doc);
+
+        doc->close();
+        delete doc;
+      }
+
+      sizes.push_back(base::file_size(fn));
+
+      {
+        app::Document* doc = load_document(&m_ctx, fn);
+        Sprite* sprite = doc->sprite();
+        EXPECT_EQ(frames, sprite->totalFrames());
+
+        LayerImage* layer = dynamic_cast<LayerImage*>(sprite->folder()->getFirstLayer());
+        ASSERT_NE((LayerImage*)NULL, layer);
+
+        // Opaque sprites must be loaded with a background layer
+        if (background)
+          ASSERT_TRUE(layer->isBackground()) << "optimize " << optimize;
+        else
+          ASSERT_FALSE(layer->isBackground()) << "optimize " << optimize;
+
+        ImageRef expected(Image::create(IMAGE_INDEXED, w, h));
+        for (frame_t f(0); f<frames; ++f) {
+          draw_optimized_frame(expected.get(), f, bg);
+          EXPECT_EQ(0, count_diff_between_images(expected.get(), layer->cel(f)->image()))
+            << "frame " << f << " background " << background << " optimize " << optimize;
+        }
+
+        doc->close();
+        delete doc;
+      }
+    }
+
+    EXPECT_LT(sizes[1], sizes[0]) << "background " << background;
+  }
+}
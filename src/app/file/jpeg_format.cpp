@@ -352,7 +352,9 @@ bool JpegFormat::onSave(FileOp* fop)
 base::SharedPtr<FormatOptions> JpegFormat::onGetFormatOptions(FileOp* fop)
 {
   base::SharedPtr<JpegOptions> jpeg_options;
-  if (fop->document->getFormatOptions())
+  // The document can contain options of other format (e.g. it was
+  // loaded/saved as .ase file)
+  if (dynamic_cast<JpegOptions*>(fop->document->getFormatOptions().get()))
     jpeg_options = base::SharedPtr<JpegOptions>(fop->document->getFormatOptions());
 
   if (!jpeg_options)
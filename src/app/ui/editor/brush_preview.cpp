@@ -180,7 +180,7 @@ void BrushPreview::show(const gfx::Point& screenPos)
     }
 
     document->notifySpritePixelsModified(
-      sprite, gfx::Region(m_lastBounds = brushBounds));
+      sprite, gfx::Region(m_lastBounds = brushBounds), layer);
   }
 
   // Save area and draw the cursor
@@ -232,7 +232,7 @@ void BrushPreview::hide()
       m_editor->getState()->requireBrushPreview()) {
     document->destroyExtraCel();
     document->notifySpritePixelsModified(
-      sprite, gfx::Region(m_lastBounds));
+      sprite, gfx::Region(m_lastBounds), m_editor->layer());
   }
 
   m_onScreen = false;
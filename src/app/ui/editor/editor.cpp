@@ -41,6 +41,7 @@
 #include "app/ui_context.h"
 #include "base/bind.h"
 #include "base/convert_to.h"
+#include "base/thread.h"
 #include "base/unique_ptr.h"
 #include "doc/conversion_she.h"
 #include "doc/doc.h"
@@ -434,6 +435,11 @@ void Editor::drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& sprite
     m_renderEngine.setupBackground(m_document, rendered->pixelFormat());
     m_renderEngine.disableOnionskin();
 
+    // Zero threads means one thread for each processor
+    int renderThreads = Preferences::instance().editor.renderThreads();
+    m_renderEngine.setMaxThreads(renderThreads > 0 ? renderThreads:
+                                 int(base::thread::hardware_concurrency()));
+
     if ((m_flags & kShowOnionskin) == kShowOnionskin) {
       DocumentPreferences& docPref = Preferences::instance()
         .document(m_document);
@@ -471,12 +477,15 @@ void Editor::drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& sprite
         m_layer, m_frame);
     }
 
+    m_renderEngine.setCompositeCache(&m_compositeCache, m_layer);
     m_renderEngine.renderSprite(rendered, m_sprite, m_frame,
       gfx::Clip(0, 0, rc), m_zoom);
 
+    m_renderEngine.removeCompositeCache();
     m_renderEngine.removeExtraImage();
   }
   catch (const std::exception& e) {
+    m_renderEngine.removeCompositeCache();
     Console::showException(e);
   }
 
@@ -1383,6 +1392,42 @@ void Editor::onExposeSpritePixels(doc::DocumentEvent& ev)
     m_state->onExposeSpritePixels(ev.region());
 }
 
+// Editor is added as a document observer before its DocumentView,
+// so the composite cache is invalidated before the modified areas
+// are redrawn.
+
+void Editor::onGeneralUpdate(doc::DocumentEvent& ev)
+{
+  m_compositeCache.invalidate();
+}
+
+void Editor::onSpritePixelsModified(doc::DocumentEvent& ev)
+{
+  // Pixels of the current layer are not in the composite cache
+  if (ev.sprite() == m_sprite && (!ev.layer() || ev.layer() != m_layer))
+    m_compositeCache.invalidate(ev.region());
+}
+
+void Editor::onImagePixelsModified(doc::DocumentEvent& ev)
+{
+  m_compositeCache.invalidate();
+}
+
+void Editor::onCelPositionChanged(doc::DocumentEvent& ev)
+{
+  m_compositeCache.invalidate();
+}
+
+void Editor::onCelOpacityChanged(doc::DocumentEvent& ev)
+{
+  m_compositeCache.invalidate();
+}
+
+void Editor::onLayerRestacked(doc::DocumentEvent& ev)
+{
+  m_compositeCache.invalidate();
+}
+
 void Editor::setCursor(const gfx::Point& mouseScreenPos)
 {
   bool used = false;
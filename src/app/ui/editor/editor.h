@@ -23,6 +23,7 @@
 #include "doc/image_buffer.h"
 #include "filters/tiled_mode.h"
 #include "gfx/fwd.h"
+#include "render/composite_cache.h"
 #include "render/zoom.h"
 #include "ui/base.h"
 #include "ui/cursor_type.h"
@@ -219,6 +220,12 @@ namespace app {
     void onFgColorChange();
     void onBrushSizeOrAngleChange();
     void onExposeSpritePixels(doc::DocumentEvent& ev);
+    void onGeneralUpdate(doc::DocumentEvent& ev);
+    void onSpritePixelsModified(doc::DocumentEvent& ev);
+    void onImagePixelsModified(doc::DocumentEvent& ev);
+    void onCelPositionChanged(doc::DocumentEvent& ev);
+    void onCelOpacityChanged(doc::DocumentEvent& ev);
+    void onLayerRestacked(doc::DocumentEvent& ev);
 
   private:
     void setStateInternal(const EditorStatePtr& newState);
@@ -256,6 +263,11 @@ namespace app {
     frame_t m_frame;          // Active frame in the editor
     render::Zoom m_zoom;          // Zoom in the editor
 
+    // Composite of the background and the layers below m_layer, so
+    // only m_layer and the layers above it are blended to redraw
+    // the areas modified by the user.
+    render::CompositeCache m_compositeCache;
+
     // Brush preview
     BrushPreview m_brushPreview;
 
@@ -611,7 +611,7 @@ void PixelsMovement::redrawCurrentMask()
   m_currentMask->freeze();
   clear_image(m_currentMask->bitmap(), 0);
   drawParallelogram(m_currentMask->bitmap(), m_initialMask->bitmap(),
-                    corners, bounds.getOrigin());
+                    corners, bounds.getOrigin(), &m_maskRotSpriteCache);
 
   m_currentMask->unfreeze();
 }
@@ -635,12 +635,13 @@ void PixelsMovement::drawImage(doc::Image* dst, const gfx::Point& pt, bool rende
       BlendMode::SRC);
 
   m_originalImage->setMaskColor(m_maskColor);
-  drawParallelogram(dst, m_originalImage, corners, pt);
+  drawParallelogram(dst, m_originalImage, corners, pt, &m_imageRotSpriteCache);
 }
 
 void PixelsMovement::drawParallelogram(doc::Image* dst, doc::Image* src,
   const gfx::Transformation::Corners& corners,
-  const gfx::Point& leftTop)
+  const gfx::Point& leftTop,
+  doc::algorithm::RotSpriteCache* rotSpriteCache)
 {
   tools::RotationAlgorithm rotAlgo = Preferences::instance().selection.rotationAlgorithm();
 
@@ -679,7 +680,8 @@ retry:;      // In case that we don't have enough memory for RotSprite
           int(corners.rightBottom().x-leftTop.x),
           int(corners.rightBottom().y-leftTop.y),
           int(corners.leftBottom().x-leftTop.x),
-          int(corners.leftBottom().y-leftTop.y));
+          int(corners.leftBottom().y-leftTop.y),
+          rotSpriteCache);
       }
       catch (const std::bad_alloc&) {
         StatusBar::instance()->showTip(1000,
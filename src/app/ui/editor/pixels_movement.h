@@ -15,6 +15,7 @@
 #include "base/connection.h"
 #include "base/shared_ptr.h"
 #include "doc/algorithm/flip_type.h"
+#include "doc/algorithm/rotsprite.h"
 #include "doc/site.h"
 #include "gfx/size.h"
 
@@ -99,7 +100,8 @@ namespace app {
     void drawImage(doc::Image* dst, const gfx::Point& pos, bool renderOriginalLayer);
     void drawParallelogram(doc::Image* dst, doc::Image* src,
       const gfx::Transformation::Corners& corners,
-      const gfx::Point& leftTop);
+      const gfx::Point& leftTop,
+      doc::algorithm::RotSpriteCache* rotSpriteCache);
     void updateDocumentMask();
 
     const ContextReader m_reader;
@@ -120,6 +122,12 @@ namespace app {
     Mask* m_currentMask;
     color_t m_maskColor;
     ScopedConnection m_rotAlgoConn;
+
+    // Scaled versions of m_originalImage and the m_initialMask bitmap
+    // used by RotSprite, so they aren't scaled again on each mouse
+    // movement.
+    doc::algorithm::RotSpriteCache m_imageRotSpriteCache;
+    doc::algorithm::RotSpriteCache m_maskRotSpriteCache;
   };
 
   inline PixelsMovement::MoveModifier& operator|=(PixelsMovement::MoveModifier& a,
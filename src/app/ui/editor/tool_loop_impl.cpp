@@ -190,7 +190,7 @@ public:
   }
 
   void updateDirtyArea() override {
-    m_document->notifySpritePixelsModified(m_sprite, m_dirtyArea);
+    m_document->notifySpritePixelsModified(m_sprite, m_dirtyArea, m_layer);
   }
 
   void updateStatusBar(const char* text) override {
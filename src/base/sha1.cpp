@@ -54,6 +54,30 @@ Sha1 Sha1::calculateFromFile(const std::string& fileName)
   return Sha1(digest);
 }
 
+Sha1::Calculator::Calculator()
+  : m_sha(new SHA1Context)
+{
+  SHA1Reset(m_sha);
+}
+
+Sha1::Calculator::~Calculator()
+{
+  delete m_sha;
+}
+
+void Sha1::Calculator::add(const void* data, std::size_t size)
+{
+  if (size > 0)
+    SHA1Input(m_sha, (const uint8_t*)data, (unsigned int)size);
+}
+
+Sha1 Sha1::Calculator::result()
+{
+  std::vector<uint8_t> digest(HashSize);
+  SHA1Result(m_sha, &digest[0]);
+  return Sha1(digest);
+}
+
 bool Sha1::operator==(const Sha1& other) const
 {
   return m_digest == other.m_digest;
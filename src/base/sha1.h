@@ -8,6 +8,9 @@
 #define BASE_SHA1_H_INCLUDED
 #pragma once
 
+#include "base/disable_copying.h"
+
+#include <cstddef>
 #include <vector>
 #include <string>
 
@@ -25,6 +28,25 @@ namespace base {
     // Calculates the SHA1 of the given file.
     static Sha1 calculateFromFile(const std::string& fileName);
 
+    // Calculates the SHA1 of a sequence of bytes given in several
+    // calls to add().
+    class Calculator {
+    public:
+      Calculator();
+      ~Calculator();
+
+      void add(const void* data, std::size_t size);
+
+      // Returns the SHA1 of all added bytes. The calculator cannot be
+      // used after calling this function.
+      Sha1 result();
+
+    private:
+      SHA1Context* m_sha;
+
+      DISABLE_COPYING(Calculator);
+    };
+
     bool operator==(const Sha1& other) const;
     bool operator!=(const Sha1& other) const;
 
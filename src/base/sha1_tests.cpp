@@ -0,0 +1,48 @@
+// Aseprite Base Library
+// Copyright (c) 2001-2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+
+#include "base/convert_to.h"
+#include "base/sha1.h"
+
+using namespace base;
+
+static std::string sha1_of(const char* str)
+{
+  Sha1::Calculator calc;
+  calc.add(str, std::strlen(str));
+  return convert_to<std::string>(calc.result());
+}
+
+TEST(Sha1, Calculator)
+{
+  EXPECT_EQ("da39a3ee5e6b4b0d3255bfef95601890afd80709", sha1_of(""));
+  EXPECT_EQ("a9993e364706816aba3e25717850c26c9cd0d89d", sha1_of("abc"));
+  EXPECT_EQ("84983e441c3bd26ebaae4aa1f95129e5e54670f1",
+            sha1_of("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"));
+}
+
+TEST(Sha1, CalculatorInParts)
+{
+  const char* str = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+  for (int i=0; i<=int(std::strlen(str)); ++i) {
+    Sha1::Calculator calc;
+    calc.add(str, i);
+    calc.add(str+i, std::strlen(str)-i);
+    EXPECT_EQ("84983e441c3bd26ebaae4aa1f95129e5e54670f1",
+              convert_to<std::string>(calc.result()));
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -43,6 +43,10 @@ namespace base {                // Based on C++0x threads lib
 
     native_handle_type native_handle();
 
+    // Returns the number of concurrent threads supported by the
+    // hardware (number of logical processors), or 1 if it's unknown.
+    static unsigned hardware_concurrency();
+
     class details {
     public:
       static void thread_proxy(void* data);
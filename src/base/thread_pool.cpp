@@ -0,0 +1,167 @@
+// Aseprite Base Library
+// Copyright (c) 2001-2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "base/thread_pool.h"
+
+#include "base/exception.h"
+#include "base/scoped_lock.h"
+#include "base/thread.h"
+
+namespace base {
+
+class ThreadPool::Task {
+public:
+  Task(const Job& job, unsigned int number)
+    : job(job), number(number), done(false) { }
+
+  Job job;
+  unsigned int number;          // Order of the job in the queue
+  bool done;
+  std::exception_ptr error;     // Exception thrown by the job
+};
+
+ThreadPool::ThreadPool(int threads)
+  : m_lastTask(0)
+  , m_done(false)
+{
+  for (int i=0; i<threads; ++i)
+    m_threads.push_back(
+      new base::thread(&ThreadPool::worker_proc, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    base::scoped_lock lock(m_mutex);
+    m_done = true;
+
+    // Jobs waiting a discarded job fail with an exception
+    for (const TaskRef& task : m_tasks) {
+      task->error = std::make_exception_ptr(base::Exception("The job was cancelled"));
+      task->done = true;
+    }
+    m_tasks.clear();
+  }
+  m_cond.notify_all();
+
+  for (base::thread* thread : m_threads) {
+    thread->join();
+    delete thread;
+  }
+}
+
+ThreadPool::TaskRef ThreadPool::execute(const Job& job)
+{
+  TaskRef task;
+  {
+    base::scoped_lock lock(m_mutex);
+    task.reset(new Task(job, ++m_lastTask));
+    m_tasks.push_back(task);
+  }
+  m_cond.notify_all();
+  return task;
+}
+
+void ThreadPool::wait(const TaskRef& task)
+{
+  std::exception_ptr error = waitTask(task);
+  if (error)
+    std::rethrow_exception(error);
+}
+
+void ThreadPool::run(const std::vector<Job>& jobs)
+{
+  if (jobs.empty())
+    return;
+
+  std::vector<TaskRef> tasks;
+  for (std::size_t i=1; i<jobs.size(); ++i)
+    tasks.push_back(execute(jobs[i]));
+
+  Task first(jobs[0], 0);
+  runTask(&first);
+  std::exception_ptr error = first.error;
+
+  // The workers cannot use "jobs" after this function returns, so we
+  // wait all of them even if one has failed.
+  for (const TaskRef& task : tasks) {
+    std::exception_ptr taskError = waitTask(task);
+    if (!error)
+      error = taskError;
+  }
+
+  // Rethrow the first exception thrown by a job in this thread
+  if (error)
+    std::rethrow_exception(error);
+}
+
+std::exception_ptr ThreadPool::waitTask(const TaskRef& task)
+{
+  base::scoped_lock lock(m_mutex);
+  while (!task->done) {
+    // Run the oldest pending job if it was added before the waited
+    // one (it can be the waited job itself).
+    if (!m_tasks.empty() &&
+        int(m_tasks.front()->number - task->number) <= 0) {
+      TaskRef next = m_tasks.front();
+      m_tasks.pop_front();
+
+      m_mutex.unlock();
+      runTask(next.get());
+      m_mutex.lock();
+    }
+    else
+      m_cond.wait(m_mutex);
+  }
+  return task->error;
+}
+
+// Runs the job catching any exception, so a failed job is marked as
+// done too (and the worker thread is not terminated).
+void ThreadPool::runTask(Task* task)
+{
+  std::exception_ptr error;
+  try {
+    task->job();
+  }
+  catch (...) {
+    error = std::current_exception();
+  }
+
+  {
+    base::scoped_lock lock(m_mutex);
+    task->error = error;
+    task->done = true;
+  }
+  m_cond.notify_all();
+}
+
+// static
+void ThreadPool::worker_proc(ThreadPool* self)
+{
+  while (true) {
+    TaskRef task;
+    {
+      base::scoped_lock lock(self->m_mutex);
+      while (!self->m_done && self->m_tasks.empty())
+        self->m_cond.wait(self->m_mutex);
+
+      if (self->m_done)
+        break;
+
+      task = self->m_tasks.front();
+      self->m_tasks.pop_front();
+    }
+
+    self->runTask(task.get());
+  }
+}
+
+} // namespace base
@@ -0,0 +1,76 @@
+// Aseprite Base Library
+// Copyright (c) 2001-2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef BASE_THREAD_POOL_H_INCLUDED
+#define BASE_THREAD_POOL_H_INCLUDED
+#pragma once
+
+#include "base/disable_copying.h"
+#include "base/mutex.h"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace base {
+
+  class thread;
+
+  // Worker threads that run jobs in the same order they are added.
+  // The threads are created once and wait for new jobs.
+  //
+  // A thread waiting for a job helps running the jobs that were added
+  // before it, so a job can wait for older jobs without blocking the
+  // pool (and all jobs run in the waiting thread if there are no
+  // workers).
+  class ThreadPool {
+  public:
+    typedef std::function<void()> Job;
+    class Task;
+    typedef std::shared_ptr<Task> TaskRef;
+
+    explicit ThreadPool(int threads);
+
+    // Pending jobs are discarded (the running ones are finished, and
+    // if they wait a discarded job, wait() throws an exception).
+    ~ThreadPool();
+
+    int size() const { return int(m_threads.size()); }
+
+    // Adds a job to the queue and returns immediately.
+    TaskRef execute(const Job& job);
+
+    // Returns when the job is done. If the job threw an exception, it
+    // is rethrown here.
+    void wait(const TaskRef& task);
+
+    // Runs the first job in the caller thread and the other ones in
+    // the worker threads (or in the caller thread if all workers are
+    // busy). Returns when all jobs are done. If a job throws an
+    // exception, the first one is rethrown here.
+    void run(const std::vector<Job>& jobs);
+
+  private:
+    std::exception_ptr waitTask(const TaskRef& task);
+    void runTask(Task* task);
+    static void worker_proc(ThreadPool* self);
+
+    std::vector<base::thread*> m_threads;
+    base::mutex m_mutex;
+    std::condition_variable_any m_cond; // Notified when a job is added/done or m_done is set
+    std::deque<TaskRef> m_tasks;        // Pending jobs (the oldest one first)
+    unsigned int m_lastTask;            // Number of the last added job
+    bool m_done;
+
+    DISABLE_COPYING(ThreadPool);
+  };
+
+} // namespace base
+
+#endif
@@ -0,0 +1,143 @@
+// Aseprite Base Library
+// Copyright (c) 2001-2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#include <gtest/gtest.h>
+
+#include "base/thread_pool.h"
+
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+using namespace base;
+
+// The same workers run the jobs of each call (there can be more jobs
+// than threads).
+TEST(ThreadPool, ReuseWorkers)
+{
+  ThreadPool pool(3);
+  EXPECT_EQ(3, pool.size());
+
+  for (int step=0; step<100; ++step) {
+    int njobs = 1 + (step % 8);
+    std::vector<std::atomic<int>> done(njobs);
+    std::vector<ThreadPool::Job> jobs;
+    for (int i=0; i<njobs; ++i) {
+      done[i] = 0;
+      jobs.push_back([&done, i]{ ++done[i]; });
+    }
+
+    pool.run(jobs);
+
+    for (int i=0; i<njobs; ++i)
+      ASSERT_EQ(1, done[i]) << "job " << i << " of " << njobs;
+  }
+}
+
+TEST(ThreadPool, JobExceptions)
+{
+  ThreadPool pool(3);
+
+  // The exception is rethrown from run() when all the other jobs are
+  // done (thrown in the caller thread or in a worker).
+  for (int failed : { 0, 5 }) {
+    const int njobs = 8;
+    std::vector<std::atomic<int>> done(njobs);
+    std::vector<ThreadPool::Job> jobs;
+    for (int i=0; i<njobs; ++i) {
+      done[i] = 0;
+      jobs.push_back([&done, i, failed]{
+          if (i == failed)
+            throw std::runtime_error("job failed");
+          ++done[i];
+        });
+    }
+
+    EXPECT_THROW(pool.run(jobs), std::runtime_error);
+
+    for (int i=0; i<njobs; ++i)
+      EXPECT_EQ(i == failed ? 0: 1, done[i]) << "job " << i;
+  }
+
+  // Workers can still be used
+  std::atomic<int> done(0);
+  std::vector<ThreadPool::Job> jobs(8, [&done]{ ++done; });
+  pool.run(jobs);
+  EXPECT_EQ(8, done);
+}
+
+TEST(ThreadPool, WaitRethrowsException)
+{
+  ThreadPool pool(2);
+
+  ThreadPool::TaskRef ok = pool.execute([]{ });
+  ThreadPool::TaskRef failed = pool.execute([]{ throw std::runtime_error("job failed"); });
+
+  EXPECT_THROW(pool.wait(failed), std::runtime_error);
+  EXPECT_NO_THROW(pool.wait(ok));
+}
+
+// Without workers, the jobs are run in order by the waiting thread.
+TEST(ThreadPool, WithoutWorkers)
+{
+  ThreadPool pool(0);
+  EXPECT_EQ(0, pool.size());
+
+  std::vector<int> order;
+  std::vector<ThreadPool::TaskRef> tasks;
+  for (int i=0; i<5; ++i)
+    tasks.push_back(pool.execute([&order, i]{ order.push_back(i); }));
+
+  pool.wait(tasks[2]);
+  EXPECT_EQ(3, int(order.size()));
+
+  pool.wait(tasks[4]);
+  ASSERT_EQ(5, int(order.size()));
+  for (int i=0; i<5; ++i)
+    EXPECT_EQ(i, order[i]);
+}
+
+// Each job waits the previous one. As the waiting job runs the older
+// pending jobs, one worker is enough.
+TEST(ThreadPool, JobsWaitingOlderJobs)
+{
+  for (int threads : { 0, 1, 3 }) {
+    ThreadPool pool(threads);
+
+    const int njobs = 64;
+    std::vector<ThreadPool::TaskRef> tasks(njobs);
+    std::vector<int> values(njobs, 0);
+    for (int i=0; i<njobs; ++i) {
+      tasks[i] = pool.execute([&pool, &tasks, &values, i]{
+          if (i > 0) {
+            pool.wait(tasks[i-1]);
+            values[i] = values[i-1] + 1;
+          }
+        });
+    }
+
+    pool.wait(tasks[njobs-1]);
+    for (int i=0; i<njobs; ++i)
+      EXPECT_EQ(i, values[i]) << "threads " << threads;
+  }
+}
+
+TEST(ThreadPool, PendingJobsAreDiscarded)
+{
+  std::atomic<int> done(0);
+  {
+    ThreadPool pool(0);
+    for (int i=0; i<8; ++i)
+      pool.execute([&done]{ ++done; });
+  }
+  EXPECT_EQ(0, done);
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -18,6 +18,11 @@ TEST(Thread, NotJoinable)
   EXPECT_FALSE(t.joinable());
 }
 
+TEST(Thread, HardwareConcurrency)
+{
+  EXPECT_GE(thread::hardware_concurrency(), 1u);
+}
+
 TEST(Thread, Joinable)
 {
   thread t(&nothing);
@@ -12,126 +12,329 @@
 
 #include "doc/image_impl.h"
 #include "doc/palette.h"
+#include "doc/primitives_fast.h"
 #include "doc/rgbmap.h"
 #include "gfx/point.h"
 
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define DOC_RESIZE_SSE2
+  #include <emmintrin.h>
+#endif
+
 namespace doc {
 namespace algorithm {
 
+// Fixed point precision used in bilinear interpolation (12 bits, so
+// the interpolation of 4 pixels of 8 bits fits in 32 bits)
+static const int kFracBits = 12;
+static const uint32_t kFracOne = (1 << kFracBits);
+
+// For each destination pixel (column or row), the two source pixels
+// to interpolate, and the weight of the second one (0 to kFracOne-1).
+struct BilinearCoord {
+  int i0, i1;
+  uint32_t frac;
+};
+
+static void create_nearest_table(int srcSize, int dstSize, std::vector<int>& table)
+{
+  table.resize(dstSize);
+  for (int i=0; i<dstSize; ++i)
+    table[i] = int(int64_t(i) * srcSize / dstSize);
+}
+
+static void create_bilinear_table(int srcSize, int dstSize, std::vector<BilinearCoord>& table)
+{
+  table.resize(dstSize);
+  for (int i=0; i<dstSize; ++i) {
+    // The first and last pixels of both images are aligned
+    int64_t pos = (dstSize > 1 ? (int64_t(i) * (srcSize-1) << kFracBits) / (dstSize-1): 0);
+    BilinearCoord& c = table[i];
+    c.i0 = int(pos >> kFracBits);
+    c.i1 = std::min(c.i0+1, srcSize-1);
+    c.frac = uint32_t(pos & (kFracOne-1));
+  }
+}
+
+static inline int interpolate(uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3,
+                              uint32_t fx, uint32_t fy)
+{
+  uint32_t top = c0*(kFracOne-fx) + c1*fx;
+  uint32_t bottom = c2*(kFracOne-fx) + c3*fx;
+  return int((top*(kFracOne-fy) + bottom*fy) >> (2*kFracBits));
+}
+
+template<typename ImageTraits>
+static void resize_image_nearest(const Image* src, Image* dst)
+{
+  typedef typename ImageTraits::const_address_t const_address_t;
+  typedef typename ImageTraits::address_t address_t;
+
+  std::vector<int> xs;
+  create_nearest_table(src->width(), dst->width(), xs);
+
+  const int w = dst->width();
+  const int h = dst->height();
+  int prev_v = -1;
+
+  for (int y=0; y<h; ++y) {
+    int v = int(int64_t(y) * src->height() / h);
+
+    // Same source row as the previous one (when the image is
+    // enlarged), we can copy the previous destination row.
+    if (v == prev_v) {
+      std::memcpy(dst->getPixelAddress(0, y),
+                  dst->getPixelAddress(0, y-1),
+                  dst->getRowStrideSize());
+      continue;
+    }
+
+    const_address_t src_row = (const_address_t)src->getPixelAddress(0, v);
+    address_t dst_row = (address_t)dst->getPixelAddress(0, y);
+    for (int x=0; x<w; ++x)
+      dst_row[x] = src_row[xs[x]];
+
+    prev_v = v;
+  }
+}
+
+// Pixels of bitmaps aren't addressable, so this version uses
+// get/put_pixel_fast()
+template<>
+void resize_image_nearest<BitmapTraits>(const Image* src, Image* dst)
+{
+  std::vector<int> xs;
+  create_nearest_table(src->width(), dst->width(), xs);
+
+  const int w = dst->width();
+  const int h = dst->height();
+  for (int y=0; y<h; ++y) {
+    int v = int(int64_t(y) * src->height() / h);
+    for (int x=0; x<w; ++x)
+      put_pixel_fast<BitmapTraits>(dst, x, y, get_pixel_fast<BitmapTraits>(src, xs[x], v));
+  }
+}
+
+template<typename ImageTraits, typename Interpolator>
+static void resize_image_bilinear(const Image* src, Image* dst, Interpolator interpolator)
+{
+  typedef typename ImageTraits::const_address_t const_address_t;
+  typedef typename ImageTraits::address_t address_t;
+
+  std::vector<BilinearCoord> xs, ys;
+  create_bilinear_table(src->width(), dst->width(), xs);
+  create_bilinear_table(src->height(), dst->height(), ys);
+
+  const int w = dst->width();
+  const int h = dst->height();
+  for (int y=0; y<h; ++y) {
+    const BilinearCoord& v = ys[y];
+    const_address_t row0 = (const_address_t)src->getPixelAddress(0, v.i0);
+    const_address_t row1 = (const_address_t)src->getPixelAddress(0, v.i1);
+    address_t dst_row = (address_t)dst->getPixelAddress(0, y);
+
+    for (int x=0; x<w; ++x) {
+      const BilinearCoord& u = xs[x];
+      dst_row[x] = interpolator(row0[u.i0], row0[u.i1],
+                                row1[u.i0], row1[u.i1],
+                                u.frac, v.frac);
+    }
+  }
+}
+
+// Interpolates two channels at the same time, each one in a 32-bit
+// lane of an uint64_t (the results are equal to interpolate()).
+static inline uint64_t interpolate_lanes(uint64_t c0, uint64_t c1, uint64_t c2, uint64_t c3,
+                                         uint32_t fx, uint32_t fy)
+{
+  uint64_t top = c0*(kFracOne-fx) + c1*fx;
+  uint64_t bottom = c2*(kFracOne-fx) + c3*fx;
+  return ((top*(kFracOne-fy) + bottom*fy) >> (2*kFracBits)) & 0x000000ff000000ffull;
+}
+
+struct RgbInterpolator {
+  // R and B channels in two lanes
+  static inline uint64_t rb(color_t c) {
+    return uint64_t(c & 0xff) | (uint64_t(c & 0xff0000) << 16);
+  }
+
+  // G and A channels in two lanes
+  static inline uint64_t ga(color_t c) {
+    return uint64_t((c >> 8) & 0xff) | (uint64_t(c >> 24) << 32);
+  }
+
+  color_t operator()(color_t c0, color_t c1, color_t c2, color_t c3,
+                     uint32_t fx, uint32_t fy) const {
+    uint64_t x = interpolate_lanes(rb(c0), rb(c1), rb(c2), rb(c3), fx, fy);
+    uint64_t y = interpolate_lanes(ga(c0), ga(c1), ga(c2), ga(c3), fx, fy);
+    return color_t(x | (x >> 16) | (y << 8) | (y >> 8));
+  }
+};
+
+#ifdef DOC_RESIZE_SSE2
+
+// Vertical interpolation of the 4 channels of a pixel (one channel
+// per 32-bit lane) with _mm_madd_epi16(). The top/bottom values use
+// up to 20 bits, so they are interpolated in two parts (the 12 high
+// bits and the 8 low bits) to keep each product in 16x16 bits. The
+// result is exactly the same as interpolate().
+static inline __m128i interpolate_vertical_sse2(__m128i top, __m128i bottom, __m128i wy)
+{
+  const __m128i mask = _mm_set1_epi32(0xff);
+  __m128i hi = _mm_madd_epi16(
+    _mm_or_si128(_mm_srli_epi32(top, 8),
+                 _mm_slli_epi32(_mm_srli_epi32(bottom, 8), 16)), wy);
+  __m128i lo = _mm_madd_epi16(
+    _mm_or_si128(_mm_and_si128(top, mask),
+                 _mm_slli_epi32(_mm_and_si128(bottom, mask), 16)), wy);
+  // The sum can use the 32 bits, so a logical shift is used
+  return _mm_srli_epi32(_mm_add_epi32(_mm_slli_epi32(hi, 8), lo), 2*kFracBits);
+}
+
+// Same as resize_image_bilinear<RgbTraits>(src, dst, RgbInterpolator())
+// converting two destination pixels at the same time.
+static void resize_image_bilinear_rgba_sse2(const Image* src, Image* dst)
+{
+  typedef RgbTraits::const_address_t const_address_t;
+  typedef RgbTraits::address_t address_t;
+
+  std::vector<BilinearCoord> xs, ys;
+  create_bilinear_table(src->width(), dst->width(), xs);
+  create_bilinear_table(src->height(), dst->height(), ys);
+
+  const int w = dst->width();
+  const int h = dst->height();
+
+  // Weights of the left and right pixels of each column as two
+  // 16-bit values (the operands of _mm_madd_epi16)
+  std::vector<int> wxs(w);
+  for (int x=0; x<w; ++x)
+    wxs[x] = int((kFracOne - xs[x].frac) | (xs[x].frac << 16));
+
+  const __m128i zero = _mm_setzero_si128();
+  RgbInterpolator interpolator;
+
+  for (int y=0; y<h; ++y) {
+    const BilinearCoord& v = ys[y];
+    const_address_t row0 = (const_address_t)src->getPixelAddress(0, v.i0);
+    const_address_t row1 = (const_address_t)src->getPixelAddress(0, v.i1);
+    address_t dst_row = (address_t)dst->getPixelAddress(0, y);
+    const __m128i wy = _mm_set1_epi32(int((kFracOne - v.frac) | (v.frac << 16)));
+
+    int x = 0;
+    for (; x+2<=w; x+=2) {
+      const BilinearCoord& a = xs[x];
+      const BilinearCoord& b = xs[x+1];
+      const __m128i wxa = _mm_set1_epi32(wxs[x]);
+      const __m128i wxb = _mm_set1_epi32(wxs[x+1]);
+
+      // Channels of the left and right source pixels interleaved
+      // (first 8 bytes for pixel "a", last 8 bytes for pixel "b")
+      __m128i top = _mm_unpacklo_epi8(
+        _mm_unpacklo_epi32(_mm_cvtsi32_si128(row0[a.i0]), _mm_cvtsi32_si128(row0[b.i0])),
+        _mm_unpacklo_epi32(_mm_cvtsi32_si128(row0[a.i1]), _mm_cvtsi32_si128(row0[b.i1])));
+      __m128i bottom = _mm_unpacklo_epi8(
+        _mm_unpacklo_epi32(_mm_cvtsi32_si128(row1[a.i0]), _mm_cvtsi32_si128(row1[b.i0])),
+        _mm_unpacklo_epi32(_mm_cvtsi32_si128(row1[a.i1]), _mm_cvtsi32_si128(row1[b.i1])));
+
+      __m128i ra = interpolate_vertical_sse2(
+        _mm_madd_epi16(_mm_unpacklo_epi8(top, zero), wxa),
+        _mm_madd_epi16(_mm_unpacklo_epi8(bottom, zero), wxa), wy);
+      __m128i rb = interpolate_vertical_sse2(
+        _mm_madd_epi16(_mm_unpackhi_epi8(top, zero), wxb),
+        _mm_madd_epi16(_mm_unpackhi_epi8(bottom, zero), wxb), wy);
+
+      _mm_storel_epi64((__m128i*)(dst_row+x),
+                       _mm_packus_epi16(_mm_packs_epi32(ra, rb), zero));
+    }
+
+    for (; x<w; ++x) {
+      const BilinearCoord& u = xs[x];
+      dst_row[x] = interpolator(row0[u.i0], row0[u.i1],
+                                row1[u.i0], row1[u.i1],
+                                u.frac, v.frac);
+    }
+  }
+}
+
+#endif // DOC_RESIZE_SSE2
+
+struct GrayscaleInterpolator {
+  color_t operator()(color_t c0, color_t c1, color_t c2, color_t c3,
+                     uint32_t fx, uint32_t fy) const {
+    return graya(
+      interpolate(graya_getv(c0), graya_getv(c1), graya_getv(c2), graya_getv(c3), fx, fy),
+      interpolate(graya_geta(c0), graya_geta(c1), graya_geta(c2), graya_geta(c3), fx, fy));
+  }
+};
+
+// Interpolates the palette colors of each index (the index 0 is
+// transparent) and maps the result with the RgbMap.
+struct IndexedInterpolator {
+  const Palette* pal;
+  const RgbMap* rgbmap;
+
+  IndexedInterpolator(const Palette* pal, const RgbMap* rgbmap)
+    : pal(pal), rgbmap(rgbmap) { }
+
+  color_t operator()(color_t i0, color_t i1, color_t i2, color_t i3,
+                     uint32_t fx, uint32_t fy) const {
+    int a = interpolate(i0 == 0 ? 0: 255, i1 == 0 ? 0: 255,
+                        i2 == 0 ? 0: 255, i3 == 0 ? 0: 255, fx, fy);
+    if (a <= 127)
+      return 0;
+
+    color_t c0 = pal->getEntry(i0);
+    color_t c1 = pal->getEntry(i1);
+    color_t c2 = pal->getEntry(i2);
+    color_t c3 = pal->getEntry(i3);
+    return rgbmap->mapColor(
+      interpolate(rgba_getr(c0), rgba_getr(c1), rgba_getr(c2), rgba_getr(c3), fx, fy),
+      interpolate(rgba_getg(c0), rgba_getg(c1), rgba_getg(c2), rgba_getg(c3), fx, fy),
+      interpolate(rgba_getb(c0), rgba_getb(c1), rgba_getb(c2), rgba_getb(c3), fx, fy));
+  }
+};
+
 void resize_image(const Image* src, Image* dst, ResizeMethod method, const Palette* pal, const RgbMap* rgbmap)
 {
+  ASSERT(src->pixelFormat() == dst->pixelFormat());
+
   switch (method) {
 
-    // TODO optimize this
     case RESIZE_METHOD_NEAREST_NEIGHBOR:
-    {
-      int o_width = src->width(), o_height = src->height();
-      int n_width = dst->width(), n_height = dst->height();
-      double x_ratio = o_width / (double)n_width;
-      double y_ratio = o_height / (double)n_height;
-      double px, py;
-      int i;
-
-      for (int y = 0; y < n_height; y++) {
-        for (int x = 0; x < n_width; x++) {
-          px = floor(x * x_ratio);
-          py = floor(y * y_ratio);
-          i = (int)(py * o_width + px);
-          dst->putPixel(x, y, src->getPixel(i % o_width, i / o_width));
-        }
+      switch (dst->pixelFormat()) {
+        case IMAGE_RGB:       resize_image_nearest<RgbTraits>(src, dst); break;
+        case IMAGE_GRAYSCALE: resize_image_nearest<GrayscaleTraits>(src, dst); break;
+        case IMAGE_INDEXED:   resize_image_nearest<IndexedTraits>(src, dst); break;
+        case IMAGE_BITMAP:    resize_image_nearest<BitmapTraits>(src, dst); break;
       }
       break;
-    }
 
-    // TODO optimize this
-    case RESIZE_METHOD_BILINEAR: {
-      uint32_t color[4], dst_color = 0;
-      double u, v, du, dv;
-      int u_floor, u_floor2;
-      int v_floor, v_floor2;
-      int x, y;
-
-      u = v = 0.0;
-      du = (src->width()-1) * 1.0 / (dst->width()-1);
-      dv = (src->height()-1) * 1.0 / (dst->height()-1);
-      for (y=0; y<dst->height(); ++y) {
-        for (x=0; x<dst->width(); ++x) {
-          u_floor = (int)floor(u);
-          v_floor = (int)floor(v);
-
-          if (u_floor > src->width()-1) {
-            u_floor = src->width()-1;
-            u_floor2 = src->width()-1;
-          }
-          else if (u_floor == src->width()-1)
-            u_floor2 = u_floor;
-          else
-            u_floor2 = u_floor+1;
-
-          if (v_floor > src->height()-1) {
-            v_floor = src->height()-1;
-            v_floor2 = src->height()-1;
-          }
-          else if (v_floor == src->height()-1)
-            v_floor2 = v_floor;
-          else
-            v_floor2 = v_floor+1;
-
-          // get the four colors
-          color[0] = src->getPixel(u_floor,  v_floor);
-          color[1] = src->getPixel(u_floor2, v_floor);
-          color[2] = src->getPixel(u_floor,  v_floor2);
-          color[3] = src->getPixel(u_floor2, v_floor2);
-
-          // calculate the interpolated color
-          double u1 = u - u_floor;
-          double v1 = v - v_floor;
-          double u2 = 1 - u1;
-          double v2 = 1 - v1;
-
-          switch (dst->pixelFormat()) {
-            case IMAGE_RGB: {
-              int r = int((rgba_getr(color[0])*u2 + rgba_getr(color[1])*u1)*v2 +
-                          (rgba_getr(color[2])*u2 + rgba_getr(color[3])*u1)*v1);
-              int g = int((rgba_getg(color[0])*u2 + rgba_getg(color[1])*u1)*v2 +
-                          (rgba_getg(color[2])*u2 + rgba_getg(color[3])*u1)*v1);
-              int b = int((rgba_getb(color[0])*u2 + rgba_getb(color[1])*u1)*v2 +
-                          (rgba_getb(color[2])*u2 + rgba_getb(color[3])*u1)*v1);
-              int a = int((rgba_geta(color[0])*u2 + rgba_geta(color[1])*u1)*v2 +
-                          (rgba_geta(color[2])*u2 + rgba_geta(color[3])*u1)*v1);
-              dst_color = rgba(r, g, b, a);
-              break;
-            }
-            case IMAGE_GRAYSCALE: {
-              int v = int((graya_getv(color[0])*u2 + graya_getv(color[1])*u1)*v2 +
-                          (graya_getv(color[2])*u2 + graya_getv(color[3])*u1)*v1);
-              int a = int((graya_geta(color[0])*u2 + graya_geta(color[1])*u1)*v2 +
-                          (graya_geta(color[2])*u2 + graya_geta(color[3])*u1)*v1);
-              dst_color = graya(v, a);
-              break;
-            }
-            case IMAGE_INDEXED: {
-              int r = int((rgba_getr(pal->getEntry(color[0]))*u2 + rgba_getr(pal->getEntry(color[1]))*u1)*v2 +
-                          (rgba_getr(pal->getEntry(color[2]))*u2 + rgba_getr(pal->getEntry(color[3]))*u1)*v1);
-              int g = int((rgba_getg(pal->getEntry(color[0]))*u2 + rgba_getg(pal->getEntry(color[1]))*u1)*v2 +
-                          (rgba_getg(pal->getEntry(color[2]))*u2 + rgba_getg(pal->getEntry(color[3]))*u1)*v1);
-              int b = int((rgba_getb(pal->getEntry(color[0]))*u2 + rgba_getb(pal->getEntry(color[1]))*u1)*v2 +
-                          (rgba_getb(pal->getEntry(color[2]))*u2 + rgba_getb(pal->getEntry(color[3]))*u1)*v1);
-              int a = int(((color[0] == 0 ? 0: 255)*u2 + (color[1] == 0 ? 0: 255)*u1)*v2 +
-                          ((color[2] == 0 ? 0: 255)*u2 + (color[3] == 0 ? 0: 255)*u1)*v1);
-              dst_color = a > 127 ? rgbmap->mapColor(r, g, b): 0;
-              break;
-            }
-          }
-
-          dst->putPixel(x, y, dst_color);
-          u += du;
-        }
-        u = 0.0;
-        v += dv;
+    case RESIZE_METHOD_BILINEAR:
+      switch (dst->pixelFormat()) {
+        case IMAGE_RGB:
+#ifdef DOC_RESIZE_SSE2
+          resize_image_bilinear_rgba_sse2(src, dst);
+#else
+          resize_image_bilinear<RgbTraits>(src, dst, RgbInterpolator());
+#endif
+          break;
+        case IMAGE_GRAYSCALE:
+          resize_image_bilinear<GrayscaleTraits>(src, dst, GrayscaleInterpolator());
+          break;
+        case IMAGE_INDEXED:
+          resize_image_bilinear<IndexedTraits>(src, dst, IndexedInterpolator(pal, rgbmap));
+          break;
+        case IMAGE_BITMAP:
+          // Bitmaps cannot be interpolated
+          resize_image_nearest<BitmapTraits>(src, dst);
+          break;
       }
       break;
-    }
 
   }
 }
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2001-2014 David Capello
+// Copyright (c) 2001-2015 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -22,7 +22,14 @@ namespace doc {
       RESIZE_METHOD_BILINEAR,
     };
 
-    // Resizes the source image 'src' to the destination image 'dst'.
+    // Resizes the source image 'src' to the destination image 'dst'
+    // (both images must have the same pixel format).
+    //
+    // RESIZE_METHOD_BILINEAR uses fixed point math (with 12 bits of
+    // precision), so each RGB/grayscale channel can differ by 1 from
+    // the value calculated with floating point. Indexed images are
+    // interpolated using 'palette' colors and remapped with
+    // 'rgbmap'. Bitmaps are resized using nearest neighbor.
     //
     // Warning: If you are using the RESIZE_METHOD_BILINEAR, it is
     // recommended to use 'fixup_image_transparent_colors' function
@@ -8,10 +8,17 @@
 #include "config.h"
 #endif
 
+#include "doc/algorithm/rotsprite.h"
+
+#include "base/thread.h"
 #include "base/unique_ptr.h"
 #include "doc/algorithm/rotate.h"
 #include "doc/image_impl.h"
 #include "doc/primitives.h"
+#include "doc/primitives_fast.h"
+
+#include <cstring>
+#include <vector>
 
 namespace doc {
 namespace algorithm {
@@ -21,155 +28,175 @@ namespace algorithm {
 // http://scale2x.sourceforge.net/algorithm.html
 // http://scale2x.sourceforge.net/scale2xandepx.html
 template<typename ImageTraits>
-static void image_scale2x_tpl(Image* dst, const Image* src, int src_w, int src_h)
+static void image_scale2x_rows(Image* dst, const Image* src,
+                               int src_w, int src_h, int y0, int y1)
 {
-#if 0      // TODO complete this implementation that should be faster
-           // than using a lot of get/put_pixel_fast calls.
-  int dst_w = src_w*2;
-  int dst_h = src_h*2;
-
-  LockImageBits<ImageTraits> dstBits(dst, Image::WriteLock, gfx::Rect(0, 0, dst_w, dst_h));
-  const LockImageBits<ImageTraits> srcBits(src);
-
-  LockImageBits<ImageTraits>::iterator dstRow0_it = dstBits.begin();
-  LockImageBits<ImageTraits>::iterator dstRow1_it = dstBits.begin();
-  LockImageBits<ImageTraits>::iterator dstRow0_end = dstBits.end();
-  LockImageBits<ImageTraits>::iterator dstRow1_end = dstBits.end();
-
-  // Iterators:
-  //   A
-  // C P B
-  //   D
-  //
-  // These iterators are displaced through src image and are modified in this way:
-  //
-  // P: is the simplest one, we just start from (0, 0) to srcEnd.
-  // A: starts from row 0 (so A = P in the first row), then we start
-  //    again from the row 0.
-  // B: It starts from (1, row) and in the last pixel we don't moved it.
-  // C: It starts from (0, 0) and then it is moved with a delay.
-  // D: It starts from row 1 and continues until we reach the last
-  //    row, in that case we start D iterator again.
-  //
-  LockImageBits<ImageTraits>::const_iterator itP, itA, itB, itC, itD, savedD;
-  LockImageBits<ImageTraits>::const_iterator srcEnd = srcBits.end();
-  color_t P, A, B, C, D;
-
-  // Adjust iterators
-  itP = itA = itB = itC = itD = savedD = srcBits.begin();
-  dstRow1_it += dst_w;
-  itD += src->width();
-
-  for (int y=0; y<src_h; ++y) {
-    if (y == 1) itA = srcBits.begin();
-    if (y == src_h-2) savedD = itD;
-    if (y == src_h-1) itD = savedD;
-    ++itB;
+  typedef typename ImageTraits::pixel_t pixel_t;
+
+  for (int y=y0; y<y1; ++y) {
+    const pixel_t* rowP = (const pixel_t*)src->getPixelAddress(0, y);
+    const pixel_t* rowA = (y > 0 ? (const pixel_t*)src->getPixelAddress(0, y-1): rowP);
+    const pixel_t* rowD = (y < src_h-1 ? (const pixel_t*)src->getPixelAddress(0, y+1): rowP);
+    pixel_t* dst0 = (pixel_t*)dst->getPixelAddress(0, 2*y);
+    pixel_t* dst1 = (pixel_t*)dst->getPixelAddress(0, 2*y+1);
 
     for (int x=0; x<src_w; ++x) {
-      ASSERT(itP != srcEnd);
-      ASSERT(itA != srcEnd);
-      ASSERT(itB != srcEnd);
-      ASSERT(itC != srcEnd);
-      ASSERT(itD != srcEnd);
-      ASSERT(dstRow0_it != dstRow0_end);
-      ASSERT(dstRow1_it != dstRow1_end);
-
-      P = *itP;
-      A = *itA;                 // y-1
-      B = *itB;                 // x+1
-      C = *itC;                 // x-1
-      D = *itD;                 // y+1
-
-      *dstRow0_it = (C == A && C != D && A != B ? A: P);
-      ++dstRow0_it;
-      *dstRow0_it = (A == B && A != C && B != D ? B: P);
-      ++dstRow0_it;
-
-      *dstRow1_it = (D == C && D != B && C != A ? C: P);
-      ++dstRow1_it;
-      *dstRow1_it = (B == D && B != A && D != C ? D: P);
-      ++dstRow1_it;
-
-      ++itP;
-      ++itA;
-      if (x < src_w-2) ++itB;
-      if (x > 0) ++itC;
-      ++itD;
+      pixel_t P = rowP[x];
+      pixel_t A = rowA[x];
+      pixel_t B = (x < src_w-1 ? rowP[x+1]: P);
+      pixel_t C = (x > 0 ? rowP[x-1]: P);
+      pixel_t D = rowD[x];
+
+      *(dst0++) = (C == A && C != D && A != B ? A: P);
+      *(dst0++) = (A == B && A != C && B != D ? B: P);
+      *(dst1++) = (D == C && D != B && C != A ? C: P);
+      *(dst1++) = (B == D && B != A && D != C ? D: P);
     }
-
-    // Adjust iterators for the next two rows.
-    ++itB;
-    ++itC;
-    dstRow0_it += dst_w;
-    if (y < src_h-1)
-      dstRow1_it += dst_w;
   }
+}
 
-  // ASSERT(itP == srcEnd);
-  // ASSERT(itA == srcEnd);
-  // ASSERT(itB == srcEnd);
-  // ASSERT(itC == srcEnd);
-  // ASSERT(itD == srcEnd);
-  ASSERT(dstRow0_it == dstRow0_end);
-  ASSERT(dstRow1_it == dstRow1_end);
-#else
-
-#define A c[0]
-#define B c[1]
-#define C c[2]
-#define D c[3]
-#define P c[4]
-
-  LockImageBits<ImageTraits> dstBits(dst, gfx::Rect(0, 0, src_w*2, src_h*2));
-  auto dstIt = dstBits.begin();
-  auto dstIt2 = dstIt;
-
-  color_t c[5];
-  for (int y=0; y<src_h; ++y) {
-    dstIt2 += src_w*2;
+// Pixels of bitmaps aren't addressable, so this version uses
+// get/put_pixel_fast()
+template<>
+void image_scale2x_rows<BitmapTraits>(Image* dst, const Image* src,
+                                      int src_w, int src_h, int y0, int y1)
+{
+  typedef BitmapTraits::pixel_t pixel_t;
+
+  for (int y=y0; y<y1; ++y) {
     for (int x=0; x<src_w; ++x) {
-      P = get_pixel_fast<ImageTraits>(src, x, y);
-      A = (y > 0 ? get_pixel_fast<ImageTraits>(src, x, y-1): P);
-      B = (x < src_w-1 ? get_pixel_fast<ImageTraits>(src, x+1, y): P);
-      C = (x > 0 ? get_pixel_fast<ImageTraits>(src, x-1, y): P);
-      D = (y < src_h-1 ? get_pixel_fast<ImageTraits>(src, x, y+1): P);
-
-      *dstIt = (C == A && C != D && A != B ? A: P);
-      ++dstIt;
-      *dstIt = (A == B && A != C && B != D ? B: P);
-      ++dstIt;
-
-      *dstIt2 = (D == C && D != B && C != A ? C: P);
-      ++dstIt2;
-      *dstIt2 = (B == D && B != A && D != C ? D: P);
-      ++dstIt2;
+      pixel_t P = get_pixel_fast<BitmapTraits>(src, x, y);
+      pixel_t A = (y > 0 ? get_pixel_fast<BitmapTraits>(src, x, y-1): P);
+      pixel_t B = (x < src_w-1 ? get_pixel_fast<BitmapTraits>(src, x+1, y): P);
+      pixel_t C = (x > 0 ? get_pixel_fast<BitmapTraits>(src, x-1, y): P);
+      pixel_t D = (y < src_h-1 ? get_pixel_fast<BitmapTraits>(src, x, y+1): P);
+
+      put_pixel_fast<BitmapTraits>(dst, 2*x,   2*y,   (C == A && C != D && A != B ? A: P));
+      put_pixel_fast<BitmapTraits>(dst, 2*x+1, 2*y,   (A == B && A != C && B != D ? B: P));
+      put_pixel_fast<BitmapTraits>(dst, 2*x,   2*y+1, (D == C && D != B && C != A ? C: P));
+      put_pixel_fast<BitmapTraits>(dst, 2*x+1, 2*y+1, (B == D && B != A && D != C ? D: P));
     }
-    dstIt += src_w*2;
   }
-
-#endif
 }
 
-static void image_scale2x(Image* dst, const Image* src, int src_w, int src_h)
+// Rows [y0, y1) of the source image to be scaled by one thread
+struct Scale2xBand {
+  Image* dst;
+  const Image* src;
+  int y0, y1;
+};
+
+static void image_scale2x_band(Scale2xBand* band)
 {
+  Image* dst = band->dst;
+  const Image* src = band->src;
+  int w = src->width();
+  int h = src->height();
+
   switch (src->pixelFormat()) {
-    case IMAGE_RGB:       image_scale2x_tpl<RgbTraits>(dst, src, src_w, src_h); break;
-    case IMAGE_GRAYSCALE: image_scale2x_tpl<GrayscaleTraits>(dst, src, src_w, src_h); break;
-    case IMAGE_INDEXED:   image_scale2x_tpl<IndexedTraits>(dst, src, src_w, src_h); break;
-    case IMAGE_BITMAP:    image_scale2x_tpl<BitmapTraits>(dst, src, src_w, src_h); break;
+    case IMAGE_RGB:       image_scale2x_rows<RgbTraits>(dst, src, w, h, band->y0, band->y1); break;
+    case IMAGE_GRAYSCALE: image_scale2x_rows<GrayscaleTraits>(dst, src, w, h, band->y0, band->y1); break;
+    case IMAGE_INDEXED:   image_scale2x_rows<IndexedTraits>(dst, src, w, h, band->y0, band->y1); break;
+    case IMAGE_BITMAP:    image_scale2x_rows<BitmapTraits>(dst, src, w, h, band->y0, band->y1); break;
   }
 }
 
+// Scales "src" to "dst" (which must be two times bigger). Big images
+// are split in bands of rows scaled by different threads (each band
+// writes different rows of "dst").
+static void image_scale2x(Image* dst, const Image* src)
+{
+  ASSERT(dst->width() == src->width()*2);
+  ASSERT(dst->height() == src->height()*2);
+
+  // Minimum number of pixels to use a new thread
+  const int kMinBandPixels = 64*1024;
+
+  int h = src->height();
+  int nbands = MID(1, src->width()*h / kMinBandPixels,
+                   MAX(1, int(base::thread::hardware_concurrency())));
+  nbands = MIN(nbands, h);
+
+  std::vector<Scale2xBand> bands(nbands);
+  for (int i=0; i<nbands; ++i) {
+    bands[i].dst = dst;
+    bands[i].src = src;
+    bands[i].y0 = h*i/nbands;
+    bands[i].y1 = h*(i+1)/nbands;
+  }
+
+  // The first band is scaled in this thread
+  std::vector<base::thread*> threads;
+  for (int i=1; i<nbands; ++i)
+    threads.push_back(new base::thread(&image_scale2x_band, &bands[i]));
+
+  image_scale2x_band(&bands[0]);
+
+  for (base::thread* thread : threads) {
+    thread->join();
+    delete thread;
+  }
+}
+
+static bool is_same_image(const Image* a, const Image* b)
+{
+  if (a->pixelFormat() != b->pixelFormat() ||
+      a->width() != b->width() ||
+      a->height() != b->height())
+    return false;
+
+  int rowBytes = a->getRowStrideSize();
+  for (int y=0; y<a->height(); ++y)
+    if (std::memcmp(a->getPixelAddress(0, y), b->getPixelAddress(0, y), rowBytes) != 0)
+      return false;
+
+  return true;
+}
+
+RotSpriteCache::RotSpriteCache()
+  : m_scaledBuf(new ImageBuffer(1))
+  , m_rotatedBuf(new ImageBuffer(1))
+{
+  m_tmpBuf[0].reset(new ImageBuffer(1));
+  m_tmpBuf[1].reset(new ImageBuffer(1));
+}
+
+RotSpriteCache::~RotSpriteCache()
+{
+}
+
+Image* RotSpriteCache::getScaledImage(const Image* spr)
+{
+  if (m_scaled && m_source && is_same_image(m_source, spr))
+    return m_scaled;
+
+  m_source.reset(nullptr);
+  m_scaled.reset(nullptr);
+
+  // Three scale2x passes (2x, 4x, and 8x) using the temporary buffers
+  base::UniquePtr<Image> tmp1(Image::create(spr->pixelFormat(), spr->width()*2, spr->height()*2, m_tmpBuf[0]));
+  base::UniquePtr<Image> tmp2(Image::create(spr->pixelFormat(), spr->width()*4, spr->height()*4, m_tmpBuf[1]));
+  base::UniquePtr<Image> scaled(Image::create(spr->pixelFormat(), spr->width()*8, spr->height()*8, m_scaledBuf));
+
+  image_scale2x(tmp1, spr);
+  image_scale2x(tmp2, tmp1);
+  image_scale2x(scaled, tmp2);
+
+  m_source.reset(Image::createCopy(spr));
+  m_scaled.reset(scaled.release());
+  return m_scaled;
+}
+
 void rotsprite_image(Image* bmp, Image* spr,
   int x1, int y1, int x2, int y2,
-  int x3, int y3, int x4, int y4)
+  int x3, int y3, int x4, int y4,
+  RotSpriteCache* cache)
 {
-  static ImageBufferPtr buf1, buf2, buf3; // TODO non-thread safe
-
-  if (!buf1) buf1.reset(new ImageBuffer(1));
-  if (!buf2) buf2.reset(new ImageBuffer(1));
-  if (!buf3) buf3.reset(new ImageBuffer(1));
+  base::UniquePtr<RotSpriteCache> tmpCache;
+  if (!cache) {
+    tmpCache.reset(new RotSpriteCache);
+    cache = tmpCache.get();
+  }
 
   int xmin = MIN(x1, MIN(x2, MIN(x3, x4)));
   int xmax = MAX(x1, MAX(x2, MAX(x3, x4)));
@@ -179,25 +206,15 @@ void rotsprite_image(Image* bmp, Image* spr,
   int rot_height = ymax - ymin + 1;
 
   int scale = 8;
-  base::UniquePtr<Image> bmp_copy(Image::create(bmp->pixelFormat(), rot_width*scale, rot_height*scale, buf1));
-  base::UniquePtr<Image> tmp_copy(Image::create(spr->pixelFormat(), spr->width()*scale, spr->height()*scale, buf2));
-  base::UniquePtr<Image> spr_copy(Image::create(spr->pixelFormat(), spr->width()*scale, spr->height()*scale, buf3));
+  base::UniquePtr<Image> bmp_copy(Image::create(bmp->pixelFormat(), rot_width*scale, rot_height*scale, cache->rotatedBuffer()));
+  Image* spr_copy = cache->getScaledImage(spr);
 
   color_t maskColor = spr->maskColor();
 
   bmp_copy->setMaskColor(maskColor);
-  tmp_copy->setMaskColor(maskColor);
   spr_copy->setMaskColor(maskColor);
 
   bmp_copy->clear(bmp->maskColor());
-  spr_copy->clear(maskColor);
-  spr_copy->copy(spr, gfx::Clip(spr->bounds()));
-
-  for (int i=0; i<3; ++i) {
-    clear_image(tmp_copy, maskColor);
-    image_scale2x(tmp_copy, spr_copy, spr->width()*(1<<i), spr->height()*(1<<i));
-    spr_copy->copy(tmp_copy, gfx::Clip(tmp_copy->bounds()));
-  }
 
   doc::algorithm::parallelogram(
     bmp_copy, spr_copy,
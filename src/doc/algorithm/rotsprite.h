@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2001-2014 David Capello
+// Copyright (c) 2001-2015 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -8,14 +8,52 @@
 #define DOC_ALGORITHM_ROTSPRITE_H_INCLUDED
 #pragma once
 
+#include "base/disable_copying.h"
+#include "base/unique_ptr.h"
+#include "doc/image_buffer.h"
+
 namespace doc {
   class Image;
 
   namespace algorithm {
 
+    // Keeps the source image scaled 8x (the slowest part of
+    // RotSprite) and the temporary buffers used by rotsprite_image(),
+    // so rotating the same image several times (e.g. while the user
+    // drags a rotation handle) doesn't scale it again each time.
+    //
+    // The scaled image is recalculated automatically when the pixels
+    // of the source image change. A cache cannot be used from two
+    // threads at the same time.
+    class RotSpriteCache {
+    public:
+      RotSpriteCache();
+      ~RotSpriteCache();
+
+      // Returns the given image scaled 8x with scale2x.
+      Image* getScaledImage(const Image* spr);
+
+      // Buffer for the rotated image (before scaling it down).
+      const ImageBufferPtr& rotatedBuffer() const { return m_rotatedBuf; }
+
+    private:
+      base::UniquePtr<Image> m_source;   // Copy of the source image
+      base::UniquePtr<Image> m_scaled;
+      ImageBufferPtr m_tmpBuf[2];
+      ImageBufferPtr m_scaledBuf;
+      ImageBufferPtr m_rotatedBuf;
+
+      DISABLE_COPYING(RotSpriteCache);
+    };
+
+    // Draws "spr" in the given parallelogram of "bmp" using the
+    // RotSprite algorithm. If "cache" is nullptr, a temporary cache
+    // is used (so it's safe to call this function from several
+    // threads).
     void rotsprite_image(Image* bmp, Image* spr,
       int x1, int y1, int x2, int y2,
-      int x3, int y3, int x4, int y4);
+      int x3, int y3, int x4, int y4,
+      RotSpriteCache* cache = nullptr);
 
   } // namespace algorithm
 } // namespace doc
@@ -22,6 +22,11 @@
 
 #include <cmath>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define DOC_BLEND_SSE2
+  #include <emmintrin.h>
+#endif
+
 namespace  {
 
 #define blend_multiply(b, s, t)   (MUL_UN8((b), (s), (t)))
@@ -590,6 +595,169 @@ color_t indexed_blender_src(color_t dst, color_t src, int opacity)
   return src;
 }
 
+//////////////////////////////////////////////////////////////////////
+// Row blenders
+
+namespace {
+
+template<BlendFunc blender>
+void rgba_row_blender(uint32_t* dst, const uint32_t* backdrop, const uint32_t* src, int w, int opacity)
+{
+  for (int x=0; x<w; ++x)
+    dst[x] = blender(backdrop[x], src[x], opacity);
+}
+
+template<BlendFunc blender>
+void graya_row_blender(uint16_t* dst, const uint16_t* backdrop, const uint16_t* src, int w, int opacity)
+{
+  for (int x=0; x<w; ++x)
+    dst[x] = blender(backdrop[x], src[x], opacity);
+}
+
+#ifdef DOC_BLEND_SSE2
+
+// All these helpers work with one 8-bit channel value per 32-bit
+// lane, so the 16-bit operations (_mm_mullo_epi16, _mm_min_epi16,
+// etc.) give exact 32-bit results.
+
+inline __m128i mul_un8_sse2(__m128i a, __m128i b)
+{
+  __m128i t = _mm_add_epi32(_mm_mullo_epi16(a, b), _mm_set1_epi32(0x80));
+  return _mm_srli_epi32(_mm_add_epi32(_mm_srli_epi32(t, 8), t), 8);
+}
+
+inline __m128i select_sse2(__m128i mask, __m128i a, __m128i b)
+{
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+inline __m128i screen_sse2(__m128i b, __m128i s)
+{
+  return _mm_sub_epi32(_mm_add_epi32(b, s), mul_un8_sse2(b, s));
+}
+
+inline __m128i hard_light_sse2(__m128i b, __m128i s)
+{
+  __m128i s2 = _mm_slli_epi32(s, 1);
+  return select_sse2(_mm_cmplt_epi32(s, _mm_set1_epi32(128)),
+                     mul_un8_sse2(b, s2),
+                     screen_sse2(b, _mm_sub_epi32(s2, _mm_set1_epi32(255))));
+}
+
+struct NormalSse2 {
+  static __m128i blend(__m128i b, __m128i s) { return s; }
+};
+
+struct MultiplySse2 {
+  static __m128i blend(__m128i b, __m128i s) { return mul_un8_sse2(b, s); }
+};
+
+struct ScreenSse2 {
+  static __m128i blend(__m128i b, __m128i s) { return screen_sse2(b, s); }
+};
+
+struct OverlaySse2 {
+  static __m128i blend(__m128i b, __m128i s) { return hard_light_sse2(s, b); }
+};
+
+struct DarkenSse2 {
+  static __m128i blend(__m128i b, __m128i s) { return _mm_min_epi16(b, s); }
+};
+
+struct LightenSse2 {
+  static __m128i blend(__m128i b, __m128i s) { return _mm_max_epi16(b, s); }
+};
+
+struct HardLightSse2 {
+  static __m128i blend(__m128i b, __m128i s) { return hard_light_sse2(b, s); }
+};
+
+struct DifferenceSse2 {
+  static __m128i blend(__m128i b, __m128i s) {
+    return _mm_sub_epi32(_mm_max_epi16(b, s), _mm_min_epi16(b, s));
+  }
+};
+
+struct ExclusionSse2 {
+  static __m128i blend(__m128i b, __m128i s) {
+    __m128i t = mul_un8_sse2(b, s);
+    return _mm_sub_epi32(_mm_add_epi32(b, s), _mm_add_epi32(t, t));
+  }
+};
+
+// Same as rgba_blender_normal(backdrop, Op::blend(backdrop, src),
+// opacity) for 4 pixels at the same time. The division by the
+// resulting alpha is done with floats: as (Sa <= Ra) the quotient
+// is always in [-255, 255] and the truncated float result is
+// exactly the same as the integer division.
+template<typename Op, BlendFunc blender>
+void rgba_row_blender_sse2(uint32_t* dst, const uint32_t* backdrop, const uint32_t* src, int w, int opacity)
+{
+  const __m128i mask = _mm_set1_epi32(0xff);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi32(1);
+  const __m128i op = _mm_set1_epi32(opacity);
+  int x = 0;
+
+  for (; x+4<=w; x+=4) {
+    __m128i B = _mm_loadu_si128((const __m128i*)(backdrop+x));
+    __m128i S = _mm_loadu_si128((const __m128i*)(src+x));
+
+    __m128i Br = _mm_and_si128(B, mask);
+    __m128i Bg = _mm_and_si128(_mm_srli_epi32(B, rgba_g_shift), mask);
+    __m128i Bb = _mm_and_si128(_mm_srli_epi32(B, rgba_b_shift), mask);
+    __m128i Ba = _mm_srli_epi32(B, rgba_a_shift);
+
+    __m128i Sr = _mm_and_si128(Op::blend(Br, _mm_and_si128(S, mask)), mask);
+    __m128i Sg = _mm_and_si128(Op::blend(Bg, _mm_and_si128(_mm_srli_epi32(S, rgba_g_shift), mask)), mask);
+    __m128i Sb = _mm_and_si128(Op::blend(Bb, _mm_and_si128(_mm_srli_epi32(S, rgba_b_shift), mask)), mask);
+    __m128i Sa = _mm_srli_epi32(S, rgba_a_shift);
+    __m128i Sa_op = mul_un8_sse2(Sa, op);
+
+    __m128i Ra = _mm_sub_epi32(_mm_add_epi32(Ba, Sa_op), mul_un8_sse2(Ba, Sa_op));
+    __m128 fSa = _mm_cvtepi32_ps(Sa_op);
+    __m128 fRa = _mm_cvtepi32_ps(_mm_max_epi16(Ra, one));
+
+#define BLEND_CHANNEL(B, S)                                             \
+    _mm_add_epi32(B, _mm_cvttps_epi32(                                  \
+                    _mm_div_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(S, B)), fSa), fRa)))
+
+    __m128i normal =
+      _mm_or_si128(
+        _mm_or_si128(BLEND_CHANNEL(Br, Sr),
+                     _mm_slli_epi32(BLEND_CHANNEL(Bg, Sg), rgba_g_shift)),
+        _mm_or_si128(_mm_slli_epi32(BLEND_CHANNEL(Bb, Sb), rgba_b_shift),
+                     _mm_slli_epi32(Ra, rgba_a_shift)));
+
+#undef BLEND_CHANNEL
+
+    __m128i transparentBackdrop =
+      _mm_or_si128(
+        _mm_or_si128(Sr, _mm_slli_epi32(Sg, rgba_g_shift)),
+        _mm_or_si128(_mm_slli_epi32(Sb, rgba_b_shift),
+                     _mm_slli_epi32(Sa_op, rgba_a_shift)));
+
+    __m128i R =
+      select_sse2(_mm_cmpeq_epi32(Ba, zero), transparentBackdrop,
+                  select_sse2(_mm_cmpeq_epi32(Sa, zero), B, normal));
+
+    _mm_storeu_si128((__m128i*)(dst+x), R);
+  }
+
+  for (; x<w; ++x)
+    dst[x] = blender(backdrop[x], src[x], opacity);
+}
+
+#define RGBA_ROW_BLENDER(op, func) rgba_row_blender_sse2<op, func>
+
+#else
+
+#define RGBA_ROW_BLENDER(op, func) rgba_row_blender<func>
+
+#endif
+
+} // anonymous namespace
+
 //////////////////////////////////////////////////////////////////////
 // getters
 
@@ -658,4 +826,64 @@ BlendFunc get_indexed_blender(BlendMode blendmode)
   return indexed_blender_src;
 }
 
+RgbaBlendRowFunc get_rgba_row_blender(BlendMode blendmode)
+{
+  switch (blendmode) {
+    case BlendMode::SRC:            return rgba_row_blender<rgba_blender_src>;
+    case BlendMode::MERGE:          return rgba_row_blender<rgba_blender_merge>;
+    case BlendMode::NEG_BW:         return rgba_row_blender<rgba_blender_neg_bw>;
+    case BlendMode::RED_TINT:       return rgba_row_blender<rgba_blender_red_tint>;
+    case BlendMode::BLUE_TINT:      return rgba_row_blender<rgba_blender_blue_tint>;
+
+    case BlendMode::NORMAL:         return RGBA_ROW_BLENDER(NormalSse2, rgba_blender_normal);
+    case BlendMode::MULTIPLY:       return RGBA_ROW_BLENDER(MultiplySse2, rgba_blender_multiply);
+    case BlendMode::SCREEN:         return RGBA_ROW_BLENDER(ScreenSse2, rgba_blender_screen);
+    case BlendMode::OVERLAY:        return RGBA_ROW_BLENDER(OverlaySse2, rgba_blender_overlay);
+    case BlendMode::DARKEN:         return RGBA_ROW_BLENDER(DarkenSse2, rgba_blender_darken);
+    case BlendMode::LIGHTEN:        return RGBA_ROW_BLENDER(LightenSse2, rgba_blender_lighten);
+    case BlendMode::COLOR_DODGE:    return rgba_row_blender<rgba_blender_color_dodge>;
+    case BlendMode::COLOR_BURN:     return rgba_row_blender<rgba_blender_color_burn>;
+    case BlendMode::HARD_LIGHT:     return RGBA_ROW_BLENDER(HardLightSse2, rgba_blender_hard_light);
+    case BlendMode::SOFT_LIGHT:     return rgba_row_blender<rgba_blender_soft_light>;
+    case BlendMode::DIFFERENCE:     return RGBA_ROW_BLENDER(DifferenceSse2, rgba_blender_difference);
+    case BlendMode::EXCLUSION:      return RGBA_ROW_BLENDER(ExclusionSse2, rgba_blender_exclusion);
+    case BlendMode::HSL_HUE:        return rgba_row_blender<rgba_blender_hsl_hue>;
+    case BlendMode::HSL_SATURATION: return rgba_row_blender<rgba_blender_hsl_saturation>;
+    case BlendMode::HSL_COLOR:      return rgba_row_blender<rgba_blender_hsl_color>;
+    case BlendMode::HSL_LUMINOSITY: return rgba_row_blender<rgba_blender_hsl_luminosity>;
+  }
+  ASSERT(false);
+  return rgba_row_blender<rgba_blender_src>;
+}
+
+GrayaBlendRowFunc get_graya_row_blender(BlendMode blendmode)
+{
+  switch (blendmode) {
+    case BlendMode::SRC:            return graya_row_blender<graya_blender_src>;
+    case BlendMode::MERGE:          return graya_row_blender<graya_blender_merge>;
+    case BlendMode::NEG_BW:         return graya_row_blender<graya_blender_neg_bw>;
+    case BlendMode::RED_TINT:       return graya_row_blender<graya_blender_normal>;
+    case BlendMode::BLUE_TINT:      return graya_row_blender<graya_blender_normal>;
+
+    case BlendMode::NORMAL:         return graya_row_blender<graya_blender_normal>;
+    case BlendMode::MULTIPLY:       return graya_row_blender<graya_blender_multiply>;
+    case BlendMode::SCREEN:         return graya_row_blender<graya_blender_screen>;
+    case BlendMode::OVERLAY:        return graya_row_blender<graya_blender_overlay>;
+    case BlendMode::DARKEN:         return graya_row_blender<graya_blender_darken>;
+    case BlendMode::LIGHTEN:        return graya_row_blender<graya_blender_lighten>;
+    case BlendMode::COLOR_DODGE:    return graya_row_blender<graya_blender_color_dodge>;
+    case BlendMode::COLOR_BURN:     return graya_row_blender<graya_blender_color_burn>;
+    case BlendMode::HARD_LIGHT:     return graya_row_blender<graya_blender_hard_light>;
+    case BlendMode::SOFT_LIGHT:     return graya_row_blender<graya_blender_soft_light>;
+    case BlendMode::DIFFERENCE:     return graya_row_blender<graya_blender_difference>;
+    case BlendMode::EXCLUSION:      return graya_row_blender<graya_blender_exclusion>;
+    case BlendMode::HSL_HUE:        return graya_row_blender<graya_blender_normal>;
+    case BlendMode::HSL_SATURATION: return graya_row_blender<graya_blender_normal>;
+    case BlendMode::HSL_COLOR:      return graya_row_blender<graya_blender_normal>;
+    case BlendMode::HSL_LUMINOSITY: return graya_row_blender<graya_blender_normal>;
+  }
+  ASSERT(false);
+  return graya_row_blender<graya_blender_src>;
+}
+
 } // namespace doc
@@ -15,6 +15,18 @@ namespace doc {
 
   typedef color_t (*BlendFunc)(color_t backdrop, color_t src, int opacity);
 
+  // Blends "w" pixels of "src" over "backdrop" and puts the result in
+  // "dst" (which can be the same pointer as "backdrop"). It gives
+  // exactly the same results as calling the BlendFunc for each pixel.
+  typedef void (*RgbaBlendRowFunc)(uint32_t* dst,
+                                   const uint32_t* backdrop,
+                                   const uint32_t* src,
+                                   int w, int opacity);
+  typedef void (*GrayaBlendRowFunc)(uint16_t* dst,
+                                    const uint16_t* backdrop,
+                                    const uint16_t* src,
+                                    int w, int opacity);
+
   color_t rgba_blender_normal(color_t backdrop, color_t src, int opacity);
   color_t rgba_blender_merge(color_t backdrop, color_t src, int opacity);
   color_t rgba_blender_neg_bw(color_t backdrop, color_t src, int opacity);
@@ -27,6 +39,9 @@ namespace doc {
   BlendFunc get_graya_blender(BlendMode blendmode);
   BlendFunc get_indexed_blender(BlendMode blendmode);
 
+  RgbaBlendRowFunc get_rgba_row_blender(BlendMode blendmode);
+  GrayaBlendRowFunc get_graya_row_blender(BlendMode blendmode);
+
 } // namespace doc
 
 #endif
@@ -0,0 +1,139 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/blend_funcs.h"
+
+#include <cstdlib>
+#include <vector>
+
+using namespace doc;
+
+static const BlendMode all_blend_modes[] = {
+  BlendMode::SRC,
+  BlendMode::MERGE,
+  BlendMode::NEG_BW,
+  BlendMode::RED_TINT,
+  BlendMode::BLUE_TINT,
+  BlendMode::NORMAL,
+  BlendMode::MULTIPLY,
+  BlendMode::SCREEN,
+  BlendMode::OVERLAY,
+  BlendMode::DARKEN,
+  BlendMode::LIGHTEN,
+  BlendMode::COLOR_DODGE,
+  BlendMode::COLOR_BURN,
+  BlendMode::HARD_LIGHT,
+  BlendMode::SOFT_LIGHT,
+  BlendMode::DIFFERENCE,
+  BlendMode::EXCLUSION,
+  BlendMode::HSL_HUE,
+  BlendMode::HSL_SATURATION,
+  BlendMode::HSL_COLOR,
+  BlendMode::HSL_LUMINOSITY
+};
+
+static const int opacities[] = { 0, 1, 64, 127, 128, 200, 254, 255 };
+
+// Random channel value biased to the extremes (0 and 255) which
+// take special paths in the blenders.
+static int random_channel()
+{
+  switch (std::rand() % 4) {
+    case 0: return 0;
+    case 1: return 255;
+    default: return std::rand() % 256;
+  }
+}
+
+TEST(BlendFuncs, RgbaRowBlendersMatchPixelBlenders)
+{
+  std::srand(1);
+
+  // Odd width to test the tail of vectorized loops
+  const int w = 4099;
+  std::vector<uint32_t> backdrop(w), src(w), dst(w);
+
+  for (int i=0; i<w; ++i) {
+    backdrop[i] = rgba(random_channel(), random_channel(), random_channel(), random_channel());
+    src[i] = rgba(random_channel(), random_channel(), random_channel(), random_channel());
+  }
+
+  for (BlendMode mode : all_blend_modes) {
+    BlendFunc blender = get_rgba_blender(mode);
+    RgbaBlendRowFunc row_blender = get_rgba_row_blender(mode);
+
+    for (int opacity : opacities) {
+      row_blender(&dst[0], &backdrop[0], &src[0], w, opacity);
+
+      for (int i=0; i<w; ++i) {
+        ASSERT_EQ(blender(backdrop[i], src[i], opacity), dst[i])
+          << "Blend mode " << int(mode) << ", opacity " << opacity
+          << ", backdrop " << std::hex << backdrop[i] << ", src " << src[i];
+      }
+    }
+  }
+}
+
+TEST(BlendFuncs, RgbaRowBlendersInPlace)
+{
+  std::srand(2);
+
+  const int w = 37;
+  std::vector<uint32_t> backdrop(w), src(w), dst(w);
+
+  for (int i=0; i<w; ++i) {
+    backdrop[i] = rgba(random_channel(), random_channel(), random_channel(), random_channel());
+    src[i] = rgba(random_channel(), random_channel(), random_channel(), random_channel());
+  }
+
+  for (BlendMode mode : all_blend_modes) {
+    BlendFunc blender = get_rgba_blender(mode);
+    RgbaBlendRowFunc row_blender = get_rgba_row_blender(mode);
+
+    dst = backdrop;
+    row_blender(&dst[0], &dst[0], &src[0], w, 128);
+
+    for (int i=0; i<w; ++i)
+      ASSERT_EQ(blender(backdrop[i], src[i], 128), dst[i]);
+  }
+}
+
+TEST(BlendFuncs, GrayaRowBlendersMatchPixelBlenders)
+{
+  std::srand(3);
+
+  const int w = 1027;
+  std::vector<uint16_t> backdrop(w), src(w), dst(w);
+
+  for (int i=0; i<w; ++i) {
+    backdrop[i] = graya(random_channel(), random_channel());
+    src[i] = graya(random_channel(), random_channel());
+  }
+
+  for (BlendMode mode : all_blend_modes) {
+    BlendFunc blender = get_graya_blender(mode);
+    GrayaBlendRowFunc row_blender = get_graya_row_blender(mode);
+
+    for (int opacity : opacities) {
+      row_blender(&dst[0], &backdrop[0], &src[0], w, opacity);
+
+      for (int i=0; i<w; ++i)
+        ASSERT_EQ(blender(backdrop[i], src[i], opacity), dst[i]);
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -14,6 +14,8 @@
 #include "doc/layer.h"
 #include "doc/sprite.h"
 
+#include <algorithm>
+
 namespace doc {
 
 CelsRange::CelsRange(const Sprite* sprite,
@@ -25,28 +27,20 @@ CelsRange::CelsRange(const Sprite* sprite,
 
 CelsRange::iterator::iterator()
   : m_cel(nullptr)
+  , m_layer(nullptr)
 {
 }
 
 CelsRange::iterator::iterator(const Sprite* sprite, frame_t first, frame_t last, CelsRange::Flags flags)
   : m_cel(nullptr)
+  , m_layer(nullptr)
   , m_first(first)
   , m_last(last)
   , m_flags(flags)
 {
   // Get first cel
-  Layer* layer = sprite->layer(sprite->firstLayer());
-  while (layer && !m_cel) {
-    for (frame_t f=first; f<=last; ++f) {
-      m_cel = layer->cel(f);
-      if (m_cel)
-        break;
-      m_cel = nullptr;
-    }
-    layer = layer->getNext();
-  }
-  if (m_cel && flags == CelsRange::UNIQUE)
-    m_visited.insert(m_cel->data()->id());
+  enterLayer(sprite->layer(sprite->firstLayer()));
+  findCel();
 }
 
 CelsRange::iterator& CelsRange::iterator::operator++()
@@ -55,30 +49,48 @@ CelsRange::iterator& CelsRange::iterator::operator++()
     return *this;
 
   // Get next cel
-  Layer* layer = m_cel->layer();
-  frame_t first = m_cel->frame()+1;
+  ++m_it;
+  findCel();
+  return *this;
+}
+
+void CelsRange::iterator::enterLayer(Layer* layer)
+{
+  m_layer = layer;
+  if (!layer || !layer->isImage())
+    return;
+
+  // Cels are sorted by frame, so we can jump to the first cel in the
+  // range with a binary search.
+  const LayerImage* imgLayer = static_cast<const LayerImage*>(layer);
+  m_end = imgLayer->getCelEnd();
+  m_it = std::lower_bound(
+    imgLayer->getCelBegin(), m_end, m_first,
+    [](const Cel* cel, frame_t frame) {
+      return cel->frame() < frame;
+    });
+}
+
+// Points m_cel to the cel in m_it, or to the next one that is in the
+// frame range (and wasn't visited in UNIQUE mode).
+void CelsRange::iterator::findCel()
+{
   m_cel = nullptr;
 
-  while (layer && !m_cel) {
-    for (frame_t f=first; f<=m_last; ++f) {
-      m_cel = layer->cel(f);
-      if (m_cel) {
-        if (m_flags == CelsRange::UNIQUE) {
-          if (m_visited.find(m_cel->data()->id()) == m_visited.end()) {
-            m_visited.insert(m_cel->data()->id());
-            break;
-          }
-          else
-            m_cel = nullptr;
-        }
-        else
-          break;
+  while (m_layer) {
+    if (m_layer->isImage()) {
+      for (; m_it != m_end && (*m_it)->frame() <= m_last; ++m_it) {
+        Cel* cel = *m_it;
+        if (m_flags == CelsRange::UNIQUE &&
+            !m_visited.insert(cel->data()->id()).second)
+          continue;
+
+        m_cel = cel;
+        return;
       }
     }
-    layer = layer->getNext();
-    first = m_first;
+    enterLayer(m_layer->getNext());
   }
-  return *this;
 }
 
 } // namespace doc
@@ -8,15 +8,23 @@
 #define DOC_CELS_RANGE_H_INCLUDED
 #pragma once
 
+#include "doc/cel_list.h"
 #include "doc/frame.h"
 #include "doc/object_id.h"
 
-#include <set>
+#include <unordered_set>
 
 namespace doc {
   class Cel;
+  class Layer;
   class Sprite;
 
+  // Iterates the cels of the sprite layers (layer by layer, and
+  // frame by frame in each layer) walking directly the sorted list
+  // of cels of each layer, so a complete iteration is O(total cels).
+  // Cels must not be added/removed to/from the layers while the
+  // range is iterated.
+
   class CelsRange {
   public:
     enum Flags {
@@ -47,10 +55,15 @@ namespace doc {
       iterator& operator++();
 
     private:
+      void enterLayer(Layer* layer);
+      void findCel();
+
       Cel* m_cel;
+      Layer* m_layer;
+      CelConstIterator m_it, m_end;
       frame_t m_first, m_last;
       Flags m_flags;
-      std::set<ObjectId> m_visited;
+      std::unordered_set<ObjectId> m_visited;
     };
 
     iterator begin() { return m_begin; }
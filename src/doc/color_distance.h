@@ -0,0 +1,33 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef DOC_COLOR_DISTANCE_H_INCLUDED
+#define DOC_COLOR_DISTANCE_H_INCLUDED
+#pragma once
+
+namespace doc {
+
+  // Each RGB component is multiplied by its weight (similar to the
+  // luminance contribution of each one) to calculate the distance
+  // between two colors, i.e. the distance is:
+  //
+  //   (30*dr)^2 + (59*dg)^2 + (11*db)^2
+  //
+  inline int color_distance_weighted_r(int r) { return 30*r; }
+  inline int color_distance_weighted_g(int g) { return 59*g; }
+  inline int color_distance_weighted_b(int b) { return 11*b; }
+
+  inline int color_distance(int r1, int g1, int b1,
+                            int r2, int g2, int b2) {
+    int dr = color_distance_weighted_r(r1 - r2);
+    int dg = color_distance_weighted_g(g1 - g2);
+    int db = color_distance_weighted_b(b1 - b2);
+    return dr*dr + dg*dg + db*db;
+  }
+
+} // namespace doc
+
+#endif
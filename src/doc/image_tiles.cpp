@@ -0,0 +1,133 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "doc/image_tiles.h"
+
+#include "base/unique_ptr.h"
+#include "doc/image.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace doc {
+
+ImageTiles::ImageTiles(const Image* image, const Image* reference)
+  : m_format(image->pixelFormat())
+  , m_width(image->width())
+  , m_height(image->height())
+  , m_maskColor(image->maskColor())
+  , m_diff(reference &&
+           reference->pixelFormat() == image->pixelFormat() &&
+           reference->width() == image->width() &&
+           reference->height() == image->height())
+  , m_tiles(tilesPerRow() * tilesPerCol())
+{
+  // Row of a tile filled with the mask color
+  base::UniquePtr<Image> maskRow;
+  if (!m_diff) {
+    maskRow.reset(Image::create(m_format, kTileSize, 1));
+    maskRow->clear(m_maskColor);
+  }
+
+  int i = 0;
+  for (int ty=0; ty<m_height; ty+=kTileSize) {
+    int th = std::min<int>(kTileSize, m_height-ty);
+
+    for (int tx=0; tx<m_width; tx+=kTileSize, ++i) {
+      int tw = std::min<int>(kTileSize, m_width-tx);
+      int rowBytes = image->getRowStrideSize(tw);
+
+      bool skip = true;
+      for (int y=ty; y<ty+th; ++y) {
+        const uint8_t* row = image->getPixelAddress(tx, y);
+        const uint8_t* cmp = (m_diff ? reference->getPixelAddress(tx, y):
+                                       maskRow->getPixelAddress(0, 0));
+        if (std::memcmp(row, cmp, rowBytes) != 0) {
+          skip = false;
+          break;
+        }
+      }
+      if (skip)
+        continue;
+
+      ImageBufferPtr tile(new ImageBuffer(rowBytes * th));
+      uint8_t* dst = tile->buffer();
+      for (int y=ty; y<ty+th; ++y, dst+=rowBytes)
+        std::memcpy(dst, image->getPixelAddress(tx, y), rowBytes);
+
+      m_tiles[i] = tile;
+    }
+  }
+}
+
+int ImageTiles::tilesCount() const
+{
+  int count = 0;
+  for (const ImageBufferPtr& tile : m_tiles)
+    if (tile)
+      ++count;
+  return count;
+}
+
+int ImageTiles::getMemSize() const
+{
+  int size = sizeof(ImageTiles) + m_tiles.size()*sizeof(ImageBufferPtr);
+  for (const ImageBufferPtr& tile : m_tiles)
+    if (tile)
+      size += int(tile->size());
+  return size;
+}
+
+Image* ImageTiles::createImage(const Image* reference) const
+{
+  Image* image;
+  if (m_diff) {
+    ASSERT(reference);
+    ASSERT(reference->pixelFormat() == m_format);
+    ASSERT(reference->width() == m_width);
+    ASSERT(reference->height() == m_height);
+    image = Image::createCopy(reference);
+  }
+  else
+    image = Image::create(m_format, m_width, m_height);
+
+  image->setMaskColor(m_maskColor);
+  restore(image);
+  return image;
+}
+
+void ImageTiles::restore(Image* image) const
+{
+  ASSERT(image->pixelFormat() == m_format);
+  ASSERT(image->width() == m_width);
+  ASSERT(image->height() == m_height);
+
+  int i = 0;
+  for (int ty=0; ty<m_height; ty+=kTileSize) {
+    int th = std::min<int>(kTileSize, m_height-ty);
+
+    for (int tx=0; tx<m_width; tx+=kTileSize, ++i) {
+      int tw = std::min<int>(kTileSize, m_width-tx);
+      const ImageBufferPtr& tile = m_tiles[i];
+
+      if (tile) {
+        int rowBytes = image->getRowStrideSize(tw);
+        const uint8_t* src = tile->buffer();
+        for (int y=ty; y<ty+th; ++y, src+=rowBytes)
+          std::memcpy(image->getPixelAddress(tx, y), src, rowBytes);
+      }
+      else if (!m_diff) {
+        image->fillRect(tx, ty, tx+tw-1, ty+th-1, m_maskColor);
+      }
+    }
+  }
+}
+
+} // namespace doc
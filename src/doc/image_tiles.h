@@ -0,0 +1,80 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef DOC_IMAGE_TILES_H_INCLUDED
+#define DOC_IMAGE_TILES_H_INCLUDED
+#pragma once
+
+#include "doc/color.h"
+#include "doc/image_buffer.h"
+#include "doc/pixel_format.h"
+
+#include <vector>
+
+namespace doc {
+
+  class Image;
+
+  // Copy of the pixels of an image split in fixed-size tiles. Tiles
+  // are immutable and reference-counted, so copies of an ImageTiles
+  // share them (copy-on-write).
+  //
+  // Only the tiles with pixels are stored: tiles with the mask
+  // color, or equal to the same tile of a reference image (so it's
+  // possible to keep just the difference between two versions of
+  // an image, e.g. for undo).
+  class ImageTiles {
+  public:
+    enum { kTileSize = 64 };
+
+    // Copies the tiles of "image" that are different from the tiles
+    // of "reference". If "reference" is nullptr (or it has other
+    // size or pixel format), tiles filled with the mask color are
+    // skipped.
+    ImageTiles(const Image* image, const Image* reference = nullptr);
+
+    PixelFormat pixelFormat() const { return m_format; }
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    color_t maskColor() const { return m_maskColor; }
+
+    // Returns true if the tiles are the difference with a reference
+    // image (i.e. createImage() needs the same reference image).
+    bool isDiff() const { return m_diff; }
+
+    // Number of stored tiles (with pixels).
+    int tilesCount() const;
+
+    int getMemSize() const;
+
+    // Creates a copy of the original image. If isDiff() is true,
+    // "reference" must contain the same pixels of the reference
+    // image used to create these tiles.
+    Image* createImage(const Image* reference = nullptr) const;
+
+    // Copies the stored tiles into "image" (that must have the same
+    // size and pixel format of the original image). If isDiff() is
+    // false, skipped tiles are cleared with the mask color.
+    void restore(Image* image) const;
+
+  private:
+    int tilesPerRow() const { return (m_width + kTileSize - 1) / kTileSize; }
+    int tilesPerCol() const { return (m_height + kTileSize - 1) / kTileSize; }
+
+    PixelFormat m_format;
+    int m_width;
+    int m_height;
+    color_t m_maskColor;
+    bool m_diff;
+
+    // Tiles in row-major order (nullptr for skipped tiles). Each
+    // buffer contains the rows of the tile one after the other.
+    std::vector<ImageBufferPtr> m_tiles;
+  };
+
+} // namespace doc
+
+#endif
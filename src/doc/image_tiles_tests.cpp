@@ -0,0 +1,114 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/unique_ptr.h"
+#include "doc/image_impl.h"
+#include "doc/image_tiles.h"
+#include "doc/primitives.h"
+
+#include <cstdlib>
+
+using namespace base;
+using namespace doc;
+
+template<typename T>
+class ImageTilesAllTypes : public testing::Test {
+protected:
+  ImageTilesAllTypes() { }
+};
+
+typedef testing::Types<RgbTraits, GrayscaleTraits, IndexedTraits, BitmapTraits> ImageAllTraits;
+TYPED_TEST_CASE(ImageTilesAllTypes, ImageAllTraits);
+
+TYPED_TEST(ImageTilesAllTypes, CopyAndRestore)
+{
+  typedef TypeParam ImageTraits;
+
+  const gfx::Size sizes[] = {
+    gfx::Size(1, 1), gfx::Size(63, 65), gfx::Size(64, 64), gfx::Size(200, 130) };
+
+  for (const gfx::Size& size : sizes) {
+    UniquePtr<Image> image(Image::create(ImageTraits::pixel_format, size.w, size.h));
+    for (int y=0; y<size.h; ++y)
+      for (int x=0; x<size.w; ++x)
+        put_pixel(image, x, y, std::rand() % ImageTraits::max_value);
+
+    ImageTiles tiles(image);
+    EXPECT_FALSE(tiles.isDiff());
+
+    UniquePtr<Image> copy(tiles.createImage());
+    EXPECT_EQ(0, count_diff_between_images(image, copy));
+  }
+}
+
+TEST(ImageTiles, SkipEmptyTiles)
+{
+  UniquePtr<Image> image(Image::create(IMAGE_RGB, 1000, 1000));
+  image->clear(0);
+  put_pixel(image, 10, 10, rgba(255, 0, 0, 255));
+  put_pixel(image, 999, 999, rgba(0, 255, 0, 255));
+
+  ImageTiles tiles(image);
+  EXPECT_EQ(2, tiles.tilesCount());
+  EXPECT_LT(tiles.getMemSize(), image->getMemSize() / 100);
+
+  UniquePtr<Image> copy(tiles.createImage());
+  EXPECT_EQ(0, count_diff_between_images(image, copy));
+}
+
+TEST(ImageTiles, DiffWithReference)
+{
+  UniquePtr<Image> oldImage(Image::create(IMAGE_RGB, 300, 200));
+  for (int y=0; y<oldImage->height(); ++y)
+    for (int x=0; x<oldImage->width(); ++x)
+      put_pixel(oldImage, x, y, rgba(x, y, x+y, 255));
+
+  UniquePtr<Image> newImage(Image::createCopy(oldImage));
+  fill_rect(newImage, 70, 70, 130, 80, rgba(0, 0, 0, 0));
+
+  // Only the two modified tiles are stored
+  ImageTiles tiles(oldImage, newImage);
+  EXPECT_TRUE(tiles.isDiff());
+  EXPECT_EQ(2, tiles.tilesCount());
+
+  UniquePtr<Image> restored(tiles.createImage(newImage));
+  EXPECT_EQ(0, count_diff_between_images(oldImage, restored));
+
+  // Copies share the tiles
+  ImageTiles tiles2 = tiles;
+  tiles2.restore(newImage);
+  EXPECT_EQ(0, count_diff_between_images(oldImage, newImage));
+}
+
+TEST(ImageTiles, ReferenceWithDifferentSize)
+{
+  UniquePtr<Image> oldImage(Image::create(IMAGE_INDEXED, 70, 10));
+  UniquePtr<Image> newImage(Image::create(IMAGE_INDEXED, 10, 70));
+  oldImage->setMaskColor(3);
+  oldImage->clear(3);
+  newImage->clear(0);
+  put_pixel(oldImage, 65, 5, 4);
+
+  ImageTiles tiles(oldImage, newImage);
+  EXPECT_FALSE(tiles.isDiff());
+  EXPECT_EQ(1, tiles.tilesCount());
+
+  UniquePtr<Image> restored(tiles.createImage());
+  EXPECT_EQ(3, restored->maskColor());
+  EXPECT_EQ(0, count_diff_between_images(oldImage, restored));
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -35,9 +35,19 @@ namespace doc {
       return bytes_per_pixel * pixels_per_row;
     }
 
+    typedef RgbaBlendRowFunc row_blender_t;
+
     static inline BlendFunc get_blender(BlendMode blend_mode) {
       return get_rgba_blender(blend_mode);
     }
+
+    static inline row_blender_t get_row_blender(BlendMode blend_mode) {
+      return get_rgba_row_blender(blend_mode);
+    }
+
+    static inline bool is_opaque(pixel_t c) {
+      return ((c & rgba_a_mask) == rgba_a_mask);
+    }
   };
 
   struct GrayscaleTraits {
@@ -62,9 +72,19 @@ namespace doc {
       return bytes_per_pixel * pixels_per_row;
     }
 
+    typedef GrayaBlendRowFunc row_blender_t;
+
     static inline BlendFunc get_blender(BlendMode blend_mode) {
       return get_graya_blender(blend_mode);
     }
+
+    static inline row_blender_t get_row_blender(BlendMode blend_mode) {
+      return get_graya_row_blender(blend_mode);
+    }
+
+    static inline bool is_opaque(pixel_t c) {
+      return ((c & graya_a_mask) == graya_a_mask);
+    }
   };
 
   struct IndexedTraits {
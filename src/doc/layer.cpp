@@ -20,6 +20,16 @@
 
 namespace doc {
 
+static bool cel_frame_less(const Cel* cel, frame_t frame)
+{
+  return cel->frame() < frame;
+}
+
+static bool frame_cel_less(frame_t frame, const Cel* cel)
+{
+  return frame < cel->frame();
+}
+
 Layer::Layer(ObjectType type, Sprite* sprite)
   : Object(type)
   , m_sprite(sprite)
@@ -125,16 +135,25 @@ void LayerImage::destroyAllCels()
 
 Cel* LayerImage::cel(frame_t frame) const
 {
-  CelConstIterator it = getCelBegin();
-  CelConstIterator end = getCelEnd();
+  if (frame < 0 || m_cels.empty())
+    return NULL;
 
-  for (; it != end; ++it) {
-    Cel* cel = *it;
-    if (cel->frame() == frame)
-      return cel;
-  }
+  // As cels are sorted by frame (and there is only one cel per
+  // frame), the cel of the given frame cannot be after the index
+  // "frame". So in layers with one cel in each frame the first
+  // comparison finds it.
+  CelConstIterator end = m_cels.begin() + std::min<int>(frame+1, int(m_cels.size()));
+  if ((*(end-1))->frame() == frame)
+    return *(end-1);
 
-  return NULL;
+  // Binary search
+  CelConstIterator it = std::lower_bound(
+    m_cels.begin(), end, frame, cel_frame_less);
+
+  if (it != end && (*it)->frame() == frame)
+    return *it;
+  else
+    return NULL;
 }
 
 void LayerImage::getCels(CelList& cels) const
@@ -158,13 +177,9 @@ void LayerImage::addCel(Cel* cel)
 {
   ASSERT(cel->data() && "The cel doesn't contain CelData");
 
-  CelIterator it = getCelBegin();
-  CelIterator end = getCelEnd();
-
-  for (; it != end; ++it) {
-    if ((*it)->frame() > cel->frame())
-      break;
-  }
+  // Insert the cel after all cels with a frame <= cel->frame()
+  CelIterator it = std::upper_bound(
+    m_cels.begin(), m_cels.end(), cel->frame(), frame_cel_less);
 
   m_cels.insert(it, cel);
 
@@ -179,7 +194,17 @@ void LayerImage::addCel(Cel* cel)
  */
 void LayerImage::removeCel(Cel* cel)
 {
-  CelIterator it = std::find(m_cels.begin(), m_cels.end(), cel);
+  CelIterator it = std::lower_bound(
+    m_cels.begin(), m_cels.end(), cel->frame(), cel_frame_less);
+
+  while (it != m_cels.end() && *it != cel && (*it)->frame() == cel->frame())
+    ++it;
+
+  // Just in case that cels are not sorted by frame
+  if (it == m_cels.end() || *it != cel) {
+    ASSERT(false);
+    it = std::find(m_cels.begin(), m_cels.end(), cel);
+  }
 
   ASSERT(it != m_cels.end());
 
@@ -284,6 +309,8 @@ void LayerFolder::addLayer(Layer* layer)
 {
   m_layers.push_back(layer);
   layer->setParent(this);
+
+  sprite()->rebuildLayersIndex();
 }
 
 void LayerFolder::removeLayer(Layer* layer)
@@ -293,6 +320,8 @@ void LayerFolder::removeLayer(Layer* layer)
   m_layers.erase(it);
 
   layer->setParent(NULL);
+
+  sprite()->rebuildLayersIndex();
 }
 
 void LayerFolder::stackLayer(Layer* layer, Layer* after)
@@ -313,6 +342,8 @@ void LayerFolder::stackLayer(Layer* layer, Layer* after)
   }
   else
     m_layers.push_front(layer);
+
+  sprite()->rebuildLayersIndex();
 }
 
 void LayerFolder::displaceFrames(frame_t fromThis, frame_t delta)
@@ -143,7 +143,7 @@ namespace doc {
 
     BlendMode m_blendmode;
     int m_opacity;
-    CelList m_cels;   // List of all cels inside this layer used by frames.
+    CelList m_cels;   // List of all cels inside this layer sorted by frame.
   };
 
   //////////////////////////////////////////////////////////////////////
@@ -0,0 +1,176 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/unique_ptr.h"
+#include "doc/cel.h"
+#include "doc/image.h"
+#include "doc/layer.h"
+#include "doc/sprite.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+
+using namespace base;
+using namespace doc;
+
+static Cel* create_cel(frame_t frame)
+{
+  ImageRef image(Image::create(IMAGE_RGB, 1, 1));
+  return new Cel(frame, image);
+}
+
+static void expect_sorted_cels(const LayerImage* layer)
+{
+  frame_t prev = -1;
+  for (CelConstIterator it=layer->getCelBegin(), end=layer->getCelEnd(); it != end; ++it) {
+    EXPECT_LT(prev, (*it)->frame());
+    EXPECT_EQ(*it, layer->cel((*it)->frame()));
+    prev = (*it)->frame();
+  }
+}
+
+TEST(LayerImage, CelLookup)
+{
+  UniquePtr<Sprite> spr(new Sprite(IMAGE_RGB, 32, 32, 256));
+  spr->setTotalFrames(100);
+  LayerImage* lay = new LayerImage(spr);
+  spr->folder()->addLayer(lay);
+
+  // Cels added in random order
+  std::map<frame_t, Cel*> cels;
+  for (int i=0; i<60; ++i) {
+    frame_t frame = std::rand() % 100;
+    if (cels.find(frame) != cels.end())
+      continue;
+
+    Cel* cel = create_cel(frame);
+    lay->addCel(cel);
+    cels[frame] = cel;
+  }
+  EXPECT_EQ(int(cels.size()), lay->getCelsCount());
+  expect_sorted_cels(lay);
+
+  for (frame_t frame=0; frame<100; ++frame) {
+    auto it = cels.find(frame);
+    EXPECT_EQ(it != cels.end() ? it->second: nullptr, lay->cel(frame));
+  }
+  EXPECT_EQ(cels.rbegin()->second, lay->getLastCel());
+
+  // Remove some cels
+  for (auto it=cels.begin(); it!=cels.end(); ) {
+    if (std::rand() % 2) {
+      lay->removeCel(it->second);
+      EXPECT_EQ(nullptr, lay->cel(it->first));
+      delete it->second;
+      it = cels.erase(it);
+    }
+    else
+      ++it;
+  }
+  EXPECT_EQ(int(cels.size()), lay->getCelsCount());
+  expect_sorted_cels(lay);
+
+  // Move cels to empty frames
+  for (int i=0; i<20; ++i) {
+    frame_t frame = std::rand() % 100;
+    if (cels.find(frame) != cels.end())
+      continue;
+
+    auto it = cels.begin();
+    std::advance(it, std::rand() % cels.size());
+    Cel* cel = it->second;
+    cels.erase(it);
+
+    lay->moveCel(cel, frame);
+    cels[frame] = cel;
+  }
+  expect_sorted_cels(lay);
+
+  for (frame_t frame=0; frame<100; ++frame) {
+    auto it = cels.find(frame);
+    EXPECT_EQ(it != cels.end() ? it->second: nullptr, lay->cel(frame));
+  }
+}
+
+TEST(LayerImage, DisplaceFrames)
+{
+  UniquePtr<Sprite> spr(new Sprite(IMAGE_RGB, 32, 32, 256));
+  spr->setTotalFrames(10);
+  LayerImage* lay = new LayerImage(spr);
+  spr->folder()->addLayer(lay);
+
+  Cel* celA = create_cel(frame_t(1));
+  Cel* celB = create_cel(frame_t(4));
+  Cel* celC = create_cel(frame_t(5));
+  lay->addCel(celA);
+  lay->addCel(celB);
+  lay->addCel(celC);
+
+  // Insert two frames before frame 4
+  spr->setTotalFrames(12);
+  lay->displaceFrames(frame_t(4), frame_t(2));
+  expect_sorted_cels(lay);
+  EXPECT_EQ(celA, lay->cel(frame_t(1)));
+  EXPECT_EQ(nullptr, lay->cel(frame_t(4)));
+  EXPECT_EQ(celB, lay->cel(frame_t(6)));
+  EXPECT_EQ(celC, lay->cel(frame_t(7)));
+
+  // Remove the inserted frames
+  lay->displaceFrames(frame_t(4), frame_t(-2));
+  spr->setTotalFrames(10);
+  expect_sorted_cels(lay);
+  EXPECT_EQ(celA, lay->cel(frame_t(1)));
+  EXPECT_EQ(celB, lay->cel(frame_t(4)));
+  EXPECT_EQ(celC, lay->cel(frame_t(5)));
+  EXPECT_EQ(nullptr, lay->cel(frame_t(6)));
+}
+
+// Prints the time of LayerImage::cel() in layers with a cel in half
+// of their frames. Run it with --gtest_also_run_disabled_tests.
+TEST(LayerImage, DISABLED_CelLookupBenchmark)
+{
+  const int lookups = 10000000;
+
+  for (int nframes : { 100, 1000, 10000 }) {
+    UniquePtr<Sprite> spr(new Sprite(IMAGE_RGB, 32, 32, 256));
+    spr->setTotalFrames(frame_t(nframes));
+    LayerImage* lay = new LayerImage(spr);
+    spr->folder()->addLayer(lay);
+
+    for (frame_t frame=0; frame<nframes; frame+=2)
+      lay->addCel(create_cel(frame));
+
+    auto t0 = std::chrono::steady_clock::now();
+    int found = 0;
+    frame_t frame = 0;
+    for (int i=0; i<lookups; ++i) {
+      if (lay->cel(frame))
+        ++found;
+      // Visit frames in a non-sequential order
+      frame = (frame + 7919) % nframes;
+    }
+    auto t1 = std::chrono::steady_clock::now();
+
+    EXPECT_EQ(lookups/2, found);
+    double ms = std::chrono::duration<double, std::milli>(t1-t0).count();
+    std::printf("%5d frames: %d lookups in %8.2f ms (%6.2f ns/lookup)\n",
+                nframes, lookups, ms, ms * 1000000.0 / lookups);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -10,6 +10,7 @@
 
 #include "doc/palette.h"
 
+#include "doc/color_distance.h"
 #include "doc/image.h"
 #include "doc/remap.h"
 
@@ -181,64 +182,28 @@ int Palette::findExactMatch(int r, int g, int b) const
   return -1;
 }
 
-//////////////////////////////////////////////////////////////////////
-// Based on Allegro's bestfit_color
-
-static unsigned int col_diff[3*128];
-
-static void bestfit_init()
-{
-  int i, k;
-
-  for (i=1; i<64; i++) {
-    k = i * i;
-    col_diff[0  +i] = col_diff[0  +128-i] = k * (59 * 59);
-    col_diff[128+i] = col_diff[128+128-i] = k * (30 * 30);
-    col_diff[256+i] = col_diff[256+128-i] = k * (11 * 11);
-  }
-}
-
 int Palette::findBestfit(int r, int g, int b, int mask_index) const
 {
-#ifdef __GNUC__
-  register int bestfit asm("%eax");
-#else
-  register int bestfit;
-#endif
-  int i, coldiff, lowest;
-
   ASSERT(r >= 0 && r <= 255);
   ASSERT(g >= 0 && g <= 255);
   ASSERT(b >= 0 && b <= 255);
 
-  if (col_diff[1] == 0)
-    bestfit_init();
+  int bestfit = 0;
+  int lowest = std::numeric_limits<int>::max();
 
-  bestfit = 0;
-  lowest = std::numeric_limits<int>::max();
+  for (int i=0; i<size(); ++i) {
+    if (i == mask_index)
+      continue;
 
-  r >>= 3;
-  g >>= 3;
-  b >>= 3;
-
-  i = 0;
-  while (i < size()) {
     color_t rgb = m_colors[i];
-
-    coldiff = (col_diff + 0) [ ((rgba_getg(rgb)>>3) - g) & 0x7F ];
+    int coldiff = color_distance(rgba_getr(rgb), rgba_getg(rgb), rgba_getb(rgb),
+                                 r, g, b);
     if (coldiff < lowest) {
-      coldiff += (col_diff + 128) [ ((rgba_getr(rgb)>>3) - r) & 0x7F ];
-      if (coldiff < lowest) {
-        coldiff += (col_diff + 256) [ ((rgba_getb(rgb)>>3) - b) & 0x7F ];
-        if (coldiff < lowest && i != mask_index) {
-          bestfit = i;
-          if (coldiff == 0)
-            return bestfit;
-          lowest = coldiff;
-        }
-      }
+      bestfit = i;
+      if (coldiff == 0)
+        break;
+      lowest = coldiff;
     }
-    i++;
   }
 
   return bestfit;
@@ -69,6 +69,10 @@ namespace doc {
     void makeGradient(int from, int to);
 
     int findExactMatch(int r, int g, int b) const;
+
+    // Returns the nearest entry to the given RGB color (see
+    // color_distance()). Use a PaletteKdTree to find the nearest
+    // entries of a lot of colors.
     int findBestfit(int r, int g, int b, int mask_index = 0) const;
 
   private:
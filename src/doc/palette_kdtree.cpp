@@ -0,0 +1,154 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "doc/palette_kdtree.h"
+
+#include "doc/color_distance.h"
+#include "doc/palette.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace doc {
+
+// Maximum number of points in leaf nodes
+static const int kMaxLeafPoints = 4;
+
+namespace {
+
+struct PointAxisLess {
+  int axis;
+  PointAxisLess(int axis) : axis(axis) { }
+
+  template<typename T>
+  bool operator()(const T& a, const T& b) const {
+    return a.v[axis] < b.v[axis];
+  }
+};
+
+} // anonymous namespace
+
+PaletteKdTree::PaletteKdTree(const Palette* palette, int mask_index)
+{
+  m_points.reserve(palette->size());
+  for (int i=0; i<palette->size(); ++i) {
+    if (i == mask_index)
+      continue;
+
+    color_t c = palette->getEntry(i);
+    Point pt;
+    pt.v[0] = color_distance_weighted_r(rgba_getr(c));
+    pt.v[1] = color_distance_weighted_g(rgba_getg(c));
+    pt.v[2] = color_distance_weighted_b(rgba_getb(c));
+    pt.index = i;
+    m_points.push_back(pt);
+  }
+
+  if (!m_points.empty())
+    build(0, int(m_points.size()));
+}
+
+int PaletteKdTree::findBestfit(int r, int g, int b) const
+{
+  ASSERT(r >= 0 && r <= 255);
+  ASSERT(g >= 0 && g <= 255);
+  ASSERT(b >= 0 && b <= 255);
+
+  // Same result as Palette::findBestfit() when all entries are
+  // the mask color
+  if (m_nodes.empty())
+    return 0;
+
+  int v[3] = {
+    color_distance_weighted_r(r),
+    color_distance_weighted_g(g),
+    color_distance_weighted_b(b) };
+
+  int bestDist = std::numeric_limits<int>::max();
+  int bestIndex = 0;
+  search(0, v, bestDist, bestIndex);
+  return bestIndex;
+}
+
+int PaletteKdTree::build(int begin, int end)
+{
+  int nodeIndex = int(m_nodes.size());
+  m_nodes.push_back(Node());
+
+  Node node;
+  node.axis = -1;
+  node.split = 0;
+  node.begin = begin;
+  node.end = end;
+  node.left = node.right = -1;
+
+  if (end - begin > kMaxLeafPoints) {
+    // Split the axis with the largest range of values
+    int range[3];
+    for (int axis=0; axis<3; ++axis) {
+      auto minmax = std::minmax_element(
+        m_points.begin()+begin, m_points.begin()+end, PointAxisLess(axis));
+      range[axis] = minmax.second->v[axis] - minmax.first->v[axis];
+    }
+    int axis = int(std::max_element(range, range+3) - range);
+
+    // All points are equal, they stay in a leaf
+    if (range[axis] > 0) {
+      int mid = (begin + end) / 2;
+      std::nth_element(m_points.begin()+begin,
+                       m_points.begin()+mid,
+                       m_points.begin()+end, PointAxisLess(axis));
+
+      node.axis = axis;
+      node.split = m_points[mid].v[axis];
+      node.left = build(begin, mid);
+      node.right = build(mid, end);
+    }
+  }
+
+  m_nodes[nodeIndex] = node;
+  return nodeIndex;
+}
+
+void PaletteKdTree::search(int nodeIndex, const int v[3], int& bestDist, int& bestIndex) const
+{
+  const Node& node = m_nodes[nodeIndex];
+
+  if (node.axis < 0) {
+    for (int i=node.begin; i<node.end; ++i) {
+      const Point& pt = m_points[i];
+      int d0 = pt.v[0] - v[0];
+      int d1 = pt.v[1] - v[1];
+      int d2 = pt.v[2] - v[2];
+      int dist = d0*d0 + d1*d1 + d2*d2;
+      if (dist < bestDist ||
+          (dist == bestDist && pt.index < bestIndex)) {
+        bestDist = dist;
+        bestIndex = pt.index;
+      }
+    }
+    return;
+  }
+
+  // Points in the left node are <= split, and points in the right
+  // node are >= split.
+  int delta = v[node.axis] - node.split;
+  int nearNode = (delta < 0 ? node.left: node.right);
+  int farNode = (delta < 0 ? node.right: node.left);
+
+  search(nearNode, v, bestDist, bestIndex);
+
+  // Equidistant entries must be checked too (they could have a
+  // lower palette index)
+  if (delta*delta <= bestDist)
+    search(farNode, v, bestDist, bestIndex);
+}
+
+} // namespace doc
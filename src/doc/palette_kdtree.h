@@ -0,0 +1,52 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef DOC_PALETTE_KDTREE_H_INCLUDED
+#define DOC_PALETTE_KDTREE_H_INCLUDED
+#pragma once
+
+#include <vector>
+
+namespace doc {
+
+  class Palette;
+
+  // k-d tree with the colors of a palette to find the nearest palette
+  // entry of a RGB color. It returns the same entry as
+  // Palette::findBestfit() (the same distance function and the lowest
+  // index for equidistant entries), but it doesn't need to compare
+  // the color with all palette entries.
+  //
+  // The tree must be created again if the palette is modified.
+  class PaletteKdTree {
+  public:
+    PaletteKdTree(const Palette* palette, int mask_index = 0);
+
+    int findBestfit(int r, int g, int b) const;
+
+  private:
+    struct Point {
+      int v[3];                 // Weighted components
+      int index;                // Palette index
+    };
+
+    struct Node {
+      int axis;                 // Split axis, or -1 if it's a leaf
+      int split;                // Split value
+      int begin, end;           // Points of this node (in m_points)
+      int left, right;          // Children nodes (in m_nodes)
+    };
+
+    int build(int begin, int end);
+    void search(int node, const int v[3], int& bestDist, int& bestIndex) const;
+
+    std::vector<Point> m_points;
+    std::vector<Node> m_nodes;
+  };
+
+} // namespace doc
+
+#endif
@@ -0,0 +1,100 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/palette.h"
+#include "doc/palette_kdtree.h"
+#include "doc/rgbmap.h"
+
+#include <cstdlib>
+
+using namespace doc;
+
+static Palette* create_random_palette(int ncolors)
+{
+  Palette* pal = new Palette(frame_t(0), ncolors);
+  for (int i=0; i<ncolors; ++i)
+    pal->setEntry(i, rgba(std::rand() % 256,
+                          std::rand() % 256,
+                          std::rand() % 256, 255));
+  return pal;
+}
+
+TEST(PaletteKdTree, SameResultsAsFindBestfit)
+{
+  const int sizes[] = { 1, 2, 5, 16, 64, 256 };
+
+  for (int ncolors : sizes) {
+    Palette* pal = create_random_palette(ncolors);
+
+    for (int mask_index=-1; mask_index<2; ++mask_index) {
+      PaletteKdTree tree(pal, mask_index);
+
+      for (int i=0; i<2000; ++i) {
+        int r = std::rand() % 256;
+        int g = std::rand() % 256;
+        int b = std::rand() % 256;
+        EXPECT_EQ(pal->findBestfit(r, g, b, mask_index),
+                  tree.findBestfit(r, g, b));
+      }
+    }
+
+    delete pal;
+  }
+}
+
+TEST(PaletteKdTree, RepeatedColors)
+{
+  Palette pal(frame_t(0), 32);
+  for (int i=0; i<pal.size(); ++i)
+    pal.setEntry(i, rgba(i < 16 ? 10: 200, 20, 30, 255));
+
+  // The first entry is used in case of equidistant entries
+  PaletteKdTree tree(&pal, -1);
+  EXPECT_EQ(0, tree.findBestfit(10, 20, 30));
+  EXPECT_EQ(16, tree.findBestfit(200, 20, 30));
+  EXPECT_EQ(0, tree.findBestfit(105, 20, 30));
+
+  PaletteKdTree tree2(&pal, 0);
+  EXPECT_EQ(1, tree2.findBestfit(10, 20, 30));
+}
+
+TEST(RgbMap, MapColors)
+{
+  Palette* pal = create_random_palette(256);
+
+  for (int bits=4; bits<=6; ++bits) {
+    RgbMap rgbmap(bits);
+    rgbmap.regenerate(pal, 0);
+    EXPECT_TRUE(rgbmap.match(pal));
+
+    // Each color is mapped to the nearest entry of the color that
+    // represents its cell in the map
+    for (int i=0; i<1000; ++i) {
+      int r = std::rand() % 256;
+      int g = std::rand() % 256;
+      int b = std::rand() % 256;
+      int r2 = ((r >> (8-bits)) << (8-bits)) | (r >> bits);
+      int g2 = ((g >> (8-bits)) << (8-bits)) | (g >> bits);
+      int b2 = ((b >> (8-bits)) << (8-bits)) | (b >> bits);
+      EXPECT_EQ(pal->findBestfit(r2, g2, b2, 0),
+                rgbmap.mapColor(r, g, b));
+    }
+  }
+
+  delete pal;
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2001-2014 David Capello
+// Copyright (c) 2001-2015 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -10,12 +10,22 @@
 
 #include <gtest/gtest.h>
 
+#include "base/unique_ptr.h"
 #include "doc/algorithm/resize_image.h"
 #include "doc/color.h"
 #include "doc/image.h"
+#include "doc/palette.h"
 #include "doc/primitives.h"
+#include "doc/rgbmap.h"
+#include "gfx/size.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
 
 using namespace std;
+using namespace base;
 using namespace doc;
 
 // Test data
@@ -77,6 +87,132 @@ TEST(ResizeImage, NearestNeighborInterp)
   ASSERT_EQ(0, count_diff_between_images(dst, dst_expected));
 }
 
+// Bilinear interpolation of RGB images using floating point
+static color_t bilinear_reference(const Image* src, double u, double v)
+{
+  int u0 = int(u), v0 = int(v);
+  int u1 = std::min(u0+1, src->width()-1);
+  int v1 = std::min(v0+1, src->height()-1);
+  double fu = u - u0, fv = v - v0;
+  color_t c[4] = {
+    get_pixel(src, u0, v0), get_pixel(src, u1, v0),
+    get_pixel(src, u0, v1), get_pixel(src, u1, v1) };
+
+  int k[4];
+  for (int i=0; i<4; ++i) {
+    int s = 8*i;
+    k[i] = int((((c[0]>>s)&255)*(1-fu) + ((c[1]>>s)&255)*fu)*(1-fv) +
+               (((c[2]>>s)&255)*(1-fu) + ((c[3]>>s)&255)*fu)*fv);
+  }
+  return rgba(k[0], k[1], k[2], k[3]);
+}
+
+// Same fixed point arithmetic (12 bits of precision) as the scalar
+// version of resize_image(), used to check that the SSE2 version
+// gives exactly the same results.
+static color_t bilinear_fixed_point(const Image* src, int x, int y, int dw, int dh)
+{
+  const int sw = src->width(), sh = src->height();
+  int64_t pu = (dw > 1 ? (int64_t(x) * (sw-1) << 12) / (dw-1): 0);
+  int64_t pv = (dh > 1 ? (int64_t(y) * (sh-1) << 12) / (dh-1): 0);
+  int u0 = int(pu >> 12), v0 = int(pv >> 12);
+  int u1 = std::min(u0+1, sw-1);
+  int v1 = std::min(v0+1, sh-1);
+  uint32_t fu = uint32_t(pu & 4095), fv = uint32_t(pv & 4095);
+  color_t c[4] = {
+    get_pixel(src, u0, v0), get_pixel(src, u1, v0),
+    get_pixel(src, u0, v1), get_pixel(src, u1, v1) };
+
+  int k[4];
+  for (int i=0; i<4; ++i) {
+    int s = 8*i;
+    uint32_t top = ((c[0]>>s)&255)*(4096-fu) + ((c[1]>>s)&255)*fu;
+    uint32_t bottom = ((c[2]>>s)&255)*(4096-fu) + ((c[3]>>s)&255)*fu;
+    k[i] = int((top*(4096-fv) + bottom*fv) >> 24);
+  }
+  return rgba(k[0], k[1], k[2], k[3]);
+}
+
+TEST(ResizeImage, NearestNeighborAllSizes)
+{
+  const PixelFormat formats[] = { IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED, IMAGE_BITMAP };
+  const int sizes[] = { 1, 2, 3, 7, 16, 33 };
+  for (PixelFormat format : formats) {
+    for (int sw : sizes) for (int sh : sizes) {
+      UniquePtr<Image> src(Image::create(format, sw, sh));
+      for (int y=0; y<sh; ++y)
+        for (int x=0; x<sw; ++x)
+          put_pixel(src, x, y, (format == IMAGE_BITMAP ? (x^y)&1: x+y*sw));
+
+      for (int dw : sizes) for (int dh : sizes) {
+        UniquePtr<Image> dst(Image::create(format, dw, dh));
+        algorithm::resize_image(src, dst, algorithm::RESIZE_METHOD_NEAREST_NEIGHBOR, NULL, NULL);
+
+        for (int y=0; y<dh; ++y)
+          for (int x=0; x<dw; ++x)
+            ASSERT_EQ(get_pixel(src, x*sw/dw, y*sh/dh), get_pixel(dst, x, y))
+              << sw << "x" << sh << " -> " << dw << "x" << dh << " format " << format;
+      }
+    }
+  }
+}
+
+TEST(ResizeImage, BilinearInterpRGBTolerance)
+{
+  std::srand(1);
+  UniquePtr<Image> src(Image::create(IMAGE_RGB, 37, 23));
+  for (int y=0; y<src->height(); ++y)
+    for (int x=0; x<src->width(); ++x)
+      put_pixel(src, x, y, rgba(std::rand()%256, std::rand()%256, std::rand()%256, std::rand()%256));
+
+  const gfx::Size sizes[] = {
+    gfx::Size(1, 1), gfx::Size(10, 7), gfx::Size(37, 23), gfx::Size(101, 64) };
+  for (const gfx::Size& size : sizes) {
+    UniquePtr<Image> dst(Image::create(IMAGE_RGB, size.w, size.h));
+    algorithm::resize_image(src, dst, algorithm::RESIZE_METHOD_BILINEAR, NULL, NULL);
+
+    double du = (size.w > 1 ? (src->width()-1) / double(size.w-1): 0.0);
+    double dv = (size.h > 1 ? (src->height()-1) / double(size.h-1): 0.0);
+    for (int y=0; y<size.h; ++y) {
+      for (int x=0; x<size.w; ++x) {
+        color_t a = bilinear_reference(src, x*du, y*dv);
+        color_t b = get_pixel(dst, x, y);
+        for (int s=0; s<32; s+=8)
+          ASSERT_NEAR(int((a>>s)&255), int((b>>s)&255), 1)
+            << "pixel " << x << "," << y << " in " << size.w << "x" << size.h;
+      }
+    }
+  }
+}
+
+TEST(ResizeImage, BilinearInterpRGBExact)
+{
+  std::srand(2);
+  UniquePtr<Image> src(Image::create(IMAGE_RGB, 31, 17));
+  for (int y=0; y<src->height(); ++y)
+    for (int x=0; x<src->width(); ++x)
+      put_pixel(src, x, y, rgba(std::rand()%256, std::rand()%256, std::rand()%256, std::rand()%256));
+  // Extreme values
+  put_pixel(src, 0, 0, rgba(255, 255, 255, 255));
+  put_pixel(src, 1, 0, rgba(255, 255, 255, 255));
+  put_pixel(src, 0, 1, rgba(255, 255, 255, 255));
+  put_pixel(src, 1, 1, rgba(255, 255, 255, 255));
+
+  // Odd and even widths to test the last pixel of each row
+  const gfx::Size sizes[] = {
+    gfx::Size(1, 1), gfx::Size(2, 3), gfx::Size(15, 8), gfx::Size(31, 17),
+    gfx::Size(32, 17), gfx::Size(97, 55), gfx::Size(200, 3) };
+  for (const gfx::Size& size : sizes) {
+    UniquePtr<Image> dst(Image::create(IMAGE_RGB, size.w, size.h));
+    algorithm::resize_image(src, dst, algorithm::RESIZE_METHOD_BILINEAR, NULL, NULL);
+
+    for (int y=0; y<size.h; ++y)
+      for (int x=0; x<size.w; ++x)
+        ASSERT_EQ(bilinear_fixed_point(src, x, y, size.w, size.h), get_pixel(dst, x, y))
+          << "pixel " << x << "," << y << " in " << size.w << "x" << size.h;
+  }
+}
+
 #if 0                           // TODO complete this test
 TEST(ResizeImage, BilinearInterpRGBType)
 {
@@ -90,6 +226,57 @@ TEST(ResizeImage, BilinearInterpRGBType)
 }
 #endif
 
+// Prints the throughput (in destination Mpixels/s) of each resize
+// method for each pixel format. Run it with
+// --gtest_also_run_disabled_tests.
+TEST(ResizeImage, DISABLED_Benchmark)
+{
+  const int sw = 1024, sh = 768;
+  const int dw = 1920, dh = 1080;
+  const int times = 10;
+  const PixelFormat formats[] = { IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED, IMAGE_BITMAP };
+  const char* formatNames[] = { "RGB", "Grayscale", "Indexed", "Bitmap" };
+
+  std::srand(1);
+  Palette palette(frame_t(0), 256);
+  for (int i=0; i<256; ++i)
+    palette.setEntry(i, rgba(std::rand()%256, std::rand()%256, std::rand()%256, 255));
+  RgbMap rgbmap;
+  rgbmap.regenerate(&palette, -1);
+
+  for (int f=0; f<4; ++f) {
+    PixelFormat format = formats[f];
+    UniquePtr<Image> src(Image::create(format, sw, sh));
+    UniquePtr<Image> dst(Image::create(format, dw, dh));
+    for (int y=0; y<sh; ++y) {
+      for (int x=0; x<sw; ++x) {
+        color_t c;
+        switch (format) {
+          case IMAGE_RGB: c = rgba(std::rand()%256, std::rand()%256, std::rand()%256, std::rand()%256); break;
+          case IMAGE_GRAYSCALE: c = graya(std::rand()%256, std::rand()%256); break;
+          case IMAGE_INDEXED: c = std::rand()%256; break;
+          default: c = std::rand()%2; break;
+        }
+        put_pixel(src, x, y, c);
+      }
+    }
+
+    for (int m=0; m<2; ++m) {
+      algorithm::ResizeMethod method = (m == 0 ? algorithm::RESIZE_METHOD_NEAREST_NEIGHBOR:
+                                                 algorithm::RESIZE_METHOD_BILINEAR);
+      auto t0 = std::chrono::steady_clock::now();
+      for (int i=0; i<times; ++i)
+        algorithm::resize_image(src, dst, method, &palette, &rgbmap);
+      auto t1 = std::chrono::steady_clock::now();
+
+      double ms = std::chrono::duration<double, std::milli>(t1-t0).count() / times;
+      std::printf("%-9s %-8s %dx%d -> %dx%d %8.2f ms %8.1f Mpixels/s\n",
+                  formatNames[f], (m == 0 ? "Nearest": "Bilinear"),
+                  sw, sh, dw, dh, ms, dw*dh / ms / 1000.0);
+    }
+  }
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
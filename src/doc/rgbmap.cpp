@@ -10,19 +10,20 @@
 
 #include "doc/rgbmap.h"
 
-#include "doc/color_scales.h"
 #include "doc/palette.h"
+#include "doc/palette_kdtree.h"
 
 namespace doc {
 
-#define MAPSIZE 32*32*32
-
-RgbMap::RgbMap()
+RgbMap::RgbMap(int bits)
   : Object(ObjectType::RgbMap)
-  , m_map(MAPSIZE)
+  , m_bits(bits)
+  , m_shift(8 - bits)
+  , m_map(1 << (3*bits))
   , m_palette(NULL)
   , m_modifications(0)
 {
+  ASSERT(bits >= 4 && bits <= 8);
 }
 
 bool RgbMap::match(const Palette* palette) const
@@ -36,26 +37,23 @@ void RgbMap::regenerate(const Palette* palette, int mask_index)
   m_palette = palette;
   m_modifications = palette->getModifications();
 
+  // Values of N bits scaled to 8 bits repeating the most
+  // significant bits (e.g. the same values of scale_5bits_to_8bits()
+  // for 5 bits)
+  std::vector<int> scale(1 << m_bits);
+  for (int i=0; i<int(scale.size()); ++i)
+    scale[i] = (i << m_shift) | (i >> (m_bits - m_shift));
+
+  PaletteKdTree tree(palette, mask_index);
+
   int i = 0;
-  for (int r=0; r<32; ++r) {
-    for (int g=0; g<32; ++g) {
-      for (int b=0; b<32; ++b) {
-        m_map[i++] =
-          palette->findBestfit(
-            scale_5bits_to_8bits(r),
-            scale_5bits_to_8bits(g),
-            scale_5bits_to_8bits(b), mask_index);
+  for (int r=0; r<int(scale.size()); ++r) {
+    for (int g=0; g<int(scale.size()); ++g) {
+      for (int b=0; b<int(scale.size()); ++b) {
+        m_map[i++] = tree.findBestfit(scale[r], scale[g], scale[b]);
       }
     }
   }
 }
 
-int RgbMap::mapColor(int r, int g, int b) const
-{
-  ASSERT(r >= 0 && r < 256);
-  ASSERT(g >= 0 && g < 256);
-  ASSERT(b >= 0 && b < 256);
-  return m_map[((r>>3) << 10) + ((g>>3) << 5) + (b>>3)];
-}
-
 } // namespace doc
@@ -8,6 +8,7 @@
 #define DOC_RGBMAP_H_INCLUDED
 #pragma once
 
+#include "base/debug.h"
 #include "base/disable_copying.h"
 #include "doc/object.h"
 
@@ -17,16 +18,30 @@ namespace doc {
 
   class Palette;
 
+  // Table to convert RGB colors to palette indexes. Each RGB
+  // component is reduced to the given number of bits (5 bits by
+  // default, i.e. a 32x32x32 table).
   class RgbMap : public Object {
   public:
-    RgbMap();
+    RgbMap(int bits = 5);
+
+    int bits() const { return m_bits; }
 
     bool match(const Palette* palette) const;
     void regenerate(const Palette* palette, int mask_index);
 
-    int mapColor(int r, int g, int b) const;
+    int mapColor(int r, int g, int b) const {
+      ASSERT(r >= 0 && r < 256);
+      ASSERT(g >= 0 && g < 256);
+      ASSERT(b >= 0 && b < 256);
+      return m_map[((r >> m_shift) << (2*m_bits)) +
+                   ((g >> m_shift) << m_bits) +
+                   (b >> m_shift)];
+    }
 
   private:
+    int m_bits;
+    int m_shift;
     std::vector<uint8_t> m_map;
     const Palette* m_palette;
     int m_modifications;
@@ -0,0 +1,62 @@
+// Aseprite Document Library
+// Copyright (c) 2001-2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/unique_ptr.h"
+#include "doc/algorithm/rotsprite.h"
+#include "doc/image.h"
+#include "doc/primitives.h"
+
+#include <cstdlib>
+
+using namespace base;
+using namespace doc;
+
+static Image* create_random_image(PixelFormat format, int w, int h)
+{
+  Image* image = Image::create(format, w, h);
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x)
+      put_pixel(image, x, y, (format == IMAGE_BITMAP ? std::rand() % 2: std::rand() % 4));
+  image->setMaskColor(0);
+  return image;
+}
+
+TEST(RotSprite, Cache)
+{
+  const PixelFormat formats[] = { IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED, IMAGE_BITMAP };
+  for (PixelFormat format : formats) {
+    UniquePtr<Image> src(create_random_image(format, 40, 25));
+    UniquePtr<Image> expected(Image::create(format, 64, 64));
+    UniquePtr<Image> dst(Image::create(format, 64, 64));
+    algorithm::RotSpriteCache cache;
+
+    for (int i=0; i<3; ++i) {
+      // The second time the same source is used (so the scaled image
+      // from the cache is used), and the third time the source is
+      // modified.
+      if (i == 2)
+        fill_rect(src, 5, 5, 20, 10, 1);
+
+      expected->clear(0);
+      dst->clear(0);
+      algorithm::rotsprite_image(expected, src, 10, 2, 60, 20, 45, 62, 1, 40);
+      algorithm::rotsprite_image(dst, src, 10, 2, 60, 20, 45, 62, 1, 40, &cache);
+      EXPECT_EQ(0, count_diff_between_images(expected, dst)) << "format " << format << " step " << i;
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -28,8 +28,7 @@
 
 namespace doc {
 
-static Layer* index2layer(const Layer* layer, const LayerIndex& index, int* index_count);
-static LayerIndex layer2index(const Layer* layer, const Layer* find_layer, int* index_count);
+static void add_layers_to_index(const LayerFolder* folder, std::vector<Layer*>& layers);
 
 //////////////////////////////////////////////////////////////////////
 // Constructors/Destructor
@@ -233,17 +232,30 @@ Layer* Sprite::layer(int layerIndex) const
 
 Layer* Sprite::indexToLayer(LayerIndex index) const
 {
-  if (index < LayerIndex(0))
+  if (index < LayerIndex(0) ||
+      index >= LayerIndex(int(m_layersByIndex.size())))
     return NULL;
 
-  int index_count = -1;
-  return index2layer(folder(), index, &index_count);
+  return m_layersByIndex[index];
 }
 
 LayerIndex Sprite::layerToIndex(const Layer* layer) const
 {
-  int index_count = -1;
-  return layer2index(folder(), layer, &index_count);
+  auto it = m_layerIndexes.find(layer);
+  if (it != m_layerIndexes.end())
+    return LayerIndex(it->second);
+  else
+    return LayerIndex(-1);
+}
+
+void Sprite::rebuildLayersIndex()
+{
+  m_layersByIndex.clear();
+  add_layers_to_index(m_folder, m_layersByIndex);
+
+  m_layerIndexes.clear();
+  for (int i=0; i<int(m_layersByIndex.size()); ++i)
+    m_layerIndexes[m_layersByIndex[i]] = i;
 }
 
 void Sprite::getLayersList(std::vector<Layer*>& layers) const
@@ -349,7 +361,9 @@ RgbMap* Sprite::rgbMap(frame_t frame) const
   int mask_color = (backgroundLayer() ? -1: transparentColor());
 
   if (m_rgbMap == NULL) {
-    m_rgbMap = new RgbMap();
+    // 6 bits per component (the k-d tree makes the regeneration of
+    // this table as fast as the old 5 bits one)
+    m_rgbMap = new RgbMap(6);
     m_rgbMap->regenerate(palette(frame), mask_color);
   }
   else if (!m_rgbMap->match(palette(frame))) {
@@ -550,49 +564,19 @@ CelsRange Sprite::uniqueCels() const
 
 //////////////////////////////////////////////////////////////////////
 
-static Layer* index2layer(const Layer* layer, const LayerIndex& index, int* index_count)
+// Adds the layers of the folder (and its subfolders, each folder is
+// followed by its children) in the same order of their LayerIndex.
+static void add_layers_to_index(const LayerFolder* folder, std::vector<Layer*>& layers)
 {
-  if (index == *index_count)
-    return (Layer*)layer;
-  else {
-    (*index_count)++;
+  LayerConstIterator it = folder->getLayerBegin();
+  LayerConstIterator end = folder->getLayerEnd();
 
-    if (layer->isFolder()) {
-      Layer *found;
-
-      LayerConstIterator it = static_cast<const LayerFolder*>(layer)->getLayerBegin();
-      LayerConstIterator end = static_cast<const LayerFolder*>(layer)->getLayerEnd();
-
-      for (; it != end; ++it) {
-        if ((found = index2layer(*it, index, index_count)))
-          return found;
-      }
-    }
-
-    return NULL;
-  }
-}
-
-static LayerIndex layer2index(const Layer* layer, const Layer* find_layer, int* index_count)
-{
-  if (layer == find_layer)
-    return LayerIndex(*index_count);
-  else {
-    (*index_count)++;
-
-    if (layer->isFolder()) {
-      int found;
-
-      LayerConstIterator it = static_cast<const LayerFolder*>(layer)->getLayerBegin();
-      LayerConstIterator end = static_cast<const LayerFolder*>(layer)->getLayerEnd();
-
-      for (; it != end; ++it) {
-        if ((found = layer2index(*it, find_layer, index_count)) >= 0)
-          return LayerIndex(found);
-      }
-    }
+  for (; it != end; ++it) {
+    Layer* layer = *it;
+    layers.push_back(layer);
 
-    return LayerIndex(-1);
+    if (layer->isFolder())
+      add_layers_to_index(static_cast<const LayerFolder*>(layer), layers);
   }
 }
 
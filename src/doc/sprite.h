@@ -21,6 +21,7 @@
 #include "doc/sprite_position.h"
 #include "gfx/rect.h"
 
+#include <unordered_map>
 #include <vector>
 
 namespace doc {
@@ -89,6 +90,15 @@ namespace doc {
     Layer* indexToLayer(LayerIndex index) const;
     LayerIndex layerToIndex(const Layer* layer) const;
 
+    // Must be called each time a layer is added/removed/moved in a
+    // folder of this sprite to regenerate the layer<->index mapping
+    // used by indexToLayer()/layerToIndex() (LayerFolder member
+    // functions already call it). The mapping is regenerated here
+    // (and not when it's used) so several threads can read it at the
+    // same time. It iterates all layers of the sprite, so adding N
+    // layers costs O(N^2).
+    void rebuildLayersIndex();
+
     void getLayersList(std::vector<Layer*>& layers) const;
 
     ////////////////////////////////////////
@@ -143,6 +153,7 @@ namespace doc {
     CelsRange uniqueCels() const;
 
   private:
+
     Document* m_document;
     PixelFormat m_format;                  // pixel format
     int m_width;                           // image width (in pixels)
@@ -152,6 +163,11 @@ namespace doc {
     PalettesList m_palettes;               // list of palettes
     LayerFolder* m_folder;                 // main folder of layers
 
+    // All layers (in the order of their LayerIndex) and the index of
+    // each one, regenerated in rebuildLayersIndex().
+    std::vector<Layer*> m_layersByIndex;
+    std::unordered_map<const Layer*, int> m_layerIndexes;
+
     // Current rgb map
     mutable RgbMap* m_rgbMap;
 
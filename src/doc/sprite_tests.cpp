@@ -10,12 +10,19 @@
 
 #include <gtest/gtest.h>
 
+#include "base/thread.h"
 #include "doc/cel.h"
 #include "doc/cels_range.h"
 #include "doc/layer.h"
 #include "doc/pixel_format.h"
 #include "doc/sprite.h"
 
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <vector>
+
 using namespace doc;
 
 // lay1 = A _ B
@@ -101,6 +108,254 @@ TEST(Sprite, CelsRange)
   EXPECT_EQ(2, i);
 }
 
+// lay1 = A _ _ _
+// fold = (folder)
+// lay2 = _ _ _ _
+// lay3 = _ B C D   (B and D are linked)
+TEST(Sprite, CelsRangeSkipsLayersWithoutCels)
+{
+  Sprite* spr = new Sprite(IMAGE_RGB, 32, 32, 256);
+  spr->setTotalFrames(4);
+
+  LayerImage* lay1 = new LayerImage(spr);
+  LayerFolder* fold = new LayerFolder(spr);
+  LayerImage* lay2 = new LayerImage(spr);
+  LayerImage* lay3 = new LayerImage(spr);
+  spr->folder()->addLayer(lay1);
+  spr->folder()->addLayer(fold);
+  spr->folder()->addLayer(lay2);
+  spr->folder()->addLayer(lay3);
+
+  Cel* celA = new Cel(frame_t(0), ImageRef(Image::create(IMAGE_RGB, 32, 32)));
+  Cel* celB = new Cel(frame_t(1), ImageRef(Image::create(IMAGE_RGB, 32, 32)));
+  Cel* celC = new Cel(frame_t(2), ImageRef(Image::create(IMAGE_RGB, 32, 32)));
+  Cel* celD = Cel::createLink(celB);
+  celD->setFrame(frame_t(3));
+  lay1->addCel(celA);
+  lay3->addCel(celD);
+  lay3->addCel(celB);
+  lay3->addCel(celC);
+
+  std::vector<Cel*> cels;
+  for (Cel* cel : spr->cels())
+    cels.push_back(cel);
+  ASSERT_EQ(4, cels.size());
+  EXPECT_EQ(celA, cels[0]);
+  EXPECT_EQ(celB, cels[1]);
+  EXPECT_EQ(celC, cels[2]);
+  EXPECT_EQ(celD, cels[3]);
+
+  cels.clear();
+  for (Cel* cel : spr->uniqueCels())
+    cels.push_back(cel);
+  ASSERT_EQ(3, cels.size());
+  EXPECT_EQ(celA, cels[0]);
+  EXPECT_EQ(celB, cels[1]);
+  EXPECT_EQ(celC, cels[2]);
+
+  cels.clear();
+  for (Cel* cel : CelsRange(spr, frame_t(1), frame_t(2)))
+    cels.push_back(cel);
+  ASSERT_EQ(2, cels.size());
+  EXPECT_EQ(celB, cels[0]);
+  EXPECT_EQ(celC, cels[1]);
+
+  EXPECT_TRUE(spr->cels(frame_t(4)).begin() == spr->cels(frame_t(4)).end());
+}
+
+// Layer indexes calculated walking the whole tree of layers (the
+// folder is before its children)
+static void get_layers_tree(const LayerFolder* folder, std::vector<Layer*>& layers)
+{
+  LayerConstIterator it = folder->getLayerBegin();
+  LayerConstIterator end = folder->getLayerEnd();
+  for (; it != end; ++it) {
+    Layer* layer = *it;
+    layers.push_back(layer);
+    if (layer->isFolder())
+      get_layers_tree(static_cast<const LayerFolder*>(layer), layers);
+  }
+}
+
+static void expect_layers_index(const Sprite* spr)
+{
+  std::vector<Layer*> layers;
+  get_layers_tree(spr->folder(), layers);
+
+  for (int i=0; i<int(layers.size()); ++i) {
+    EXPECT_EQ(layers[i], spr->indexToLayer(LayerIndex(i)));
+    EXPECT_EQ(i, spr->layerToIndex(layers[i]));
+  }
+  EXPECT_EQ(nullptr, spr->indexToLayer(LayerIndex(-1)));
+  EXPECT_EQ(nullptr, spr->indexToLayer(LayerIndex(layers.size())));
+  EXPECT_EQ(-1, spr->layerToIndex(spr->folder()));
+  EXPECT_EQ(-1, spr->layerToIndex(nullptr));
+}
+
+TEST(Sprite, LayersIndex)
+{
+  Sprite* spr = new Sprite(IMAGE_RGB, 32, 32, 256);
+  std::srand(1);
+
+  for (int step=0; step<2000; ++step) {
+    std::vector<Layer*> layers;
+    get_layers_tree(spr->folder(), layers);
+
+    std::vector<LayerFolder*> folders;
+    folders.push_back(spr->folder());
+    for (Layer* layer : layers)
+      if (layer->isFolder())
+        folders.push_back(static_cast<LayerFolder*>(layer));
+
+    int op = (layers.size() < 4 ? 0: std::rand() % 5);
+    switch (op) {
+
+      // Add a layer in a folder (more frequently, so the tree grows)
+      case 0:
+      case 4: {
+        LayerFolder* parent = folders[std::rand() % folders.size()];
+        if (std::rand() % 3 == 0)
+          parent->addLayer(new LayerFolder(spr));
+        else
+          parent->addLayer(new LayerImage(spr));
+        break;
+      }
+
+      // Remove a layer
+      case 1: {
+        Layer* layer = layers[std::rand() % layers.size()];
+        layer->parent()->removeLayer(layer);
+        delete layer;
+        break;
+      }
+
+      // Restack a layer in its folder
+      case 2: {
+        Layer* layer = layers[std::rand() % layers.size()];
+        LayerFolder* parent = layer->parent();
+        const LayerList& siblings = parent->getLayersList();
+        Layer* after = nullptr;
+        int i = std::rand() % (siblings.size()+1);
+        if (i < int(siblings.size())) {
+          LayerList::const_iterator it = siblings.begin();
+          std::advance(it, i);
+          after = *it;
+        }
+        if (after != layer)
+          parent->stackLayer(layer, after);
+        break;
+      }
+
+      // Move a layer to other folder
+      case 3: {
+        Layer* layer = layers[std::rand() % layers.size()];
+        LayerFolder* folder = folders[std::rand() % folders.size()];
+        bool valid = true;
+        for (Layer* l=folder; l; l=l->parent())
+          if (l == layer)
+            valid = false;  // Cannot move a folder inside itself
+        if (valid) {
+          layer->parent()->removeLayer(layer);
+          folder->addLayer(layer);
+        }
+        break;
+      }
+    }
+
+    expect_layers_index(spr);
+  }
+
+  delete spr;
+}
+
+// The index of layers is read from several threads at the same time
+// (e.g. rendering threads), it must be ready after each change.
+TEST(Sprite, LayersIndexFromSeveralThreads)
+{
+  Sprite* spr = new Sprite(IMAGE_RGB, 32, 32, 256);
+  for (int i=0; i<10; ++i) {
+    LayerFolder* folder = new LayerFolder(spr);
+    spr->folder()->addLayer(folder);
+    for (int j=0; j<10; ++j)
+      folder->addLayer(new LayerImage(spr));
+  }
+
+  for (int step=0; step<10; ++step) {
+    // Change the tree from the main thread
+    LayerFolder* folder = static_cast<LayerFolder*>(spr->indexToLayer(LayerIndex(0)));
+    spr->folder()->stackLayer(folder, spr->folder()->getLastLayer());
+
+    std::vector<base::thread*> threads;
+    for (int i=0; i<4; ++i)
+      threads.push_back(new base::thread([spr]{
+            for (int j=0; j<20; ++j)
+              expect_layers_index(spr);
+          }));
+    for (base::thread* thread : threads) {
+      thread->join();
+      delete thread;
+    }
+  }
+
+  delete spr;
+}
+
+// Prints the time to iterate all cels of a big sprite (each layer
+// has a new image each 10 frames and links in the other ones). Run
+// it with --gtest_also_run_disabled_tests.
+TEST(CelsRange, DISABLED_Benchmark)
+{
+  const int nlayers = 100;
+  const int nframes = 5000;
+
+  Sprite* spr = new Sprite(IMAGE_RGB, 32, 32, 256);
+  spr->setTotalFrames(frame_t(nframes));
+
+  for (int i=0; i<nlayers; ++i) {
+    LayerImage* lay = new LayerImage(spr);
+    spr->folder()->addLayer(lay);
+
+    Cel* first = nullptr;
+    for (frame_t frame=0; frame<nframes; ++frame) {
+      Cel* cel;
+      if (frame % 10 == 0) {
+        ImageRef image(Image::create(IMAGE_RGB, 1, 1));
+        first = cel = new Cel(frame, image);
+      }
+      else {
+        cel = Cel::createLink(first);
+        cel->setFrame(frame);
+      }
+      lay->addCel(cel);
+    }
+  }
+
+  for (int unique=0; unique<2; ++unique) {
+    auto t0 = std::chrono::steady_clock::now();
+    int n = 0;
+    if (unique) {
+      for (Cel* cel : spr->uniqueCels()) {
+        (void)cel;
+        ++n;
+      }
+    }
+    else {
+      for (Cel* cel : spr->cels()) {
+        (void)cel;
+        ++n;
+      }
+    }
+    auto t1 = std::chrono::steady_clock::now();
+
+    EXPECT_EQ(unique ? nlayers*nframes/10: nlayers*nframes, n);
+    std::printf("%-12s %d layers x %d frames: %7d cels in %8.2f ms\n",
+                (unique ? "uniqueCels()": "cels()"), nlayers, nframes, n,
+                std::chrono::duration<double, std::milli>(t1-t0).count());
+  }
+
+  delete spr;
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
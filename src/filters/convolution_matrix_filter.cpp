@@ -19,95 +19,265 @@
 #include "doc/palette.h"
 #include "doc/rgbmap.h"
 
+#include <cstdlib>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define FILTERS_CONVOLUTION_SSE2
+  #include <emmintrin.h>
+#endif
+
 namespace filters {
 
 using namespace doc;
 
 namespace {
 
-  struct GetPixelsDelegate {
-    uint32_t color;
-    int div;
-    const int* matrixData;
+  // The "Channels" structs split a pixel in the values that are
+  // multiplied by the matrix. Each value is in the [0, 255] range.
+  // The last channel of RGBA/grayscale pixels is 1 for transparent
+  // pixels (which are not used, so their weights are subtracted from
+  // the matrix div).
 
-    void reset(const ConvolutionMatrix* matrix) {
-      div = matrix->getDiv();
-      matrixData = &matrix->value(0, 0);
+  struct RgbaChannels {
+    typedef RgbTraits Traits;
+    enum { R, G, B, A, Transparent, N };
+
+    void unpack(RgbTraits::pixel_t color, int* v, int stride) const {
+      if (rgba_geta(color) == 0) {
+        v[R*stride] = v[G*stride] = v[B*stride] = v[A*stride] = 0;
+        v[Transparent*stride] = 1;
+      }
+      else {
+        v[R*stride] = rgba_getr(color);
+        v[G*stride] = rgba_getg(color);
+        v[B*stride] = rgba_getb(color);
+        v[A*stride] = rgba_geta(color);
+        v[Transparent*stride] = 0;
+      }
     }
+  };
+
+  struct GrayscaleChannels {
+    typedef GrayscaleTraits Traits;
+    enum { V, A, Transparent, N };
 
+    void unpack(GrayscaleTraits::pixel_t color, int* v, int stride) const {
+      if (graya_geta(color) == 0) {
+        v[V*stride] = v[A*stride] = 0;
+        v[Transparent*stride] = 1;
+      }
+      else {
+        v[V*stride] = graya_getv(color);
+        v[A*stride] = graya_geta(color);
+        v[Transparent*stride] = 0;
+      }
+    }
   };
 
-  struct GetPixelsDelegateRgba : public GetPixelsDelegate {
-    int r, g, b, a;
+  struct IndexedChannels {
+    typedef IndexedTraits Traits;
+    enum { R, G, B, Index, N };
+    const Palette* pal;
 
-    void reset(const ConvolutionMatrix* matrix) {
-      GetPixelsDelegate::reset(matrix);
-      r = g = b = a = 0;
+    IndexedChannels(const Palette* pal) : pal(pal) { }
+
+    void unpack(IndexedTraits::pixel_t color, int* v, int stride) const {
+      color_t c = pal->getEntry(color);
+      v[R*stride] = rgba_getr(c);
+      v[G*stride] = rgba_getg(c);
+      v[B*stride] = rgba_getb(c);
+      v[Index*stride] = color;
     }
+  };
 
-    void operator()(RgbTraits::pixel_t color)
-    {
-      if (*matrixData) {
-        if (rgba_geta(color) == 0)
-          div -= *matrixData;
-        else {
-          r += rgba_getr(color) * (*matrixData);
-          g += rgba_getg(color) * (*matrixData);
-          b += rgba_getb(color) * (*matrixData);
-          a += rgba_geta(color) * (*matrixData);
-        }
+  // acc[i] += src[i]*weight for i in [0, n). The values of "src" must
+  // be in the [0, 255] range.
+  inline void add_weighted_channel(int* acc, const int* src, int weight, int n)
+  {
+    int i = 0;
+
+#ifdef FILTERS_CONVOLUTION_SSE2
+    // _mm_madd_epi16() multiplies the low 16 bits of each 32-bit
+    // lane (the high 16 bits of "src" values are zero), which gives
+    // the exact product when the weight fits in 16 bits.
+    if (weight >= -32768 && weight <= 32767) {
+      const __m128i w = _mm_set1_epi32(weight & 0xffff);
+      for (; i+4<=n; i+=4) {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src+i));
+        __m128i a = _mm_loadu_si128((const __m128i*)(acc+i));
+        _mm_storeu_si128((__m128i*)(acc+i), _mm_add_epi32(a, _mm_madd_epi16(s, w)));
       }
-      matrixData++;
     }
+#endif
 
-  };
-
-  struct GetPixelsDelegateGrayscale : public GetPixelsDelegate {
-    int v, a;
+    for (; i<n; ++i)
+      acc[i] += src[i] * weight;
+  }
 
-    void reset(const ConvolutionMatrix* matrix) {
-      GetPixelsDelegate::reset(matrix);
-      v = a = 0;
+  // Calculates the weighted sum of each channel for all pixels of
+  // the current row, i.e. sums[c*width + i] is the sum of the
+  // channel "c" for the pixel filterMgr->x()+i.
+  //
+  // If "hkernel" and "vkernel" aren't empty, they are the factors of
+  // the matrix (matrix(x, y) = hkernel[x]*vkernel[y]), and the sums
+  // are calculated in two 1-D passes (first vertical and then
+  // horizontal).
+  template<typename Channels>
+  void get_row_sums(FilterManager* filterMgr,
+                    const ConvolutionMatrix* matrix,
+                    const std::vector<int>& hkernel,
+                    const std::vector<int>& vkernel,
+                    TiledMode tiledMode,
+                    const Channels& channels,
+                    std::vector<int>& sums)
+  {
+    typedef typename Channels::Traits Traits;
+    const int N = Channels::N;
+
+    const Image* src = filterMgr->getSourceImage();
+    const int mw = matrix->getWidth();
+    const int mh = matrix->getHeight();
+    const int cx = matrix->getCenterX();
+    const int cy = matrix->getCenterY();
+    const int x = filterMgr->x();
+    const int y = filterMgr->y();
+    const int w = filterMgr->getWidth();
+    const bool tiledX = ((int(tiledMode) & int(TiledMode::X_AXIS)) != 0);
+    const bool tiledY = ((int(tiledMode) & int(TiledMode::Y_AXIS)) != 0);
+
+    sums.assign(N*w, 0);
+
+    // Columns of the image used by the matrix (from x-cx to
+    // x+w-1-cx+mw-1)
+    const int n = w+mw-1;
+    std::vector<int> cols(n);
+    for (int i=0; i<n; ++i)
+      cols[i] = get_neighboring_coord(x-cx+i, src->width(), tiledX);
+
+    const bool separable = !hkernel.empty();
+    std::vector<int> line(N*n);
+    std::vector<int> vsums;
+    if (separable)
+      vsums.assign(N*n, 0);
+
+    for (int dy=0; dy<mh; ++dy) {
+      bool used = false;
+      if (separable)
+        used = (vkernel[dy] != 0);
+      else {
+        for (int dx=0; dx<mw && !used; ++dx)
+          used = (matrix->value(dx, dy) != 0);
+      }
+      if (!used)
+        continue;
+
+      // Unpack the channels of the row (each channel in its own
+      // array, so they can be processed 4 values at the same time)
+      typename Traits::const_address_t row =
+        (typename Traits::const_address_t)src->getPixelAddress(
+          0, get_neighboring_coord(y-cy+dy, src->height(), tiledY));
+      for (int i=0; i<n; ++i)
+        channels.unpack(row[cols[i]], &line[i], n);
+
+      if (separable) {
+        for (int c=0; c<N; ++c)
+          add_weighted_channel(&vsums[c*n], &line[c*n], vkernel[dy], n);
+      }
+      else {
+        for (int dx=0; dx<mw; ++dx) {
+          int weight = matrix->value(dx, dy);
+          if (weight) {
+            for (int c=0; c<N; ++c)
+              add_weighted_channel(&sums[c*w], &line[c*n+dx], weight, w);
+          }
+        }
+      }
     }
 
-    void operator()(GrayscaleTraits::pixel_t color)
-    {
-      if (*matrixData) {
-        if (graya_geta(color) == 0)
-          div -= *matrixData;
-        else {
-          v += graya_getv(color) * (*matrixData);
-          a += graya_geta(color) * (*matrixData);
+    if (separable) {
+      for (int c=0; c<N; ++c) {
+        for (int dx=0; dx<mw; ++dx) {
+          int weight = hkernel[dx];
+          if (weight) {
+            int* s = &sums[c*w];
+            const int* v = &vsums[c*n+dx];
+            for (int i=0; i<w; ++i)
+              s[i] += v[i] * weight;
+          }
         }
       }
-      matrixData++;
     }
+  }
 
-  };
-
-  struct GetPixelsDelegateIndexed : public GetPixelsDelegate {
-    const Palette* pal;
-    int r, g, b, index;
-
-    GetPixelsDelegateIndexed(const Palette* pal) : pal(pal) { }
+  int gcd(int a, int b)
+  {
+    while (b) {
+      int t = a % b;
+      a = b;
+      b = t;
+    }
+    return a;
+  }
 
-    void reset(const ConvolutionMatrix* matrix) {
-      GetPixelsDelegate::reset(matrix);
-      r = g = b = index = 0;
+  // Returns true if the matrix is the product of a column and a row
+  // with integer values, i.e. matrix(x, y) = hkernel[x]*vkernel[y],
+  // and it's worth to apply it in two passes.
+  bool factorize_matrix(const ConvolutionMatrix* matrix,
+                        std::vector<int>& hkernel,
+                        std::vector<int>& vkernel)
+  {
+    const int mw = matrix->getWidth();
+    const int mh = matrix->getHeight();
+
+    hkernel.clear();
+    vkernel.clear();
+
+    // 1-D matrices are already processed in one pass
+    if (mw < 2 || mh < 2)
+      return false;
+
+    // The first row with a non-zero value divided by the GCD of its
+    // values is the horizontal kernel. As its values are coprime,
+    // each row of a rank-1 matrix must be an integer multiple of it.
+    int y0 = 0, g = 0;
+    for (; y0<mh && g == 0; ++y0)
+      for (int x=0; x<mw; ++x)
+        g = gcd(g, std::abs(matrix->value(x, y0)));
+    if (g == 0)
+      return false;
+    --y0;
+
+    // The horizontal pass is not vectorized, so two passes are
+    // slower for small matrices (e.g. 3x3).
+    int nonzero = 0;
+    for (int y=0; y<mh; ++y)
+      for (int x=0; x<mw; ++x)
+        if (matrix->value(x, y))
+          ++nonzero;
+    if (2*(mw+mh) > nonzero)
+      return false;
+
+    int x0 = 0;
+    hkernel.resize(mw);
+    for (int x=0; x<mw; ++x) {
+      hkernel[x] = matrix->value(x, y0) / g;
+      if (hkernel[x] != 0 && hkernel[x0] == 0)
+        x0 = x;
     }
 
-    void operator()(GrayscaleTraits::pixel_t color)
-    {
-      if (*matrixData) {
-        r += rgba_getr(pal->getEntry(color)) * (*matrixData);
-        g += rgba_getg(pal->getEntry(color)) * (*matrixData);
-        b += rgba_getb(pal->getEntry(color)) * (*matrixData);
-        index += color * (*matrixData);
+    vkernel.resize(mh);
+    for (int y=0; y<mh; ++y) {
+      vkernel[y] = matrix->value(x0, y) / hkernel[x0];
+      for (int x=0; x<mw; ++x) {
+        if (matrix->value(x, y) != hkernel[x]*vkernel[y]) {
+          hkernel.clear();
+          vkernel.clear();
+          return false;
+        }
       }
-      matrixData++;
     }
-
-  };
+    return true;
+  }
 
 }
 
@@ -120,7 +290,7 @@ ConvolutionMatrixFilter::ConvolutionMatrixFilter()
 void ConvolutionMatrixFilter::setMatrix(const base::SharedPtr<ConvolutionMatrix>& matrix)
 {
   m_matrix = matrix;
-  m_lines.resize(matrix->getHeight());
+  factorize_matrix(matrix.get(), m_hkernel, m_vkernel);
 }
 
 void ConvolutionMatrixFilter::setTiledMode(TiledMode tiledMode)
@@ -133,70 +303,71 @@ const char* ConvolutionMatrixFilter::getName()
   return "Convolution Matrix";
 }
 
+// The sums of each row are stored in local buffers, so the filter
+// can be applied to different rows from several threads.
+
 void ConvolutionMatrixFilter::applyToRgba(FilterManager* filterMgr)
 {
   if (!m_matrix)
     return;
 
+  typedef RgbaChannels C;
+  std::vector<int> sums;
+  get_row_sums(filterMgr, m_matrix.get(), m_hkernel, m_vkernel,
+               m_tiledMode, C(), sums);
+
   const Image* src = filterMgr->getSourceImage();
   uint32_t* dst_address = (uint32_t*)filterMgr->getDestinationAddress();
   Target target = filterMgr->getTarget();
   uint32_t color;
-  GetPixelsDelegateRgba delegate;
+  int r, g, b, a, div;
   int x = filterMgr->x();
-  int x2 = x+filterMgr->getWidth();
+  int w = filterMgr->getWidth();
   int y = filterMgr->y();
 
-  for (; x<x2; ++x) {
+  for (int i=0; i<w; ++i) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
       ++dst_address;
       continue;
     }
 
-    delegate.reset(m_matrix.get());
-    get_neighboring_pixels<RgbTraits>(src, x, y,
-                                      m_matrix->getWidth(),
-                                      m_matrix->getHeight(),
-                                      m_matrix->getCenterX(),
-                                      m_matrix->getCenterY(),
-                                      m_tiledMode, delegate);
-
-    color = get_pixel_fast<RgbTraits>(src, x, y);
-    if (delegate.div == 0) {
+    color = get_pixel_fast<RgbTraits>(src, x+i, y);
+    div = m_matrix->getDiv() - sums[C::Transparent*w + i];
+    if (div == 0) {
       *(dst_address++) = color;
       continue;
     }
 
     if (target & TARGET_RED_CHANNEL) {
-      delegate.r = delegate.r / delegate.div + m_matrix->getBias();
-      delegate.r = MID(0, delegate.r, 255);
+      r = sums[C::R*w + i] / div + m_matrix->getBias();
+      r = MID(0, r, 255);
     }
     else
-      delegate.r = rgba_getr(color);
+      r = rgba_getr(color);
 
     if (target & TARGET_GREEN_CHANNEL) {
-      delegate.g = delegate.g / delegate.div + m_matrix->getBias();
-      delegate.g = MID(0, delegate.g, 255);
+      g = sums[C::G*w + i] / div + m_matrix->getBias();
+      g = MID(0, g, 255);
     }
     else
-      delegate.g = rgba_getg(color);
+      g = rgba_getg(color);
 
     if (target & TARGET_BLUE_CHANNEL) {
-      delegate.b = delegate.b / delegate.div + m_matrix->getBias();
-      delegate.b = MID(0, delegate.b, 255);
+      b = sums[C::B*w + i] / div + m_matrix->getBias();
+      b = MID(0, b, 255);
     }
     else
-      delegate.b = rgba_getb(color);
+      b = rgba_getb(color);
 
     if (target & TARGET_ALPHA_CHANNEL) {
-      delegate.a = delegate.a / m_matrix->getDiv() + m_matrix->getBias();
-      delegate.a = MID(0, delegate.a, 255);
+      a = sums[C::A*w + i] / m_matrix->getDiv() + m_matrix->getBias();
+      a = MID(0, a, 255);
     }
     else
-      delegate.a = rgba_geta(color);
+      a = rgba_geta(color);
 
-    *(dst_address++) = rgba(delegate.r, delegate.g, delegate.b, delegate.a);
+    *(dst_address++) = rgba(r, g, b, a);
   }
 }
 
@@ -205,51 +376,49 @@ void ConvolutionMatrixFilter::applyToGrayscale(FilterManager* filterMgr)
   if (!m_matrix)
     return;
 
+  typedef GrayscaleChannels C;
+  std::vector<int> sums;
+  get_row_sums(filterMgr, m_matrix.get(), m_hkernel, m_vkernel,
+               m_tiledMode, C(), sums);
+
   const Image* src = filterMgr->getSourceImage();
   uint16_t* dst_address = (uint16_t*)filterMgr->getDestinationAddress();
   Target target = filterMgr->getTarget();
   uint16_t color;
-  GetPixelsDelegateGrayscale delegate;
+  int v, a, div;
   int x = filterMgr->x();
-  int x2 = x+filterMgr->getWidth();
+  int w = filterMgr->getWidth();
   int y = filterMgr->y();
 
-  for (; x<x2; ++x) {
+  for (int i=0; i<w; ++i) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
       ++dst_address;
       continue;
     }
 
-    delegate.reset(m_matrix.get());
-    get_neighboring_pixels<GrayscaleTraits>(src, x, y,
-                                            m_matrix->getWidth(),
-                                            m_matrix->getHeight(),
-                                            m_matrix->getCenterX(),
-                                            m_matrix->getCenterY(),
-                                            m_tiledMode, delegate);
-
-    color = get_pixel_fast<GrayscaleTraits>(src, x, y);
-    if (delegate.div == 0) {
+    color = get_pixel_fast<GrayscaleTraits>(src, x+i, y);
+    div = m_matrix->getDiv() - sums[C::Transparent*w + i];
+    if (div == 0) {
       *(dst_address++) = color;
       continue;
     }
 
     if (target & TARGET_GRAY_CHANNEL) {
-      delegate.v = delegate.v / delegate.div + m_matrix->getBias();
-      delegate.v = MID(0, delegate.v, 255);
+      v = sums[C::V*w + i] / div + m_matrix->getBias();
+      v = MID(0, v, 255);
     }
     else
-      delegate.v = graya_getv(color);
+      v = graya_getv(color);
 
     if (target & TARGET_ALPHA_CHANNEL) {
-      delegate.a = delegate.a / m_matrix->getDiv() + m_matrix->getBias();
-      delegate.a = MID(0, delegate.a, 255);
+      a = sums[C::A*w + i] / m_matrix->getDiv() + m_matrix->getBias();
+      a = MID(0, a, 255);
     }
     else
-      delegate.a = graya_geta(color);
+      a = graya_geta(color);
 
-    *(dst_address++) = graya(delegate.v, delegate.a);
+    *(dst_address++) = graya(v, a);
   }
 }
 
@@ -258,67 +427,66 @@ void ConvolutionMatrixFilter::applyToIndexed(FilterManager* filterMgr)
   if (!m_matrix)
     return;
 
-  const Image* src = filterMgr->getSourceImage();
-  uint8_t* dst_address = (uint8_t*)filterMgr->getDestinationAddress();
   const Palette* pal = filterMgr->getIndexedData()->getPalette();
   const RgbMap* rgbmap = filterMgr->getIndexedData()->getRgbMap();
+
+  typedef IndexedChannels C;
+  std::vector<int> sums;
+  get_row_sums(filterMgr, m_matrix.get(), m_hkernel, m_vkernel,
+               m_tiledMode, C(pal), sums);
+
+  const Image* src = filterMgr->getSourceImage();
+  uint8_t* dst_address = (uint8_t*)filterMgr->getDestinationAddress();
   Target target = filterMgr->getTarget();
   uint8_t color;
-  GetPixelsDelegateIndexed delegate(pal);
+  int r, g, b, index;
+  int div = m_matrix->getDiv();
   int x = filterMgr->x();
-  int x2 = x+filterMgr->getWidth();
+  int w = filterMgr->getWidth();
   int y = filterMgr->y();
 
-  for (; x<x2; ++x) {
+  for (int i=0; i<w; ++i) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
       ++dst_address;
       continue;
     }
 
-    delegate.reset(m_matrix.get());
-    get_neighboring_pixels<IndexedTraits>(src, x, y,
-                                          m_matrix->getWidth(),
-                                          m_matrix->getHeight(),
-                                          m_matrix->getCenterX(),
-                                          m_matrix->getCenterY(),
-                                          m_tiledMode, delegate);
-
-    color = get_pixel_fast<IndexedTraits>(src, x, y);
-    if (delegate.div == 0) {
+    color = get_pixel_fast<IndexedTraits>(src, x+i, y);
+    if (div == 0) {
       *(dst_address++) = color;
       continue;
     }
 
     if (target & TARGET_INDEX_CHANNEL) {
-      delegate.index = delegate.index / m_matrix->getDiv() + m_matrix->getBias();
-      delegate.index = MID(0, delegate.index, 255);
+      index = sums[C::Index*w + i] / div + m_matrix->getBias();
+      index = MID(0, index, 255);
 
-      *(dst_address++) = delegate.index;
+      *(dst_address++) = index;
     }
     else {
       if (target & TARGET_RED_CHANNEL) {
-        delegate.r = delegate.r / delegate.div + m_matrix->getBias();
-        delegate.r = MID(0, delegate.r, 255);
+        r = sums[C::R*w + i] / div + m_matrix->getBias();
+        r = MID(0, r, 255);
       }
       else
-        delegate.r = rgba_getr(pal->getEntry(color));
+        r = rgba_getr(pal->getEntry(color));
 
       if (target & TARGET_GREEN_CHANNEL) {
-        delegate.g =  delegate.g / delegate.div + m_matrix->getBias();
-        delegate.g = MID(0, delegate.g, 255);
+        g = sums[C::G*w + i] / div + m_matrix->getBias();
+        g = MID(0, g, 255);
       }
       else
-        delegate.g = rgba_getg(pal->getEntry(color));
+        g = rgba_getg(pal->getEntry(color));
 
       if (target & TARGET_BLUE_CHANNEL) {
-        delegate.b = delegate.b / delegate.div + m_matrix->getBias();
-        delegate.b = MID(0, delegate.b, 255);
+        b = sums[C::B*w + i] / div + m_matrix->getBias();
+        b = MID(0, b, 255);
       }
       else
-        delegate.b = rgba_getb(pal->getEntry(color));
+        b = rgba_getb(pal->getEntry(color));
 
-      *(dst_address++) = rgbmap->mapColor(delegate.r, delegate.g, delegate.b);
+      *(dst_address++) = rgbmap->mapColor(r, g, b);
     }
   }
 }
@@ -29,6 +29,10 @@ namespace filters {
     base::SharedPtr<ConvolutionMatrix> getMatrix() { return m_matrix; }
     TiledMode getTiledMode() const { return m_tiledMode; }
 
+    // True if the matrix is applied in two 1-D passes (a vertical and
+    // an horizontal one).
+    bool isSeparable() const { return !m_hkernel.empty(); }
+
     // Filter implementation
     const char* getName();
     void applyToRgba(FilterManager* filterMgr);
@@ -38,7 +42,11 @@ namespace filters {
   private:
     base::SharedPtr<ConvolutionMatrix> m_matrix;
     TiledMode m_tiledMode;
-    std::vector<uint8_t*> m_lines;
+
+    // Factors of a separable matrix (empty if the matrix cannot be
+    // separated in a row and a column).
+    std::vector<int> m_hkernel;
+    std::vector<int> m_vkernel;
   };
 
 } // namespace filters
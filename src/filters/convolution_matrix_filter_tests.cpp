@@ -0,0 +1,407 @@
+// Aseprite
+// Copyright (C) 2001-2015  David Capello
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/unique_ptr.h"
+#include "doc/image.h"
+#include "doc/palette.h"
+#include "doc/primitives.h"
+#include "doc/rgbmap.h"
+#include "filters/convolution_matrix.h"
+#include "filters/convolution_matrix_filter.h"
+#include "filters/neighboring_pixels.h"
+#include "filters/test_filter_manager.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using namespace base;
+using namespace doc;
+using namespace filters;
+
+// Matrices in the format of data/convmatr.def ("div" and "bias" are
+// calculated from the values when they are "auto").
+struct MatrixDef {
+  const char* name;
+  int w, h, cx, cy;
+  std::vector<int> values;
+  bool autoDiv;
+  int div;
+  bool autoBias;
+  int bias;
+};
+
+static const MatrixDef matrices[] = {
+  // Some matrices from data/convmatr.def
+  { "blur-3x3", 3, 3, 1, 1,
+    { 1, 2, 1,
+      2, 4, 2,
+      1, 2, 1 }, true, 0, true, 0 },
+  { "blur-5x5", 5, 5, 2, 2,
+    { 1, 2, 3, 2, 1,
+      2, 3, 4, 3, 2,
+      3, 4, 5, 4, 3,
+      2, 3, 4, 3, 2,
+      1, 2, 3, 2, 1 }, true, 0, true, 0 },
+  { "blur-9x9", 9, 9, 4, 4,
+    { 1, 2, 3, 4, 5, 4, 3, 2, 1,
+      2, 3, 4, 5, 6, 5, 4, 3, 2,
+      3, 4, 5, 6, 7, 6, 5, 4, 3,
+      4, 5, 6, 7, 8, 7, 6, 5, 4,
+      5, 6, 7, 8, 9, 8, 7, 6, 5,
+      4, 5, 6, 7, 8, 7, 6, 5, 4,
+      3, 4, 5, 6, 7, 6, 5, 4, 3,
+      2, 3, 4, 5, 6, 5, 4, 3, 2,
+      1, 2, 3, 4, 5, 4, 3, 2, 1 }, true, 0, true, 0 },
+  { "blur-5x3-left", 5, 3, 0, 1,
+    { 2, 3, 2, 1, 0,
+      6, 4, 3, 2, 1,
+      2, 3, 2, 1, 0 }, true, 0, true, 0 },
+  { "sharpen-3x3", 3, 3, 1, 1,
+    { -1, -1, -1,
+      -1, 16, -1,
+      -1, -1, -1 }, false, 8, false, 0 },
+  // Its center (224*Precision) doesn't fit in 16 bits, so it uses
+  // the scalar path
+  { "sharpen-7x7", 7, 7, 3, 3,
+    {  0, -1,  -2,  -4,  -2, -1,  0,
+      -1, -2,  -4,  -8,  -4, -2, -1,
+      -2, -4,  -8, -16,  -8, -4, -2,
+      -4, -8, -16, 224, -16, -8, -4,
+      -2, -4,  -8, -16,  -8, -4, -2,
+      -1, -2,  -4,  -8,  -4, -2, -1,
+       0, -1,  -2,  -4,  -2, -1,  0 }, false, 16, false, 0 },
+  { "edges-find-horizontal", 3, 3, 1, 1,
+    { -1, -2, -1,
+       0,  0,  0,
+       1,  2,  1 }, false, 1, false, 0 },
+  { "misc-contour", 3, 3, 1, 1,
+    { 1,  1, 1,
+      1, -8, 1,
+      1,  1, 1 }, false, 1, false, 255 },
+  { "misc-rock", 3, 3, 1, 1,
+    { -4, -2, -1,
+      -2,  0,  2,
+       1,  2,  4 }, true, 0, true, 0 },
+  { "negative", 1, 1, 0, 0, { -1 }, true, 0, true, 0 },
+  { "brightness", 1, 1, 0, 0, { 1 }, false, 1, false, 8 },
+
+  // Separable matrices (applied in two passes)
+  { "binomial-5x5", 5, 5, 2, 2,
+    { 1,  4,  6,  4, 1,
+      4, 16, 24, 16, 4,
+      6, 24, 36, 24, 6,
+      4, 16, 24, 16, 4,
+      1,  4,  6,  4, 1 }, true, 0, true, 0 },
+  { "sobel-5x5", 5, 5, 2, 2,
+    { -1, -4, -6, -4, -1,
+      -2, -8,-12, -8, -2,
+       0,  0,  0,  0,  0,
+       2,  8, 12,  8,  2,
+       1,  4,  6,  4,  1 }, false, 4, false, 128 },
+  { "separable-7x5-off-center", 7, 5, 1, 3,
+    { 2, 4, 6, 8, 6, 4, 2,
+      3, 6, 9,12, 9, 6, 3,
+      1, 2, 3, 4, 3, 2, 1,
+      3, 6, 9,12, 9, 6, 3,
+      2, 4, 6, 8, 6, 4, 2 }, true, 0, true, 0 },
+
+  // Non-separable matrix with zero rows and columns
+  { "non-separable-5x5", 5, 5, 3, 1,
+    { 0, 0, 0, 0, 0,
+      1, 0, 3, 0,-2,
+      0, 0, 0, 0, 0,
+      4, 0,-1, 0, 5,
+      2, 0, 0, 0, 1 }, true, 0, true, 0 },
+};
+
+static const bool matrices_separable[] = {
+  false, false, false, false, false, false, false, false, false, false, false,
+  true, true, true,
+  false
+};
+
+// Creates the matrix like ConvolutionMatrixStock::reloadStock() does.
+static ConvolutionMatrix* create_matrix(const MatrixDef& def)
+{
+  ConvolutionMatrix* matrix = new ConvolutionMatrix(def.w, def.h);
+  matrix->setName(def.name);
+  matrix->setCenterX(def.cx);
+  matrix->setCenterY(def.cy);
+
+  int div = 0, bias;
+  for (int y=0; y<def.h; ++y)
+    for (int x=0; x<def.w; ++x) {
+      int value = def.values[y*def.w+x] * ConvolutionMatrix::Precision;
+      div += value;
+      matrix->value(x, y) = value;
+    }
+
+  if (div > 0)
+    bias = 0;
+  else if (div == 0) {
+    div = ConvolutionMatrix::Precision;
+    bias = 128;
+  }
+  else {
+    div = ABS(div);
+    bias = 255;
+  }
+
+  matrix->setDiv(def.autoDiv ? div: def.div * ConvolutionMatrix::Precision);
+  matrix->setBias(def.autoBias ? bias: def.bias);
+  return matrix;
+}
+
+// Weighted sums of one pixel calculated like the implementation
+// before the row sums (one matrix value at a time).
+struct ReferenceSums {
+  PixelFormat format;
+  const Palette* pal;
+  const int* matrixData;
+  int div;
+  int v[4];
+
+  ReferenceSums(PixelFormat format, const Palette* pal, const ConvolutionMatrix* matrix)
+    : format(format), pal(pal), matrixData(&matrix->value(0, 0)), div(matrix->getDiv()) {
+    v[0] = v[1] = v[2] = v[3] = 0;
+  }
+
+  void operator()(color_t c) {
+    const int m = *matrixData;
+    if (m) {
+      switch (format) {
+        case IMAGE_RGB:
+          if (rgba_geta(c) == 0)
+            div -= m;
+          else {
+            v[0] += rgba_getr(c) * m;
+            v[1] += rgba_getg(c) * m;
+            v[2] += rgba_getb(c) * m;
+            v[3] += rgba_geta(c) * m;
+          }
+          break;
+        case IMAGE_GRAYSCALE:
+          if (graya_geta(c) == 0)
+            div -= m;
+          else {
+            v[0] += graya_getv(c) * m;
+            v[1] += graya_geta(c) * m;
+          }
+          break;
+        case IMAGE_INDEXED:
+          v[0] += rgba_getr(pal->getEntry(c)) * m;
+          v[1] += rgba_getg(pal->getEntry(c)) * m;
+          v[2] += rgba_getb(pal->getEntry(c)) * m;
+          v[3] += c * m;
+          break;
+      }
+    }
+    ++matrixData;
+  }
+};
+
+template<typename Traits>
+static void reference_convolution_pixel(const Image* src, Image* dst, int x, int y,
+                                        const ConvolutionMatrix* matrix,
+                                        TiledMode tiled, Target target,
+                                        const Palette* pal, const RgbMap* rgbmap)
+{
+  ReferenceSums sums(src->pixelFormat(), pal, matrix);
+  get_neighboring_pixels<Traits>(src, x, y,
+                                 matrix->getWidth(), matrix->getHeight(),
+                                 matrix->getCenterX(), matrix->getCenterY(),
+                                 tiled, sums);
+
+  color_t c = get_pixel(src, x, y);
+  if (sums.div == 0) {
+    put_pixel(dst, x, y, c);
+    return;
+  }
+
+  const int bias = matrix->getBias();
+  int v[4];
+  for (int i=0; i<4; ++i)
+    v[i] = MID(0, sums.v[i] / sums.div + bias, 255);
+
+  switch (src->pixelFormat()) {
+    case IMAGE_RGB:
+      c = rgba(
+        (target & TARGET_RED_CHANNEL ? v[0]: rgba_getr(c)),
+        (target & TARGET_GREEN_CHANNEL ? v[1]: rgba_getg(c)),
+        (target & TARGET_BLUE_CHANNEL ? v[2]: rgba_getb(c)),
+        (target & TARGET_ALPHA_CHANNEL ? MID(0, sums.v[3] / matrix->getDiv() + bias, 255): rgba_geta(c)));
+      break;
+    case IMAGE_GRAYSCALE:
+      c = graya(
+        (target & TARGET_GRAY_CHANNEL ? v[0]: graya_getv(c)),
+        (target & TARGET_ALPHA_CHANNEL ? MID(0, sums.v[1] / matrix->getDiv() + bias, 255): graya_geta(c)));
+      break;
+    case IMAGE_INDEXED:
+      if (target & TARGET_INDEX_CHANNEL)
+        c = v[3];
+      else {
+        color_t e = pal->getEntry(c);
+        c = rgbmap->mapColor(
+          (target & TARGET_RED_CHANNEL ? v[0]: rgba_getr(e)),
+          (target & TARGET_GREEN_CHANNEL ? v[1]: rgba_getg(e)),
+          (target & TARGET_BLUE_CHANNEL ? v[2]: rgba_getb(e)));
+      }
+      break;
+  }
+  put_pixel(dst, x, y, c);
+}
+
+static void reference_convolution(const Image* src, Image* dst, const gfx::Rect& bounds,
+                                  const Image* selection,
+                                  const ConvolutionMatrix* matrix,
+                                  TiledMode tiled, Target target,
+                                  const Palette* pal, const RgbMap* rgbmap)
+{
+  for (int y=bounds.y; y<bounds.y2(); ++y)
+    for (int x=bounds.x; x<bounds.x2(); ++x) {
+      if (selection && !get_pixel(selection, x, y))
+        continue;
+
+      switch (src->pixelFormat()) {
+        case IMAGE_RGB:
+          reference_convolution_pixel<RgbTraits>(src, dst, x, y, matrix, tiled, target, pal, rgbmap);
+          break;
+        case IMAGE_GRAYSCALE:
+          reference_convolution_pixel<GrayscaleTraits>(src, dst, x, y, matrix, tiled, target, pal, rgbmap);
+          break;
+        case IMAGE_INDEXED:
+          reference_convolution_pixel<IndexedTraits>(src, dst, x, y, matrix, tiled, target, pal, rgbmap);
+          break;
+      }
+    }
+}
+
+struct ConvolutionMatrixFilterTest {
+  typedef MatrixDef Param;
+
+  static std::vector<Param> params() {
+    return std::vector<Param>(std::begin(matrices), std::end(matrices));
+  }
+
+  static std::string name(const Param& def) {
+    return std::string("matrix=") + def.name;
+  }
+
+  static Filter* createFilter(const Param& def, TiledMode tiled) {
+    ConvolutionMatrixFilter* filter = new ConvolutionMatrixFilter;
+    filter->setMatrix(SharedPtr<ConvolutionMatrix>(create_matrix(def)));
+    filter->setTiledMode(tiled);
+    return filter;
+  }
+
+  static void reference(const Image* src, Image* dst, const gfx::Rect& bounds,
+                        const Image* selection, const Param& def,
+                        TiledMode tiled, Target target,
+                        const Palette* pal, const RgbMap* rgbmap) {
+    UniquePtr<ConvolutionMatrix> matrix(create_matrix(def));
+    reference_convolution(src, dst, bounds, selection, matrix, tiled, target, pal, rgbmap);
+  }
+};
+
+TEST(ConvolutionMatrixFilter, SeparableMatrices)
+{
+  int i = 0;
+  for (const MatrixDef& def : matrices) {
+    ConvolutionMatrixFilter filter;
+    filter.setMatrix(SharedPtr<ConvolutionMatrix>(create_matrix(def)));
+    EXPECT_EQ(matrices_separable[i++], filter.isSeparable()) << def.name;
+  }
+}
+
+FILTER_PIXEL_FORMAT_TESTS(ConvolutionMatrixFilter, ConvolutionMatrixFilterTest)
+
+// Matrices wider than the image (they use the same columns/rows
+// several times).
+TEST(ConvolutionMatrixFilter, MatrixWiderThanImage)
+{
+  const PixelFormat formats[] = { IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED };
+  const Target targets[] = {
+    TARGET_RED_CHANNEL | TARGET_GREEN_CHANNEL | TARGET_BLUE_CHANNEL | TARGET_ALPHA_CHANNEL,
+    TARGET_GRAY_CHANNEL | TARGET_ALPHA_CHANNEL,
+    TARGET_INDEX_CHANNEL
+  };
+
+  for (int f=0; f<3; ++f) {
+    std::srand(f+1);
+    UniquePtr<Image> src(create_random_image(formats[f], 4, 6));
+    UniquePtr<Image> selection(create_random_selection(4, 6));
+
+    for (const MatrixDef& def : matrices)
+      for (TiledMode tiled : tiled_modes) {
+        expect_same_as_reference<ConvolutionMatrixFilterTest>(src, src->bounds(), nullptr, def, tiled, targets[f]);
+        expect_same_as_reference<ConvolutionMatrixFilterTest>(src, src->bounds(), selection, def, tiled, targets[f]);
+      }
+  }
+}
+
+// Prints the time to apply 3x3, 5x5 and 9x9 matrices to a 4096x4096
+// RGBA image compared with the per-pixel implementation. Run it with
+// --gtest_also_run_disabled_tests.
+TEST(ConvolutionMatrixFilter, DISABLED_Benchmark)
+{
+  const int w = 4096, h = 4096;
+  const MatrixDef& blur3x3 = matrices[0];
+  const MatrixDef& blur5x5 = matrices[1];
+  const MatrixDef& blur9x9 = matrices[2];
+  const MatrixDef binomial9x9 = { "binomial-9x9", 9, 9, 4, 4,
+    { 1,  8,  28,   56,   70,   56,  28,  8,  1,
+      8, 64, 224,  448,  560,  448, 224, 64,  8,
+     28,224, 784, 1568, 1960, 1568, 784,224, 28,
+     56,448,1568, 3136, 3920, 3136,1568,448, 56,
+     70,560,1960, 3920, 4900, 3920,1960,560, 70,
+     56,448,1568, 3136, 3920, 3136,1568,448, 56,
+     28,224, 784, 1568, 1960, 1568, 784,224, 28,
+      8, 64, 224,  448,  560,  448, 224, 64,  8,
+      1,  8,  28,   56,   70,   56,  28,  8,  1 }, true, 0, true, 0 };
+  const MatrixDef* defs[] = { &blur3x3, &blur5x5, &blur9x9, &binomial9x9 };
+
+  std::srand(1);
+  UniquePtr<Image> src(create_random_image(IMAGE_RGB, w, h));
+  UniquePtr<Image> dst(Image::createCopy(src));
+  const Target target = TARGET_RED_CHANNEL | TARGET_GREEN_CHANNEL | TARGET_BLUE_CHANNEL | TARGET_ALPHA_CHANNEL;
+
+  for (const MatrixDef* def : defs) {
+    SharedPtr<ConvolutionMatrix> matrix(create_matrix(*def));
+    ConvolutionMatrixFilter filter;
+    filter.setMatrix(matrix);
+
+    auto t0 = std::chrono::steady_clock::now();
+    reference_convolution(src, dst, src->bounds(), nullptr, matrix.get(),
+                          TiledMode::NONE, target, nullptr, nullptr);
+    auto t1 = std::chrono::steady_clock::now();
+    TestFilterManager filterMgr(src, dst, src->bounds(), target);
+    filterMgr.applyFilter(&filter);
+    auto t2 = std::chrono::steady_clock::now();
+
+    double refMs = std::chrono::duration<double, std::milli>(t1-t0).count();
+    double ms = std::chrono::duration<double, std::milli>(t2-t1).count();
+    std::printf("%-14s %dx%d per-pixel %9.2f ms, rows %9.2f ms%s\n",
+                def->name, w, h, refMs, ms,
+                (filter.isSeparable() ? " (separable)": ""));
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -21,78 +21,250 @@
 #include "filters/tiled_mode.h"
 
 #include <algorithm>
+#include <vector>
 
 namespace filters {
 
 using namespace doc;
 
 namespace {
-  struct GetPixelsDelegateRgba {
-    std::vector<std::vector<uint8_t> >& channel;
-    int c;
 
-    GetPixelsDelegateRgba(std::vector<std::vector<uint8_t> >& channel) : channel(channel) { }
+  // Histogram of the values of one channel in the filter window. It
+  // keeps the current median and the number of values below it, so
+  // when the window slides one pixel to the right, the new median is
+  // found moving from the previous one (Huang's algorithm) instead of
+  // sorting all values again.
+  class ChannelHistogram {
+  public:
+    // "middle" is the position of the median in the sorted window
+    // (i.e. width*height/2).
+    void reset(int middle) {
+      std::fill(m_hist, m_hist+256, 0);
+      m_middle = middle;
+      m_median = 0;
+      m_lt = 0;
+    }
+
+    void add(int v) {
+      ++m_hist[v];
+      if (v < m_median)
+        ++m_lt;
+    }
 
-    void reset() { c = 0; }
+    void remove(int v) {
+      --m_hist[v];
+      if (v < m_median)
+        --m_lt;
+    }
 
-    void operator()(RgbTraits::pixel_t color)
-    {
-      channel[0][c] = rgba_getr(color);
-      channel[1][c] = rgba_getg(color);
-      channel[2][c] = rgba_getb(color);
-      channel[3][c] = rgba_geta(color);
-      c++;
+    int median() {
+      while (m_lt > m_middle) {
+        --m_median;
+        m_lt -= m_hist[m_median];
+      }
+      while (m_lt + m_hist[m_median] <= m_middle) {
+        m_lt += m_hist[m_median];
+        ++m_median;
+      }
+      return m_median;
     }
+
+  private:
+    int m_hist[256];
+    int m_middle;
+    int m_median;
+    int m_lt;                   // Number of values less than m_median
   };
 
-  struct GetPixelsDelegateGrayscale {
-    std::vector<std::vector<uint8_t> >& channel;
-    int c;
+  class MedianDelegateRgba {
+  public:
+    typedef RgbTraits Traits;
 
-    GetPixelsDelegateGrayscale(std::vector<std::vector<uint8_t> >& channel) : channel(channel) { }
+    MedianDelegateRgba(Target target)
+      : m_target(target) { }
 
-    void reset() { c = 0; }
+    void reset(int middle) {
+      for (int c=0; c<4; ++c)
+        m_hist[c].reset(middle);
+    }
 
-    void operator()(GrayscaleTraits::pixel_t color)
-    {
-      channel[0][c] = graya_getv(color);
-      channel[1][c] = graya_geta(color);
-      c++;
+    void add(RgbTraits::pixel_t color) {
+      if (m_target & TARGET_RED_CHANNEL) m_hist[0].add(rgba_getr(color));
+      if (m_target & TARGET_GREEN_CHANNEL) m_hist[1].add(rgba_getg(color));
+      if (m_target & TARGET_BLUE_CHANNEL) m_hist[2].add(rgba_getb(color));
+      if (m_target & TARGET_ALPHA_CHANNEL) m_hist[3].add(rgba_geta(color));
     }
+
+    void remove(RgbTraits::pixel_t color) {
+      if (m_target & TARGET_RED_CHANNEL) m_hist[0].remove(rgba_getr(color));
+      if (m_target & TARGET_GREEN_CHANNEL) m_hist[1].remove(rgba_getg(color));
+      if (m_target & TARGET_BLUE_CHANNEL) m_hist[2].remove(rgba_getb(color));
+      if (m_target & TARGET_ALPHA_CHANNEL) m_hist[3].remove(rgba_geta(color));
+    }
+
+    RgbTraits::pixel_t median(RgbTraits::pixel_t color) {
+      return rgba(
+        (m_target & TARGET_RED_CHANNEL ? m_hist[0].median(): rgba_getr(color)),
+        (m_target & TARGET_GREEN_CHANNEL ? m_hist[1].median(): rgba_getg(color)),
+        (m_target & TARGET_BLUE_CHANNEL ? m_hist[2].median(): rgba_getb(color)),
+        (m_target & TARGET_ALPHA_CHANNEL ? m_hist[3].median(): rgba_geta(color)));
+    }
+
+  private:
+    Target m_target;
+    ChannelHistogram m_hist[4];
   };
 
-  struct GetPixelsDelegateIndexed {
-    const Palette* pal;
-    std::vector<std::vector<uint8_t> >& channel;
-    Target target;
-    int c;
+  class MedianDelegateGrayscale {
+  public:
+    typedef GrayscaleTraits Traits;
+
+    MedianDelegateGrayscale(Target target)
+      : m_target(target) { }
+
+    void reset(int middle) {
+      for (int c=0; c<2; ++c)
+        m_hist[c].reset(middle);
+    }
+
+    void add(GrayscaleTraits::pixel_t color) {
+      if (m_target & TARGET_GRAY_CHANNEL) m_hist[0].add(graya_getv(color));
+      if (m_target & TARGET_ALPHA_CHANNEL) m_hist[1].add(graya_geta(color));
+    }
 
-    GetPixelsDelegateIndexed(const Palette* pal, std::vector<std::vector<uint8_t> >& channel, Target target)
-      : pal(pal), channel(channel), target(target) { }
+    void remove(GrayscaleTraits::pixel_t color) {
+      if (m_target & TARGET_GRAY_CHANNEL) m_hist[0].remove(graya_getv(color));
+      if (m_target & TARGET_ALPHA_CHANNEL) m_hist[1].remove(graya_geta(color));
+    }
 
-    void reset() { c = 0; }
+    GrayscaleTraits::pixel_t median(GrayscaleTraits::pixel_t color) {
+      return graya(
+        (m_target & TARGET_GRAY_CHANNEL ? m_hist[0].median(): graya_getv(color)),
+        (m_target & TARGET_ALPHA_CHANNEL ? m_hist[1].median(): graya_geta(color)));
+    }
 
-    void operator()(IndexedTraits::pixel_t color)
-    {
-      if (target & TARGET_INDEX_CHANNEL) {
-        channel[0][c] = color;
+  private:
+    Target m_target;
+    ChannelHistogram m_hist[2];
+  };
+
+  class MedianDelegateIndexed {
+  public:
+    typedef IndexedTraits Traits;
+
+    MedianDelegateIndexed(const Palette* pal, const RgbMap* rgbmap, Target target)
+      : m_pal(pal), m_rgbmap(rgbmap), m_target(target) { }
+
+    void reset(int middle) {
+      for (int c=0; c<3; ++c)
+        m_hist[c].reset(middle);
+    }
+
+    void add(IndexedTraits::pixel_t color) {
+      if (m_target & TARGET_INDEX_CHANNEL) {
+        m_hist[0].add(color);
+      }
+      else {
+        color_t c = m_pal->getEntry(color);
+        if (m_target & TARGET_RED_CHANNEL) m_hist[0].add(rgba_getr(c));
+        if (m_target & TARGET_GREEN_CHANNEL) m_hist[1].add(rgba_getg(c));
+        if (m_target & TARGET_BLUE_CHANNEL) m_hist[2].add(rgba_getb(c));
+      }
+    }
+
+    void remove(IndexedTraits::pixel_t color) {
+      if (m_target & TARGET_INDEX_CHANNEL) {
+        m_hist[0].remove(color);
       }
       else {
-        channel[0][c] = rgba_getr(pal->getEntry(color));
-        channel[1][c] = rgba_getg(pal->getEntry(color));
-        channel[2][c] = rgba_getb(pal->getEntry(color));
+        color_t c = m_pal->getEntry(color);
+        if (m_target & TARGET_RED_CHANNEL) m_hist[0].remove(rgba_getr(c));
+        if (m_target & TARGET_GREEN_CHANNEL) m_hist[1].remove(rgba_getg(c));
+        if (m_target & TARGET_BLUE_CHANNEL) m_hist[2].remove(rgba_getb(c));
       }
-      c++;
     }
+
+    IndexedTraits::pixel_t median(IndexedTraits::pixel_t color) {
+      if (m_target & TARGET_INDEX_CHANNEL)
+        return m_hist[0].median();
+
+      color_t c = m_pal->getEntry(color);
+      return m_rgbmap->mapColor(
+        (m_target & TARGET_RED_CHANNEL ? m_hist[0].median(): rgba_getr(c)),
+        (m_target & TARGET_GREEN_CHANNEL ? m_hist[1].median(): rgba_getg(c)),
+        (m_target & TARGET_BLUE_CHANNEL ? m_hist[2].median(): rgba_getb(c)));
+    }
+
+  private:
+    const Palette* m_pal;
+    const RgbMap* m_rgbmap;
+    Target m_target;
+    ChannelHistogram m_hist[3];
   };
-};
+
+  template<typename Delegate>
+  void apply_median_to_row(FilterManager* filterMgr,
+                           int width, int height,
+                           TiledMode tiledMode,
+                           Delegate& delegate)
+  {
+    typedef typename Delegate::Traits Traits;
+
+    const Image* src = filterMgr->getSourceImage();
+    typename Traits::address_t dst_address =
+      (typename Traits::address_t)filterMgr->getDestinationAddress();
+    const int centerX = width/2;
+    const int centerY = height/2;
+    const bool tiledX = ((int(tiledMode) & int(TiledMode::X_AXIS)) != 0);
+    const bool tiledY = ((int(tiledMode) & int(TiledMode::Y_AXIS)) != 0);
+    int x = filterMgr->x();
+    int x2 = x+filterMgr->getWidth();
+    int y = filterMgr->y();
+
+    delegate.reset(width*height/2);
+
+    // Rows of the image in the window
+    std::vector<typename Traits::const_address_t> rows(height);
+    for (int dy=0; dy<height; ++dy)
+      rows[dy] = (typename Traits::const_address_t)
+        src->getPixelAddress(0, get_neighboring_coord(y-centerY+dy, src->height(), tiledY));
+
+    // Initial window
+    for (int dx=0; dx<width; ++dx) {
+      int u = get_neighboring_coord(x-centerX+dx, src->width(), tiledX);
+      for (int dy=0; dy<height; ++dy)
+        delegate.add(rows[dy][u]);
+    }
+
+    for (int x1=x; x<x2; ++x) {
+      // Slide the window one pixel to the right (we must do it even
+      // for skipped pixels to keep the histograms updated)
+      if (x > x1) {
+        int u = get_neighboring_coord(x-1-centerX, src->width(), tiledX);
+        int v = get_neighboring_coord(x-centerX+width-1, src->width(), tiledX);
+        for (int dy=0; dy<height; ++dy) {
+          delegate.remove(rows[dy][u]);
+          delegate.add(rows[dy][v]);
+        }
+      }
+
+      // Avoid the non-selected region
+      if (filterMgr->skipPixel()) {
+        ++dst_address;
+        continue;
+      }
+
+      *(dst_address++) = delegate.median(get_pixel_fast<Traits>(src, x, y));
+    }
+  }
+
+} // anonymous namespace
 
 MedianFilter::MedianFilter()
   : m_tiledMode(TiledMode::NONE)
   , m_width(0)
   , m_height(0)
   , m_ncolors(0)
-  , m_channel(4)
 {
 }
 
@@ -106,9 +278,6 @@ void MedianFilter::setSize(int width, int height)
   m_width = width;
   m_height = height;
   m_ncolors = width*height;
-
-  for (int c = 0; c < 4; ++c)
-    m_channel[c].resize(m_ncolors);
 }
 
 const char* MedianFilter::getName()
@@ -116,160 +285,27 @@ const char* MedianFilter::getName()
   return "Median Blur";
 }
 
+// Each call uses its own histograms, so the filter can be applied to
+// different rows from several threads.
+
 void MedianFilter::applyToRgba(FilterManager* filterMgr)
 {
-  const Image* src = filterMgr->getSourceImage();
-  uint32_t* dst_address = (uint32_t*)filterMgr->getDestinationAddress();
-  Target target = filterMgr->getTarget();
-  int color;
-  int r, g, b, a;
-  GetPixelsDelegateRgba delegate(m_channel);
-  int x = filterMgr->x();
-  int x2 = x+filterMgr->getWidth();
-  int y = filterMgr->y();
-
-  for (; x<x2; ++x) {
-    // Avoid the non-selected region
-    if (filterMgr->skipPixel()) {
-      ++dst_address;
-      continue;
-    }
-
-    delegate.reset();
-    get_neighboring_pixels<RgbTraits>(src, x, y, m_width, m_height, m_width/2, m_height/2,
-                                      m_tiledMode, delegate);
-
-    color = get_pixel_fast<RgbTraits>(src, x, y);
-
-    if (target & TARGET_RED_CHANNEL) {
-      std::sort(m_channel[0].begin(), m_channel[0].end());
-      r = m_channel[0][m_ncolors/2];
-    }
-    else
-      r = rgba_getr(color);
-
-    if (target & TARGET_GREEN_CHANNEL) {
-      std::sort(m_channel[1].begin(), m_channel[1].end());
-      g = m_channel[1][m_ncolors/2];
-    }
-    else
-      g = rgba_getg(color);
-
-    if (target & TARGET_BLUE_CHANNEL) {
-      std::sort(m_channel[2].begin(), m_channel[2].end());
-      b = m_channel[2][m_ncolors/2];
-    }
-    else
-      b = rgba_getb(color);
-
-    if (target & TARGET_ALPHA_CHANNEL) {
-      std::sort(m_channel[3].begin(), m_channel[3].end());
-      a = m_channel[3][m_ncolors/2];
-    }
-    else
-      a = rgba_geta(color);
-
-    *(dst_address++) = rgba(r, g, b, a);
-  }
+  MedianDelegateRgba delegate(filterMgr->getTarget());
+  apply_median_to_row(filterMgr, m_width, m_height, m_tiledMode, delegate);
 }
 
 void MedianFilter::applyToGrayscale(FilterManager* filterMgr)
 {
-  const Image* src = filterMgr->getSourceImage();
-  uint16_t* dst_address = (uint16_t*)filterMgr->getDestinationAddress();
-  Target target = filterMgr->getTarget();
-  int color, k, a;
-  GetPixelsDelegateGrayscale delegate(m_channel);
-  int x = filterMgr->x();
-  int x2 = x+filterMgr->getWidth();
-  int y = filterMgr->y();
-
-  for (; x<x2; ++x) {
-    // Avoid the non-selected region
-    if (filterMgr->skipPixel()) {
-      ++dst_address;
-      continue;
-    }
-
-    delegate.reset();
-    get_neighboring_pixels<GrayscaleTraits>(src, x, y, m_width, m_height, m_width/2, m_height/2,
-                                            m_tiledMode, delegate);
-
-    color = get_pixel_fast<GrayscaleTraits>(src, x, y);
-
-    if (target & TARGET_GRAY_CHANNEL) {
-      std::sort(m_channel[0].begin(), m_channel[0].end());
-      k = m_channel[0][m_ncolors/2];
-    }
-    else
-      k = graya_getv(color);
-
-    if (target & TARGET_ALPHA_CHANNEL) {
-      std::sort(m_channel[1].begin(), m_channel[1].end());
-      a = m_channel[1][m_ncolors/2];
-    }
-    else
-      a = graya_geta(color);
-
-    *(dst_address++) = graya(k, a);
-  }
+  MedianDelegateGrayscale delegate(filterMgr->getTarget());
+  apply_median_to_row(filterMgr, m_width, m_height, m_tiledMode, delegate);
 }
 
 void MedianFilter::applyToIndexed(FilterManager* filterMgr)
 {
-  const Image* src = filterMgr->getSourceImage();
-  uint8_t* dst_address = (uint8_t*)filterMgr->getDestinationAddress();
-  const Palette* pal = filterMgr->getIndexedData()->getPalette();
-  const RgbMap* rgbmap = filterMgr->getIndexedData()->getRgbMap();
-  Target target = filterMgr->getTarget();
-  int color, r, g, b;
-  GetPixelsDelegateIndexed delegate(pal, m_channel, target);
-  int x = filterMgr->x();
-  int x2 = x+filterMgr->getWidth();
-  int y = filterMgr->y();
-
-  for (; x<x2; ++x) {
-    // Avoid the non-selected region
-    if (filterMgr->skipPixel()) {
-      ++dst_address;
-      continue;
-    }
-
-    delegate.reset();
-    get_neighboring_pixels<IndexedTraits>(src, x, y, m_width, m_height, m_width/2, m_height/2,
-                                          m_tiledMode, delegate);
-
-    if (target & TARGET_INDEX_CHANNEL) {
-      std::sort(m_channel[0].begin(), m_channel[0].end());
-      *(dst_address++) = m_channel[0][m_ncolors/2];
-    }
-    else {
-      color = get_pixel_fast<IndexedTraits>(src, x, y);
-
-      if (target & TARGET_RED_CHANNEL) {
-        std::sort(m_channel[0].begin(), m_channel[0].end());
-        r = m_channel[0][m_ncolors/2];
-      }
-      else
-        r = rgba_getr(pal->getEntry(color));
-
-      if (target & TARGET_GREEN_CHANNEL) {
-        std::sort(m_channel[1].begin(), m_channel[1].end());
-        g = m_channel[1][m_ncolors/2];
-      }
-      else
-        g = rgba_getg(pal->getEntry(color));
-
-      if (target & TARGET_BLUE_CHANNEL) {
-        std::sort(m_channel[2].begin(), m_channel[2].end());
-        b = m_channel[2][m_ncolors/2];
-      }
-      else
-        b = rgba_getb(pal->getEntry(color));
-
-      *(dst_address++) = rgbmap->mapColor(r, g, b);
-    }
-  }
+  MedianDelegateIndexed delegate(filterMgr->getIndexedData()->getPalette(),
+                                 filterMgr->getIndexedData()->getRgbMap(),
+                                 filterMgr->getTarget());
+  apply_median_to_row(filterMgr, m_width, m_height, m_tiledMode, delegate);
 }
 
 } // namespace filters
@@ -38,7 +38,6 @@ namespace filters {
     int m_width;
     int m_height;
     int m_ncolors;
-    std::vector<std::vector<uint8_t> > m_channel;
   };
 
 } // namespace filters
@@ -0,0 +1,262 @@
+// Aseprite
+// Copyright (C) 2001-2015  David Capello
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/convert_to.h"
+#include "base/unique_ptr.h"
+#include "doc/image.h"
+#include "doc/palette.h"
+#include "doc/primitives.h"
+#include "doc/rgbmap.h"
+#include "filters/median_filter.h"
+#include "filters/neighboring_pixels.h"
+#include "filters/test_filter_manager.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace base;
+using namespace doc;
+using namespace filters;
+
+// Collects the channels of each pixel in the window (the color
+// values of each channel are sorted later).
+struct CollectChannels {
+  PixelFormat format;
+  const Palette* palette;
+  std::vector<int> channel[4];
+
+  CollectChannels(PixelFormat format, const Palette* palette)
+    : format(format), palette(palette) { }
+
+  void operator()(color_t c) {
+    if (format == IMAGE_RGB) {
+      channel[0].push_back(rgba_getr(c));
+      channel[1].push_back(rgba_getg(c));
+      channel[2].push_back(rgba_getb(c));
+      channel[3].push_back(rgba_geta(c));
+    }
+    else if (format == IMAGE_GRAYSCALE) {
+      channel[0].push_back(graya_getv(c));
+      channel[1].push_back(graya_geta(c));
+    }
+    else {
+      color_t e = palette->getEntry(c);
+      channel[0].push_back(rgba_getr(e));
+      channel[1].push_back(rgba_getg(e));
+      channel[2].push_back(rgba_getb(e));
+      channel[3].push_back(c);
+    }
+  }
+
+  int median(int i) {
+    std::sort(channel[i].begin(), channel[i].end());
+    return channel[i][channel[i].size()/2];
+  }
+};
+
+template<typename Traits>
+static void reference_median_pixel(const Image* src, Image* dst, int x, int y,
+                                   const gfx::Size& size, TiledMode tiled,
+                                   Target target, const Palette* palette,
+                                   const RgbMap* rgbmap)
+{
+  CollectChannels channels(src->pixelFormat(), palette);
+  get_neighboring_pixels<Traits>(src, x, y, size.w, size.h, size.w/2, size.h/2,
+                                 tiled, channels);
+
+  color_t c = get_pixel(src, x, y);
+  switch (src->pixelFormat()) {
+    case IMAGE_RGB:
+      c = rgba(
+        (target & TARGET_RED_CHANNEL ? channels.median(0): rgba_getr(c)),
+        (target & TARGET_GREEN_CHANNEL ? channels.median(1): rgba_getg(c)),
+        (target & TARGET_BLUE_CHANNEL ? channels.median(2): rgba_getb(c)),
+        (target & TARGET_ALPHA_CHANNEL ? channels.median(3): rgba_geta(c)));
+      break;
+    case IMAGE_GRAYSCALE:
+      c = graya(
+        (target & TARGET_GRAY_CHANNEL ? channels.median(0): graya_getv(c)),
+        (target & TARGET_ALPHA_CHANNEL ? channels.median(1): graya_geta(c)));
+      break;
+    case IMAGE_INDEXED:
+      if (target & TARGET_INDEX_CHANNEL)
+        c = channels.median(3);
+      else {
+        color_t e = palette->getEntry(c);
+        c = rgbmap->mapColor(
+          (target & TARGET_RED_CHANNEL ? channels.median(0): rgba_getr(e)),
+          (target & TARGET_GREEN_CHANNEL ? channels.median(1): rgba_getg(e)),
+          (target & TARGET_BLUE_CHANNEL ? channels.median(2): rgba_getb(e)));
+      }
+      break;
+  }
+  put_pixel(dst, x, y, c);
+}
+
+// Median calculated sorting the values of each window (the
+// implementation before the histogram one).
+static void reference_median(const Image* src, Image* dst, const gfx::Rect& bounds,
+                             const Image* selection,
+                             const gfx::Size& size, TiledMode tiled,
+                             Target target, const Palette* palette,
+                             const RgbMap* rgbmap)
+{
+  for (int y=bounds.y; y<bounds.y2(); ++y)
+    for (int x=bounds.x; x<bounds.x2(); ++x) {
+      if (selection && !get_pixel(selection, x, y))
+        continue;
+
+      switch (src->pixelFormat()) {
+        case IMAGE_RGB:
+          reference_median_pixel<RgbTraits>(src, dst, x, y, size, tiled, target, palette, rgbmap);
+          break;
+        case IMAGE_GRAYSCALE:
+          reference_median_pixel<GrayscaleTraits>(src, dst, x, y, size, tiled, target, palette, rgbmap);
+          break;
+        case IMAGE_INDEXED:
+          reference_median_pixel<IndexedTraits>(src, dst, x, y, size, tiled, target, palette, rgbmap);
+          break;
+      }
+    }
+}
+
+struct MedianFilterTest {
+  typedef gfx::Size Param;
+
+  static std::vector<Param> params() {
+    return {
+      gfx::Size(1, 1),
+      gfx::Size(3, 3),
+      gfx::Size(5, 3),
+      gfx::Size(2, 4),
+      gfx::Size(7, 7)
+    };
+  }
+
+  static std::string name(const Param& size) {
+    return "size=" + convert_to<std::string>(size.w) + "x" + convert_to<std::string>(size.h);
+  }
+
+  static Filter* createFilter(const Param& size, TiledMode tiled) {
+    MedianFilter* filter = new MedianFilter;
+    filter->setTiledMode(tiled);
+    filter->setSize(size.w, size.h);
+    return filter;
+  }
+
+  static void reference(const Image* src, Image* dst, const gfx::Rect& bounds,
+                        const Image* selection, const Param& size,
+                        TiledMode tiled, Target target,
+                        const Palette* palette, const RgbMap* rgbmap) {
+    reference_median(src, dst, bounds, selection, size, tiled, target, palette, rgbmap);
+  }
+};
+
+FILTER_PIXEL_FORMAT_TESTS(MedianFilter, MedianFilterTest)
+
+TEST(MedianFilter, Selection)
+{
+  const PixelFormat formats[] = { IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED };
+  const Target targets[] = {
+    TARGET_ALL_CHANNELS,
+    TARGET_ALL_CHANNELS,
+    TARGET_INDEX_CHANNEL
+  };
+
+  for (int f=0; f<3; ++f) {
+    std::srand(f+1);
+    UniquePtr<Image> src(create_random_image(formats[f], 31, 19));
+    UniquePtr<Image> selection(create_random_selection(31, 19));
+
+    for (TiledMode tiled : tiled_modes)
+      for (const gfx::Size& size : MedianFilterTest::params()) {
+        // Whole image and a part of it (rows that don't start in x=0)
+        expect_same_as_reference<MedianFilterTest>(src, src->bounds(), selection, size, tiled, targets[f]);
+        expect_same_as_reference<MedianFilterTest>(src, gfx::Rect(5, 3, 20, 11), selection, size, tiled, targets[f]);
+      }
+  }
+}
+
+// Windows wider than the image (they use the same columns/rows
+// several times).
+TEST(MedianFilter, WindowWiderThanImage)
+{
+  const PixelFormat formats[] = { IMAGE_RGB, IMAGE_GRAYSCALE, IMAGE_INDEXED };
+  const Target targets[] = {
+    TARGET_ALL_CHANNELS,
+    TARGET_ALL_CHANNELS,
+    TARGET_INDEX_CHANNEL
+  };
+  const gfx::Size sizes[] = {
+    gfx::Size(7, 3),
+    gfx::Size(9, 9),
+    gfx::Size(3, 11)
+  };
+
+  for (int f=0; f<3; ++f) {
+    std::srand(f+1);
+    UniquePtr<Image> src(create_random_image(formats[f], 4, 5));
+    UniquePtr<Image> selection(create_random_selection(4, 5));
+
+    for (TiledMode tiled : tiled_modes)
+      for (const gfx::Size& size : sizes) {
+        expect_same_as_reference<MedianFilterTest>(src, src->bounds(), nullptr, size, tiled, targets[f]);
+        expect_same_as_reference<MedianFilterTest>(src, src->bounds(), selection, size, tiled, targets[f]);
+      }
+  }
+}
+
+// Columns visited by get_neighboring_pixels() (clamped or wrapped
+// around), even when the window is wider than the image.
+TEST(MedianFilter, NeighboringPixels)
+{
+  const int w = 6, h = 2;
+  UniquePtr<Image> image(Image::create(IMAGE_RGB, w, h));
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x)
+      put_pixel(image, x, y, rgba(x, y, 0, 255));
+
+  struct Collect {
+    std::vector<int> cols;
+    void operator()(color_t c) { cols.push_back(rgba_getr(c)); }
+  };
+
+  struct Case {
+    int x, width, centerX;
+    TiledMode tiled;
+    std::vector<int> cols;
+  } cases[] = {
+    { 1, 5, 2, TiledMode::NONE,   { 0, 0, 1, 2, 3 } },
+    { 5, 5, 2, TiledMode::NONE,   { 3, 4, 5, 5, 5 } },
+    { 1, 5, 2, TiledMode::X_AXIS, { 5, 0, 1, 2, 3 } },
+    { 5, 5, 2, TiledMode::X_AXIS, { 3, 4, 5, 0, 1 } },
+    { 0, 9, 4, TiledMode::NONE,   { 0, 0, 0, 0, 0, 1, 2, 3, 4 } },
+    { 3, 9, 4, TiledMode::NONE,   { 0, 0, 1, 2, 3, 4, 5, 5, 5 } },
+    { 0, 9, 4, TiledMode::X_AXIS, { 2, 3, 4, 5, 0, 1, 2, 3, 4 } },
+    { 2, 14, 0, TiledMode::NONE,  { 2, 3, 4, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5 } },
+  };
+
+  for (const Case& c : cases) {
+    Collect collect;
+    get_neighboring_pixels<RgbTraits>(image, c.x, 0, c.width, 1, c.centerX, 0, c.tiled, collect);
+    EXPECT_EQ(c.cols, collect.cols) << "x=" << c.x << " width=" << c.width;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -18,6 +18,20 @@
 namespace filters {
   using namespace doc;
 
+  // Returns the column/row of the source image used by
+  // get_neighboring_pixels() for the coordinate "i" of the matrix
+  // (which can be outside the image): it wraps around in tiled axes
+  // and it's clamped otherwise.
+  inline int get_neighboring_coord(int i, int size, bool tiled)
+  {
+    if (tiled) {
+      i %= size;
+      return (i < 0 ? i+size: i);
+    }
+    else
+      return (i < 0 ? 0: (i >= size ? size-1: i));
+  }
+
   // Calls the specified "delegate" for all neighboring pixels in a 2D
   // (width*height) matrix located in (x,y) where its center is the
   // (centerX,centerY) element of the matrix.
@@ -28,76 +42,17 @@ namespace filters {
                                      TiledMode tiledMode,
                                      Delegate& delegate)
   {
-    int dx, dy;
-
-    // Y position to get pixel.
-    int getx, gety = y - centerY;
-    int addx, addy = 0;
-    if (gety < 0) {
-      if (int(tiledMode) & int(TiledMode::Y_AXIS))
-        gety = sourceImage->height() - (-(gety+1) % sourceImage->height()) - 1;
-      else {
-        addy = -gety;
-        gety = 0;
-      }
-    }
-    else if (gety >= sourceImage->height()) {
-      if (int(tiledMode) & int(TiledMode::Y_AXIS))
-        gety = gety % sourceImage->height();
-      else
-        gety = sourceImage->height()-1;
-    }
-
-    for (dy=0; dy<height; ++dy) {
-      // X position to get pixel.
-      getx = x - centerX;
-      addx = 0;
-      if (getx < 0) {
-        if (int(tiledMode) & int(TiledMode::X_AXIS))
-          getx = sourceImage->width() - (-(getx+1) % sourceImage->width()) - 1;
-        else {
-          addx = -getx;
-          getx = 0;
-        }
-      }
-      else if (getx >= sourceImage->width()) {
-        if (int(tiledMode) & int(TiledMode::X_AXIS))
-          getx = getx % sourceImage->width();
-        else
-          getx = sourceImage->width()-1;
-      }
+    const bool tiledX = ((int(tiledMode) & int(TiledMode::X_AXIS)) != 0);
+    const bool tiledY = ((int(tiledMode) & int(TiledMode::Y_AXIS)) != 0);
 
+    for (int dy=0; dy<height; ++dy) {
+      int gety = get_neighboring_coord(y-centerY+dy, sourceImage->height(), tiledY);
       typename Traits::const_address_t srcAddress =
-        reinterpret_cast<typename Traits::const_address_t>(sourceImage->getPixelAddress(getx, gety));
-
-      for (dx=0; dx<width; dx++) {
-        // Call the delegate for each pixel value.
-        delegate(*srcAddress);
-
-        // Update X position to get pixel.
-        if (getx < sourceImage->width()-1) {
-          ++getx;
-          if (addx == 0)
-            ++srcAddress;
-          else
-            --addx;
-        }
-        else if (int(tiledMode) & int(TiledMode::X_AXIS)) {
-          getx = 0;
-          srcAddress =
-            reinterpret_cast<typename Traits::const_address_t>(sourceImage->getPixelAddress(getx, gety));
-        }
-      }
+        reinterpret_cast<typename Traits::const_address_t>(sourceImage->getPixelAddress(0, gety));
 
-      // Update Y position to get pixel
-      if (gety < sourceImage->height()-1) {
-        if (addy == 0)
-          ++gety;
-        else
-          --addy;
-      }
-      else if (int(tiledMode) & int(TiledMode::Y_AXIS))
-        gety = 0;
+      // Call the delegate for each pixel value.
+      for (int dx=0; dx<width; ++dx)
+        delegate(srcAddress[get_neighboring_coord(x-centerX+dx, sourceImage->width(), tiledX)]);
     }
   }
 
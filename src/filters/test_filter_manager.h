@@ -0,0 +1,246 @@
+// Aseprite
+// Copyright (C) 2001-2015  David Capello
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License version 2 as
+// published by the Free Software Foundation.
+
+#ifndef FILTERS_TEST_FILTER_MANAGER_H_INCLUDED
+#define FILTERS_TEST_FILTER_MANAGER_H_INCLUDED
+#pragma once
+
+#include <gtest/gtest.h>
+
+#include "base/unique_ptr.h"
+#include "doc/image.h"
+#include "doc/palette.h"
+#include "doc/primitives.h"
+#include "doc/rgbmap.h"
+#include "filters/filter.h"
+#include "filters/filter_indexed_data.h"
+#include "filters/filter_manager.h"
+#include "filters/target.h"
+#include "filters/tiled_mode.h"
+#include "gfx/rect.h"
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace filters {
+
+  // FilterManager used in tests to apply a filter to the "bounds" of
+  // an image row by row (like app::FilterManagerImpl does). The
+  // optional "selection" is a bitmap of the same size of the image
+  // where zero pixels are skipped.
+  class TestFilterManager : public FilterManager
+                          , public FilterIndexedData {
+  public:
+    TestFilterManager(const doc::Image* src, doc::Image* dst,
+                      const gfx::Rect& bounds, Target target)
+      : m_src(src), m_dst(dst), m_bounds(bounds), m_target(target)
+      , m_selection(nullptr), m_palette(nullptr), m_rgbmap(nullptr)
+      , m_y(0), m_skipX(0) {
+    }
+
+    void setSelection(const doc::Image* selection) { m_selection = selection; }
+
+    void setIndexedData(doc::Palette* palette, doc::RgbMap* rgbmap) {
+      m_palette = palette;
+      m_rgbmap = rgbmap;
+    }
+
+    void applyFilter(Filter* filter) {
+      for (m_y=m_bounds.y; m_y<m_bounds.y2(); ++m_y) {
+        m_skipX = m_bounds.x;
+        switch (m_src->pixelFormat()) {
+          case doc::IMAGE_RGB: filter->applyToRgba(this); break;
+          case doc::IMAGE_GRAYSCALE: filter->applyToGrayscale(this); break;
+          case doc::IMAGE_INDEXED: filter->applyToIndexed(this); break;
+        }
+      }
+    }
+
+    // FilterManager implementation
+    const void* getSourceAddress() override { return m_src->getPixelAddress(m_bounds.x, m_y); }
+    void* getDestinationAddress() override { return m_dst->getPixelAddress(m_bounds.x, m_y); }
+    int getWidth() override { return m_bounds.w; }
+    Target getTarget() override { return m_target; }
+    FilterIndexedData* getIndexedData() override { return this; }
+    bool skipPixel() override {
+      int x = m_skipX++;
+      return (m_selection && !doc::get_pixel(m_selection, x, m_y));
+    }
+    const doc::Image* getSourceImage() override { return m_src; }
+    int x() override { return m_bounds.x; }
+    int y() override { return m_y; }
+
+    // FilterIndexedData implementation
+    doc::Palette* getPalette() override { return m_palette; }
+    doc::RgbMap* getRgbMap() override { return m_rgbmap; }
+
+  private:
+    const doc::Image* m_src;
+    doc::Image* m_dst;
+    gfx::Rect m_bounds;
+    Target m_target;
+    const doc::Image* m_selection;
+    doc::Palette* m_palette;
+    doc::RgbMap* m_rgbmap;
+    int m_y;
+    int m_skipX;
+  };
+
+  // Helpers to compare a filter with a reference implementation
+  // (e.g. the old pixel by pixel one). Each test file defines a
+  // "FilterTest" struct with:
+  //
+  //   typedef ... Param;    // Filter parameter (e.g. a window size)
+  //   static std::vector<Param> params();
+  //   static std::string name(const Param& param);
+  //   static Filter* createFilter(const Param& param, TiledMode tiled);
+  //   static void reference(const doc::Image* src, doc::Image* dst,
+  //                         const gfx::Rect& bounds, const doc::Image* selection,
+  //                         const Param& param, TiledMode tiled, Target target,
+  //                         const doc::Palette* palette, const doc::RgbMap* rgbmap);
+
+  static const TiledMode tiled_modes[] = {
+    TiledMode::NONE,
+    TiledMode::X_AXIS,
+    TiledMode::Y_AXIS,
+    TiledMode::BOTH
+  };
+
+  // Random pixels with few values in some channels (so windows have
+  // repeated values), and where 1/4 of RGBA/grayscale pixels are
+  // transparent (with RGB/gray values that could be ignored).
+  inline doc::Image* create_random_image(doc::PixelFormat format, int w, int h) {
+    doc::Image* image = doc::Image::create(format, w, h);
+    for (int y=0; y<h; ++y)
+      for (int x=0; x<w; ++x) {
+        doc::color_t c = 0;
+        switch (format) {
+          case doc::IMAGE_RGB:
+            c = doc::rgba(32*(std::rand()%8), 64*(std::rand()%4), std::rand()%256, 85*(std::rand()%4));
+            break;
+          case doc::IMAGE_GRAYSCALE:
+            c = doc::graya(16*(std::rand()%16), 85*(std::rand()%4));
+            break;
+          case doc::IMAGE_INDEXED:
+            c = std::rand()%16;
+            break;
+        }
+        doc::put_pixel(image, x, y, c);
+      }
+    return image;
+  }
+
+  inline doc::Image* create_random_selection(int w, int h) {
+    doc::Image* image = doc::Image::create(doc::IMAGE_BITMAP, w, h);
+    for (int y=0; y<h; ++y)
+      for (int x=0; x<w; ++x)
+        doc::put_pixel(image, x, y, (std::rand()%3) != 0 ? 1: 0);
+    return image;
+  }
+
+  inline doc::Palette* create_palette() {
+    doc::Palette* palette = new doc::Palette(doc::frame_t(0), 16);
+    for (int i=0; i<16; ++i)
+      palette->setEntry(i, doc::rgba(17*i, 255-17*i, (i*73) % 256, 255));
+    return palette;
+  }
+
+  template<typename FilterTest>
+  void expect_same_as_reference(const doc::Image* src, const gfx::Rect& bounds,
+                                const doc::Image* selection,
+                                const typename FilterTest::Param& param,
+                                TiledMode tiled, Target target) {
+    base::UniquePtr<doc::Palette> palette(create_palette());
+    doc::RgbMap rgbmap;
+    rgbmap.regenerate(palette, -1);
+
+    base::UniquePtr<doc::Image> expected(doc::Image::createCopy(src));
+    FilterTest::reference(src, expected, bounds, selection, param, tiled, target,
+                          palette, &rgbmap);
+
+    base::UniquePtr<doc::Image> dst(doc::Image::createCopy(src));
+    base::UniquePtr<Filter> filter(FilterTest::createFilter(param, tiled));
+
+    TestFilterManager filterMgr(src, dst, bounds, target);
+    filterMgr.setSelection(selection);
+    filterMgr.setIndexedData(palette, &rgbmap);
+    filterMgr.applyFilter(filter);
+
+    for (int y=0; y<src->height(); ++y)
+      for (int x=0; x<src->width(); ++x) {
+        if (doc::get_pixel(expected, x, y) != doc::get_pixel(dst, x, y)) {
+          ADD_FAILURE() << "Different pixel at " << x << "," << y
+                        << " " << FilterTest::name(param)
+                        << " format=" << src->pixelFormat()
+                        << " bounds=" << bounds.x << "," << bounds.y << "," << bounds.w << "," << bounds.h
+                        << " tiled=" << int(tiled)
+                        << " target=" << target
+                        << " expected=" << doc::get_pixel(expected, x, y)
+                        << " actual=" << doc::get_pixel(dst, x, y);
+          return;
+        }
+      }
+  }
+
+  template<typename FilterTest>
+  void test_format(doc::PixelFormat format, const Target* targets, int ntargets) {
+    std::srand(format+1);
+    base::UniquePtr<doc::Image> src(create_random_image(format, 23, 17));
+    base::UniquePtr<doc::Image> selection(create_random_selection(23, 17));
+
+    for (const auto& param : FilterTest::params())
+      for (TiledMode tiled : tiled_modes)
+        for (int t=0; t<ntargets; ++t) {
+          // Whole image (4 pixels at a time with SSE2), a part of it
+          // with a selection, and rows of less than 4 pixels (which
+          // use the scalar loop only)
+          expect_same_as_reference<FilterTest>(src, src->bounds(), nullptr, param, tiled, targets[t]);
+          expect_same_as_reference<FilterTest>(src, gfx::Rect(5, 3, 15, 11), selection, param, tiled, targets[t]);
+          expect_same_as_reference<FilterTest>(src, gfx::Rect(20, 0, 3, 17), nullptr, param, tiled, targets[t]);
+        }
+  }
+
+} // namespace filters
+
+// Compares the filter with its reference implementation in each pixel
+// format (with different targets).
+#define FILTER_PIXEL_FORMAT_TESTS(test_case_name, FilterTest)           \
+  TEST(test_case_name, Rgb)                                             \
+  {                                                                     \
+    const filters::Target targets[] = {                                 \
+      TARGET_RED_CHANNEL | TARGET_GREEN_CHANNEL |                       \
+      TARGET_BLUE_CHANNEL | TARGET_ALPHA_CHANNEL,                       \
+      TARGET_RED_CHANNEL | TARGET_GREEN_CHANNEL |                       \
+      TARGET_BLUE_CHANNEL,                                              \
+      TARGET_GREEN_CHANNEL | TARGET_ALPHA_CHANNEL                       \
+    };                                                                  \
+    filters::test_format<FilterTest>(doc::IMAGE_RGB, targets, 3);       \
+  }                                                                     \
+                                                                        \
+  TEST(test_case_name, Grayscale)                                       \
+  {                                                                     \
+    const filters::Target targets[] = {                                 \
+      TARGET_GRAY_CHANNEL | TARGET_ALPHA_CHANNEL,                       \
+      TARGET_GRAY_CHANNEL,                                              \
+      TARGET_ALPHA_CHANNEL                                              \
+    };                                                                  \
+    filters::test_format<FilterTest>(doc::IMAGE_GRAYSCALE, targets, 3); \
+  }                                                                     \
+                                                                        \
+  TEST(test_case_name, Indexed)                                         \
+  {                                                                     \
+    const filters::Target targets[] = {                                 \
+      TARGET_INDEX_CHANNEL,                                             \
+      TARGET_RED_CHANNEL | TARGET_GREEN_CHANNEL |                       \
+      TARGET_BLUE_CHANNEL,                                              \
+      TARGET_BLUE_CHANNEL                                               \
+    };                                                                  \
+    filters::test_format<FilterTest>(doc::IMAGE_INDEXED, targets, 3);   \
+  }
+
+#endif
@@ -1,5 +1,5 @@
 // Aseprite Gfx Library
-// Copyright (C) 2001-2014 David Capello
+// Copyright (C) 2001-2015 David Capello
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
@@ -10,19 +10,31 @@
 
 #include "gfx/packing_rects.h"
 
-#include "gfx/region.h"
+#include "gfx/point.h"
 #include "gfx/size.h"
 
+#include <algorithm>
+#include <climits>
+
 namespace gfx {
 
+PackingRects::PackingRects()
+  : m_heuristic(BottomLeft)
+  , m_allowRotation(false)
+  , m_powerOfTwo(true)
+{
+}
+
 void PackingRects::add(const Size& sz)
 {
-  m_rects.push_back(Rect(sz));
+  add(Rect(sz));
 }
 
 void PackingRects::add(const Rect& rc)
 {
   m_rects.push_back(rc);
+  m_sizes.push_back(rc.getSize());
+  m_rotated.push_back(false);
 }
 
 Size PackingRects::bestFit()
@@ -32,67 +44,262 @@ Size PackingRects::bestFit()
   // Calculate the amount of pixels that we need, the texture cannot
   // be smaller than that.
   int neededArea = 0;
-  for (const auto& rc : m_rects) {
-    neededArea += rc.w * rc.h;
+  for (const auto& sz : m_sizes) {
+    neededArea += sz.w * sz.h;
   }
 
+  std::vector<int> order = sortedIndexes();
   int w = 1;
   int h = 1;
   int z = 0;
-  bool fit = false;
+  int resumeFrom = -1;
   while (true) {
-    if (w*h >= neededArea) {
-      fit = pack(Size(w, h));
-      if (fit) {
+    if (w*h >= neededArea && canFitEachRect(Size(w, h))) {
+      int placed;
+
+      // If the last tried size had the same width (and half of this
+      // height), we continue from the rectangle that didn't fit in
+      // it. With BottomLeft heuristic, the result is the same as
+      // packing the rectangles again in the new size.
+      if (resumeFrom >= 0) {
+        growHeight(h);
+        placed = packFrom(order, resumeFrom);
+      }
+      else {
+        reset(Size(w, h));
+        placed = packFrom(order, 0);
+      }
+
+      if (placed == int(order.size())) {
         size = Size(w, h);
         break;
       }
+      resumeFrom = placed;
     }
+    else
+      resumeFrom = -1;
 
-    if ((++z) & 1)
+    if ((++z) & 1) {
       w *= 2;
+      resumeFrom = -1;
+    }
     else
       h *= 2;
   }
 
+  // Remove the empty space at the right and bottom sides (with
+  // BottomLeft heuristic the last doubled side is usually half
+  // empty).
+  if (!m_powerOfTwo) {
+    Rect used;
+    for (const auto& rc : m_rects)
+      used |= rc;
+
+    if (!used.isEmpty()) {
+      size = Size(used.x2(), used.y2());
+      m_bounds = Rect(size);
+    }
+  }
+
   return size;
 }
 
-static bool by_area(const Rect* a, const Rect* b) {
-  return a->w*a->h > b->w*b->h;
+bool PackingRects::pack(const Size& size)
+{
+  std::vector<int> order = sortedIndexes();
+  reset(size);
+  return (packFrom(order, 0) == int(order.size()));
 }
 
-bool PackingRects::pack(const Size& size)
+bool PackingRects::packAround(const Size& size, const Rects& occupied)
+{
+  std::vector<int> order = sortedIndexes();
+  reset(size);
+  for (const auto& rc : occupied) {
+    if (!rc.isEmpty())
+      placeRect(rc);
+  }
+  return (packFrom(order, 0) == int(order.size()));
+}
+
+// Returns the indexes of all rectangles from the biggest to the
+// smallest one (we cannot sort m_rects because we want to keep the
+// same order given in add() calls).
+std::vector<int> PackingRects::sortedIndexes() const
+{
+  std::vector<int> order(m_sizes.size());
+  for (int i=0; i<int(order.size()); ++i)
+    order[i] = i;
+
+  std::sort(order.begin(), order.end(),
+            [this](int a, int b) {
+              return m_sizes[a].w*m_sizes[a].h > m_sizes[b].w*m_sizes[b].h;
+            });
+  return order;
+}
+
+// Returns false if there is a rectangle bigger than the given size,
+// so we don't need to try to pack the rectangles.
+bool PackingRects::canFitEachRect(const Size& size) const
+{
+  for (const auto& sz : m_sizes) {
+    if (!(sz.w <= size.w && sz.h <= size.h) &&
+        !(m_allowRotation && sz.h <= size.w && sz.w <= size.h))
+      return false;
+  }
+  return true;
+}
+
+void PackingRects::reset(const Size& size)
 {
   m_bounds = Rect(size);
+  m_freeRects.clear();
+  if (!m_bounds.isEmpty())
+    m_freeRects.push_back(m_bounds);
+}
+
+// Makes the packing area taller keeping the already placed
+// rectangles in the same position.
+void PackingRects::growHeight(int height)
+{
+  int oldHeight = m_bounds.h;
+  bool fullWidth = false;
 
-  // We cannot sort m_rects because we want to 
-  std::vector<Rect*> rectPtrs(m_rects.size());
-  int i = 0;
-  for (auto& rc : m_rects)
-    rectPtrs[i++] = &rc;
-  std::sort(rectPtrs.begin(), rectPtrs.end(), by_area);
-
-  gfx::Region rgn(m_bounds);
-  for (auto rcPtr : rectPtrs) {
-    gfx::Rect& rc = *rcPtr;
-
-    for (int v=0; v<=m_bounds.h-rc.h; ++v) {
-      for (int u=0; u<=m_bounds.w-rc.w; ++u) {
-        gfx::Rect possible(u, v, rc.w, rc.h);
-        Region::Overlap overlap = rgn.contains(possible);
-        if (overlap == Region::In) {
-          rc = possible;
-          rgn.createSubtraction(rgn, gfx::Region(rc));
-          goto next_rc;
-        }
+  // Free rectangles touching the bottom side grow down.
+  for (auto& rc : m_freeRects) {
+    if (rc.y2() == oldHeight) {
+      rc.h = height - rc.y;
+      if (rc.x == 0 && rc.w == m_bounds.w)
+        fullWidth = true;
+    }
+  }
+
+  if (!fullWidth)
+    m_freeRects.push_back(Rect(0, oldHeight, m_bounds.w, height-oldHeight));
+
+  m_bounds.h = height;
+}
+
+// Packs the rectangles order[start], order[start+1], etc. in the
+// free space. Returns the position in "order" of the first rectangle
+// that doesn't fit (or order.size() if all rectangles were packed).
+int PackingRects::packFrom(const std::vector<int>& order, int start)
+{
+  for (int j=start; j<int(order.size()); ++j) {
+    int i = order[j];
+    const Size& sz = m_sizes[i];
+
+    if (sz.w <= 0 || sz.h <= 0) {
+      m_rects[i] = Rect(0, 0, sz.w, sz.h);
+      m_rotated[i] = false;
+      continue;
+    }
+
+    Rect rc;
+    bool rotated;
+    if (!findPosition(sz, rc, rotated))
+      return j;            // There is not enough room for this rectangle
+
+    m_rects[i] = rc;
+    m_rotated[i] = rotated;
+    placeRect(rc);
+  }
+  return int(order.size());
+}
+
+bool PackingRects::findPosition(const Size& size, Rect& result, bool& rotated) const
+{
+  int bestScore1 = INT_MAX;
+  int bestScore2 = INT_MAX;
+
+  for (const auto& free : m_freeRects) {
+    for (int r=0; r<(m_allowRotation && size.w != size.h ? 2: 1); ++r) {
+      int w = (r == 0 ? size.w: size.h);
+      int h = (r == 0 ? size.h: size.w);
+      if (w > free.w || h > free.h)
+        continue;
+
+      int leftoverW = free.w - w;
+      int leftoverH = free.h - h;
+      int score1, score2;
+
+      switch (m_heuristic) {
+        case BestShortSideFit:
+          score1 = std::min(leftoverW, leftoverH);
+          score2 = std::max(leftoverW, leftoverH);
+          break;
+        case BestLongSideFit:
+          score1 = std::max(leftoverW, leftoverH);
+          score2 = std::min(leftoverW, leftoverH);
+          break;
+        case BestAreaFit:
+          score1 = free.w*free.h - w*h;
+          score2 = std::min(leftoverW, leftoverH);
+          break;
+        default:
+          score1 = free.y + h;
+          score2 = free.x;
+          break;
+      }
+
+      if (score1 < bestScore1 ||
+          (score1 == bestScore1 && score2 < bestScore2)) {
+        bestScore1 = score1;
+        bestScore2 = score2;
+        result = Rect(free.x, free.y, w, h);
+        rotated = (r == 1);
       }
     }
-    return false; // There is not enough room for "rc"
-  next_rc:;
   }
 
-  return true;
+  return (bestScore1 != INT_MAX);
+}
+
+// Removes the given rectangle from the free space, splitting each
+// free rectangle that intersects it in the (up to 4) maximal
+// rectangles around it.
+void PackingRects::placeRect(const Rect& rc)
+{
+  Rects newRects;
+
+  for (std::size_t i=0; i<m_freeRects.size(); ) {
+    Rect free = m_freeRects[i];
+    if (!free.intersects(rc)) {
+      ++i;
+      continue;
+    }
+
+    if (rc.x > free.x)
+      newRects.push_back(Rect(free.x, free.y, rc.x - free.x, free.h));
+    if (rc.x2() < free.x2())
+      newRects.push_back(Rect(rc.x2(), free.y, free.x2() - rc.x2(), free.h));
+    if (rc.y > free.y)
+      newRects.push_back(Rect(free.x, free.y, free.w, rc.y - free.y));
+    if (rc.y2() < free.y2())
+      newRects.push_back(Rect(free.x, rc.y2(), free.w, free.y2() - rc.y2()));
+
+    m_freeRects[i] = m_freeRects.back();
+    m_freeRects.pop_back();
+  }
+
+  // The remaining free rectangles are still maximal, we only need to
+  // discard new rectangles that are inside other free rectangles.
+  std::size_t oldCount = m_freeRects.size();
+  for (std::size_t i=0; i<newRects.size(); ++i) {
+    const Rect& a = newRects[i];
+    bool maximal = true;
+
+    for (std::size_t j=0; j<oldCount && maximal; ++j)
+      if (m_freeRects[j].contains(a))
+        maximal = false;
+
+    for (std::size_t j=0; j<newRects.size() && maximal; ++j)
+      if (j != i && newRects[j].contains(a) && (newRects[j] != a || j < i))
+        maximal = false;
+
+    if (maximal)
+      m_freeRects.push_back(a);
+  }
 }
 
 } // namespace gfx
@@ -14,12 +14,29 @@
 
 namespace gfx {
 
-  // TODO add support for rotations
+  // Packs rectangles in a texture using the MaxRects algorithm: a
+  // list of maximal free rectangles is kept, and each rectangle
+  // (from the biggest to the smallest one) is placed in the free
+  // rectangle with the best score for the selected heuristic.
   class PackingRects {
   public:
     typedef std::vector<Rect> Rects;
     typedef Rects::const_iterator const_iterator;
 
+    enum Heuristic {
+      // Top-most position, then left-most (the same position that a
+      // row by row scan of the texture would find).
+      BottomLeft,
+      // Free rectangle where the shorter leftover side is minimal.
+      BestShortSideFit,
+      // Free rectangle where the longer leftover side is minimal.
+      BestLongSideFit,
+      // Smallest free rectangle.
+      BestAreaFit,
+    };
+
+    PackingRects();
+
     // Iterate over all given rectangles (in the same order they where
     // given in addSize() calls).
     const_iterator begin() const { return m_rects.begin(); }
@@ -28,11 +45,24 @@ namespace gfx {
     std::size_t size() const { return m_rects.size(); }
     const Rect& operator[](int i) const { return m_rects[i]; }
 
+    // Returns true if the i-th rectangle was rotated 90 degrees to
+    // pack it (so its width and height are swapped).
+    bool isRotated(int i) const { return m_rotated[i]; }
+
+    Heuristic heuristic() const { return m_heuristic; }
+    bool allowRotation() const { return m_allowRotation; }
+    bool powerOfTwo() const { return m_powerOfTwo; }
+    void setHeuristic(Heuristic heuristic) { m_heuristic = heuristic; }
+    void setAllowRotation(bool state) { m_allowRotation = state; }
+    void setPowerOfTwo(bool state) { m_powerOfTwo = state; }
+
     // Adds a new rectangle.
     void add(const Size& sz);
     void add(const Rect& rc);
 
-    // Returns the best size for the texture.
+    // Returns the best size for the texture. It's the smallest power
+    // of two size where all rectangles fit, or (if powerOfTwo() is
+    // false) that size cropped to the area used by the rectangles.
     Size bestFit();
 
     // Rearrange all given rectangles to best fit a texture size.
@@ -40,12 +70,31 @@ namespace gfx {
     // if there is not enough space.
     bool pack(const Size& size);
 
+    // Like pack(), but the "occupied" rectangles of the texture are
+    // not used (e.g. rectangles of a previous packing that must stay
+    // in the same position).
+    bool packAround(const Size& size, const Rects& occupied);
+
     // Returns the bounds of the packed area.
     const Rect& bounds() const { return m_bounds; }
 
   private:
+    std::vector<int> sortedIndexes() const;
+    bool canFitEachRect(const Size& size) const;
+    void reset(const Size& size);
+    void growHeight(int height);
+    int packFrom(const std::vector<int>& order, int start);
+    bool findPosition(const Size& size, Rect& result, bool& rotated) const;
+    void placeRect(const Rect& rc);
+
     Rect m_bounds;
     Rects m_rects;
+    std::vector<Size> m_sizes;     // Original size of each rectangle
+    std::vector<bool> m_rotated;
+    Rects m_freeRects;             // Maximal free rectangles
+    Heuristic m_heuristic;
+    bool m_allowRotation;
+    bool m_powerOfTwo;
   };
 
 } // namespace gfx
@@ -11,11 +11,76 @@
 #include <gtest/gtest.h>
 
 #include "gfx/packing_rects.h"
+#include "gfx/point.h"
 #include "gfx/rect_io.h"
 #include "gfx/size.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
 using namespace gfx;
 
+static const PackingRects::Heuristic heuristics[] = {
+  PackingRects::BottomLeft,
+  PackingRects::BestShortSideFit,
+  PackingRects::BestLongSideFit,
+  PackingRects::BestAreaFit,
+};
+
+static const char* heuristic_name(PackingRects::Heuristic heuristic)
+{
+  switch (heuristic) {
+    case PackingRects::BottomLeft: return "BottomLeft";
+    case PackingRects::BestShortSideFit: return "BestShortSideFit";
+    case PackingRects::BestLongSideFit: return "BestLongSideFit";
+    case PackingRects::BestAreaFit: return "BestAreaFit";
+  }
+  return "";
+}
+
+// Sizes similar to trimmed frames of animations: most frames of the
+// same animation have a similar size (a character moving its arms,
+// legs, etc.), with some wider frames (attacks, effects).
+static std::vector<Size> trimmed_frame_sizes(int animations, int frames, unsigned int seed)
+{
+  std::vector<Size> sizes;
+  for (int a=0; a<animations; ++a) {
+    seed = seed*1103515245 + 12345;
+    int w = 8 + (seed >> 16) % 56;
+    seed = seed*1103515245 + 12345;
+    int h = 8 + (seed >> 16) % 56;
+
+    for (int f=0; f<frames; ++f) {
+      seed = seed*1103515245 + 12345;
+      int r = (seed >> 16);
+      int dw = r % 9 - 4;
+      int dh = (r / 9) % 9 - 4;
+      if ((r / 81) % 8 == 0)
+        dw += w;
+      sizes.push_back(Size(std::max(1, w+dw), std::max(1, h+dh)));
+    }
+  }
+  return sizes;
+}
+
+static void expect_valid_packing(const PackingRects& pr, const std::vector<Size>& sizes)
+{
+  ASSERT_EQ(sizes.size(), pr.size());
+  for (int i=0; i<int(pr.size()); ++i) {
+    const Rect& rc = pr[i];
+    if (pr.isRotated(i))
+      EXPECT_EQ(Size(sizes[i].h, sizes[i].w), rc.getSize());
+    else
+      EXPECT_EQ(sizes[i], rc.getSize());
+
+    EXPECT_TRUE(pr.bounds().contains(rc)) << rc;
+    for (int j=0; j<i; ++j)
+      EXPECT_FALSE(rc.intersects(pr[j])) << rc << " " << pr[j];
+  }
+}
+
 TEST(PackingRects, Simple)
 {
   PackingRects pr;
@@ -93,6 +158,221 @@ TEST(PackingRects, KeepSameRectsOrder)
   EXPECT_EQ(Rect(0, 0, 30, 30), pr[2]);
 }
 
+TEST(PackingRects, Rotation)
+{
+  PackingRects pr;
+  pr.add(Size(100, 20));
+  EXPECT_FALSE(pr.pack(Size(20, 100)));
+
+  pr.setAllowRotation(true);
+  EXPECT_TRUE(pr.pack(Size(20, 100)));
+  EXPECT_TRUE(pr.isRotated(0));
+  EXPECT_EQ(Rect(0, 0, 20, 100), pr[0]);
+
+  EXPECT_TRUE(pr.pack(Size(100, 20)));
+  EXPECT_FALSE(pr.isRotated(0));
+  EXPECT_EQ(Rect(0, 0, 100, 20), pr[0]);
+}
+
+TEST(PackingRects, BestFitWithRotation)
+{
+  PackingRects pr;
+  pr.setAllowRotation(true);
+  pr.add(Size(64, 16));
+  pr.add(Size(48, 64));
+  pr.bestFit();
+
+  EXPECT_EQ(Rect(0, 0, 64, 64), pr.bounds());
+  EXPECT_EQ(Rect(0, 48, 64, 16), pr[0]);
+  EXPECT_EQ(Rect(0, 0, 64, 48), pr[1]);
+  EXPECT_FALSE(pr.isRotated(0));
+  EXPECT_TRUE(pr.isRotated(1));
+}
+
+TEST(PackingRects, AllHeuristics)
+{
+  std::vector<Size> sizes = trimmed_frame_sizes(10, 12, 1);
+
+  for (auto heuristic : heuristics) {
+    for (int rotation=0; rotation<2; ++rotation) {
+      PackingRects pr;
+      pr.setHeuristic(heuristic);
+      pr.setAllowRotation(rotation == 1);
+      for (const auto& sz : sizes)
+        pr.add(sz);
+
+      Size size = pr.bestFit();
+      EXPECT_EQ(Rect(size), pr.bounds());
+      expect_valid_packing(pr, sizes);
+      if (!rotation) {
+        for (int i=0; i<int(pr.size()); ++i)
+          EXPECT_FALSE(pr.isRotated(i));
+      }
+    }
+  }
+}
+
+// Packs trimmed frames with the default options (the same layout as
+// the old packer that scanned a gfx::Region) and with the options
+// that reduce the empty space of the texture.
+TEST(PackingRects, TrimmedFramesFill)
+{
+  std::vector<Size> sizes = trimmed_frame_sizes(50, 16, 50);
+  double fill[3];
+
+  for (int i=0; i<3; ++i) {
+    PackingRects pr;
+    pr.setPowerOfTwo(i == 0);
+    pr.setAllowRotation(i == 2);
+    int area = 0;
+    for (const auto& sz : sizes) {
+      pr.add(sz);
+      area += sz.w*sz.h;
+    }
+
+    Size size = pr.bestFit();
+    EXPECT_EQ(Rect(size), pr.bounds());
+    expect_valid_packing(pr, sizes);
+    fill[i] = double(area) / (size.w*size.h);
+
+    if (i == 0) {
+      EXPECT_EQ(Size(2048, 1024), size);
+    }
+    else {
+      // The texture is cropped to the packed rectangles
+      Rect used;
+      for (const auto& rc : pr)
+        used |= rc;
+      EXPECT_EQ(size, Size(used.x2(), used.y2()));
+    }
+  }
+
+  EXPECT_LT(fill[0], 0.6);
+  EXPECT_GT(fill[1], 0.9);
+  EXPECT_GT(fill[2], fill[1]);
+}
+
+// With a fixed texture size, the MaxRects heuristics can pack
+// frames that don't fit with BottomLeft (the old packer).
+TEST(PackingRects, TrimmedFramesFixedSize)
+{
+  std::vector<Size> sizes = trimmed_frame_sizes(10, 16, 10);
+
+  for (auto heuristic : heuristics) {
+    PackingRects pr;
+    pr.setHeuristic(heuristic);
+    for (const auto& sz : sizes)
+      pr.add(sz);
+
+    bool packed = pr.pack(Size(500, 500));
+    if (heuristic == PackingRects::BottomLeft)
+      EXPECT_FALSE(packed);
+    else {
+      EXPECT_TRUE(packed) << heuristic_name(heuristic);
+      expect_valid_packing(pr, sizes);
+    }
+  }
+}
+
+TEST(PackingRects, PackAround)
+{
+  PackingRects::Rects occupied;
+  occupied.push_back(Rect(0, 0, 64, 32));
+  occupied.push_back(Rect(64, 32, 64, 32));
+
+  PackingRects pr;
+  pr.add(Size(64, 32));
+  pr.add(Size(64, 32));
+  EXPECT_TRUE(pr.packAround(Size(128, 64), occupied));
+  EXPECT_EQ(Rect(64, 0, 64, 32), pr[0]);
+  EXPECT_EQ(Rect(0, 32, 64, 32), pr[1]);
+
+  pr.add(Size(1, 1));
+  EXPECT_FALSE(pr.packAround(Size(128, 64), occupied));
+}
+
+// New frames are packed in the free space around the frames of a
+// previous packing.
+TEST(PackingRects, TrimmedFramesPackAround)
+{
+  std::vector<Size> sizes = trimmed_frame_sizes(10, 16, 10);
+
+  for (auto heuristic : heuristics) {
+    PackingRects old;
+    old.setHeuristic(heuristic);
+    for (const auto& sz : sizes)
+      old.add(sz);
+    Size size = old.bestFit();
+
+    // Each 4th frame is packed again (e.g. they changed)
+    PackingRects::Rects occupied;
+    std::vector<Size> newSizes;
+    PackingRects pr;
+    pr.setHeuristic(heuristic);
+    for (int i=0; i<int(sizes.size()); ++i) {
+      if ((i % 4) == 0) {
+        newSizes.push_back(sizes[i]);
+        pr.add(sizes[i]);
+      }
+      else
+        occupied.push_back(old[i]);
+    }
+
+    EXPECT_TRUE(pr.packAround(size, occupied)) << heuristic_name(heuristic);
+    expect_valid_packing(pr, newSizes);
+    for (const auto& rc : pr)
+      for (const auto& occ : occupied)
+        EXPECT_FALSE(rc.intersects(occ)) << rc << " " << occ;
+  }
+}
+
+// Prints the time to find the texture size, and the percentage of
+// used pixels in the power of two texture and in the cropped one
+// (setPowerOfTwo(false)) for each heuristic. Run it with
+// --gtest_also_run_disabled_tests.
+TEST(PackingRects, DISABLED_TrimmedFramesBenchmark)
+{
+  const int animations[] = { 10, 50, 200 };
+
+  for (int n : animations) {
+    std::vector<Size> sizes = trimmed_frame_sizes(n, 16, n);
+    int area = 0;
+    for (const auto& sz : sizes)
+      area += sz.w*sz.h;
+
+    for (auto heuristic : heuristics) {
+      for (int rotation=0; rotation<2; ++rotation) {
+        PackingRects pr;
+        pr.setHeuristic(heuristic);
+        pr.setAllowRotation(rotation == 1);
+        pr.setPowerOfTwo(false);
+        for (const auto& sz : sizes)
+          pr.add(sz);
+
+        auto t0 = std::chrono::steady_clock::now();
+        Size size = pr.bestFit();
+        auto t1 = std::chrono::steady_clock::now();
+        expect_valid_packing(pr, sizes);
+
+        // Power of two size that bestFit() found before cropping
+        Size pot(1, 1);
+        while (pot.w < size.w) pot.w *= 2;
+        while (pot.h < size.h) pot.h *= 2;
+
+        std::printf("%5d frames %-16s %-11s %5dx%-5d %5.1f%% %5dx%-5d %5.1f%% %9.2f ms\n",
+                    int(sizes.size()),
+                    heuristic_name(heuristic),
+                    (rotation ? "rotation": "no rotation"),
+                    pot.w, pot.h,
+                    100.0 * area / (pot.w*pot.h),
+                    size.w, size.h,
+                    100.0 * area / (size.w*size.h),
+                    std::chrono::duration<double, std::milli>(t1-t0).count());
+      }
+    }
+  }
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
@@ -32,6 +32,7 @@ namespace render {
 
     ColorHistogram()
       : m_histogram(RElements*GElements*BElements, 0)
+      , m_highPrecisionHash(kHashSize, 0)
       , m_useHighPrecision(true)
     {
     }
@@ -50,26 +51,32 @@ namespace render {
     {
       int i = histogramIndex(color);
 
-      if (m_histogram[i] < std::numeric_limits<std::size_t>::max()-count) // Avoid overflow
-        m_histogram[i] += count;
-      else
-        m_histogram[i] = std::numeric_limits<std::size_t>::max();
+      addCount(i, count);
 
       // Accurate colors are used only for less than 256 colors.  If the
       // image has more than 256 colors the m_histogram is used
       // instead.
-      if (m_useHighPrecision) {
-        std::vector<uint32_t>::iterator it =
-          std::find(m_highPrecision.begin(), m_highPrecision.end(), color);
+      if (m_useHighPrecision)
+        addHighPrecisionColor(color);
+    }
 
-        // The color is not in the high-precision table
-        if (it == m_highPrecision.end()) {
-          if (m_highPrecision.size() < 256) {
-            m_highPrecision.push_back(color);
-          }
-          else {
-            // In this case we reach the limit for the high-precision histogram.
-            m_useHighPrecision = false;
+    // Adds all samples of the other histogram, as if they were added
+    // after the samples of this one (so the colors of the
+    // high-precision table are kept in the same order).
+    void merge(const ColorHistogram& other)
+    {
+      for (int i=0; i<int(m_histogram.size()); ++i)
+        if (other.m_histogram[i] > 0)
+          addCount(i, other.m_histogram[i]);
+
+      if (m_useHighPrecision) {
+        if (!other.m_useHighPrecision)
+          m_useHighPrecision = false;
+        else {
+          for (uint32_t color : other.m_highPrecision) {
+            addHighPrecisionColor(color);
+            if (!m_useHighPrecision)
+              break;
           }
         }
       }
@@ -102,6 +109,40 @@ namespace render {
     }
 
   private:
+    // Size of the hash table to find colors in the high-precision
+    // table (a power of two, big enough for 256 colors).
+    enum { kHashSize = 1024 };
+
+    void addCount(std::size_t i, std::size_t count)
+    {
+      if (m_histogram[i] < std::numeric_limits<std::size_t>::max()-count) // Avoid overflow
+        m_histogram[i] += count;
+      else
+        m_histogram[i] = std::numeric_limits<std::size_t>::max();
+    }
+
+    void addHighPrecisionColor(uint32_t color)
+    {
+      // Linear probing in the hash table (each entry is an index in
+      // m_highPrecision plus one, or 0 if the entry is empty).
+      std::size_t h = ((color * 2654435761u) >> 22) & (kHashSize-1);
+      while (m_highPrecisionHash[h] != 0) {
+        if (m_highPrecision[m_highPrecisionHash[h]-1] == color)
+          return;
+        h = (h+1) & (kHashSize-1);
+      }
+
+      // The color is not in the high-precision table
+      if (m_highPrecision.size() < 256) {
+        m_highPrecision.push_back(color);
+        m_highPrecisionHash[h] = uint16_t(m_highPrecision.size());
+      }
+      else {
+        // In this case we reach the limit for the high-precision histogram.
+        m_useHighPrecision = false;
+      }
+    }
+
     // Converts input color in a index for the histogram. It reduces
     // each 8-bit component to the resolution given in the template
     // parameters.
@@ -124,6 +165,9 @@ namespace render {
     // source images contains less than 256 colors.
     std::vector<uint32_t> m_highPrecision;
 
+    // Hash table to find colors in m_highPrecision.
+    std::vector<uint16_t> m_highPrecisionHash;
+
     // True if we can use m_highPrecision still (it means that the
     // number of different samples is less than 256 colors still).
     bool m_useHighPrecision;
@@ -0,0 +1,98 @@
+// Aseprite Render Library
+// Copyright (c) 2001-2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "render/composite_cache.h"
+
+#include "doc/image.h"
+#include "doc/sprite.h"
+
+namespace render {
+
+using namespace doc;
+
+// Bigger zoomed sprites are not cached (64MB for RGB images)
+static const int kMaxCachePixels = 4096*4096;
+
+CompositeCache::CompositeCache()
+  : m_sprite(nullptr)
+  , m_layer(nullptr)
+  , m_frame(0)
+  , m_zoom(1, 1)
+  , m_pixelFormat(IMAGE_RGB)
+  , m_state(0)
+{
+}
+
+CompositeCache::~CompositeCache()
+{
+}
+
+void CompositeCache::invalidate()
+{
+  m_validRgn.clear();
+}
+
+void CompositeCache::invalidate(const gfx::Region& spriteRgn)
+{
+  if (m_validRgn.isEmpty())
+    return;
+
+  gfx::Region zoomedRgn;
+  for (gfx::Rect rc : spriteRgn) {
+    // Zoomed cel positions are rounded, so one sprite pixel can
+    // affect the nearest pixels of the zoomed area.
+    rc = m_zoom.apply(rc);
+    rc.enlarge(2);
+    zoomedRgn.createUnion(zoomedRgn, gfx::Region(rc));
+  }
+  m_validRgn.createSubtraction(m_validRgn, zoomedRgn);
+}
+
+bool CompositeCache::setup(const Sprite* sprite,
+                           const Layer* layer,
+                           frame_t frame,
+                           Zoom zoom,
+                           PixelFormat pixelFormat,
+                           uint32_t state)
+{
+  gfx::Rect bounds = zoom.apply(sprite->bounds());
+  if (bounds.isEmpty() || bounds.w*bounds.h > kMaxCachePixels) {
+    m_image.reset(nullptr);
+    m_validRgn.clear();
+    return false;
+  }
+
+  if (m_sprite != sprite ||
+      m_layer != layer ||
+      m_frame != frame ||
+      m_zoom != zoom ||
+      m_pixelFormat != pixelFormat ||
+      m_state != state) {
+    m_sprite = sprite;
+    m_layer = layer;
+    m_frame = frame;
+    m_zoom = zoom;
+    m_pixelFormat = pixelFormat;
+    m_state = state;
+    m_validRgn.clear();
+  }
+
+  if (!m_image ||
+      m_image->pixelFormat() != pixelFormat ||
+      m_image->width() != bounds.w ||
+      m_image->height() != bounds.h) {
+    m_image.reset(Image::create(pixelFormat, bounds.w, bounds.h));
+    m_validRgn.clear();
+  }
+
+  return true;
+}
+
+} // namespace render
@@ -0,0 +1,82 @@
+// Aseprite Render Library
+// Copyright (c) 2001-2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef RENDER_COMPOSITE_CACHE_H_INCLUDED
+#define RENDER_COMPOSITE_CACHE_H_INCLUDED
+#pragma once
+
+#include "base/disable_copying.h"
+#include "base/unique_ptr.h"
+#include "doc/frame.h"
+#include "doc/image_buffer.h"
+#include "doc/pixel_format.h"
+#include "gfx/region.h"
+#include "render/zoom.h"
+
+#include <stdint.h>
+
+namespace doc {
+  class Image;
+  class Layer;
+  class Sprite;
+}
+
+namespace render {
+  class Render;
+
+  // Composite of the background and all layers below a specific
+  // layer (e.g. the layer that the user is editing) for one frame
+  // and zoom level. It's used by Render::renderSprite() to blend
+  // only the given layer and the ones above it, reusing the cached
+  // pixels for the rest.
+  //
+  // The owner of the cache must invalidate the modified areas of the
+  // sprite (e.g. from doc::DocumentObserver notifications). Changes
+  // in the frame, zoom, layers/cels properties, palette, or
+  // background are detected by the Render itself.
+  class CompositeCache {
+  public:
+    CompositeCache();
+    ~CompositeCache();
+
+    // Invalidates the whole cache.
+    void invalidate();
+
+    // Invalidates the given region (in sprite coordinates).
+    void invalidate(const gfx::Region& spriteRgn);
+
+    // Returns true if there is no valid pixel in the cache.
+    bool isEmpty() const { return m_validRgn.isEmpty(); }
+
+  private:
+    friend class Render;
+
+    // Resets the cache if the given key doesn't match the current
+    // one. Returns false if the cache cannot be used for this key
+    // (e.g. the zoomed sprite is too big).
+    bool setup(const doc::Sprite* sprite,
+               const doc::Layer* layer,
+               doc::frame_t frame,
+               Zoom zoom,
+               doc::PixelFormat pixelFormat,
+               uint32_t state);
+
+    const doc::Sprite* m_sprite;
+    const doc::Layer* m_layer;
+    doc::frame_t m_frame;
+    Zoom m_zoom;
+    doc::PixelFormat m_pixelFormat;
+    uint32_t m_state;            // Hash of layers/cels/bg properties
+    gfx::Region m_validRgn;      // Valid area (in zoomed coordinates)
+    base::UniquePtr<doc::Image> m_image;
+    doc::ImageBufferPtr m_tmpBuffer;
+
+    DISABLE_COPYING(CompositeCache);
+  };
+
+} // namespace render
+
+#endif
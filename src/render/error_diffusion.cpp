@@ -0,0 +1,176 @@
+// Aseprite Render Library
+// Copyright (c) 2001-2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "render/error_diffusion.h"
+
+#include "base/base.h"
+#include "doc/color.h"
+#include "doc/image_impl.h"
+#include "doc/palette.h"
+#include "doc/rgbmap.h"
+
+#include <algorithm>
+
+namespace render {
+
+using namespace doc;
+
+namespace {
+
+// Maximum horizontal distance between a pixel and the neighbors that
+// receive its error (the error rows have this padding on each side).
+const int kBorder = 2;
+
+struct Weight {
+  int dx, dy;           // Position relative to the converted pixel (for left-to-right rows)
+  int weight;
+};
+
+} // anonymous namespace
+
+struct ErrorDiffusionDither::Kernel {
+  int shift;            // Sum of all weights (as a power of two)
+  int rows;             // Rows affected by the error (the current one included)
+  int nweights;
+  Weight weights[10];
+};
+
+namespace {
+
+//     * 7
+//   3 5 1   (1/16)
+const ErrorDiffusionDither::Kernel kFloydSteinberg = {
+  4, 2, 4, {
+    { 1, 0, 7 },
+    { -1, 1, 3 }, { 0, 1, 5 }, { 1, 1, 1 } } };
+
+//     * 1 1
+//   1 1 1
+//     1     (1/8, only 3/4 of the error is distributed)
+const ErrorDiffusionDither::Kernel kAtkinson = {
+  3, 3, 6, {
+    { 1, 0, 1 }, { 2, 0, 1 },
+    { -1, 1, 1 }, { 0, 1, 1 }, { 1, 1, 1 },
+    { 0, 2, 1 } } };
+
+//       * 5 3
+//   2 4 5 4 2
+//     2 3 2     (1/32)
+const ErrorDiffusionDither::Kernel kSierra = {
+  5, 3, 10, {
+    { 1, 0, 5 }, { 2, 0, 3 },
+    { -2, 1, 2 }, { -1, 1, 4 }, { 0, 1, 5 }, { 1, 1, 4 }, { 2, 1, 2 },
+    { -1, 2, 2 }, { 0, 2, 3 }, { 1, 2, 2 } } };
+
+} // anonymous namespace
+
+// static
+bool ErrorDiffusionDither::isErrorDiffusion(DitheringMethod method)
+{
+  switch (method) {
+    case DitheringMethod::FLOYD_STEINBERG:
+    case DitheringMethod::ATKINSON:
+    case DitheringMethod::SIERRA:
+      return true;
+    default:
+      return false;
+  }
+}
+
+ErrorDiffusionDither::ErrorDiffusionDither(DitheringMethod method,
+                                           int transparentIndex)
+  : m_transparentIndex(transparentIndex)
+{
+  switch (method) {
+    case DitheringMethod::ATKINSON: m_kernel = &kAtkinson; break;
+    case DitheringMethod::SIERRA: m_kernel = &kSierra; break;
+    default:
+      ASSERT(method == DitheringMethod::FLOYD_STEINBERG);
+      m_kernel = &kFloydSteinberg;
+      break;
+  }
+}
+
+void ErrorDiffusionDither::ditherRgbImageToIndexed(const Image* srcImage,
+                                                   Image* dstImage,
+                                                   const RgbMap* rgbmap,
+                                                   const Palette* palette)
+{
+  ASSERT(srcImage->pixelFormat() == IMAGE_RGB);
+  ASSERT(dstImage->pixelFormat() == IMAGE_INDEXED);
+
+  const Kernel& kernel = *m_kernel;
+  const int w = srcImage->width();
+  const int h = srcImage->height();
+  const int rows = kernel.rows;
+  const int stride = 3*(w + 2*kBorder);
+  const int round = (1 << kernel.shift) / 2;
+
+  m_errors.assign(stride*rows, 0);
+
+  for (int y=0; y<h; ++y) {
+    // Errors of this row and the next ones, rowErrors[i][3*x] is the
+    // red component of the error for pixel (x, y+i).
+    int* rowErrors[3];
+    for (int i=0; i<rows; ++i)
+      rowErrors[i] = &m_errors[stride*((y+i) % rows) + 3*kBorder];
+
+    const RgbTraits::pixel_t* srcRow =
+      (const RgbTraits::pixel_t*)srcImage->getPixelAddress(0, y);
+    IndexedTraits::pixel_t* dstRow =
+      (IndexedTraits::pixel_t*)dstImage->getPixelAddress(0, y);
+
+    const int dir = ((y & 1) ? -1: 1);
+    int x = ((y & 1) ? w-1: 0);
+
+    for (int n=0; n<w; ++n, x+=dir) {
+      color_t c = srcRow[x];
+
+      // Alpha=0, output transparent color (its error is discarded)
+      if (!rgba_geta(c)) {
+        dstRow[x] = m_transparentIndex;
+        continue;
+      }
+
+      const int* e = rowErrors[0] + 3*x;
+      int r = rgba_getr(c) + ((e[0] + round) >> kernel.shift);
+      int g = rgba_getg(c) + ((e[1] + round) >> kernel.shift);
+      int b = rgba_getb(c) + ((e[2] + round) >> kernel.shift);
+      r = MID(0, r, 255);
+      g = MID(0, g, 255);
+      b = MID(0, b, 255);
+
+      int i = (rgbmap ? rgbmap->mapColor(r, g, b):
+                        palette->findBestfit(r, g, b, m_transparentIndex));
+      dstRow[x] = i;
+
+      color_t p = palette->getEntry(i);
+      int er = r - rgba_getr(p);
+      int eg = g - rgba_getg(p);
+      int eb = b - rgba_getb(p);
+      if (!er && !eg && !eb)
+        continue;
+
+      // Distribute the error (the kernel is mirrored in right-to-left rows)
+      for (int k=0; k<kernel.nweights; ++k) {
+        const Weight& wt = kernel.weights[k];
+        int* t = rowErrors[wt.dy] + 3*(x + dir*wt.dx);
+        t[0] += er * wt.weight;
+        t[1] += eg * wt.weight;
+        t[2] += eb * wt.weight;
+      }
+    }
+
+    // Now the errors of this row are reused for row y+rows.
+    std::fill(rowErrors[0] - 3*kBorder, rowErrors[0] - 3*kBorder + stride, 0);
+  }
+}
+
+} // namespace render
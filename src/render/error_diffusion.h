@@ -0,0 +1,55 @@
+// Aseprite Render Library
+// Copyright (c) 2001-2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef RENDER_ERROR_DIFFUSION_H_INCLUDED
+#define RENDER_ERROR_DIFFUSION_H_INCLUDED
+#pragma once
+
+#include "doc/dithering_method.h"
+
+#include <vector>
+
+namespace doc {
+  class Image;
+  class Palette;
+  class RgbMap;
+}
+
+namespace render {
+
+  // Converts RGB images to indexed distributing the error of each
+  // converted pixel between its neighbors that weren't converted yet
+  // (Floyd-Steinberg, Atkinson, or Sierra matrices). Rows are
+  // converted in serpentine order (even rows from left to right, odd
+  // rows from right to left), and only the errors of the next rows
+  // are kept in memory.
+  class ErrorDiffusionDither {
+  public:
+    struct Kernel;
+
+    // Returns true if the given method is supported by this class.
+    static bool isErrorDiffusion(doc::DitheringMethod method);
+
+    ErrorDiffusionDither(doc::DitheringMethod method,
+                         int transparentIndex = -1);
+
+    void ditherRgbImageToIndexed(const doc::Image* srcImage,
+                                 doc::Image* dstImage,
+                                 const doc::RgbMap* rgbmap,
+                                 const doc::Palette* palette);
+
+  private:
+    const Kernel* m_kernel;
+    int m_transparentIndex;
+
+    // Accumulated errors (RGB components) of the current row and the
+    // next ones, used as a circular buffer of rows.
+    std::vector<int> m_errors;
+  };
+
+} // namespace render
+
+#endif
@@ -0,0 +1,238 @@
+// Aseprite Render Library
+// Copyright (c) 2001-2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/unique_ptr.h"
+#include "doc/image.h"
+#include "doc/palette.h"
+#include "doc/primitives.h"
+#include "doc/rgbmap.h"
+#include "render/error_diffusion.h"
+#include "render/ordered_dither.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace base;
+using namespace doc;
+using namespace render;
+
+static const DitheringMethod methods[] = {
+  DitheringMethod::FLOYD_STEINBERG,
+  DitheringMethod::ATKINSON,
+  DitheringMethod::SIERRA
+};
+
+static const char* method_name(DitheringMethod method)
+{
+  switch (method) {
+    case DitheringMethod::FLOYD_STEINBERG: return "Floyd-Steinberg";
+    case DitheringMethod::ATKINSON: return "Atkinson";
+    case DitheringMethod::SIERRA: return "Sierra";
+    default: return "";
+  }
+}
+
+static Image* create_gradient_image(int w, int h)
+{
+  Image* image = Image::create(IMAGE_RGB, w, h);
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x)
+      put_pixel(image, x, y, rgba(255*x/w, 255*y/h, (x*y) % 256, 255));
+  return image;
+}
+
+static Palette* create_palette(int ncolors)
+{
+  Palette* palette = new Palette(frame_t(0), ncolors);
+  for (int i=0; i<ncolors; ++i)
+    palette->setEntry(i, rgba(std::rand() % 256, std::rand() % 256, std::rand() % 256, 255));
+  return palette;
+}
+
+// Straightforward version of the error diffusion (matrices centered
+// at column 2, and the errors of the whole image in memory) to
+// compare with ErrorDiffusionDither.
+static void reference_dither(DitheringMethod method,
+                             const Image* src, Image* dst,
+                             const Palette* palette)
+{
+  static const int fs[3][5] = { { 0, 0, 0, 7, 0 },
+                                { 0, 3, 5, 1, 0 },
+                                { 0, 0, 0, 0, 0 } };
+  static const int atkinson[3][5] = { { 0, 0, 0, 1, 1 },
+                                      { 0, 1, 1, 1, 0 },
+                                      { 0, 0, 1, 0, 0 } };
+  static const int sierra[3][5] = { { 0, 0, 0, 5, 3 },
+                                    { 2, 4, 5, 4, 2 },
+                                    { 0, 2, 3, 2, 0 } };
+  const int (*matrix)[5] = (method == DitheringMethod::ATKINSON ? atkinson:
+                            method == DitheringMethod::SIERRA ? sierra: fs);
+  const int divisor = (method == DitheringMethod::ATKINSON ? 8:
+                       method == DitheringMethod::SIERRA ? 32: 16);
+
+  const int w = src->width();
+  const int h = src->height();
+  std::vector<int> errors(3*(w+4)*(h+2), 0);
+  auto error = [&](int x, int y, int c) -> int& {
+    return errors[3*((x+2) + (w+4)*y) + c];
+  };
+
+  for (int y=0; y<h; ++y) {
+    const bool rtl = (y & 1 ? true: false);
+    for (int n=0; n<w; ++n) {
+      const int x = (rtl ? w-1-n: n);
+      color_t c = get_pixel(src, x, y);
+      if (rgba_geta(c) == 0) {
+        put_pixel(dst, x, y, 0);
+        continue;
+      }
+
+      int v[3] = { int(rgba_getr(c)), int(rgba_getg(c)), int(rgba_getb(c)) };
+      for (int i=0; i<3; ++i) {
+        // Rounded division (halves are rounded up)
+        int e = error(x, y, i) + divisor/2;
+        e = (e >= 0 ? e/divisor: -((-e + divisor - 1)/divisor));
+        v[i] = MID(0, v[i] + e, 255);
+      }
+
+      int index = palette->findBestfit(v[0], v[1], v[2], 0);
+      put_pixel(dst, x, y, index);
+
+      color_t p = palette->getEntry(index);
+      int e[3] = { v[0] - int(rgba_getr(p)),
+                   v[1] - int(rgba_getg(p)),
+                   v[2] - int(rgba_getb(p)) };
+      for (int j=0; j<3; ++j)
+        for (int i=0; i<5; ++i) {
+          int weight = matrix[j][rtl ? 4-i: i];
+          if (weight)
+            for (int k=0; k<3; ++k)
+              error(x+i-2, y+j, k) += e[k] * weight;
+        }
+    }
+  }
+}
+
+TEST(ErrorDiffusionDither, SameAsReference)
+{
+  std::srand(1);
+  UniquePtr<Image> src(create_gradient_image(37, 23));
+  put_pixel(src, 5, 5, rgba(0, 0, 0, 0));
+  put_pixel(src, 36, 22, rgba(0, 0, 0, 0));
+
+  UniquePtr<Palette> palette(create_palette(16));
+  UniquePtr<Image> dst(Image::create(IMAGE_INDEXED, 37, 23));
+  UniquePtr<Image> expected(Image::create(IMAGE_INDEXED, 37, 23));
+
+  for (auto method : methods) {
+    ErrorDiffusionDither dither(method, 0);
+    dither.ditherRgbImageToIndexed(src, dst, nullptr, palette);
+    reference_dither(method, src, expected, palette);
+    EXPECT_EQ(0, count_diff_between_images(dst, expected)) << method_name(method);
+  }
+}
+
+TEST(ErrorDiffusionDither, PaletteColors)
+{
+  Palette palette(frame_t(0), 4);
+  palette.setEntry(0, rgba(0, 0, 0, 255));
+  palette.setEntry(1, rgba(255, 0, 0, 255));
+  palette.setEntry(2, rgba(0, 255, 0, 255));
+  palette.setEntry(3, rgba(0, 0, 255, 255));
+
+  UniquePtr<Image> src(Image::create(IMAGE_RGB, 8, 8));
+  UniquePtr<Image> dst(Image::create(IMAGE_INDEXED, 8, 8));
+  for (int y=0; y<8; ++y)
+    for (int x=0; x<8; ++x)
+      put_pixel(src, x, y, palette.getEntry((x+y) % 4));
+
+  for (auto method : methods) {
+    ErrorDiffusionDither dither(method);
+    dither.ditherRgbImageToIndexed(src, dst, nullptr, &palette);
+    for (int y=0; y<8; ++y)
+      for (int x=0; x<8; ++x)
+        EXPECT_EQ((x+y) % 4, get_pixel(dst, x, y));
+  }
+}
+
+// A flat gray must be converted to the same amount of black and
+// white pixels.
+TEST(ErrorDiffusionDither, Gray)
+{
+  Palette palette(frame_t(0), 3);
+  palette.setEntry(0, rgba(0, 0, 0, 0));
+  palette.setEntry(1, rgba(0, 0, 0, 255));
+  palette.setEntry(2, rgba(255, 255, 255, 255));
+  RgbMap rgbmap;
+  rgbmap.regenerate(&palette, 0);
+
+  const int w = 64, h = 64;
+  UniquePtr<Image> src(Image::create(IMAGE_RGB, w, h));
+  UniquePtr<Image> dst(Image::create(IMAGE_INDEXED, w, h));
+  clear_image(src, rgba(128, 128, 128, 255));
+
+  for (auto method : methods) {
+    ErrorDiffusionDither dither(method, 0);
+    dither.ditherRgbImageToIndexed(src, dst, &rgbmap, &palette);
+
+    int white = 0;
+    for (int y=0; y<h; ++y)
+      for (int x=0; x<w; ++x) {
+        int i = get_pixel(dst, x, y);
+        EXPECT_TRUE(i == 1 || i == 2);
+        if (i == 2)
+          ++white;
+      }
+
+    EXPECT_NEAR(w*h/2, white, w*h/20) << method_name(method);
+  }
+}
+
+// Prints the throughput of each method compared with the ordered
+// dithering. Run it with --gtest_also_run_disabled_tests.
+TEST(ErrorDiffusionDither, DISABLED_Benchmark)
+{
+  const int w = 1920, h = 1080;
+  std::srand(1);
+  UniquePtr<Image> src(create_gradient_image(w, h));
+  UniquePtr<Image> dst(Image::create(IMAGE_INDEXED, w, h));
+  UniquePtr<Palette> palette(create_palette(256));
+  RgbMap rgbmap;
+  rgbmap.regenerate(palette, -1);
+
+  for (int m=-1; m<3; ++m) {
+    auto t0 = std::chrono::steady_clock::now();
+    if (m < 0) {
+      BayerMatrix<8> matrix;
+      OrderedDither dither;
+      dither.ditherRgbImageToIndexed(matrix, src, dst, 0, 0, &rgbmap, palette);
+    }
+    else {
+      ErrorDiffusionDither dither(methods[m]);
+      dither.ditherRgbImageToIndexed(src, dst, &rgbmap, palette);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+
+    double ms = std::chrono::duration<double, std::milli>(t1-t0).count();
+    std::printf("%-16s %dx%d %9.2f ms %8.1f Mpixels/s\n",
+                (m < 0 ? "Ordered": method_name(methods[m])),
+                w, h, ms, w*h / ms / 1000.0);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -12,18 +12,87 @@
 
 #include <list>
 #include <queue>
+#include <vector>
 
 namespace render {
 
+  // Summed-volume table of a histogram: each entry (i, j, k)
+  // contains the number of points in the box from (0, 0, 0) to
+  // (i-1, j-1, k-1). So the points inside any box of the histogram
+  // can be calculated with 8 lookups instead of scanning the box.
+  template<class Histogram>
+  class HistogramSums {
+  public:
+    explicit HistogramSums(const Histogram& histogram)
+      : m_sums(RSize*GSize*BSize, 0)
+    {
+      for (int k=1; k<BSize; ++k)
+        for (int j=1; j<GSize; ++j)
+          for (int i=1; i<RSize; ++i)
+            m_sums[index(i, j, k)] = histogram.at(i-1, j-1, k-1);
+
+      // Accumulate the points along each axis (unsigned arithmetic
+      // wraps around, so the results are correct even if some partial
+      // sum overflows).
+      for (int k=1; k<BSize; ++k)
+        for (int j=1; j<GSize; ++j)
+          for (int i=1; i<RSize; ++i)
+            m_sums[index(i, j, k)] += m_sums[index(i-1, j, k)];
+
+      for (int k=1; k<BSize; ++k)
+        for (int j=1; j<GSize; ++j)
+          for (int i=1; i<RSize; ++i)
+            m_sums[index(i, j, k)] += m_sums[index(i, j-1, k)];
+
+      for (int k=1; k<BSize; ++k)
+        for (int j=1; j<GSize; ++j)
+          for (int i=1; i<RSize; ++i)
+            m_sums[index(i, j, k)] += m_sums[index(i, j, k-1)];
+    }
+
+    // Returns the number of points inside the given box (bounds
+    // included).
+    std::size_t points(int r1, int g1, int b1,
+                       int r2, int g2, int b2) const
+    {
+      ++r2; ++g2; ++b2;
+      return
+        + m_sums[index(r2, g2, b2)]
+        - m_sums[index(r1, g2, b2)]
+        - m_sums[index(r2, g1, b2)]
+        - m_sums[index(r2, g2, b1)]
+        + m_sums[index(r1, g1, b2)]
+        + m_sums[index(r1, g2, b1)]
+        + m_sums[index(r2, g1, b1)]
+        - m_sums[index(r1, g1, b1)];
+    }
+
+  private:
+    // The table has an extra plane of zeros at the beginning of each axis.
+    enum {
+      RSize = Histogram::RElements+1,
+      GSize = Histogram::GElements+1,
+      BSize = Histogram::BElements+1
+    };
+
+    static int index(int i, int j, int k) {
+      return i + RSize*(j + GSize*k);
+    }
+
+    std::vector<std::size_t> m_sums;
+  };
+
   template<class Histogram>
   class Box {
+    typedef HistogramSums<Histogram> Sums;
 
     // These classes are used as parameters for some Box's generic
     // member functions, so we can access to a different axis using
     // the same generic function (i=Red channel in RAxisGetter, etc.).
-    struct RAxisGetter { static std::size_t at(const Histogram& h, int i, int j, int k) { return h.at(i, j, k); } };
-    struct GAxisGetter { static std::size_t at(const Histogram& h, int i, int j, int k) { return h.at(j, i, k); } };
-    struct BAxisGetter { static std::size_t at(const Histogram& h, int i, int j, int k) { return h.at(j, k, i); } };
+    // They return the number of points in the box [i1,i2] x [j1,j2] x [k1,k2].
+    struct RAxisGetter { static std::size_t points(const Sums& s, int i1, int i2, int j1, int j2, int k1, int k2) { return s.points(i1, j1, k1, i2, j2, k2); } };
+    struct GAxisGetter { static std::size_t points(const Sums& s, int i1, int i2, int j1, int j2, int k1, int k2) { return s.points(j1, i1, k1, j2, i2, k2); } };
+    struct BAxisGetter { static std::size_t points(const Sums& s, int i1, int i2, int j1, int j2, int k1, int k2) { return s.points(j1, k1, i1, j2, k2, i2); } };
 
     // These classes are used as template parameter to split a Box
     // along an axis (see splitAlongAxis)
@@ -50,31 +119,31 @@ namespace render {
 
     // Shrinks each plane of the box to a position where there are
     // points in the histogram.
-    void shrink(const Histogram& histogram)
+    void shrink(const Sums& sums)
     {
-      axisShrink<RAxisGetter>(histogram, r1, r2, g1, g2, b1, b2);
-      axisShrink<GAxisGetter>(histogram, g1, g2, r1, r2, b1, b2);
-      axisShrink<BAxisGetter>(histogram, b1, b2, r1, r2, g1, g2);
+      axisShrink<RAxisGetter>(sums, r1, r2, g1, g2, b1, b2);
+      axisShrink<GAxisGetter>(sums, g1, g2, r1, r2, b1, b2);
+      axisShrink<BAxisGetter>(sums, b1, b2, r1, r2, g1, g2);
 
       // Calculate number of points inside the box (this is done by
       // first time here, because the Box ctor didn't calculate it).
-      points = countPoints(histogram);
+      points = sums.points(r1, g1, b1, r2, g2, b2);
 
       // Recalculate the volume (used in operator<).
       volume = calculateVolume();
     }
 
-    bool split(const Histogram& histogram, std::priority_queue<Box>& boxes) const
+    bool split(const Sums& sums, std::priority_queue<Box>& boxes) const
     {
       // Split along the largest dimension of the box.
       if ((r2-r1) >= (g2-g1) && (r2-r1) >= (b2-b1)) {
-        return splitAlongAxis<RAxisGetter, RAxisSplitter>(histogram, boxes, r1, r2, g1, g2, b1, b2);
+        return splitAlongAxis<RAxisGetter, RAxisSplitter>(sums, boxes, r1, r2, g1, g2, b1, b2);
       }
       else if ((g2-g1) >= (r2-r1) && (g2-g1) >= (b2-b1)) {
-        return splitAlongAxis<GAxisGetter, GAxisSplitter>(histogram, boxes, g1, g2, r1, r2, b1, b2);
+        return splitAlongAxis<GAxisGetter, GAxisSplitter>(sums, boxes, g1, g2, r1, r2, b1, b2);
       }
       else {
-        return splitAlongAxis<BAxisGetter, BAxisSplitter>(histogram, boxes, b1, b2, r1, r2, g1, g2);
+        return splitAlongAxis<BAxisGetter, BAxisSplitter>(sums, boxes, b1, b2, r1, r2, g1, g2);
       }
     }
 
@@ -124,53 +193,26 @@ namespace render {
       return (r2-r1+1) * (g2-g1+1) * (b2-b1+1);
     }
 
-    // Returns the number of histogram's points inside the box bounds.
-    std::size_t countPoints(const Histogram& histogram) const
-    {
-      std::size_t count = 0;
-      int i, j, k;
-
-      for (i=r1; i<=r2; ++i)
-        for (j=g1; j<=g2; ++j)
-          for (k=b1; k<=b2; ++k)
-            count += histogram.at(i, j, k);
-
-      return count;
-    }
-
     // Reduces the specified side of the box (i1/i2) along the
     // specified axis (if AxisGetter is RAxisGetter, then i1=r1,
     // i2=r2; if AxisGetter is GAxisGetter, then i1=g1, i2=g2).
     template<class AxisGetter>
-    static void axisShrink(const Histogram& histogram,
+    static void axisShrink(const Sums& sums,
                            int& i1, int& i2,
                            const int& j1, const int& j2,
                            const int& k1, const int& k2)
     {
-      int j, k;
-
       // Shrink i1.
       for (; i1<i2; ++i1) {
-        for (j=j1; j<=j2; ++j) {
-          for (k=k1; k<=k2; ++k) {
-            if (AxisGetter::at(histogram, i1, j, k) > 0)
-              goto doneA;
-          }
-        }
+        if (AxisGetter::points(sums, i1, i1, j1, j2, k1, k2) > 0)
+          break;
       }
 
-    doneA:;
-
+      // Shrink i2.
       for (; i2>i1; --i2) {
-        for (j=j1; j<=j2; ++j) {
-          for (k=k1; k<=k2; ++k) {
-            if (AxisGetter::at(histogram, i2, j, k) > 0)
-              goto doneB;
-          }
-        }
+        if (AxisGetter::points(sums, i2, i2, j1, j2, k1, k2) > 0)
+          break;
       }
-
-    doneB:;
     }
 
     // Splits the box in two sub-boxes (if it's possible) along the
@@ -179,7 +221,7 @@ namespace render {
     // queue contains the new two sub-boxes resulting from the split
     // operation.
     template<class AxisGetter, class AxisSplitter>
-    bool splitAlongAxis(const Histogram& histogram,
+    bool splitAlongAxis(const Sums& sums,
                         std::priority_queue<Box>& boxes,
                         const int& i1, const int& i2,
                         const int& j1, const int& j2,
@@ -189,7 +231,7 @@ namespace render {
       // in each side of the box if we split it in "i" position.
       std::size_t totalPoints1 = 0;
       std::size_t totalPoints2 = this->points;
-      int i, j, k;
+      int i;
 
       // We will try to split the box along the "i" axis. Imagine a
       // plane which its normal vector is "i" axis, so we will try to
@@ -197,12 +239,8 @@ namespace render {
       // the number of points in both sides of the plane are
       // approximated the same.
       for (i=i1; i<=i2; ++i) {
-        std::size_t planePoints = 0;
-
         // We count all points in "i" plane.
-        for (j=j1; j<=j2; ++j)
-          for (k=k1; k<=k2; ++k)
-            planePoints += AxisGetter::at(histogram, i, j, k);
+        std::size_t planePoints = AxisGetter::points(sums, i, i, j1, j2, k1, k2);
 
         // As we move the plane to split through "i" axis One side is getting more points,
         totalPoints1 += planePoints;
@@ -246,6 +284,10 @@ namespace render {
   template<class Histogram>
   void median_cut(const Histogram& histogram, std::size_t maxBoxes, std::vector<uint32_t>& result)
   {
+    // The histogram is summed only once, so boxes don't need to be
+    // scanned each time they are shrunk or split.
+    const HistogramSums<Histogram> sums(histogram);
+
     // We need a priority queue to split bigger boxes first (see Box::operator<).
     std::priority_queue<Box<Histogram> > boxes;
 
@@ -264,10 +306,10 @@ namespace render {
 
       // Shrink the box to the minimum, to enclose the same points in
       // the histogram.
-      box.shrink(histogram);
+      box.shrink(sums);
 
       // Try to split the box along the largest axis.
-      if (!box.split(histogram, boxes)) {
+      if (!box.split(sums, boxes)) {
         // If we were not able to split the box (maybe because it is
         // too small or there are not enough points to split it), then
         // we add the box's color to the "result" vector directly (the
@@ -13,6 +13,8 @@
 #include "doc/palette.h"
 #include "doc/rgbmap.h"
 
+#include <vector>
+
 namespace render {
 
   // Creates a Bayer dither matrix.
@@ -68,6 +70,36 @@ namespace render {
                  (b1-b2) * (b1-b2) *  7); //  722
     }
 
+    // Ways to get the nearest palette entry of a RGB color.
+    struct RgbMapLookup {
+      const doc::RgbMap* rgbmap;
+      int operator()(int r, int g, int b) const {
+        return rgbmap->mapColor(r, g, b);
+      }
+    };
+    struct PaletteLookup {
+      const doc::Palette* palette;
+      int mask_index;
+      int operator()(int r, int g, int b) const {
+        return palette->findBestfit(r, g, b, mask_index);
+      }
+    };
+
+    // The two palette entries that can be used to dither a color,
+    // and the position of the color between them in the matrix range
+    // (nearest2 is used when "mix" is greater than the threshold).
+    struct Candidates {
+      doc::color_t color;
+      int nearest1;
+      int nearest2;
+      int mix;
+    };
+
+    // Colors of the image that were already converted (direct-mapped
+    // cache of 2^kCacheBits entries).
+    enum { kCacheBits = 12,
+           kCacheProbeRows = 16 };
+
   public:
     OrderedDither(int transparentIndex = -1) : m_transparentIndex(transparentIndex) {
     }
@@ -83,14 +115,112 @@ namespace render {
       if (!doc::rgba_geta(color))
         return m_transparentIndex;
 
+      Candidates c;
+      if (rgbmap)
+        c = findCandidates(matrix.maxValue(), color, RgbMapLookup{ rgbmap }, palette);
+      else
+        c = findCandidates(matrix.maxValue(), color, PaletteLookup{ palette, m_transparentIndex }, palette);
+
+      return (c.mix > matrix(x, y) ? c.nearest2: c.nearest1);
+    }
+
+    template<typename Matrix>
+    void ditherRgbImageToIndexed(const Matrix& matrix,
+                                 const doc::Image* srcImage,
+                                 doc::Image* dstImage,
+                                 int u, int v,
+                                 const doc::RgbMap* rgbmap,
+                                 const doc::Palette* palette) {
+      if (rgbmap)
+        ditherImage(matrix, srcImage, dstImage, u, v,
+                    RgbMapLookup{ rgbmap }, palette);
+      else
+        ditherImage(matrix, srcImage, dstImage, u, v,
+                    PaletteLookup{ palette, m_transparentIndex }, palette);
+    }
+
+  private:
+    template<typename Matrix, typename Lookup>
+    void ditherImage(const Matrix& matrix,
+                     const doc::Image* srcImage,
+                     doc::Image* dstImage,
+                     int u, int v,
+                     const Lookup& lookup,
+                     const doc::Palette* palette) {
+      const int w = srcImage->width();
+      const int h = srcImage->height();
+
+      // Images usually contain few colors (or long runs of the same
+      // color), so the candidates of each color are calculated only
+      // once. Colors with alpha=0 are never looked up, so the cache
+      // starts with all entries invalid.
+      std::vector<Candidates> cache(1 << kCacheBits);
+      for (Candidates& c : cache)
+        c.color = 0;
+
+      // If most colors of a row weren't in the cache (e.g. gradients
+      // or photos), the next rows are converted without it, and it's
+      // tried again each kCacheProbeRows rows.
+      bool useCache = true;
+
+      for (int y=0; y<h; ++y) {
+        const doc::RgbTraits::pixel_t* srcRow =
+          (const doc::RgbTraits::pixel_t*)srcImage->getPixelAddress(0, y);
+        doc::IndexedTraits::pixel_t* dstRow =
+          (doc::IndexedTraits::pixel_t*)dstImage->getPixelAddress(0, y);
+
+        if (!useCache && (y % kCacheProbeRows) != 0) {
+          for (int x=0; x<w; ++x) {
+            doc::color_t color = srcRow[x];
+            if (!doc::rgba_geta(color)) {
+              dstRow[x] = m_transparentIndex;
+              continue;
+            }
+
+            Candidates c = findCandidates(matrix.maxValue(), color, lookup, palette);
+            dstRow[x] = (c.mix > matrix(x+u, y+v) ? c.nearest2: c.nearest1);
+          }
+          continue;
+        }
+
+        int misses = 0;
+        for (int x=0; x<w; ++x) {
+          doc::color_t color = srcRow[x];
+
+          // Alpha=0, output transparent color
+          if (!doc::rgba_geta(color)) {
+            dstRow[x] = m_transparentIndex;
+            continue;
+          }
+
+          Candidates& c = cache[(color * 2654435761u) >> (32-kCacheBits)];
+          if (c.color != color) {
+            c = findCandidates(matrix.maxValue(), color, lookup, palette);
+            ++misses;
+          }
+
+          // One compare with the matrix threshold per pixel
+          dstRow[x] = (c.mix > matrix(x+u, y+v) ? c.nearest2: c.nearest1);
+        }
+        useCache = (misses < w/2);
+      }
+    }
+
+    // Returns the candidates to dither the given color (which must
+    // not be transparent).
+    template<typename Lookup>
+    static Candidates findCandidates(int maxValue,
+                                     doc::color_t color,
+                                     const Lookup& lookup,
+                                     const doc::Palette* palette) {
+      ASSERT(doc::rgba_geta(color) != 0);
+
       // Get the nearest color in the palette with the given RGB
       // values.
       int r = doc::rgba_getr(color);
       int g = doc::rgba_getg(color);
       int b = doc::rgba_getb(color);
-      doc::color_t nearest1idx =
-        (rgbmap ? rgbmap->mapColor(r, g, b):
-                  palette->findBestfit(r, g, b, m_transparentIndex));
+      int nearest1idx = lookup(r, g, b);
 
       doc::color_t nearest1rgb = palette->getEntry(nearest1idx);
       int r1 = doc::rgba_getr(nearest1rgb);
@@ -107,14 +237,12 @@ namespace render {
       r2 = MID(0, r2, 255);
       g2 = MID(0, g2, 255);
       b2 = MID(0, b2, 255);
-      doc::color_t nearest2idx =
-        (rgbmap ? rgbmap->mapColor(r2, g2, b2):
-                  palette->findBestfit(r2, g2, b2, m_transparentIndex));
+      int nearest2idx = lookup(r2, g2, b2);
 
       // If both possible RGB colors use the same index, we cannot
       // make any dither with these two colors.
       if (nearest1idx == nearest2idx)
-        return nearest1idx;
+        return Candidates{ color, nearest1idx, nearest1idx, 0 };
 
       doc::color_t nearest2rgb = palette->getEntry(nearest2idx);
       r2 = doc::rgba_getr(nearest2rgb);
@@ -127,42 +255,14 @@ namespace render {
       int d = colorDistance(r1, g1, b1, r, g, b);
       int D = colorDistance(r1, g1, b1, r2, g2, b2);
       if (D == 0)
-        return nearest1idx;
+        return Candidates{ color, nearest1idx, nearest1idx, 0 };
 
       // We convert the d/D factor to the matrix range to compare it
       // with the threshold. If d > threshold, it means that we're
       // closer to 'nearest2rgb' than to 'nearest1rgb'.
-      d = matrix.maxValue() * d / D;
-      int threshold = matrix(x, y);
-
-      return (d > threshold ? nearest2idx:
-                              nearest1idx);
-    }
-
-    template<typename Matrix>
-    void ditherRgbImageToIndexed(const Matrix& matrix,
-                                 const doc::Image* srcImage,
-                                 doc::Image* dstImage,
-                                 int u, int v,
-                                 const doc::RgbMap* rgbmap,
-                                 const doc::Palette* palette) {
-      const doc::LockImageBits<doc::RgbTraits> srcBits(srcImage);
-      doc::LockImageBits<doc::IndexedTraits> dstBits(dstImage);
-      auto srcIt = srcBits.begin();
-      auto dstIt = dstBits.begin();
-      int w = srcImage->width();
-      int h = srcImage->height();
-
-      for (int y=0; y<h; ++y) {
-        for (int x=0; x<w; ++x, ++srcIt, ++dstIt) {
-          ASSERT(srcIt != srcBits.end());
-          ASSERT(dstIt != dstBits.end());
-          *dstIt = ditherRgbPixelToIndex(matrix, *srcIt, x+u, y+v, rgbmap, palette);
-        }
-      }
+      return Candidates{ color, nearest1idx, nearest2idx, maxValue * d / D };
     }
 
-  private:
     int m_transparentIndex;
   };
 
@@ -10,8 +10,13 @@
 
 #include <gtest/gtest.h>
 
+#include "base/unique_ptr.h"
+#include "doc/primitives.h"
 #include "render/ordered_dither.h"
 
+#include <cstdlib>
+
+using namespace base;
 using namespace doc;
 using namespace render;
 
@@ -57,6 +62,131 @@ TEST(BayerMatrix, CheckD8)
     EXPECT_EQ(expected[i], matrix[i]);
 }
 
+// The whole image conversion (which caches the candidates of each
+// color) must give the same result as converting each pixel.
+TEST(OrderedDither, ImageSameAsPixels)
+{
+  std::srand(1);
+  const int w = 97, h = 70;
+
+  Palette palette(frame_t(0), 64);
+  for (int i=0; i<palette.size(); ++i)
+    palette.setEntry(i, rgba(std::rand() % 256, std::rand() % 256, std::rand() % 256, 255));
+  RgbMap rgbmap;
+  rgbmap.regenerate(&palette, 0);
+
+  // The top half has few colors (so the cache is used) and the
+  // bottom half a different color in each pixel.
+  UniquePtr<Image> src(Image::create(IMAGE_RGB, w, h));
+  color_t colors[8];
+  for (color_t& c : colors)
+    c = rgba(std::rand() % 256, std::rand() % 256, std::rand() % 256, 255);
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x) {
+      color_t c;
+      if ((std::rand() % 10) == 0)
+        c = rgba(0, 0, 0, 0);
+      else if (y < h/2)
+        c = colors[std::rand() % 8];
+      else
+        c = rgba(std::rand() % 256, std::rand() % 256, std::rand() % 256, 255);
+      put_pixel(src, x, y, c);
+    }
+
+  BayerMatrix<8> matrix;
+  UniquePtr<Image> dst(Image::create(IMAGE_INDEXED, w, h));
+  for (int i=0; i<2; ++i) {
+    const RgbMap* map = (i == 0 ? &rgbmap: nullptr);
+    OrderedDither dither(0);
+    dither.ditherRgbImageToIndexed(matrix, src, dst, 3, 5, map, &palette);
+
+    for (int y=0; y<h; ++y)
+      for (int x=0; x<w; ++x)
+        ASSERT_EQ(dither.ditherRgbPixelToIndex(matrix, get_pixel(src, x, y), x+3, y+5, map, &palette),
+                  get_pixel(dst, x, y)) << "pixel " << x << "," << y;
+  }
+}
+
+// Palette and image with known results (the indexes were generated
+// with the implementation that didn't cache the candidates of each
+// color).
+static const color_t test_palette_16[16] = {
+  rgba(  0,   0,   0, 255), rgba(255, 255, 255, 255),
+  rgba(136,   0,   0, 255), rgba(170, 255, 238, 255),
+  rgba(204,  68, 204, 255), rgba(  0, 204,  85, 255),
+  rgba(  0,   0, 170, 255), rgba(238, 238, 119, 255),
+  rgba(221, 136,  85, 255), rgba(102,  68,   0, 255),
+  rgba(255, 119, 119, 255), rgba( 51,  51,  51, 255),
+  rgba(119, 119, 119, 255), rgba(170, 255, 102, 255),
+  rgba(  0, 136, 255, 255), rgba(187, 187, 187, 255),
+};
+
+static color_t test_image_color(int x, int y)
+{
+  if ((x*7 + y*3) % 11 == 0)
+    return rgba(0, 0, 0, 0);
+  return rgba((x*37 + y*11) & 255, (x*5 + y*29) & 255, (x*x + y*53) & 255, 255);
+}
+
+// Expected indexes using the RgbMap
+static const color_t test_dither_16x8_rgbmap[16*8] = {
+   0,  6,  2,  2,  2,  2,  4, 11, 11, 11, 11,  0,  4,  4, 11, 11,
+   6, 11, 11,  2,  9,  4,  4, 11, 11,  0,  9, 12,  4, 10, 14, 11,
+  11, 11, 11,  9,  4,  4, 10,  0, 12, 12, 12, 12, 12,  8, 12, 12,
+  11, 11, 12, 12, 12,  0, 10, 14, 12, 12, 12,  8,  8,  5, 14, 12,
+  14, 12, 12,  0, 12,  8, 14, 12, 12, 12, 12, 15, 15,  5,  0,  5,
+  12,  0, 12, 12,  8,  8,  5, 12,  5, 15, 15,  7,  0,  5,  5,  5,
+   5, 15, 15, 15,  7, 15,  5,  5, 15, 13,  0,  7,  1,  5, 13, 13,
+   5,  5, 15, 15,  7,  5,  5,  5,  0, 13,  3,  4,  6,  2,  2, 11
+};
+
+// Expected indexes using Palette::findBestfit()
+static const color_t test_dither_16x8_bestfit[16*8] = {
+   0,  6,  2,  2,  2,  2,  2, 11, 11, 11,  9,  0,  4,  4, 11, 11,
+  11, 11, 11,  2,  9,  4,  4, 11, 11,  0,  9, 12,  4, 10, 14, 11,
+  11, 11, 11,  9,  4,  4,  4,  0, 12, 12, 12, 12, 12,  8, 12, 12,
+  11, 11, 12, 12, 12,  0, 10, 14, 12, 12, 12,  8,  8,  5, 14, 12,
+  14, 12, 12,  0, 12,  8, 14, 12, 12, 12, 12, 15, 15,  5,  0,  5,
+  12,  0, 12, 15,  8,  8,  5, 12, 15, 15, 15,  7,  0,  5,  5,  5,
+   5, 15, 15, 15,  7, 15,  5,  5, 15, 13,  0,  7,  1,  5, 13, 13,
+   5,  5, 15, 15,  7,  5,  5,  5,  0, 13,  3,  4,  6,  2,  2, 11
+};
+
+TEST(OrderedDither, KnownResults)
+{
+  const int w = 16, h = 8;
+
+  Palette palette(frame_t(0), 16);
+  for (int i=0; i<16; ++i)
+    palette.setEntry(i, test_palette_16[i]);
+  RgbMap rgbmap;
+  rgbmap.regenerate(&palette, 0);
+
+  UniquePtr<Image> src(Image::create(IMAGE_RGB, w, h));
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x)
+      put_pixel(src, x, y, test_image_color(x, y));
+
+  BayerMatrix<4> matrix;
+  UniquePtr<Image> dst(Image::create(IMAGE_INDEXED, w, h));
+  for (int i=0; i<2; ++i) {
+    const RgbMap* map = (i == 0 ? &rgbmap: nullptr);
+    const color_t* expected = (i == 0 ? test_dither_16x8_rgbmap:
+                                        test_dither_16x8_bestfit);
+    OrderedDither dither(0);
+    dither.ditherRgbImageToIndexed(matrix, src, dst, 3, 5, map, &palette);
+
+    for (int y=0; y<h; ++y)
+      for (int x=0; x<w; ++x) {
+        EXPECT_EQ(expected[y*w+x], get_pixel(dst, x, y))
+          << "pixel " << x << "," << y << (map ? " with": " without") << " RgbMap";
+        EXPECT_EQ(expected[y*w+x],
+                  dither.ditherRgbPixelToIndex(matrix, get_pixel(src, x, y), x+3, y+5, map, &palette))
+          << "pixel " << x << "," << y << (map ? " with": " without") << " RgbMap";
+      }
+  }
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
@@ -10,6 +10,7 @@
 
 #include "render/quantization.h"
 
+#include "base/thread.h"
 #include "doc/image_impl.h"
 #include "doc/images_collector.h"
 #include "doc/layer.h"
@@ -19,6 +20,7 @@
 #include "doc/sprite.h"
 #include "gfx/hsv.h"
 #include "gfx/rgb.h"
+#include "render/error_diffusion.h"
 #include "render/ordered_dither.h"
 #include "render/render.h"
 
@@ -32,32 +34,85 @@ namespace render {
 using namespace doc;
 using namespace gfx;
 
+// Consecutive range of frames rendered and added to one optimizer.
+struct OptimizerFrames {
+  const Sprite* sprite;
+  frame_t fromFrame, toFrame;
+  PaletteOptimizer optimizer;
+};
+
+static void feed_optimizer_with_frames(OptimizerFrames* frames)
+{
+  const Sprite* sprite = frames->sprite;
+
+  // Add a flat image with the current sprite's frame rendered
+  ImageRef flat_image(Image::create(IMAGE_RGB,
+      sprite->width(), sprite->height()));
+
+  render::Render render;
+  for (frame_t frame=frames->fromFrame; frame<=frames->toFrame; ++frame) {
+    render.renderSprite(flat_image.get(), sprite, frame);
+
+    // Other threads are already rendering the other frames.
+    frames->optimizer.feedWithImage(flat_image.get(), false);
+  }
+}
+
 Palette* create_palette_from_rgb(
   const Sprite* sprite,
   frame_t fromFrame,
   frame_t toFrame,
   Palette* palette)
 {
-  PaletteOptimizer optimizer;
-
   if (!palette)
     palette = new Palette(fromFrame, 256);
 
   bool has_background_layer = (sprite->backgroundLayer() != nullptr);
 
-  // Add a flat image with the current sprite's frame rendered
-  ImageRef flat_image(Image::create(IMAGE_RGB,
-      sprite->width(), sprite->height()));
+  // Feed the optimizer with all rendered frames. Each thread renders
+  // a consecutive range of frames, and then the optimizers are
+  // merged in frame order (so the palette is the same as adding the
+  // frames one by one). With only one range, the frame is split in
+  // bands of rows by feedWithImage().
+  int nframes = toFrame - fromFrame + 1;
+  int nranges = MID(1, nframes, MAX(1, int(base::thread::hardware_concurrency())));
+
+  std::vector<OptimizerFrames> ranges(nranges);
+  for (int i=0; i<nranges; ++i) {
+    ranges[i].sprite = sprite;
+    ranges[i].fromFrame = fromFrame + frame_t(nframes*i/nranges);
+    ranges[i].toFrame = fromFrame + frame_t(nframes*(i+1)/nranges) - 1;
+  }
 
-  // Feed the optimizer with all rendered frames
-  render::Render render;
-  for (frame_t frame=fromFrame; frame<=toFrame; ++frame) {
-    render.renderSprite(flat_image.get(), sprite, frame);
-    optimizer.feedWithImage(flat_image.get());
+  if (nranges == 1) {
+    ImageRef flat_image(Image::create(IMAGE_RGB,
+        sprite->width(), sprite->height()));
+
+    render::Render render;
+    for (frame_t frame=fromFrame; frame<=toFrame; ++frame) {
+      render.renderSprite(flat_image.get(), sprite, frame);
+      ranges[0].optimizer.feedWithImage(flat_image.get());
+    }
+  }
+  else {
+    // The first range is processed in this thread
+    std::vector<base::thread*> threads;
+    for (int i=1; i<nranges; ++i)
+      threads.push_back(new base::thread(&feed_optimizer_with_frames, &ranges[i]));
+
+    feed_optimizer_with_frames(&ranges[0]);
+
+    for (base::thread* thread : threads) {
+      thread->join();
+      delete thread;
+    }
+
+    for (int i=1; i<nranges; ++i)
+      ranges[0].optimizer.feedWithOptimizer(ranges[i].optimizer);
   }
 
   // Generate an optimized palette
-  optimizer.calculate(palette, has_background_layer);
+  ranges[0].optimizer.calculate(palette, has_background_layer);
 
   return palette;
 }
@@ -84,6 +139,16 @@ Image* convert_pixel_format(
     return new_image;
   }
 
+  // RGB -> Indexed with error diffusion (transparent pixels are
+  // converted to index 0 as in the non-dithered conversion)
+  if (image->pixelFormat() == IMAGE_RGB &&
+      pixelFormat == IMAGE_INDEXED &&
+      ErrorDiffusionDither::isErrorDiffusion(ditheringMethod)) {
+    ErrorDiffusionDither dither(ditheringMethod, 0);
+    dither.ditherRgbImageToIndexed(image, new_image, rgbmap, palette);
+    return new_image;
+  }
+
   color_t c;
   int r, g, b;
 
@@ -300,50 +365,114 @@ Image* convert_pixel_format(
 // Creation of optimized palette for RGB images
 // by David Capello
 
-void PaletteOptimizer::feedWithImage(Image* image)
+// Returns the opaque color added in the histogram for the given
+// pixel, or 0 if the pixel is transparent.
+static inline uint32_t histogram_color(RgbTraits::pixel_t c)
 {
-  uint32_t color;
+  return (rgba_geta(c) > 0 ? (c | rgba(0, 0, 0, 255)): 0);
+}
 
-  ASSERT(image);
-  switch (image->pixelFormat()) {
+static inline uint32_t histogram_color(GrayscaleTraits::pixel_t c)
+{
+  if (graya_geta(c) > 0) {
+    int v = graya_getv(c);
+    return rgba(v, v, v, 255);
+  }
+  else
+    return 0;
+}
 
-    case IMAGE_RGB:
-      {
-        const LockImageBits<RgbTraits> bits(image);
-        LockImageBits<RgbTraits>::const_iterator it = bits.begin(), end = bits.end();
+// Adds the rows [y0,y1) of the image in the histogram. Runs of
+// pixels with the same color are added at once.
+template<typename ImageTraits>
+static void feed_histogram_with_rows(ColorHistogram<5, 6, 5>* histogram,
+                                     const Image* image, int y0, int y1)
+{
+  typedef typename ImageTraits::pixel_t pixel_t;
+  const int w = image->width();
 
-        for (; it != end; ++it) {
-          color = *it;
+  for (int y=y0; y<y1; ++y) {
+    const pixel_t* it = (const pixel_t*)image->getPixelAddress(0, y);
+    const pixel_t* end = it + w;
 
-          if (rgba_geta(color) > 0) {
-            color |= rgba(0, 0, 0, 255);
-            m_histogram.addSamples(color, 1);
-          }
-        }
-      }
-      break;
+    while (it != end) {
+      const pixel_t c = *it;
+      const pixel_t* runEnd = it+1;
+      while (runEnd != end && *runEnd == c)
+        ++runEnd;
 
-    case IMAGE_GRAYSCALE:
-      {
-        const LockImageBits<RgbTraits> bits(image);
-        LockImageBits<RgbTraits>::const_iterator it = bits.begin(), end = bits.end();
+      uint32_t color = histogram_color(c);
+      if (color)
+        histogram->addSamples(color, runEnd - it);
 
-        for (; it != end; ++it) {
-          color = *it;
+      it = runEnd;
+    }
+  }
+}
 
-          if (graya_geta(color) > 0) {
-            color = graya_getv(color);
-            m_histogram.addSamples(rgba(color, color, color, 255), 1);
-          }
-        }
-      }
-      break;
+// Band of rows of an image added in a histogram by one thread.
+struct HistogramBand {
+  const Image* image;
+  int y0, y1;
+  ColorHistogram<5, 6, 5>* histogram;
+};
 
-    case IMAGE_INDEXED:
-      ASSERT(false);
-      break;
+static void feed_histogram_with_band(HistogramBand* band)
+{
+  switch (band->image->pixelFormat()) {
+    case IMAGE_RGB:       feed_histogram_with_rows<RgbTraits>(band->histogram, band->image, band->y0, band->y1); break;
+    case IMAGE_GRAYSCALE: feed_histogram_with_rows<GrayscaleTraits>(band->histogram, band->image, band->y0, band->y1); break;
+  }
+}
+
+void PaletteOptimizer::feedWithImage(Image* image, bool useThreads)
+{
+  ASSERT(image);
+  ASSERT(image->pixelFormat() == IMAGE_RGB ||
+         image->pixelFormat() == IMAGE_GRAYSCALE);
+
+  // Minimum number of pixels to use a new thread
+  const int kMinBandPixels = 256*1024;
+
+  int h = image->height();
+  int nbands = 1;
+  if (useThreads) {
+    nbands = MID(1, image->width()*h / kMinBandPixels,
+                 MAX(1, int(base::thread::hardware_concurrency())));
+    nbands = MIN(nbands, h);
+  }
 
+  // The first band is added directly in m_histogram, the other ones
+  // in their own histograms, which are merged in order (the order
+  // of the colors in the high-precision table must be the same as
+  // adding all rows one by one).
+  std::vector<ColorHistogram<5, 6, 5> > histograms(nbands-1);
+  std::vector<HistogramBand> bands(nbands);
+  for (int i=0; i<nbands; ++i) {
+    bands[i].image = image;
+    bands[i].y0 = h*i/nbands;
+    bands[i].y1 = h*(i+1)/nbands;
+    bands[i].histogram = (i == 0 ? &m_histogram: &histograms[i-1]);
   }
+
+  std::vector<base::thread*> threads;
+  for (int i=1; i<nbands; ++i)
+    threads.push_back(new base::thread(&feed_histogram_with_band, &bands[i]));
+
+  feed_histogram_with_band(&bands[0]);
+
+  for (base::thread* thread : threads) {
+    thread->join();
+    delete thread;
+  }
+
+  for (const auto& histogram : histograms)
+    m_histogram.merge(histogram);
+}
+
+void PaletteOptimizer::feedWithOptimizer(const PaletteOptimizer& other)
+{
+  m_histogram.merge(other.m_histogram);
 }
 
 void PaletteOptimizer::calculate(Palette* palette, bool has_background_layer)
@@ -28,7 +28,15 @@ namespace render {
 
  class PaletteOptimizer {
  public:
-   void feedWithImage(Image* image);
+   // Adds all visible colors of the image. Big images are split in
+   // bands of rows added by different threads (if "useThreads" is
+   // true).
+   void feedWithImage(Image* image, bool useThreads = true);
+
+   // Adds all colors that were given to other optimizer, as if its
+   // images were given after the images of this one.
+   void feedWithOptimizer(const PaletteOptimizer& other);
+
    void calculate(Palette* palette, bool has_background_layer);
 
   private:
@@ -0,0 +1,195 @@
+// Aseprite Render Library
+// Copyright (c) 2001-2015 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/unique_ptr.h"
+#include "doc/image.h"
+#include "doc/palette.h"
+#include "doc/primitives.h"
+#include "render/color_histogram.h"
+#include "render/quantization.h"
+
+#include <cstdlib>
+
+using namespace base;
+using namespace doc;
+using namespace render;
+
+static Image* create_random_image(int w, int h, int ncolors)
+{
+  std::vector<color_t> colors(ncolors);
+  for (color_t& c : colors)
+    c = rgba(std::rand() % 256, std::rand() % 256, std::rand() % 256, 255);
+
+  Image* image = Image::create(IMAGE_RGB, w, h);
+  for (int y=0; y<h; ++y) {
+    color_t c = 0;
+    for (int x=0; x<w; ++x) {
+      // Runs of pixels with the same color and some transparent pixels
+      if ((std::rand() % 4) == 0)
+        c = (std::rand() % 16 ? colors[std::rand() % ncolors]: rgba(0, 0, 0, 0));
+      put_pixel(image, x, y, c);
+    }
+  }
+  return image;
+}
+
+static void expect_same_palette(const Palette& a, const Palette& b)
+{
+  ASSERT_EQ(a.size(), b.size());
+  for (int i=0; i<a.size(); ++i)
+    EXPECT_EQ(a.getEntry(i), b.getEntry(i)) << "entry " << i;
+}
+
+TEST(PaletteOptimizer, ColorsInOrder)
+{
+  UniquePtr<Image> image(Image::create(IMAGE_RGB, 4, 1));
+  put_pixel(image, 0, 0, rgba(0, 0, 0, 0));
+  put_pixel(image, 1, 0, rgba(255, 0, 0, 128));
+  put_pixel(image, 2, 0, rgba(0, 0, 255, 255));
+  put_pixel(image, 3, 0, rgba(255, 0, 0, 255));
+
+  PaletteOptimizer optimizer;
+  optimizer.feedWithImage(image);
+
+  Palette palette(frame_t(0), 256);
+  optimizer.calculate(&palette, false);
+  ASSERT_EQ(3, palette.size());
+  EXPECT_EQ(rgba(255, 0, 0, 255), palette.getEntry(1));
+  EXPECT_EQ(rgba(0, 0, 255, 255), palette.getEntry(2));
+}
+
+// Grayscale pixels are read as gray colors (before 3f301e4 they were
+// read as RGB pixels, past the end of each row).
+TEST(PaletteOptimizer, GrayscaleImage)
+{
+  UniquePtr<Image> image(Image::create(IMAGE_GRAYSCALE, 5, 1));
+  put_pixel(image, 0, 0, graya(0, 0));
+  put_pixel(image, 1, 0, graya(200, 128));
+  put_pixel(image, 2, 0, graya(50, 255));
+  put_pixel(image, 3, 0, graya(200, 255));
+  put_pixel(image, 4, 0, graya(50, 255));
+
+  PaletteOptimizer optimizer;
+  optimizer.feedWithImage(image);
+
+  Palette palette(frame_t(0), 256);
+  optimizer.calculate(&palette, false);
+  ASSERT_EQ(3, palette.size());
+  EXPECT_EQ(rgba(200, 200, 200, 255), palette.getEntry(1));
+  EXPECT_EQ(rgba(50, 50, 50, 255), palette.getEntry(2));
+}
+
+// Feeding images to different optimizers and merging them must give
+// the same palette as feeding all images to one optimizer.
+TEST(PaletteOptimizer, FeedWithOptimizer)
+{
+  const int ncolors[] = { 10, 100, 200, 1000 };
+  for (int n : ncolors) {
+    std::srand(n);
+    UniquePtr<Image> a(create_random_image(64, 64, n));
+    UniquePtr<Image> b(create_random_image(32, 80, n));
+    UniquePtr<Image> c(create_random_image(50, 50, n));
+
+    PaletteOptimizer expected;
+    expected.feedWithImage(a);
+    expected.feedWithImage(b);
+    expected.feedWithImage(c);
+
+    PaletteOptimizer optimizer1, optimizer2;
+    optimizer1.feedWithImage(a);
+    optimizer2.feedWithImage(b);
+    optimizer2.feedWithImage(c);
+    optimizer1.feedWithOptimizer(optimizer2);
+
+    Palette palette1(frame_t(0), 256);
+    Palette palette2(frame_t(0), 256);
+    expected.calculate(&palette1, false);
+    optimizer1.calculate(&palette2, false);
+    expect_same_palette(palette1, palette2);
+  }
+}
+
+// Big images are fed by several threads.
+TEST(PaletteOptimizer, BigImage)
+{
+  const int ncolors[] = { 200, 5000 };
+  for (int n : ncolors) {
+    std::srand(n);
+    UniquePtr<Image> image(create_random_image(1024, 768, n));
+
+    PaletteOptimizer optimizer1, optimizer2;
+    optimizer1.feedWithImage(image, false);
+    optimizer2.feedWithImage(image, true);
+
+    Palette palette1(frame_t(0), 256);
+    Palette palette2(frame_t(0), 256);
+    optimizer1.calculate(&palette1, true);
+    optimizer2.calculate(&palette2, true);
+    expect_same_palette(palette1, palette2);
+  }
+
+  // Grayscale image with all gray levels (which must be in the
+  // palette)
+  UniquePtr<Image> image(Image::create(IMAGE_GRAYSCALE, 1024, 768));
+  for (int y=0; y<image->height(); ++y)
+    for (int x=0; x<image->width(); ++x)
+      put_pixel(image, x, y, graya((x+y) % 256, 255));
+
+  PaletteOptimizer optimizer1, optimizer2;
+  optimizer1.feedWithImage(image, false);
+  optimizer2.feedWithImage(image, true);
+
+  Palette palette1(frame_t(0), 256);
+  Palette palette2(frame_t(0), 256);
+  optimizer1.calculate(&palette1, true);
+  optimizer2.calculate(&palette2, true);
+  expect_same_palette(palette1, palette2);
+  for (int i=0; i<palette1.size(); ++i) {
+    color_t c = palette1.getEntry(i);
+    EXPECT_TRUE(rgba_getr(c) == rgba_getg(c) && rgba_getg(c) == rgba_getb(c))
+      << "entry " << i;
+  }
+}
+
+TEST(MedianCut, HistogramSums)
+{
+  typedef ColorHistogram<5, 6, 5> Histogram;
+  Histogram histogram;
+  std::srand(1);
+  for (int i=0; i<2000; ++i)
+    histogram.addSamples(rgba(std::rand() % 256, std::rand() % 256, std::rand() % 256, 255),
+                         1 + std::rand() % 100);
+
+  HistogramSums<Histogram> sums(histogram);
+  for (int n=0; n<100; ++n) {
+    int r1 = std::rand() % Histogram::RElements, r2 = std::rand() % Histogram::RElements;
+    int g1 = std::rand() % Histogram::GElements, g2 = std::rand() % Histogram::GElements;
+    int b1 = std::rand() % Histogram::BElements, b2 = std::rand() % Histogram::BElements;
+    if (r1 > r2) std::swap(r1, r2);
+    if (g1 > g2) std::swap(g1, g2);
+    if (b1 > b2) std::swap(b1, b2);
+
+    std::size_t points = 0;
+    for (int i=r1; i<=r2; ++i)
+      for (int j=g1; j<=g2; ++j)
+        for (int k=b1; k<=b2; ++k)
+          points += histogram.at(i, j, k);
+
+    EXPECT_EQ(points, sums.points(r1, g1, b1, r2, g2, b2));
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -10,6 +10,8 @@
 
 #include "render/render.h"
 
+#include "base/thread_pool.h"
+#include "base/unique_ptr.h"
 #include "doc/blend_internals.h"
 #include "doc/blend_mode.h"
 #include "doc/doc.h"
@@ -17,12 +19,75 @@
 #include "doc/image_impl.h"
 #include "gfx/clip.h"
 #include "gfx/region.h"
+#include "render/composite_cache.h"
+
+#include <algorithm>
+#include <vector>
 
 namespace render {
 
 //////////////////////////////////////////////////////////////////////
 // Scaled composite
 
+// Blends a run of "w" non-transparent pixels (pixels that aren't the
+// mask color) of "src" over "dst" and puts the result in "scanline".
+// If "copy_opaque" is true, the result of blending an opaque pixel is
+// the same source pixel, so runs of opaque pixels are just copied.
+template<class Traits>
+static void blend_row_run(typename Traits::pixel_t* scanline,
+                          const typename Traits::pixel_t* dst,
+                          const typename Traits::pixel_t* src,
+                          int w, int opacity,
+                          typename Traits::row_blender_t row_blender,
+                          bool copy_opaque)
+{
+  if (!copy_opaque) {
+    (*row_blender)(scanline, dst, src, w, opacity);
+    return;
+  }
+
+  int x = 0;
+  while (x < w) {
+    int x0 = x;
+    while (x < w && Traits::is_opaque(src[x]))
+      ++x;
+    if (x > x0) {
+      std::copy(src+x0, src+x, scanline+x0);
+      x0 = x;
+    }
+
+    while (x < w && !Traits::is_opaque(src[x]))
+      ++x;
+    if (x > x0)
+      (*row_blender)(scanline+x0, dst+x0, src+x0, x-x0, opacity);
+  }
+}
+
+// Splits a row in runs of pixels with the mask color (which are
+// skipped) and runs of pixels to be blended.
+template<class DstTraits, class SrcTraits, class BlendRun>
+static void blend_row_skipping_mask(typename DstTraits::pixel_t* scanline,
+                                    const typename DstTraits::pixel_t* dst,
+                                    const typename SrcTraits::pixel_t* src,
+                                    int w, color_t mask_color,
+                                    BlendRun blend_run)
+{
+  int x = 0;
+  while (x < w) {
+    int x0 = x;
+    while (x < w && src[x] == mask_color)
+      ++x;
+    if (x > x0 && scanline != dst)
+      std::copy(dst+x0, dst+x, scanline+x0);
+
+    x0 = x;
+    while (x < w && src[x] != mask_color)
+      ++x;
+    if (x > x0)
+      blend_run(x0, x-x0);
+  }
+}
+
 template<class DstTraits, class SrcTraits>
 class BlenderHelper {
   BlendFunc m_blend_func;
@@ -43,17 +108,91 @@ public:
     else
       scanline = dst;
   }
+  void blendRow(typename DstTraits::pixel_t* scanline,
+                const typename DstTraits::pixel_t* dst,
+                const typename SrcTraits::pixel_t* src,
+                int w, int opacity)
+  {
+    for (int x=0; x<w; ++x)
+      operator()(scanline[x], dst[x], src[x], opacity);
+  }
+};
+
+// Helper for images with the same RGB or grayscale pixel format.
+template<class Traits>
+class SameFormatBlenderHelper {
+  BlendFunc m_blend_func;
+  typename Traits::row_blender_t m_row_blender;
+  color_t m_mask_color;
+  bool m_copy_opaque;
+public:
+  SameFormatBlenderHelper(const Image* src, const Palette* pal, BlendMode blend_mode)
+  {
+    m_blend_func = Traits::get_blender(blend_mode);
+    m_row_blender = Traits::get_row_blender(blend_mode);
+    m_mask_color = src->maskColor();
+    m_copy_opaque = (blend_mode == BlendMode::SRC ||
+                     blend_mode == BlendMode::NORMAL);
+  }
+  inline void operator()(typename Traits::pixel_t& scanline,
+                         const typename Traits::pixel_t& dst,
+                         const typename Traits::pixel_t& src,
+                         int opacity)
+  {
+    if (src != m_mask_color)
+      scanline = (*m_blend_func)(dst, src, opacity);
+    else
+      scanline = dst;
+  }
+  void blendRow(typename Traits::pixel_t* scanline,
+                const typename Traits::pixel_t* dst,
+                const typename Traits::pixel_t* src,
+                int w, int opacity)
+  {
+    // An opaque pixel with the normal blend mode replaces the
+    // backdrop only when the opacity is 255.
+    bool copy_opaque = (m_copy_opaque && opacity == 255);
+
+    blend_row_skipping_mask<Traits, Traits>(
+      scanline, dst, src, w, m_mask_color,
+      [&](int x, int n) {
+        blend_row_run<Traits>(scanline+x, dst+x, src+x, n, opacity,
+                              m_row_blender, copy_opaque);
+      });
+  }
+};
+
+template<>
+class BlenderHelper<RgbTraits, RgbTraits>
+  : public SameFormatBlenderHelper<RgbTraits> {
+public:
+  BlenderHelper(const Image* src, const Palette* pal, BlendMode blend_mode)
+    : SameFormatBlenderHelper<RgbTraits>(src, pal, blend_mode) { }
+};
+
+template<>
+class BlenderHelper<GrayscaleTraits, GrayscaleTraits>
+  : public SameFormatBlenderHelper<GrayscaleTraits> {
+public:
+  BlenderHelper(const Image* src, const Palette* pal, BlendMode blend_mode)
+    : SameFormatBlenderHelper<GrayscaleTraits>(src, pal, blend_mode) { }
 };
 
 template<>
 class BlenderHelper<RgbTraits, GrayscaleTraits> {
   BlendFunc m_blend_func;
+  RgbaBlendRowFunc m_row_blender;
   color_t m_mask_color;
+  bool m_copy_opaque;
+  std::vector<RgbTraits::pixel_t> m_row;
 public:
   BlenderHelper(const Image* src, const Palette* pal, BlendMode blend_mode)
   {
     m_blend_func = RgbTraits::get_blender(blend_mode);
+    m_row_blender = RgbTraits::get_row_blender(blend_mode);
     m_mask_color = src->maskColor();
+    m_copy_opaque = (blend_mode == BlendMode::SRC ||
+                     blend_mode == BlendMode::NORMAL);
   }
   inline void operator()(RgbTraits::pixel_t& scanline,
                          const RgbTraits::pixel_t& dst,
@@ -67,21 +206,51 @@ public:
     else
       scanline = dst;
   }
+  void blendRow(RgbTraits::pixel_t* scanline,
+                const RgbTraits::pixel_t* dst,
+                const GrayscaleTraits::pixel_t* src,
+                int w, int opacity)
+  {
+    bool copy_opaque = (m_copy_opaque && opacity == 255);
+
+    if (int(m_row.size()) < w)
+      m_row.resize(w);
+
+    blend_row_skipping_mask<RgbTraits, GrayscaleTraits>(
+      scanline, dst, src, w, m_mask_color,
+      [&](int x, int n) {
+        RgbTraits::pixel_t* row = &m_row[x];
+        for (int i=0; i<n; ++i) {
+          int v = graya_getv(src[x+i]);
+          row[i] = rgba(v, v, v, graya_geta(src[x+i]));
+        }
+        blend_row_run<RgbTraits>(scanline+x, dst+x, row, n, opacity,
+                                 m_row_blender, copy_opaque);
+      });
+  }
 };
 
 template<>
 class BlenderHelper<RgbTraits, IndexedTraits> {
-  const Palette* m_pal;
   BlendMode m_blend_mode;
   BlendFunc m_blend_func;
+  RgbaBlendRowFunc m_row_blender;
   color_t m_mask_color;
+  bool m_copy_opaque;
+  RgbTraits::pixel_t m_lut[256];
+  std::vector<RgbTraits::pixel_t> m_row;
 public:
   BlenderHelper(const Image* src, const Palette* pal, BlendMode blend_mode)
   {
     m_blend_mode = blend_mode;
     m_blend_func = RgbTraits::get_blender(blend_mode);
+    m_row_blender = RgbTraits::get_row_blender(blend_mode);
     m_mask_color = src->maskColor();
-    m_pal = pal;
+    m_copy_opaque = (blend_mode == BlendMode::NORMAL);
+
+    // Palette look-up table to convert each index to RGBA
+    for (int i=0; i<256; ++i)
+      m_lut[i] = (pal ? pal->getEntry(i): 0);
   }
   inline void operator()(RgbTraits::pixel_t& scanline,
                          const RgbTraits::pixel_t& dst,
@@ -89,16 +258,42 @@ public:
                          int opacity)
   {
     if (m_blend_mode == BlendMode::SRC) {
-      scanline = m_pal->getEntry(src);
+      scanline = m_lut[src];
     }
     else {
       if (src != m_mask_color) {
-        scanline = (*m_blend_func)(dst, m_pal->getEntry(src), opacity);
+        scanline = (*m_blend_func)(dst, m_lut[src], opacity);
       }
       else
         scanline = dst;
     }
   }
+  void blendRow(RgbTraits::pixel_t* scanline,
+                const RgbTraits::pixel_t* dst,
+                const IndexedTraits::pixel_t* src,
+                int w, int opacity)
+  {
+    if (m_blend_mode == BlendMode::SRC) {
+      for (int x=0; x<w; ++x)
+        scanline[x] = m_lut[src[x]];
+      return;
+    }
+
+    bool copy_opaque = (m_copy_opaque && opacity == 255);
+
+    if (int(m_row.size()) < w)
+      m_row.resize(w);
+
+    blend_row_skipping_mask<RgbTraits, IndexedTraits>(
+      scanline, dst, src, w, m_mask_color,
+      [&](int x, int n) {
+        RgbTraits::pixel_t* row = &m_row[x];
+        for (int i=0; i<n; ++i)
+          row[i] = m_lut[src[x+i]];
+        blend_row_run<RgbTraits>(scanline+x, dst+x, row, n, opacity,
+                                 m_row_blender, copy_opaque);
+      });
+  }
 };
 
 template<>
@@ -126,8 +321,48 @@ public:
         scanline = dst;
     }
   }
+  void blendRow(IndexedTraits::pixel_t* scanline,
+                const IndexedTraits::pixel_t* dst,
+                const IndexedTraits::pixel_t* src,
+                int w, int opacity)
+  {
+    if (m_blend_mode == BlendMode::SRC) {
+      std::copy(src, src+w, scanline);
+      return;
+    }
+
+    blend_row_skipping_mask<IndexedTraits, IndexedTraits>(
+      scanline, dst, src, w, m_mask_color,
+      [&](int x, int n) {
+        std::copy(src+x, src+x+n, scanline+x);
+      });
+  }
 };
 
+template<class DstTraits, class SrcTraits>
+static void compose_image_unscaled(
+  Image* dst, const Image* src, const Palette* pal,
+  gfx::Clip area,
+  int opacity, BlendMode blend_mode)
+{
+  if (!area.clip(dst->width(), dst->height(),
+                 src->width(), src->height()))
+    return;
+
+  BlenderHelper<DstTraits, SrcTraits> blender(src, pal, blend_mode);
+
+  // Each row is blended in-place directly in the destination image
+  for (int y=0; y<area.size.h; ++y) {
+    typename DstTraits::address_t dst_address =
+      (typename DstTraits::address_t)dst->getPixelAddress(area.dst.x, area.dst.y+y);
+    typename SrcTraits::const_address_t src_address =
+      (typename SrcTraits::const_address_t)src->getPixelAddress(area.src.x, area.src.y+y);
+
+    blender.blendRow(dst_address, dst_address, src_address,
+                     area.size.w, opacity);
+  }
+}
+
 template<class DstTraits, class SrcTraits>
 static void compose_scaled_image_scale_up(
   Image* dst, const Image* src, const Palette* pal,
@@ -135,7 +370,7 @@ static void compose_scaled_image_scale_up(
   int opacity, BlendMode blend_mode, Zoom zoom)
 {
   BlenderHelper<DstTraits, SrcTraits> blender(src, pal, blend_mode);
-  int px_x, px_y;
+  int px_y;
 
   if (!area.clip(dst->width(), dst->height(),
       zoom.apply(src->width()),
@@ -157,96 +392,59 @@ static void compose_scaled_image_scale_up(
   if (srcBounds.isEmpty())
     return;
 
-  // the scanline variable is used to blend src/dst pixels one time for each pixel
-  typedef std::vector<typename DstTraits::pixel_t> Scanline;
-  Scanline scanline(srcBounds.w);
-  typename Scanline::iterator scanline_it;
-#ifdef _DEBUG
-  typename Scanline::iterator scanline_end = scanline.end();
-#endif
-
-  // Lock all necessary bits
-  const LockImageBits<SrcTraits> srcBits(src, srcBounds);
-  LockImageBits<DstTraits> dstBits(dst, dstBounds);
-  typename LockImageBits<SrcTraits>::const_iterator src_it = srcBits.begin();
-#ifdef _DEBUG
-  typename LockImageBits<SrcTraits>::const_iterator src_end = srcBits.end();
-#endif
-  typename LockImageBits<DstTraits>::iterator dst_it, dst_end;
+  // the scanline variable is used to blend src/dst pixels one time
+  // for each pixel, and the backdrop contains the dst pixels below
+  // each src pixel
+  std::vector<typename DstTraits::pixel_t> scanline(srcBounds.w);
+  std::vector<typename DstTraits::pixel_t> backdrop(srcBounds.w);
 
   // For each line to draw of the source image...
   dstBounds.h = 1;
   for (int y=0; y<srcBounds.h; ++y) {
-    dst_it = dstBits.begin_area(dstBounds);
-    dst_end = dstBits.end_area(dstBounds);
-
-    // Read 'src' and 'dst' and blend them, put the result in `scanline'
-    scanline_it = scanline.begin();
-    for (int x=0; x<srcBounds.w; ++x) {
-      ASSERT(src_it >= srcBits.begin() && src_it < src_end);
-      ASSERT(dst_it >= dstBits.begin() && dst_it < dst_end);
-      ASSERT(scanline_it >= scanline.begin() && scanline_it < scanline_end);
-
-      blender(*scanline_it, *dst_it, *src_it, opacity);
-      ++src_it;
-
-      int delta;
-      if (x == 0)
-        delta = first_px_w;
-      else
-        delta = px_w;
-
-      while (dst_it != dst_end && delta-- > 0)
-        ++dst_it;
-
-      ++scanline_it;
+    // Read 'dst' pixels below each 'src' pixel (the last 'src'
+    // pixels could be outside the 'dst' area, but their blended
+    // values aren't used)
+    typename DstTraits::const_address_t backdrop_address =
+      (typename DstTraits::const_address_t)dst->getPixelAddress(dstBounds.x, dstBounds.y);
+    for (int x=0, u=0; x<srcBounds.w; ++x) {
+      backdrop[x] = backdrop_address[MIN(u, dstBounds.w-1)];
+      u += (x == 0 ? first_px_w: px_w);
     }
 
+    // Blend 'src' and 'dst', put the result in `scanline'
+    blender.blendRow(
+      &scanline[0], &backdrop[0],
+      (typename SrcTraits::const_address_t)src->getPixelAddress(
+        srcBounds.x, srcBounds.y+y),
+      srcBounds.w, opacity);
+
     // Get the 'height' of the line to be painted in 'dst'
     if ((y == 0) && (first_px_h > 0))
       line_h = first_px_h;
     else
       line_h = px_h;
 
-    // Draw the line in 'dst'
+    // Draw the line in 'dst' (the first time replicating each
+    // scanline pixel, the next lines are a copy of the first one)
+    typename DstTraits::address_t first_line = NULL;
     for (px_y=0; px_y<line_h; ++px_y) {
-      dst_it = dstBits.begin_area(dstBounds);
-      dst_end = dstBits.end_area(dstBounds);
-      scanline_it = scanline.begin();
-
-      int x = 0;
-
-      // first pixel
-      for (px_x=0; px_x<first_px_w; ++px_x) {
-        ASSERT(scanline_it != scanline_end);
-        ASSERT(dst_it != dst_end);
-
-        *dst_it = *scanline_it;
-
-        ++dst_it;
-        if (dst_it == dst_end)
-          goto done_with_line;
-      }
-
-      ++scanline_it;
-      ++x;
+      typename DstTraits::address_t dst_address =
+        (typename DstTraits::address_t)dst->getPixelAddress(dstBounds.x, dstBounds.y);
 
-      // the rest of the line
-      for (; x<srcBounds.w; ++x) {
-        for (px_x=0; px_x<px_w; ++px_x) {
-          ASSERT(dst_it !=  dst_end);
+      if (!first_line) {
+        int u = MIN(first_px_w, dstBounds.w);
+        std::fill(dst_address, dst_address+u, scanline[0]);
 
-          *dst_it = *scanline_it;
-
-          ++dst_it;
-          if (dst_it == dst_end)
-            goto done_with_line;
+        for (int x=1; x<srcBounds.w && u<dstBounds.w; ++x) {
+          int n = MIN(px_w, dstBounds.w-u);
+          std::fill(dst_address+u, dst_address+u+n, scanline[x]);
+          u += n;
         }
-
-        ++scanline_it;
+        first_line = dst_address;
       }
+      else
+        std::copy(first_line, first_line+dstBounds.w, dst_address);
 
-done_with_line:;
       if (++dstBounds.y > bottom)
         goto done_with_blit;
     }
@@ -318,12 +516,81 @@ static void compose_scaled_image(
   const gfx::Clip& area,
   int opacity, BlendMode blend_mode, Zoom zoom)
 {
-  if (zoom.scale() >= 1.0)
+  if (zoom.scale() == 1.0)
+    compose_image_unscaled<DstTraits, SrcTraits>(dst, src, pal, area, opacity, blend_mode);
+  else if (zoom.scale() > 1.0)
     compose_scaled_image_scale_up<DstTraits, SrcTraits>(dst, src, pal, area, opacity, blend_mode, zoom);
   else
     compose_scaled_image_scale_down<DstTraits, SrcTraits>(dst, src, pal, area, opacity, blend_mode, zoom);
 }
 
+//////////////////////////////////////////////////////////////////////
+// Composite cache state
+
+static inline void hash_value(uint32_t& hash, uint32_t value)
+{
+  hash = (hash ^ value) * 16777619u;
+}
+
+static inline void hash_pointer(uint32_t& hash, const void* ptr)
+{
+  uint64_t value = uint64_t(uintptr_t(ptr));
+  hash_value(hash, uint32_t(value));
+  hash_value(hash, uint32_t(value >> 32));
+}
+
+// Hashes the properties of the layers (and their cels in the given
+// frame) rendered before "target", so changes that were not
+// notified to the composite cache can be detected. Returns false if
+// "target" is not inside "layer".
+static bool hash_layers_below(const Layer* layer, const Layer* target,
+                              frame_t frame, uint32_t& hash)
+{
+  if (layer == target)
+    return true;
+
+  hash_pointer(hash, layer);
+  hash_value(hash, layer->version());
+  hash_value(hash, uint32_t(layer->flags()));
+
+  switch (layer->type()) {
+
+    case ObjectType::LayerImage: {
+      const LayerImage* imgLayer = static_cast<const LayerImage*>(layer);
+      hash_value(hash, uint32_t(imgLayer->blendMode()));
+      hash_value(hash, imgLayer->opacity());
+
+      const Cel* cel = layer->cel(frame);
+      hash_pointer(hash, cel);
+      if (cel) {
+        hash_value(hash, cel->version());
+        hash_value(hash, cel->x());
+        hash_value(hash, cel->y());
+        hash_value(hash, cel->opacity());
+
+        const Image* image = cel->image();
+        hash_pointer(hash, image);
+        if (image)
+          hash_value(hash, image->version());
+      }
+      break;
+    }
+
+    case ObjectType::LayerFolder: {
+      LayerConstIterator it = static_cast<const LayerFolder*>(layer)->getLayerBegin();
+      LayerConstIterator end = static_cast<const LayerFolder*>(layer)->getLayerEnd();
+
+      for (; it != end; ++it) {
+        if (hash_layers_below(*it, target, frame, hash))
+          return true;
+      }
+      break;
+    }
+
+  }
+  return false;
+}
+
 Render::Render()
   : m_sprite(NULL)
   , m_currentLayer(NULL)
@@ -338,6 +605,11 @@ Render::Render()
   , m_selectedFrame(-1)
   , m_previewImage(nullptr)
   , m_onionskin(OnionskinType::NONE)
+  , m_maxThreads(1)
+  , m_compositeCache(nullptr)
+  , m_compositeLayer(nullptr)
+  , m_layerRange(LayerRange::ALL)
+  , m_compositeLayerFound(false)
 {
 }
 
@@ -408,6 +680,30 @@ void Render::disableOnionskin()
   m_onionskin.type(OnionskinType::NONE);
 }
 
+void Render::setMaxThreads(int threads)
+{
+  m_maxThreads = MAX(1, threads);
+
+  // The caller thread renders one band, so we need m_maxThreads-1
+  // workers. If the maximum is reduced to one thread, the workers
+  // are kept for the next time (they don't consume CPU waiting).
+  if (m_maxThreads > 1 &&
+      (!m_threads || m_threads->size() != m_maxThreads-1))
+    m_threads.reset(new base::ThreadPool(m_maxThreads-1));
+}
+
+void Render::setCompositeCache(CompositeCache* cache, const Layer* layer)
+{
+  m_compositeCache = cache;
+  m_compositeLayer = layer;
+}
+
+void Render::removeCompositeCache()
+{
+  m_compositeCache = nullptr;
+  m_compositeLayer = nullptr;
+}
+
 void Render::renderSprite(
   Image* dstImage,
   const Sprite* sprite,
@@ -473,6 +769,26 @@ void Render::renderSprite(
   if (!scaled_func)
     return;
 
+  if (!renderCompositeCache(dstImage, frame, area, zoom, scaled_func))
+    renderSpriteBackground(dstImage, frame, area, zoom);
+
+  // Bands with less rows are not worth a new thread
+  const int kMinBandHeight = 32;
+  int bands = MIN(m_maxThreads, area.size.h / kMinBandHeight);
+  if (bands > 1)
+    renderSpriteLayersInBands(dstImage, frame, area, zoom, scaled_func, bands);
+  else
+    renderSpriteLayers(dstImage, frame, area, zoom, scaled_func);
+
+  m_layerRange = LayerRange::ALL;
+}
+
+void Render::renderSpriteBackground(
+  Image* dstImage,
+  frame_t frame,
+  const gfx::Clip& area,
+  Zoom zoom)
+{
   const LayerImage* bgLayer = m_sprite->backgroundLayer();
   color_t bg_color = 0;
   if (m_sprite->pixelFormat() == IMAGE_INDEXED) {
@@ -502,14 +818,103 @@ void Render::renderSprite(
       fill_rect(dstImage, area.dstBounds(), bg_color);
       break;
   }
+}
+
+bool Render::renderCompositeCache(
+  Image* dstImage,
+  frame_t frame,
+  const gfx::Clip& area,
+  Zoom zoom,
+  RenderScaledImage scaled_func)
+{
+  // The checked background depends on the position of the area in
+  // the destination image, so the cached pixels are only valid for
+  // areas drawn at the origin (as the Editor does).
+  if (!m_compositeCache ||
+      !m_compositeLayer ||
+      area.dst != gfx::Point(0, 0) ||
+      m_previewImage ||
+      (m_extraCel && m_currentLayer != m_compositeLayer))
+    return false;
+
+  uint32_t state = 2166136261u;
+  if (!hash_layers_below(m_sprite->folder(), m_compositeLayer, frame, state))
+    return false;
+
+  const Palette* pal = m_sprite->palette(frame);
+  hash_pointer(state, pal);
+  hash_value(state, pal->getModifications());
+  hash_value(state, m_sprite->transparentColor());
+  hash_value(state, (m_sprite->backgroundLayer() &&
+                     m_sprite->backgroundLayer()->isVisible()));
+  hash_value(state, uint32_t(m_bgType));
+  hash_value(state, m_bgZoom);
+  hash_value(state, m_bgColor1);
+  hash_value(state, m_bgColor2);
+  hash_value(state, m_bgCheckedSize.w);
+  hash_value(state, m_bgCheckedSize.h);
+
+  if (!m_compositeCache->setup(m_sprite, m_compositeLayer, frame, zoom,
+                               dstImage->pixelFormat(), state))
+    return false;
+
+  Image* cacheImage = m_compositeCache->m_image.get();
+  gfx::Rect srcBounds = area.srcBounds();
+  if (!cacheImage->bounds().contains(srcBounds))
+    return false;
+
+  // Render the background and the layers below m_compositeLayer in
+  // the parts of the area which are not in the cache yet.
+  gfx::Region missing(srcBounds);
+  missing.createSubtraction(missing, m_compositeCache->m_validRgn);
+  if (!missing.isEmpty()) {
+    m_layerRange = LayerRange::BELOW;
+
+    for (const gfx::Rect& rc : missing) {
+      base::UniquePtr<Image> tmp(
+        Image::create(dstImage->pixelFormat(), rc.w, rc.h,
+                      m_compositeCache->m_tmpBuffer));
+      gfx::Clip tmpArea(0, 0, rc);
+
+      renderSpriteBackground(tmp, frame, tmpArea, zoom);
+
+      m_globalOpacity = 255;
+      m_compositeLayerFound = false;
+      renderLayer(
+        m_sprite->folder(), tmp,
+        tmpArea, frame, zoom, scaled_func,
+        true, true, BlendMode::UNSPECIFIED);
+
+      copy_image(cacheImage, tmp, rc.x, rc.y);
+    }
+
+    m_compositeCache->m_validRgn.createUnion(
+      m_compositeCache->m_validRgn, missing);
+  }
 
+  dstImage->copy(cacheImage, area);
+  m_layerRange = LayerRange::FROM;
+  return true;
+}
+
+void Render::renderSpriteLayers(
+  Image* dstImage,
+  frame_t frame,
+  const gfx::Clip& area,
+  Zoom zoom,
+  RenderScaledImage scaled_func)
+{
   // Draw the current frame.
   m_globalOpacity = 255;
+  m_compositeLayerFound = false;
   renderLayer(
     m_sprite->folder(), dstImage,
     area, frame, zoom, scaled_func,
     true, true, BlendMode::UNSPECIFIED);
 
+  // Other frames are not in the composite cache
+  m_layerRange = LayerRange::ALL;
+
   // Onion-skin feature: Draw previous/next frames with different
   // opacity (<255)
   if (m_onionskin.type() != OnionskinType::NONE) {
@@ -560,6 +965,56 @@ void Render::renderSprite(
   }
 }
 
+void Render::renderSpriteLayersInBands(
+  Image* dstImage,
+  frame_t frame,
+  const gfx::Clip& area,
+  Zoom zoom,
+  RenderScaledImage scaled_func,
+  int bands)
+{
+  // Each band is rendered with its own copy of this Render (as
+  // renderSpriteLayers() modifies some members), and touches a
+  // different set of rows of "dstImage". The sprite is only read.
+  std::vector<Render> renders(bands, *this);
+  std::vector<gfx::Clip> clips(bands);
+  std::vector<base::ThreadPool::Job> jobs;
+
+  // When the zoom is greater than 100%, each source pixel is blended
+  // with the destination pixel at its top-left corner, so bands must
+  // start at the first row of a zoomed pixel to get the same result.
+  int px_h = (zoom.scale() > 1.0 ? zoom.apply(1): 1);
+  int y1 = 0;
+
+  for (int i=0; i<bands; ++i) {
+    int y2 = area.size.h * (i+1) / bands;
+    if (i < bands-1)
+      y2 = MAX(y1, (area.src.y + y2) / px_h * px_h - area.src.y);
+    else
+      y2 = area.size.h;
+
+    clips[i] = gfx::Clip(area.dst.x, area.dst.y+y1,
+                         area.src.x, area.src.y+y1,
+                         area.size.w, y2-y1);
+    y1 = y2;
+  }
+
+  for (int i=0; i<bands; ++i) {
+    if (clips[i].size.h <= 0)
+      continue;
+
+    jobs.push_back(
+      [&, i]{
+        renders[i].renderSpriteLayers(dstImage, frame, clips[i], zoom, scaled_func);
+      });
+  }
+
+  // The first band is rendered in this thread and the other ones in
+  // the workers created in setMaxThreads().
+  ASSERT(m_threads);
+  m_threads->run(jobs);
+}
+
 void Render::renderBackground(Image* image,
   const gfx::Clip& area,
   Zoom zoom)
@@ -632,6 +1087,17 @@ void Render::renderLayer(
   bool render_transparent,
   BlendMode blend_mode)
 {
+  // Skip layers which are (or will be) in the composite cache
+  if (m_layerRange != LayerRange::ALL) {
+    if (layer == m_compositeLayer)
+      m_compositeLayerFound = true;
+
+    if (m_layerRange == LayerRange::BELOW ?
+        m_compositeLayerFound:
+        (!m_compositeLayerFound && layer->isImage()))
+      return;
+  }
+
   // we can't read from this layer
   if (!layer->isVisible())
     return;
@@ -8,6 +8,7 @@
 #define RENDER_RENDER_H_INCLUDED
 #pragma once
 
+#include "base/shared_ptr.h"
 #include "doc/anidir.h"
 #include "doc/blend_mode.h"
 #include "doc/color.h"
@@ -18,6 +19,10 @@
 #include "render/extra_type.h"
 #include "render/zoom.h"
 
+namespace base {
+  class ThreadPool;
+}
+
 namespace gfx {
   class Clip;
 }
@@ -34,6 +39,8 @@ namespace doc {
 namespace render {
   using namespace doc;
 
+  class CompositeCache;
+
   enum class BgType {
     NONE,
     TRANSPARENT,
@@ -108,6 +115,23 @@ namespace render {
     void setOnionskin(const OnionskinOptions& options);
     void disableOnionskin();
 
+    // Maximum number of threads to render the sprite. Big areas are
+    // split in horizontal bands, and each band is rendered in its
+    // own thread (the result is the same as rendering the whole area
+    // in the caller thread, which is the default behavior). The
+    // worker threads are created here and reused in each
+    // renderSprite() call.
+    void setMaxThreads(int threads);
+
+    // Uses the given cache to get the composite of the background
+    // and the layers below "layer" in renderSprite() calls (so only
+    // "layer" and the layers above it are blended). The cache is
+    // ignored when the rendered area is not drawn at the origin of
+    // the destination image, or when there is a preview/extra image
+    // in other layer.
+    void setCompositeCache(CompositeCache* cache, const Layer* layer);
+    void removeCompositeCache();
+
     void renderSprite(
       Image* dstImage,
       const Sprite* sprite,
@@ -156,6 +180,34 @@ namespace render {
       const gfx::Clip& area,
       int opacity, BlendMode blend_mode, Zoom zoom);
 
+    void renderSpriteBackground(
+      Image* dstImage,
+      frame_t frame,
+      const gfx::Clip& area,
+      Zoom zoom);
+
+    bool renderCompositeCache(
+      Image* dstImage,
+      frame_t frame,
+      const gfx::Clip& area,
+      Zoom zoom,
+      RenderScaledImage scaled_func);
+
+    void renderSpriteLayers(
+      Image* dstImage,
+      frame_t frame,
+      const gfx::Clip& area,
+      Zoom zoom,
+      RenderScaledImage scaled_func);
+
+    void renderSpriteLayersInBands(
+      Image* dstImage,
+      frame_t frame,
+      const gfx::Clip& area,
+      Zoom zoom,
+      RenderScaledImage scaled_func,
+      int bands);
+
     void renderLayer(
       const Layer* layer,
       Image* image,
@@ -197,6 +249,19 @@ namespace render {
     frame_t m_selectedFrame;
     Image* m_previewImage;
     OnionskinOptions m_onionskin;
+    int m_maxThreads;
+    base::SharedPtr<base::ThreadPool> m_threads;
+
+    // Layers of the current frame drawn by renderLayer() when a
+    // composite cache is used: all of them, the layers below
+    // m_compositeLayer (to fill the cache), or m_compositeLayer and
+    // the ones above it (to draw on top of the cached composite).
+    enum class LayerRange { ALL, BELOW, FROM };
+
+    CompositeCache* m_compositeCache;
+    const Layer* m_compositeLayer;
+    LayerRange m_layerRange;
+    bool m_compositeLayerFound;
   };
 
   void composite_image(Image* dst, const Image* src,
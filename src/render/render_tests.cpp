@@ -20,6 +20,10 @@
 #include "doc/layer.h"
 #include "doc/palette.h"
 #include "doc/primitives.h"
+#include "doc/sprite.h"
+#include "render/composite_cache.h"
+
+#include <vector>
 
 using namespace doc;
 using namespace render;
@@ -214,6 +218,153 @@ TEST(Render, ZoomAndDstBounds)
     0, 0, 0, 0);
 }
 
+TEST(Render, CompositeRowsWithOpaqueAndTransparentRuns)
+{
+  // Rows with runs of mask color, opaque and semi-transparent pixels
+  // must give the same result as blending pixel by pixel.
+  const color_t colors[] = {
+    0, 0, rgba(255, 0, 0, 255), rgba(0, 255, 0, 255), rgba(0, 0, 255, 128),
+    rgba(10, 20, 30, 0), 0, rgba(255, 255, 255, 255), rgba(40, 50, 60, 64)
+  };
+  const int w = sizeof(colors) / sizeof(colors[0]);
+
+  base::UniquePtr<Image> src(Image::create(IMAGE_RGB, w, 2));
+  base::UniquePtr<Image> backdrop(Image::create(IMAGE_RGB, w, 2));
+  for (int x=0; x<w; ++x) {
+    put_pixel(src, x, 0, colors[x]);
+    put_pixel(src, x, 1, colors[w-x-1]);
+    put_pixel(backdrop, x, 0, rgba(100, 100, 100, 255));
+    put_pixel(backdrop, x, 1, rgba(x*20, 0, 0, x*25));
+  }
+
+  const int opacities[] = { 255, 128 };
+  for (int opacity : opacities) {
+    base::UniquePtr<Image> dst(Image::createCopy(backdrop));
+    composite_image(dst, src, 0, 0, opacity, BlendMode::NORMAL);
+
+    for (int y=0; y<2; ++y) {
+      for (int x=0; x<w; ++x) {
+        color_t s = get_pixel(src, x, y);
+        color_t b = get_pixel(backdrop, x, y);
+        EXPECT_EQ(s == src->maskColor() ? b: rgba_blender_normal(b, s, opacity),
+                  get_pixel(dst, x, y));
+      }
+    }
+  }
+}
+
+TEST(Render, RenderInBandsWithThreads)
+{
+  Context ctx;
+  Document* doc = ctx.documents().add(64, 100, ColorMode::RGB);
+  Image* src = doc->sprite()->layer(0)->cel(0)->image();
+  for (int y=0; y<src->height(); ++y)
+    for (int x=0; x<src->width(); ++x)
+      put_pixel(src, x, y, rgba(x*4, y*2, (x*y) & 0xff, (x+y) & 0xff));
+
+  Render render;
+  render.setBgType(BgType::CHECKED);
+  render.setBgColor1(rgba(128, 128, 128, 255));
+  render.setBgColor2(rgba(192, 192, 192, 255));
+  render.setBgCheckedSize(gfx::Size(5, 5));
+
+  const Zoom zooms[] = { Zoom(1, 1), Zoom(3, 1), Zoom(1, 2) };
+  for (const Zoom& zoom : zooms) {
+    gfx::Clip area(1, 2, 1, 3,
+                   zoom.apply(src->width()),
+                   zoom.apply(src->height()));
+    base::UniquePtr<Image> expected(Image::create(IMAGE_RGB, area.size.w+2, area.size.h+2));
+    base::UniquePtr<Image> result(Image::create(IMAGE_RGB, area.size.w+2, area.size.h+2));
+    clear_image(expected, 0);
+    clear_image(result, 0);
+
+    render.setMaxThreads(1);
+    render.renderSprite(expected, doc->sprite(), frame_t(0), area, zoom);
+    render.setMaxThreads(4);
+    render.renderSprite(result, doc->sprite(), frame_t(0), area, zoom);
+
+    EXPECT_EQ(0, count_diff_between_images(expected, result));
+  }
+}
+
+TEST(Render, CompositeCacheOfLayersBelow)
+{
+  Context ctx;
+  Document* doc = ctx.documents().add(40, 30, ColorMode::RGB);
+  Sprite* sprite = doc->sprite();
+
+  // Four layers: the default one, two with other blend modes, and
+  // one with a cel outside the sprite origin.
+  const BlendMode modes[] = { BlendMode::MULTIPLY, BlendMode::SCREEN, BlendMode::NORMAL };
+  for (BlendMode mode : modes) {
+    LayerImage* layer = new LayerImage(sprite);
+    layer->setBlendMode(mode);
+    layer->addCel(new Cel(frame_t(0), ImageRef(Image::create(IMAGE_RGB, 30, 20))));
+    sprite->folder()->addLayer(layer);
+  }
+  sprite->layer(3)->cel(0)->setPosition(7, 5);
+  sprite->layer(3)->cel(0)->setOpacity(200);
+
+  for (int i=0; i<4; ++i) {
+    Image* src = sprite->layer(i)->cel(0)->image();
+    for (int y=0; y<src->height(); ++y)
+      for (int x=0; x<src->width(); ++x)
+        put_pixel(src, x, y, rgba((x*7+i*50) & 0xff, (y*11) & 0xff,
+                                  (x*y+i) & 0xff, (x+y*i*3) & 0xff));
+  }
+
+  Render render;
+  render.setBgType(BgType::CHECKED);
+  render.setBgColor1(rgba(128, 128, 128, 255));
+  render.setBgColor2(rgba(192, 192, 192, 255));
+  render.setBgCheckedSize(gfx::Size(4, 4));
+  render.setBgZoom(true);
+
+  CompositeCache cache;
+
+  auto check = [&](const Zoom& zoom, const gfx::Rect& bounds) {
+    gfx::Clip area(0, 0, bounds);
+    base::UniquePtr<Image> expected(Image::create(IMAGE_RGB, bounds.w, bounds.h));
+    base::UniquePtr<Image> result(Image::create(IMAGE_RGB, bounds.w, bounds.h));
+
+    render.removeCompositeCache();
+    render.renderSprite(expected, sprite, frame_t(0), area, zoom);
+    render.setCompositeCache(&cache, sprite->layer(2));
+    render.renderSprite(result, sprite, frame_t(0), area, zoom);
+    render.removeCompositeCache();
+
+    EXPECT_EQ(0, count_diff_between_images(expected, result));
+  };
+
+  const Zoom zooms[] = { Zoom(1, 1), Zoom(2, 1), Zoom(1, 2) };
+  for (const Zoom& zoom : zooms) {
+    gfx::Rect bounds = zoom.apply(sprite->bounds());
+    check(zoom, bounds);
+    EXPECT_FALSE(cache.isEmpty());
+
+    // Cached pixels are reused for sub-areas
+    check(zoom, gfx::Rect(bounds.x+2, bounds.y+4, bounds.w/2, bounds.h/2));
+
+    // Modified pixels in a layer below, notified to the cache
+    put_pixel(sprite->layer(1)->cel(0)->image(), 3, 4, rgba(255, 0, 0, 255));
+    cache.invalidate(gfx::Region(gfx::Rect(3, 4, 1, 1)));
+    check(zoom, bounds);
+
+    // Modified cel properties are detected by the Render itself
+    sprite->layer(0)->cel(0)->setOpacity(100);
+    check(zoom, bounds);
+    sprite->layer(1)->setVisible(false);
+    check(zoom, bounds);
+    sprite->layer(1)->setVisible(true);
+    sprite->layer(0)->cel(0)->setOpacity(255);
+
+    // Layers above are always rendered
+    put_pixel(sprite->layer(2)->cel(0)->image(), 5, 5, rgba(0, 255, 0, 128));
+    put_pixel(sprite->layer(3)->cel(0)->image(), 1, 2, rgba(0, 0, 255, 64));
+    check(zoom, bounds);
+  }
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
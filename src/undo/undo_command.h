@@ -8,6 +8,8 @@
 #define UNDO_UNDO_COMMAND_H_INCLUDED
 #pragma once
 
+#include <cstddef>
+
 namespace undo {
 
   class UndoCommand {
@@ -16,6 +18,9 @@ namespace undo {
     virtual void undo() = 0;
     virtual void redo() = 0;
     virtual void dispose() = 0;
+
+    // Memory used to undo/redo the command (in bytes).
+    virtual std::size_t memSize() const { return 0; }
   };
 
 } // namespace undo
@@ -22,6 +22,7 @@ UndoHistory::UndoHistory()
   : m_first(nullptr)
   , m_last(nullptr)
   , m_cur(nullptr)
+  , m_memSize(0)
 {
 }
 
@@ -68,6 +69,7 @@ void UndoHistory::clearRedo()
        state && state != m_cur;
        state = prev) {
     prev = state->m_prev;
+    m_memSize -= state->m_memSize;
     delete state;
   }
 
@@ -90,6 +92,8 @@ void UndoHistory::add(UndoCommand* cmd)
   if (!m_first)
     m_first = state;
 
+  m_memSize += state->m_memSize;
+
   m_cur = m_last = state;
 
   if (state->m_prev) {
@@ -98,6 +102,39 @@ void UndoHistory::add(UndoCommand* cmd)
   }
 }
 
+bool UndoHistory::deleteFirstState()
+{
+  UndoState* first = m_first;
+  if (!first || first == m_cur)
+    return false;
+
+  // The first state must be the root of the current state, i.e. the
+  // state that remains when the first one is deleted is equal to
+  // the document after executing the first command.
+  UndoState* root = m_cur;
+  while (root && root->m_parent)
+    root = root->m_parent;
+  if (root != first)
+    return false;
+
+  // Other branches from the initial state cannot be reached anymore
+  for (UndoState* state = first->m_next; state; state = state->m_next) {
+    if (!state->m_parent)
+      return false;
+  }
+
+  for (UndoState* state = first->m_next; state; state = state->m_next) {
+    if (state->m_parent == first)
+      state->m_parent = nullptr;
+  }
+
+  m_first = first->m_next;
+  m_first->m_prev = nullptr;
+  m_memSize -= first->m_memSize;
+  delete first;
+  return true;
+}
+
 UndoState* UndoHistory::findCommonParent(UndoState* a, UndoState* b)
 {
   UndoState* pA = a;
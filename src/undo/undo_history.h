@@ -8,6 +8,8 @@
 #define UNDO_UNDO_HISTORY_H_INCLUDED
 #pragma once
 
+#include <cstddef>
+
 namespace undo {
 
   class UndoCommand;
@@ -30,6 +32,15 @@ namespace undo {
 
     void clearRedo();
 
+    // Deletes the oldest state, so it cannot be undone anymore. It's
+    // used to limit the memory used by the history. Returns false if
+    // the state cannot be deleted (it's the current state, or it's
+    // not an ancestor of the current state).
+    bool deleteFirstState();
+
+    // Memory used by all states (sum of UndoCommand::memSize()).
+    std::size_t memSize() const { return m_memSize; }
+
   private:
     UndoState* findCommonParent(UndoState* a, UndoState* b);
     void moveTo(UndoState* new_state);
@@ -37,6 +48,7 @@ namespace undo {
     UndoState* m_first;
     UndoState* m_last;
     UndoState* m_cur;          // Current action that can be undone
+    std::size_t m_memSize;
   };
 
 } // namespace undo
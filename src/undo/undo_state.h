@@ -24,7 +24,8 @@ namespace undo {
       : m_prev(nullptr)
       , m_next(nullptr)
       , m_parent(nullptr)
-      , m_cmd(cmd) {
+      , m_cmd(cmd)
+      , m_memSize(cmd ? cmd->memSize(): 0) {
     }
     ~UndoState() {
       if (m_cmd)
@@ -33,11 +34,13 @@ namespace undo {
     UndoState* prev() const { return m_prev; }
     UndoState* next() const { return m_next; }
     UndoCommand* cmd() const { return m_cmd; }
+    std::size_t memSize() const { return m_memSize; }
   private:
     UndoState* m_prev;
     UndoState* m_next;
     UndoState* m_parent;             // Parent state, after we undo
     UndoCommand* m_cmd;
+    std::size_t m_memSize;           // Command memSize() when it was added
   };
 
 } // namespace undo
@@ -12,23 +12,27 @@
 
 #include "undo/undo_command.h"
 #include "undo/undo_history.h"
+#include "undo/undo_state.h"
 
 using namespace undo;
 
 class Cmd : public UndoCommand {
 public:
-  Cmd(int& model, int redo_value, int undo_value)
+  Cmd(int& model, int redo_value, int undo_value, std::size_t size = 0)
     : m_model(model)
     , m_redo_value(redo_value)
-    , m_undo_value(undo_value) {
+    , m_undo_value(undo_value)
+    , m_size(size) {
   }
   void redo() override { m_model = m_redo_value; }
   void undo() override { m_model = m_undo_value; }
   void dispose() override { }
+  std::size_t memSize() const override { return m_size; }
 private:
   int& m_model;
   int m_redo_value;
   int m_undo_value;
+  std::size_t m_size;
 };
 
 TEST(Undo, Basics)
@@ -175,6 +179,80 @@ TEST(Undo, ComplexTree)
   EXPECT_FALSE(history.canRedo());
 }
 
+TEST(Undo, MemSizeAndDeleteFirstState)
+{
+  int model = 0;
+  Cmd cmd1(model, 1, 0, 10);
+  Cmd cmd2(model, 2, 1, 20);
+  Cmd cmd3(model, 3, 2, 30);
+
+  UndoHistory history;
+  EXPECT_EQ(0u, history.memSize());
+  EXPECT_FALSE(history.deleteFirstState());
+
+  cmd1.redo(); history.add(&cmd1);
+  cmd2.redo(); history.add(&cmd2);
+  cmd3.redo(); history.add(&cmd3);
+  EXPECT_EQ(60u, history.memSize());
+
+  history.undo();
+  EXPECT_EQ(2, model);
+  EXPECT_TRUE(history.deleteFirstState());
+  EXPECT_EQ(50u, history.memSize());
+  EXPECT_EQ(&cmd2, history.firstState()->cmd());
+
+  // The current state cannot be deleted
+  EXPECT_FALSE(history.deleteFirstState());
+
+  history.undo();
+  EXPECT_EQ(1, model);
+  EXPECT_FALSE(history.canUndo());
+  history.redo();
+  history.redo();
+  EXPECT_EQ(3, model);
+
+  history.undo();
+  history.undo();
+  history.clearRedo();
+  EXPECT_EQ(0u, history.memSize());
+}
+
+TEST(Undo, DeleteFirstStateInTree)
+{
+  // 1 --- 2
+  //  \
+  //   ------ 3
+  int model = 0;
+  Cmd cmd1(model, 1, 0, 1);
+  Cmd cmd2(model, 2, 1, 2);
+  Cmd cmd3(model, 3, 1, 4);
+
+  UndoHistory history;
+  cmd1.redo(); history.add(&cmd1);
+  cmd2.redo(); history.add(&cmd2);
+  history.undo();
+  cmd3.redo(); history.add(&cmd3);
+  EXPECT_EQ(7u, history.memSize());
+
+  EXPECT_TRUE(history.deleteFirstState());
+  EXPECT_EQ(6u, history.memSize());
+
+  // 2 and 3 are two branches from the new initial state (1)
+  history.undo();
+  EXPECT_EQ(2, model);
+  history.undo();
+  EXPECT_EQ(1, model);
+  EXPECT_FALSE(history.canUndo());
+  history.redo();
+  EXPECT_EQ(2, model);
+  history.redo();
+  EXPECT_EQ(3, model);
+  EXPECT_FALSE(history.canRedo());
+
+  // 2 is not an ancestor of the current state
+  EXPECT_FALSE(history.deleteFirstState());
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);